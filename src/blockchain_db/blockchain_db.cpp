@@ -119,6 +119,7 @@ uint64_t BlockchainDB::add_block( const block& blk
                                 , const std::vector<transaction>& txs
                                 )
 {
+  db_op_timer timer(m_op_stats, DB_OP_ADD_BLOCK);
   block_txn_start(false);
 
   TIME_MEASURE_START(time1);
@@ -128,7 +129,18 @@ uint64_t BlockchainDB::add_block( const block& blk
 
   // call out to subclass implementation to add the block & metadata
   time1 = epee::misc_utils::get_tick_count();
-  add_block(blk, block_size, cumulative_difficulty, coins_generated, blk_hash);
+  uint64_t num_rct_outs = 0;
+  if (blk.miner_tx.version == 2)
+    num_rct_outs += blk.miner_tx.vout.size();
+  for (const transaction& tx : txs)
+  {
+    for (const auto &vout: tx.vout)
+    {
+      if (vout.amount == 0)
+        ++num_rct_outs;
+    }
+  }
+  add_block(blk, block_size, cumulative_difficulty, coins_generated, num_rct_outs, blk_hash);
   TIME_MEASURE_FINISH(time1);
   time_add_block1 += time1;
 
@@ -199,6 +211,127 @@ void BlockchainDB::remove_transaction(const crypto::hash& tx_hash)
   remove_transaction_data(tx_hash, tx);
 }
 
+void BlockchainDB::get_block_info_range(const uint64_t& h1, const uint64_t& h2, std::vector<block_info_t>& infos, unsigned int fields) const
+{
+  infos.clear();
+  if (h1 > h2)
+    return;
+  infos.reserve(h2 - h1 + 1);
+  for (uint64_t height = h1; height <= h2; ++height)
+  {
+    block_info_t bi;
+    bi.height = height;
+    if (fields & BI_TIMESTAMP)
+      bi.timestamp = get_block_timestamp(height);
+    if (fields & BI_COINS_GENERATED)
+      bi.coins_generated = get_block_already_generated_coins(height);
+    if (fields & BI_SIZE)
+      bi.size = get_block_size(height);
+    if (fields & BI_CUMULATIVE_DIFFICULTY)
+      bi.cumulative_difficulty = get_block_cumulative_difficulty(height);
+    if (fields & BI_HASH)
+      bi.hash = get_block_hash_from_height(height);
+    if (fields & BI_CUMULATIVE_RCT_OUTPUTS)
+      bi.cumulative_rct_outputs = get_num_outputs_below_height(0, height + 1);
+    if (fields & BI_VERSIONS)
+    {
+      const block b = get_block_from_height(height);
+      bi.major_version = b.major_version;
+      bi.minor_version = b.minor_version;
+    }
+    infos.push_back(bi);
+  }
+}
+
+void BlockchainDB::get_block_blobs_range(const uint64_t& h1, const uint64_t& h2, std::vector<block_blobs_t>& blocks, bool get_output_indices) const
+{
+  blocks.clear();
+  if (h1 > h2)
+    return;
+  blocks.reserve(h2 - h1 + 1);
+  for (uint64_t height = h1; height <= h2; ++height)
+  {
+    const block b = get_block_from_height(height);
+    blocks.push_back(block_blobs_t());
+    block_blobs_t &entry = blocks.back();
+    entry.block = block_to_blob(b);
+    entry.txs.reserve(b.tx_hashes.size());
+    uint64_t tx_id;
+    if (get_output_indices)
+    {
+      if (!tx_exists(get_transaction_hash(b.miner_tx), tx_id))
+        throw TX_DNE("Miner tx of block not found in db");
+      entry.output_indices.push_back(get_tx_amount_output_indices(tx_id));
+    }
+    for (const crypto::hash &tx_hash : b.tx_hashes)
+    {
+      if (!tx_exists(tx_hash, tx_id))
+        throw TX_DNE(std::string("tx with hash ").append(epee::string_tools::pod_to_hex(tx_hash)).append(" not found in db").c_str());
+      const transaction tx = get_tx(tx_hash);
+      entry.pruned |= tx.pruned;
+      entry.txs.push_back(tx_to_blob(tx));
+      if (get_output_indices)
+        entry.output_indices.push_back(get_tx_amount_output_indices(tx_id));
+    }
+  }
+}
+
+bool BlockchainDB::get_tx_blob(const crypto::hash& h, blobdata& bd) const
+{
+  if (!tx_exists(h))
+    return false;
+  bd = tx_to_blob(get_tx(h));
+  return true;
+}
+
+void BlockchainDB::add_alt_block(const crypto::hash &blkid, const alt_block_data_t &data, const blobdata &blob)
+{
+}
+
+void BlockchainDB::remove_alt_block(const crypto::hash &blkid)
+{
+}
+
+void BlockchainDB::drop_alt_blocks()
+{
+}
+
+bool BlockchainDB::for_all_alt_blocks(std::function<bool(const crypto::hash&, const alt_block_data_t&, const blobdata&)> f) const
+{
+  return true;
+}
+
+bool BlockchainDB::has_txpool_storage() const
+{
+  return false;
+}
+
+void BlockchainDB::add_txpool_tx(const crypto::hash &txid, const txpool_tx_meta_t &meta, const blobdata &blob)
+{
+}
+
+void BlockchainDB::update_txpool_tx(const crypto::hash &txid, const txpool_tx_meta_t &meta)
+{
+}
+
+void BlockchainDB::remove_txpool_tx(const crypto::hash &txid)
+{
+}
+
+void BlockchainDB::drop_txpool()
+{
+}
+
+uint64_t BlockchainDB::get_txpool_tx_count() const
+{
+  return 0;
+}
+
+bool BlockchainDB::for_all_txpool_txes(std::function<bool(const crypto::hash&, const txpool_tx_meta_t&, const blobdata&)> f) const
+{
+  return true;
+}
+
 void BlockchainDB::reset_stats()
 {
   num_calls = 0;
@@ -231,6 +364,53 @@ void BlockchainDB::show_stats()
   );
 }
 
+uint64_t BlockchainDB::get_num_outputs_below_height(const uint64_t& amount, const uint64_t& height) const
+{
+  // find the first output in a block at or above height; tx heights are
+  // one past their block's
+  uint64_t lo = 0, hi = get_num_outputs(amount);
+  while (lo < hi)
+  {
+    const uint64_t mid = lo + (hi - lo) / 2;
+    const tx_out_index toi = get_output_tx_and_index(amount, mid);
+    if (get_tx_block_height(toi.first) <= height)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+void BlockchainDB::get_output_distribution(const uint64_t& amount, const uint64_t& from_height, const uint64_t& to_height, std::vector<uint64_t>& distribution, uint64_t& base) const
+{
+  distribution.clear();
+  base = get_num_outputs_below_height(amount, from_height);
+  if (from_height > to_height)
+    return;
+  distribution.reserve(to_height - from_height + 1);
+  for (uint64_t height = from_height; height <= to_height; ++height)
+    distribution.push_back(get_num_outputs_below_height(amount, height + 1));
+}
+
+uint64_t BlockchainDB::prune_blockchain(uint64_t keep_blocks)
+{
+  LOG_PRINT_L1("This database backend does not support pruning");
+  return 0;
+}
+
+bool BlockchainDB::copy(const std::string& path, bool compact) const
+{
+  LOG_PRINT_L1("This database backend does not support copying");
+  return false;
+}
+
+void BlockchainDB::get_stats(db_stats_t& stats) const
+{
+  stats = db_stats_t();
+  stats.db_type = get_db_name();
+  m_op_stats.get(stats.ops);
+}
+
 void BlockchainDB::fixup()
 {
    set_batch_transactions(true);
@@ -35,9 +35,11 @@
 #include <string>
 #include <exception>
 #include "crypto/hash.h"
+#include "cryptonote_protocol/blobdatatype.h" // for type blobdata
 #include "cryptonote_core/cryptonote_basic.h"
 #include "cryptonote_core/difficulty.h"
 #include "cryptonote_core/hardfork.h"
+#include "blockchain_db/db_stats.h"
 
 /** \file
  * Cryptonote Blockchain Database Interface
@@ -124,6 +126,88 @@ struct tx_data_t
 };
 #pragma pack(pop)
 
+/**
+ * @brief a struct containing the metadata stored for a block
+ */
+struct block_info_t
+{
+  uint64_t        height;                 //!< the height of the block
+  uint64_t        timestamp;              //!< the block's timestamp
+  uint64_t        coins_generated;        //!< the total coins generated as of the block
+  uint64_t        size;                   //!< the block's size
+  difficulty_type cumulative_difficulty;  //!< the cumulative difficulty as of the block
+  crypto::hash    hash;                   //!< the block's hash
+  uint64_t        cumulative_rct_outputs; //!< the number of RingCT outputs as of the block
+  uint8_t         major_version;          //!< the block's major version
+  uint8_t         minor_version;          //!< the block's minor version (its hard fork vote)
+};
+
+/**
+ * @brief the fields of block_info_t which get_block_info_range fills in
+ *
+ * The height is always filled in.
+ */
+enum block_info_fields
+{
+  BI_TIMESTAMP              = 1 << 0,
+  BI_COINS_GENERATED        = 1 << 1,
+  BI_SIZE                   = 1 << 2,
+  BI_CUMULATIVE_DIFFICULTY  = 1 << 3,
+  BI_HASH                   = 1 << 4,
+  BI_CUMULATIVE_RCT_OUTPUTS = 1 << 5,
+  BI_VERSIONS               = 1 << 6,  //!< read from the block itself, so costlier than the rest
+  BI_ALL                    = (1 << 7) - 1
+};
+
+/**
+ * @brief a block and its transactions as they are stored
+ */
+struct block_blobs_t
+{
+  blobdata block;                                     //!< the block's blob
+  std::vector<blobdata> txs;                          //!< the blobs of the block's transactions, not including the miner tx
+  std::vector<std::vector<uint64_t>> output_indices;  //!< the output indices of the miner tx, then of each transaction, if asked for
+  bool pruned = false;                                //!< whether any of the transactions lacks its prunable data
+};
+
+/**
+ * @brief the metadata stored alongside an alternative block
+ *
+ * Stored in front of the block's blob in the alternative block table.
+ */
+#pragma pack(push, 1)
+struct alt_block_data_t
+{
+  uint64_t        height;                   //!< the height of the block
+  uint64_t        cumulative_size;          //!< the size (in bytes) of the block
+  difficulty_type cumulative_difficulty;    //!< the accumulated difficulty after the block
+  uint64_t        already_generated_coins;  //!< the total coins minted after the block
+  uint64_t        receive_time;             //!< when the block was first received
+};
+#pragma pack(pop)
+
+/**
+ * @brief the metadata stored alongside a transaction pool entry
+ *
+ * A fixed size encoding of the pool's per-transaction details, stored
+ * apart from the transaction's blob so it can be updated on its own.
+ */
+#pragma pack(push, 1)
+struct txpool_tx_meta_t
+{
+  crypto::hash max_used_block_id;      //!< the hash of the highest block referenced by an input
+  crypto::hash last_failed_id;         //!< the hash of the highest block when checking the inputs last failed
+  uint64_t     blob_size;              //!< the transaction's size
+  uint64_t     fee;                    //!< the transaction's fee amount
+  uint64_t     max_used_block_height;  //!< the height of the highest block referenced by an input
+  uint64_t     last_failed_height;     //!< the height of the highest block when checking the inputs last failed
+  uint64_t     receive_time;           //!< the time when the transaction entered the pool
+  uint64_t     last_relayed_time;      //!< the last time the transaction was relayed to the network
+  uint8_t      kept_by_block;          //!< whether the transaction has been in a block before
+  uint8_t      relayed;                //!< whether the transaction has been relayed to the network
+};
+#pragma pack(pop)
+
 /***********************************
  * Exception Definitions
  ***********************************/
@@ -326,12 +410,14 @@ private:
    * @param block_size the size of the block (transactions and all)
    * @param cumulative_difficulty the accumulated difficulty after this block
    * @param coins_generated the number of coins generated total after this block
+   * @param num_rct_outs the number of RingCT outputs in the block
    * @param blk_hash the hash of the block
    */
   virtual void add_block( const block& blk
                 , const size_t& block_size
                 , const difficulty_type& cumulative_difficulty
                 , const uint64_t& coins_generated
+                , uint64_t num_rct_outs
                 , const crypto::hash& blk_hash
                 ) = 0;
 
@@ -498,6 +584,8 @@ protected:
   mutable uint64_t time_tx_exists = 0;  //!< a performance metric
   uint64_t time_commit1 = 0;  //!< a performance metric
   bool m_auto_remove_logs = true;  //!< whether or not to automatically remove old logs
+  uint64_t m_max_size = 0;  //!< the most space the db may grow to, 0 for no limit
+  mutable db_op_counters m_op_stats;  //!< call counts and latencies, see get_stats()
 
   HardFork* m_hardfork;
 
@@ -699,6 +787,17 @@ public:
    */
   virtual void set_batch_transactions(bool) = 0;
 
+  /**
+   * @brief whether blocks added in a batch can be rolled back one by one
+   *
+   * If true, a block which fails to be added while a batch is in progress
+   * is undone without affecting the blocks added before it in the batch,
+   * so a batch may safely span the blocks of a whole sync request.
+   *
+   * @return true if block-level transactions nest inside a batch
+   */
+  virtual bool can_nest_block_txns() const { return false; }
+
   virtual void block_txn_start(bool readonly=false) = 0;
   virtual void block_txn_stop() = 0;
   virtual void block_txn_abort() = 0;
@@ -924,6 +1023,48 @@ public:
    */
   virtual std::vector<crypto::hash> get_hashes_range(const uint64_t& h1, const uint64_t& h2) const = 0;
 
+  /**
+   * @brief fetch the metadata of a range of blocks
+   *
+   * Returns the metadata of blocks with heights starting at h1 and ending
+   * at h2, inclusively, in height order.  Only the fields asked for are
+   * filled in, the others are left unset.  The default implementation uses
+   * the per-height accessors; subclasses should override it with a single
+   * pass over their storage.
+   *
+   * If the height range requested goes past the end of the blockchain,
+   * BLOCK_DNE is thrown.
+   *
+   * @param h1 the start height
+   * @param h2 the end height
+   * @param infos return-by-reference the blocks' metadata
+   * @param fields the block_info_fields wanted, or'ed together
+   */
+  virtual void get_block_info_range(const uint64_t& h1, const uint64_t& h2, std::vector<block_info_t>& infos, unsigned int fields = BI_ALL) const;
+
+  /**
+   * @brief fetch a range of blocks and their transactions as stored
+   *
+   * Returns the blobs of blocks with heights starting at h1 and ending at
+   * h2, inclusively, in height order, with the blobs of their transactions
+   * and optionally the amount output indices of every transaction.  The
+   * blobs are copied straight out of storage, without being parsed and
+   * serialized again.  Transactions whose prunable data has been pruned
+   * are returned without it, and the block is flagged as pruned.  The
+   * default implementation uses the per-item accessors; subclasses should
+   * override it.
+   *
+   * If the height range requested goes past the end of the blockchain,
+   * BLOCK_DNE is thrown.  If one of the transactions is missing, TX_DNE
+   * is thrown.
+   *
+   * @param h1 the start height
+   * @param h2 the end height
+   * @param blocks return-by-reference the blocks and their transactions
+   * @param get_output_indices whether to fetch the transactions' output indices
+   */
+  virtual void get_block_blobs_range(const uint64_t& h1, const uint64_t& h2, std::vector<block_blobs_t>& blocks, bool get_output_indices) const;
+
   /**
    * @brief fetch the top block's hash
    *
@@ -1020,6 +1161,20 @@ public:
    */
   virtual transaction get_tx(const crypto::hash& h) const = 0;
 
+  /**
+   * @brief fetches the transaction blob with the given hash
+   *
+   * The blob is copied straight out of storage.  The default implementation
+   * serializes the transaction returned by get_tx(); subclasses should
+   * override it.
+   *
+   * @param h the hash to look for
+   * @param bd return-by-reference the transaction's blob
+   *
+   * @return true iff the transaction was found
+   */
+  virtual bool get_tx_blob(const crypto::hash& h, blobdata& bd) const;
+
   /**
    * @brief fetches the total number of transactions ever
    *
@@ -1164,7 +1319,9 @@ public:
    *
    * This function is a mirror of
    * get_output_data(const uint64_t& amount, const uint64_t& index)
-   * but for a list of outputs rather than just one.
+   * but for a list of outputs rather than just one.  The offsets may be
+   * given in any order; outputs is resized to match them, reusing its
+   * storage, and filled in the same order.
    *
    * @param amount an output amount
    * @param offsets a list of amount-specific output indices
@@ -1305,9 +1462,116 @@ public:
    */
   virtual void drop_hard_fork_info() = 0;
 
+  /**
+   * @brief store an alternative block
+   *
+   * Alternative blocks are kept apart from the main chain so they survive
+   * a restart.  The default implementation does not store anything.
+   *
+   * @param blkid the block's hash
+   * @param data the block's metadata
+   * @param blob the block's blob
+   */
+  virtual void add_alt_block(const crypto::hash &blkid, const alt_block_data_t &data, const blobdata &blob);
+
+  /**
+   * @brief remove a stored alternative block
+   *
+   * Does nothing if the block is not stored.
+   *
+   * @param blkid the block's hash
+   */
+  virtual void remove_alt_block(const crypto::hash &blkid);
+
+  /**
+   * @brief remove all stored alternative blocks
+   */
+  virtual void drop_alt_blocks();
+
+  /**
+   * @brief runs a function over all stored alternative blocks
+   *
+   * The function is passed (block_hash, metadata, blob), in no particular
+   * order.  If any call to the function returns false, iteration stops and
+   * false is returned.
+   *
+   * @param std::function f the function to run
+   *
+   * @return false if the function returns false for any block, otherwise true
+   */
+  virtual bool for_all_alt_blocks(std::function<bool(const crypto::hash&, const alt_block_data_t&, const blobdata&)> f) const;
+
+  /**
+   * @brief whether the transaction pool can be stored in this database
+   *
+   * The default implementation does not store the pool, and returns false.
+   *
+   * @return true if the txpool functions below store anything, otherwise false
+   */
+  virtual bool has_txpool_storage() const;
+
+  /**
+   * @brief store a transaction pool entry
+   *
+   * Replaces any entry already stored for the transaction.
+   *
+   * @param txid the transaction's hash
+   * @param meta the pool's details about the transaction
+   * @param blob the transaction's blob
+   */
+  virtual void add_txpool_tx(const crypto::hash &txid, const txpool_tx_meta_t &meta, const blobdata &blob);
+
+  /**
+   * @brief update the details of a stored transaction pool entry
+   *
+   * @param txid the transaction's hash
+   * @param meta the pool's new details about the transaction
+   */
+  virtual void update_txpool_tx(const crypto::hash &txid, const txpool_tx_meta_t &meta);
+
+  /**
+   * @brief remove a stored transaction pool entry
+   *
+   * Does nothing if the transaction is not stored.
+   *
+   * @param txid the transaction's hash
+   */
+  virtual void remove_txpool_tx(const crypto::hash &txid);
+
+  /**
+   * @brief remove all stored transaction pool entries
+   */
+  virtual void drop_txpool();
+
+  /**
+   * @brief get the number of stored transaction pool entries
+   *
+   * @return the number of entries
+   */
+  virtual uint64_t get_txpool_tx_count() const;
+
+  /**
+   * @brief runs a function over all stored transaction pool entries
+   *
+   * The function is passed (tx_hash, metadata, blob), in no particular
+   * order.  If any call to the function returns false, iteration stops and
+   * false is returned.
+   *
+   * @param std::function f the function to run
+   *
+   * @return false if the function returns false for any entry, otherwise true
+   */
+  virtual bool for_all_txpool_txes(std::function<bool(const crypto::hash&, const txpool_tx_meta_t&, const blobdata&)> f) const;
+
   /**
    * @brief return a histogram of outputs on the blockchain
    *
+   * For each amount, the tuple holds the number of outputs, the number of
+   * those which are unlocked, and the number of unlocked outputs in blocks
+   * from recent_cutoff on.  The latter two are only counted if unlocked is
+   * set or recent_cutoff is not zero, and are had from
+   * get_num_outputs_below_height, so they cost a few lookups per amount.
+   *
    * @param amounts optional set of amounts to lookup
    * @param unlocked whether to restrict count to unlocked outputs
    * @param recent_cutoff timestamp to determine whether an output is recent
@@ -1316,6 +1580,40 @@ public:
    */
   virtual std::map<uint64_t, std::tuple<uint64_t, uint64_t, uint64_t>> get_output_histogram(const std::vector<uint64_t> &amounts, bool unlocked, uint64_t recent_cutoff) const = 0;
 
+  /**
+   * @brief count the outputs of an amount created below a height
+   *
+   * Outputs of an amount are indexed in the order they were added, so
+   * their block heights never decrease with the index.  The default
+   * implementation binary searches the outputs by height; subclasses
+   * which keep per-block counts should override it.
+   *
+   * Transactions and outputs are added after their block, so the heights
+   * stored with them are one past their block's; height here is a block
+   * height, for all amounts alike.
+   *
+   * @param amount the output amount (0 for RingCT outputs)
+   * @param height the height to count up to, exclusively
+   *
+   * @return the number of outputs of the amount in blocks below height
+   */
+  virtual uint64_t get_num_outputs_below_height(const uint64_t& amount, const uint64_t& height) const;
+
+  /**
+   * @brief get the cumulative output counts of an amount over a range of heights
+   *
+   * Fills distribution with, for each height from from_height to
+   * to_height inclusively, the number of outputs of the amount created
+   * in blocks up to and including that height.
+   *
+   * @param amount the output amount (0 for RingCT outputs)
+   * @param from_height the first height of the range
+   * @param to_height the last height of the range, must be below height()
+   * @param distribution return-by-reference the cumulative counts
+   * @param base return-by-reference the number of outputs below from_height
+   */
+  virtual void get_output_distribution(const uint64_t& amount, const uint64_t& from_height, const uint64_t& to_height, std::vector<uint64_t>& distribution, uint64_t& base) const;
+
   /**
    * @brief is BlockchainDB in read-only mode?
    *
@@ -1323,6 +1621,54 @@ public:
    */
   virtual bool is_read_only() const = 0;
 
+  /**
+   * @brief drops the prunable data of transactions in older blocks
+   *
+   * Removes the prunable signature data of the transactions in all blocks
+   * but the most recent keep_blocks ones.  The pruned transactions can
+   * still be served, without that data, to clients that do not need to
+   * validate them.  This is incremental: blocks pruned in earlier calls
+   * are not looked at again, so it may be called after every block.
+   *
+   * The default implementation does nothing, for backends which don't
+   * store the prunable data separately.
+   *
+   * @param keep_blocks the number of most recent blocks to leave intact
+   *
+   * @return the number of transactions pruned
+   */
+  virtual uint64_t prune_blockchain(uint64_t keep_blocks);
+
+  /**
+   * @brief gets the db's operation counters and storage statistics
+   *
+   * The default implementation fills in the operation counters, which are
+   * kept since the db was created.  Implementations add what they know of
+   * their storage: table sizes, memory map use, reader slots and so on.
+   *
+   * @param stats return-by-reference the statistics
+   */
+  virtual void get_stats(db_stats_t& stats) const;
+
+  /**
+   * @brief copies the db to a directory while it stays in use
+   *
+   * The copy is made from a single read transaction, so it is consistent,
+   * and writers carry on meanwhile.  It may take a long time for a large
+   * db, so it is meant to be run from a thread of its own.
+   *
+   * The default implementation does nothing, for backends which can't be
+   * copied.
+   *
+   * @param path the directory to copy to, created if need be, which may
+   *             not already hold a copy
+   * @param compact whether to leave out free pages, which is slower but
+   *                makes for a smaller copy
+   *
+   * @return false if the backend can't be copied, otherwise true
+   */
+  virtual bool copy(const std::string& path, bool compact) const;
+
   // TODO: this should perhaps be (or call) a series of functions which
   // progressively update through version updates
   /**
@@ -1340,6 +1686,17 @@ public:
    */
   void set_auto_remove_logs(bool auto_remove) { m_auto_remove_logs = auto_remove; }
 
+  /**
+   * @brief set the most space the database may grow to
+   *
+   * For implementations which map their storage (BlockchainLMDB), this much
+   * address space is reserved when the db is opened, so it rarely needs to
+   * be resized.  Must be called before open() to take effect there.
+   *
+   * @param max_size the size in bytes, or 0 for the implementation default
+   */
+  void set_max_size(uint64_t max_size) { m_max_size = max_size; }
+
   bool m_open;  //!< Whether or not the BlockchainDB is open/ready for use
   mutable epee::critical_section m_synchronization_lock;  //!< A lock, currently for when BlockchainLMDB needs to resize the backing db file
 
@@ -0,0 +1,206 @@
+// Copyright (c) 2014-2017, The Monero Project
+// Copyright (c) 2017, SUMOKOIN
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cryptonote
+{
+
+/**
+ * @brief the db operations whose calls are counted and timed
+ */
+enum db_op
+{
+  DB_OP_ADD_BLOCK,
+  DB_OP_TX_EXISTS,
+  DB_OP_HAS_KEY_IMAGE,
+  DB_OP_GET_OUTPUT_KEY,   //!< a single output
+  DB_OP_GET_OUTPUT_KEYS,  //!< a set of outputs of one amount, as for a ring
+  DB_OP_COMMIT,
+  DB_OP_COUNT
+};
+
+/**
+ * @brief the number of latency buckets kept per operation
+ *
+ * Bucket n counts the calls which took under 2^n microseconds and at least
+ * half that, the last one also every call which took longer.
+ */
+static const size_t DB_LATENCY_BUCKETS = 24;
+
+/**
+ * @brief the counters of one db operation, as reported
+ */
+struct db_op_stats_t
+{
+  std::string name;                     //!< the operation
+  uint64_t count;                       //!< the number of calls
+  uint64_t total_us;                    //!< the time spent in them, in microseconds
+  uint64_t max_us;                      //!< the longest call, in microseconds
+  std::vector<uint64_t> latency_buckets;  //!< the calls by duration, see DB_LATENCY_BUCKETS
+};
+
+/**
+ * @brief the size of one table of the db
+ */
+struct db_table_stats_t
+{
+  std::string name;          //!< the table
+  uint64_t entries;          //!< the number of entries
+  uint64_t depth;            //!< the depth of its B-tree, 0 if not stored as one
+  uint64_t branch_pages;     //!< the number of internal pages
+  uint64_t leaf_pages;       //!< the number of leaf pages
+  uint64_t overflow_pages;   //!< the number of overflow pages
+};
+
+/**
+ * @brief the statistics a db reports, see BlockchainDB::get_stats
+ *
+ * Backends fill in what applies to them and leave the rest 0.
+ */
+struct db_stats_t
+{
+  std::string db_type;                  //!< the backend, as in BlockchainDB::get_db_name
+  std::vector<db_op_stats_t> ops;       //!< the operation counters
+  std::vector<db_table_stats_t> tables; //!< the tables
+  uint64_t page_size = 0;               //!< the size of a page, in bytes
+  uint64_t map_size = 0;                //!< the size of the memory map, in bytes
+  uint64_t map_used = 0;                //!< the part of the memory map in use, in bytes
+  uint64_t max_readers = 0;             //!< the number of reader slots
+  uint64_t readers_used = 0;            //!< the number of reader slots held by a thread
+  uint64_t num_resizes = 0;             //!< the number of times the memory map was grown
+  uint64_t resize_time_us = 0;          //!< the time spent growing it, with all txns stalled
+};
+
+/**
+ * @brief call counters and latency histograms for the db operations
+ *
+ * Updates are lock-free, so they may be made from any thread, and a read
+ * while calls are under way gets counters which may be a call or so apart.
+ */
+class db_op_counters
+{
+public:
+  db_op_counters()
+  {
+    for (auto &op: m_ops)
+    {
+      op.count = 0;
+      op.total_us = 0;
+      op.max_us = 0;
+      for (auto &bucket: op.buckets)
+        bucket = 0;
+    }
+  }
+
+  /**
+   * @brief records a call
+   *
+   * @param op the operation
+   * @param us the time it took, in microseconds
+   */
+  void add(db_op op, uint64_t us)
+  {
+    counters &c = m_ops[op];
+    size_t bucket = 0;
+    while (bucket < DB_LATENCY_BUCKETS - 1 && us >= (1ull << bucket))
+      ++bucket;
+    c.count.fetch_add(1, std::memory_order_relaxed);
+    c.total_us.fetch_add(us, std::memory_order_relaxed);
+    c.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    uint64_t max_us = c.max_us.load(std::memory_order_relaxed);
+    while (us > max_us && !c.max_us.compare_exchange_weak(max_us, us, std::memory_order_relaxed));
+  }
+
+  /**
+   * @brief gets the counters of every operation
+   *
+   * @param ops return-by-reference the counters, by operation
+   */
+  void get(std::vector<db_op_stats_t> &ops) const
+  {
+    static const char * const names[DB_OP_COUNT] = {
+      "add_block", "tx_exists", "has_key_image", "get_output_key", "get_output_keys", "commit"
+    };
+    ops.clear();
+    ops.reserve(DB_OP_COUNT);
+    for (size_t n = 0; n < DB_OP_COUNT; ++n)
+    {
+      const counters &c = m_ops[n];
+      db_op_stats_t s;
+      s.name = names[n];
+      s.count = c.count.load(std::memory_order_relaxed);
+      s.total_us = c.total_us.load(std::memory_order_relaxed);
+      s.max_us = c.max_us.load(std::memory_order_relaxed);
+      s.latency_buckets.reserve(DB_LATENCY_BUCKETS);
+      for (const auto &bucket: c.buckets)
+        s.latency_buckets.push_back(bucket.load(std::memory_order_relaxed));
+      ops.push_back(std::move(s));
+    }
+  }
+
+private:
+  struct counters
+  {
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> total_us;
+    std::atomic<uint64_t> max_us;
+    std::atomic<uint64_t> buckets[DB_LATENCY_BUCKETS];
+  };
+
+  counters m_ops[DB_OP_COUNT];
+};
+
+/**
+ * @brief times a db operation from construction to destruction
+ */
+class db_op_timer
+{
+public:
+  db_op_timer(db_op_counters &counters, db_op op):
+    m_counters(counters), m_op(op), m_start(std::chrono::steady_clock::now()) {}
+
+  ~db_op_timer()
+  {
+    m_counters.add(m_op, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_start).count());
+  }
+
+private:
+  db_op_counters &m_counters;
+  const db_op m_op;
+  const std::chrono::steady_clock::time_point m_start;
+};
+
+}  // namespace cryptonote
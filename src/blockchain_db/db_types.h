@@ -36,6 +36,7 @@ namespace cryptonote
   const std::unordered_set<std::string> blockchain_db_types = 
   { "lmdb"
   , "berkeley"
+  , "memory"
   };
 
 } // namespace cryptonote
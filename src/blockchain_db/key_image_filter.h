@@ -0,0 +1,143 @@
+// Copyright (c) 2014-2017, The Monero Project
+// Copyright (c) 2017, SUMOKOIN
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include "crypto/crypto.h"
+
+namespace cryptonote
+{
+
+/**
+ * @brief a blocked Bloom filter over key images
+ *
+ * Tells whether a key image may be in the set, with no false negatives, so
+ * most lookups for key images which aren't there never reach the database.
+ * Every key image sets KEY_BITS bits within a single 512 bit block, so a
+ * lookup touches one cache line.  Key images are uniformly distributed,
+ * so their own bytes serve as the hash.
+ *
+ * Inserts and lookups may run concurrently with each other; reset() may
+ * not.  Removal isn't supported: removed key images stay in as false
+ * positives until the filter is rebuilt.  A filter sized for fewer key
+ * images than it holds still works, with more false positives.
+ */
+class key_image_filter
+{
+public:
+  key_image_filter(): m_num_blocks(0) {}
+
+  /**
+   * @brief empties the filter and sizes it for a number of key images
+   *
+   * @param capacity the number of key images to size the filter for
+   */
+  void reset(uint64_t capacity)
+  {
+    m_num_blocks = (capacity * BITS_PER_KEY + BLOCK_BITS - 1) / BLOCK_BITS;
+    if (m_num_blocks == 0)
+      m_num_blocks = 1;
+    m_words.reset(new std::atomic<uint64_t>[m_num_blocks * BLOCK_WORDS]);
+    for (uint64_t i = 0; i < m_num_blocks * BLOCK_WORDS; ++i)
+      m_words[i].store(0, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief adds a key image to the filter
+   *
+   * @param ki the key image
+   */
+  void insert(const crypto::key_image &ki)
+  {
+    if (!m_num_blocks)
+      return;
+    uint64_t block, bits[KEY_BITS];
+    positions(ki, block, bits);
+    for (size_t i = 0; i < KEY_BITS; ++i)
+      m_words[block + (bits[i] >> 6)].fetch_or(1ull << (bits[i] & 63), std::memory_order_release);
+  }
+
+  /**
+   * @brief checks whether a key image may have been added
+   *
+   * An unsized filter may contain anything.
+   *
+   * @param ki the key image
+   *
+   * @return false if the key image was never added, true if it may have been
+   */
+  bool may_contain(const crypto::key_image &ki) const
+  {
+    if (!m_num_blocks)
+      return true;
+    uint64_t block, bits[KEY_BITS];
+    positions(ki, block, bits);
+    for (size_t i = 0; i < KEY_BITS; ++i)
+      if (!(m_words[block + (bits[i] >> 6)].load(std::memory_order_acquire) & (1ull << (bits[i] & 63))))
+        return false;
+    return true;
+  }
+
+  /**
+   * @brief gets the filter's memory footprint
+   *
+   * @return the number of bytes used by the filter
+   */
+  uint64_t size() const { return m_num_blocks * BLOCK_WORDS * sizeof(uint64_t); }
+
+private:
+  static const size_t BLOCK_BITS = 512;
+  static const size_t BLOCK_WORDS = BLOCK_BITS / 64;
+  static const size_t KEY_BITS = 8;
+  static const size_t BITS_PER_KEY = 16;
+
+  // the first 8 bytes pick the block, the next 9 bits at a time the bits in it
+  void positions(const crypto::key_image &ki, uint64_t &block, uint64_t *bits) const
+  {
+    uint64_t words[4];
+    memcpy(words, &ki, sizeof(words));
+    block = (words[0] % m_num_blocks) * BLOCK_WORDS;
+    for (size_t i = 0; i < KEY_BITS; ++i)
+    {
+      const size_t bit = 64 + i * 9;
+      const uint64_t w = words[bit / 64] >> (bit % 64);
+      const uint64_t hi = bit % 64 > 55 ? words[bit / 64 + 1] << (64 - bit % 64) : 0;
+      bits[i] = (w | hi) & (BLOCK_BITS - 1);
+    }
+  }
+
+  std::unique_ptr<std::atomic<uint64_t>[]> m_words;
+  uint64_t m_num_blocks;
+};
+
+}  // namespace cryptonote
@@ -31,10 +31,16 @@
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
 #include <boost/current_function.hpp>
+#include <chrono>
 #include <memory>  // std::unique_ptr
 #include <cstring>  // memcpy
 #include <random>
+#ifndef WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
+#include "common/varint.h"
 #include "cryptonote_core/cryptonote_format_utils.h"
 #include "crypto/crypto.h"
 #include "profile_tools.h"
@@ -47,7 +53,7 @@ using epee::string_tools::pod_to_hex;
 
 // Increase when the DB changes in a non backward compatible way, and there
 // is no automatic conversion, so that a full resync is needed.
-#define VERSION 1
+#define VERSION 3
 
 namespace
 {
@@ -164,7 +170,8 @@ int compare_string(const MDB_val *a, const MDB_val *b)
  * block_heights    block hash   block height
  * block_info       block ID     {block metadata}
  *
- * txs              txn ID       txn blob
+ * txs              txn ID       txn blob, less the prunable data
+ * txs_prunable     txn ID       prunable txn data
  * tx_indices       txn hash     {txn ID, metadata}
  * tx_outputs       txn ID       [txn amount output indices]
  *
@@ -186,6 +193,7 @@ const char* const LMDB_BLOCK_HEIGHTS = "block_heights";
 const char* const LMDB_BLOCK_INFO = "block_info";
 
 const char* const LMDB_TXS = "txs";
+const char* const LMDB_TXS_PRUNABLE = "txs_prunable";
 const char* const LMDB_TX_INDICES = "tx_indices";
 const char* const LMDB_TX_OUTPUTS = "tx_outputs";
 
@@ -196,6 +204,11 @@ const char* const LMDB_SPENT_KEYS = "spent_keys";
 const char* const LMDB_HF_STARTING_HEIGHTS = "hf_starting_heights";
 const char* const LMDB_HF_VERSIONS = "hf_versions";
 
+const char* const LMDB_ALT_BLOCKS = "alt_blocks";
+
+const char* const LMDB_TXPOOL_META = "txpool_meta";
+const char* const LMDB_TXPOOL_BLOB = "txpool_blob";
+
 const char* const LMDB_PROPERTIES = "properties";
 
 const char zerokey[8] = {0};
@@ -207,6 +220,24 @@ const std::string lmdb_error(const std::string& error_string, int mdb_res)
   return full_string;
 }
 
+const size_t PREFETCH_MAX_BYTES = 256 * 1024;
+
+// hints the kernel that up to the given number of bytes following the page
+// holding addr are going to be read. LMDB doesn't tell where the pages a
+// cursor will move to are, but pages appended to one table tend to follow
+// one another in the file, and this is only a hint.
+void prefetch_pages(const void *addr, size_t bytes)
+{
+#ifndef WIN32
+  static const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  const uintptr_t start = ((uintptr_t)addr / page_size + 1) * page_size;
+  bytes = std::min<size_t>(bytes, PREFETCH_MAX_BYTES);
+  bytes = (bytes + page_size - 1) / page_size * page_size;
+  if (bytes)
+    madvise((void *)start, bytes, MADV_WILLNEED);
+#endif
+}
+
 inline void lmdb_db_open(MDB_txn* txn, const char* name, int flags, MDB_dbi& dbi, const std::string& error_string)
 {
   if (auto res = mdb_dbi_open(txn, name, flags, &dbi))
@@ -248,6 +279,7 @@ typedef struct mdb_block_info
   uint64_t bi_size; // a size_t really but we need 32-bit compat
   difficulty_type bi_diff;
   crypto::hash bi_hash;
+  uint64_t bi_cum_rct; // RingCT outputs as of this block
 } mdb_block_info;
 
 typedef struct blk_height {
@@ -414,17 +446,29 @@ void BlockchainLMDB::do_resize(uint64_t increase_size)
 
   mdb_env_stat(m_env, &mst);
 
-  // add 1Gb per resize, instead of doing a percentage increase
-  uint64_t new_mapsize = (double) mei.me_mapsize + add_size;
+  // grow by half the current size (at least 1Gb), so a db which outgrows its
+  // initial reservation needs few resizes, each of which stalls all readers
+  uint64_t new_mapsize = mei.me_mapsize + std::max<uint64_t>(add_size, mei.me_mapsize / 2);
 
-  // If given, use increase_size intead of above way of resizing.
+  // If given, make room for at least increase_size more.
   // This is currently used for increasing by an estimated size at start of new
   // batch txn.
   if (increase_size > 0)
-    new_mapsize = mei.me_mapsize + increase_size;
+    new_mapsize = std::max<uint64_t>(new_mapsize, mei.me_mapsize + increase_size);
+
+  if (m_max_size > 0)
+  {
+    if (mei.me_mapsize >= m_max_size)
+    {
+      LOG_PRINT_RED_L0("!! WARNING: database has reached its maximum size (--db-max-size), not extending it !!");
+      return;
+    }
+    new_mapsize = std::min<uint64_t>(new_mapsize, m_max_size);
+  }
 
   new_mapsize += (new_mapsize % mst.ms_psize);
 
+  const auto stall_start = std::chrono::steady_clock::now();
   mdb_txn_safe::prevent_new_txns();
 
   if (m_write_txn != nullptr)
@@ -448,6 +492,8 @@ void BlockchainLMDB::do_resize(uint64_t increase_size)
   LOG_PRINT_GREEN("LMDB Mapsize increased." << "  Old: " << mei.me_mapsize / (1024 * 1024) << "MiB" << ", New: " << new_mapsize / (1024 * 1024) << "MiB", LOG_LEVEL_0);
 
   mdb_txn_safe::allow_new_txns();
+  ++m_num_resizes;
+  m_resize_time_us += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - stall_start).count();
 }
 
 // threshold_size is used for batch transactions
@@ -597,7 +643,7 @@ uint64_t BlockchainLMDB::get_estimated_batch_size(uint64_t batch_num_blocks) con
 }
 
 void BlockchainLMDB::add_block(const block& blk, const size_t& block_size, const difficulty_type& cumulative_difficulty, const uint64_t& coins_generated,
-    const crypto::hash& blk_hash)
+    uint64_t num_rct_outs, const crypto::hash& blk_hash)
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
@@ -644,6 +690,16 @@ void BlockchainLMDB::add_block(const block& blk, const size_t& block_size, const
   bi.bi_size = block_size;
   bi.bi_diff = cumulative_difficulty;
   bi.bi_hash = blk_hash;
+  bi.bi_cum_rct = num_rct_outs;
+  if (m_height > 0)
+  {
+    MDB_val_copy<uint64_t> prev_height(m_height - 1);
+    MDB_val h = prev_height;
+    if ((result = mdb_cursor_get(m_cur_block_info, (MDB_val *)&zerokval, &h, MDB_GET_BOTH)))
+      throw1(DB_ERROR(lmdb_error("Failed to get block info: ", result).c_str()));
+    const mdb_block_info *bi_prev = (const mdb_block_info*)h.mv_data;
+    bi.bi_cum_rct += bi_prev->bi_cum_rct;
+  }
 
   MDB_val_set(val, bi);
   result = mdb_cursor_put(m_cur_block_info, (MDB_val *)&zerokval, &val, MDB_APPENDDUP);
@@ -708,6 +764,7 @@ uint64_t BlockchainLMDB::add_transaction_data(const crypto::hash& blk_hash, cons
   uint64_t tx_id = m_num_txs;
 
   CURSOR(txs)
+  CURSOR(txs_prunable)
   CURSOR(tx_indices)
 
   MDB_val_set(val_tx_id, tx_id);
@@ -733,10 +790,24 @@ uint64_t BlockchainLMDB::add_transaction_data(const crypto::hash& blk_hash, cons
   if (result)
     throw0(DB_ERROR(lmdb_error("Failed to add tx data to db transaction: ", result).c_str()));
 
-  MDB_val_copy<blobdata> blob(tx_to_blob(tx));
+  // the prunable data goes in its own table, so it can be dropped later;
+  // every tx gets an entry there, even if it has nothing prunable, unless
+  // it has been pruned already
+  const blobdata bd = tx_to_blob(tx);
+  size_t pruned_size;
+  if (!get_pruned_tx_blob_size(bd, pruned_size))
+    throw0(DB_ERROR("Failed to find the prunable data of tx"));
+  MDB_val blob = {pruned_size, (void *)bd.data()};
   result = mdb_cursor_put(m_cur_txs, &val_tx_id, &blob, MDB_APPEND);
   if (result)
     throw0(DB_ERROR(lmdb_error("Failed to add tx blob to db transaction: ", result).c_str()));
+  if (!tx.pruned)
+  {
+    MDB_val prunable = {bd.size() - pruned_size, (void *)(bd.data() + pruned_size)};
+    result = mdb_cursor_put(m_cur_txs_prunable, &val_tx_id, &prunable, MDB_APPEND);
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to add tx prunable data to db transaction: ", result).c_str()));
+  }
 
   m_num_txs++;
   return tx_id;
@@ -754,6 +825,7 @@ void BlockchainLMDB::remove_transaction_data(const crypto::hash& tx_hash, const
   mdb_txn_cursors *m_cursors = &m_wcursors;
   CURSOR(tx_indices)
   CURSOR(txs)
+  CURSOR(txs_prunable)
   CURSOR(tx_outputs)
 
   MDB_val_set(val_h, tx_hash);
@@ -769,6 +841,17 @@ void BlockchainLMDB::remove_transaction_data(const crypto::hash& tx_hash, const
   if (result)
       throw1(DB_ERROR(lmdb_error("Failed to add removal of tx to db transaction: ", result).c_str()));
 
+  // not there if it has been pruned
+  result = mdb_cursor_get(m_cur_txs_prunable, &val_tx_id, NULL, MDB_SET);
+  if (result && result != MDB_NOTFOUND)
+      throw1(DB_ERROR(lmdb_error("Failed to locate tx prunable data for removal: ", result).c_str()));
+  if (!result)
+  {
+    result = mdb_cursor_del(m_cur_txs_prunable, 0);
+    if (result)
+      throw1(DB_ERROR(lmdb_error("Failed to add removal of tx prunable data to db transaction: ", result).c_str()));
+  }
+
   remove_tx_outputs(tip->data.tx_id, tx);
 
   result = mdb_cursor_get(m_cur_tx_outputs, &val_tx_id, NULL, MDB_SET);
@@ -956,6 +1039,9 @@ void BlockchainLMDB::add_spent_key(const crypto::key_image& k_image)
     else
       throw1(DB_ERROR(lmdb_error("Error adding spent key image to db transaction: ", result).c_str()));
   }
+
+  // in before the txn commits, so no reader can see it missing from the filter
+  m_key_image_filter.insert(k_image);
 }
 
 void BlockchainLMDB::remove_spent_key(const crypto::key_image& k_image)
@@ -976,6 +1062,7 @@ void BlockchainLMDB::remove_spent_key(const crypto::key_image& k_image)
     if (result)
         throw1(DB_ERROR(lmdb_error("Error adding removal of key image to db transaction", result).c_str()));
   }
+  // it stays in the key image filter, which only costs a lookup
 }
 
 blobdata BlockchainLMDB::output_to_blob(const tx_out& output) const
@@ -1001,6 +1088,20 @@ tx_out BlockchainLMDB::output_from_blob(const blobdata& blob) const
   return o;
 }
 
+void BlockchainLMDB::tx_from_blobs(blobdata& bd, const MDB_val *prunable, transaction& tx) const
+{
+  if (prunable)
+  {
+    bd.append(reinterpret_cast<const char*>(prunable->mv_data), prunable->mv_size);
+    if (!parse_and_validate_tx_from_blob(bd, tx))
+      throw0(DB_ERROR("Failed to parse tx from blob retrieved from the db"));
+  }
+  else if (!parse_and_validate_tx_base_from_blob(bd, tx))
+  {
+    throw0(DB_ERROR("Failed to parse pruned tx from blob retrieved from the db"));
+  }
+}
+
 void BlockchainLMDB::check_open() const
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
@@ -1033,6 +1134,8 @@ BlockchainLMDB::BlockchainLMDB(bool batch_transactions)
   m_batch_active = false;
   m_cum_size = 0;
   m_cum_count = 0;
+  m_num_resizes = 0;
+  m_resize_time_us = 0;
 
   m_hardfork = nullptr;
 }
@@ -1075,7 +1178,7 @@ void BlockchainLMDB::open(const std::string& filename, const int mdb_flags)
   if ((result = mdb_env_set_maxdbs(m_env, 20)))
     throw0(DB_ERROR(lmdb_error("Failed to set max number of dbs: ", result).c_str()));
 
-  size_t mapsize = DEFAULT_MAPSIZE;
+  size_t mapsize = m_max_size > 0 ? m_max_size : DEFAULT_MAPSIZE;
 
   if (auto result = mdb_env_open(m_env, filename.c_str(), mdb_flags, 0644))
     throw0(DB_ERROR(lmdb_error("Failed to open lmdb environment: ", result).c_str()));
@@ -1116,6 +1219,17 @@ void BlockchainLMDB::open(const std::string& filename, const int mdb_flags)
   lmdb_db_open(txn, LMDB_BLOCK_HEIGHTS, MDB_INTEGERKEY | MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED, m_block_heights, "Failed to open db handle for m_block_heights");
 
   lmdb_db_open(txn, LMDB_TXS, MDB_INTEGERKEY | MDB_CREATE, m_txs, "Failed to open db handle for m_txs");
+  // older databases have no prunable table until migrate_1_2 adds it, which
+  // can't be done read-only, so it is not created then; the version check
+  // below turns such databases away
+  if (mdb_flags & MDB_RDONLY)
+  {
+    result = mdb_dbi_open(txn, LMDB_TXS_PRUNABLE, MDB_INTEGERKEY, &m_txs_prunable);
+    if (result && result != MDB_NOTFOUND)
+      throw0(DB_OPEN_FAILURE(lmdb_error("Failed to open db handle for m_txs_prunable: ", result).c_str()));
+  }
+  else
+    lmdb_db_open(txn, LMDB_TXS_PRUNABLE, MDB_INTEGERKEY | MDB_CREATE, m_txs_prunable, "Failed to open db handle for m_txs_prunable");
   lmdb_db_open(txn, LMDB_TX_INDICES, MDB_INTEGERKEY | MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED, m_tx_indices, "Failed to open db handle for m_tx_indices");
   lmdb_db_open(txn, LMDB_TX_OUTPUTS, MDB_INTEGERKEY | MDB_CREATE, m_tx_outputs, "Failed to open db handle for m_tx_outputs");
 
@@ -1132,6 +1246,18 @@ void BlockchainLMDB::open(const std::string& filename, const int mdb_flags)
 
   lmdb_db_open(txn, LMDB_HF_VERSIONS, MDB_INTEGERKEY | MDB_CREATE, m_hf_versions, "Failed to open db handle for m_hf_versions");
 
+  // alternative blocks are only written by a running daemon, and this table
+  // may not exist in older databases, so it is skipped for read-only opens
+  if (!(mdb_flags & MDB_RDONLY))
+    lmdb_db_open(txn, LMDB_ALT_BLOCKS, MDB_CREATE, m_alt_blocks, "Failed to open db handle for m_alt_blocks");
+
+  // the same goes for the transaction pool
+  if (!(mdb_flags & MDB_RDONLY))
+  {
+    lmdb_db_open(txn, LMDB_TXPOOL_META, MDB_CREATE, m_txpool_meta, "Failed to open db handle for m_txpool_meta");
+    lmdb_db_open(txn, LMDB_TXPOOL_BLOB, MDB_CREATE, m_txpool_blob, "Failed to open db handle for m_txpool_blob");
+  }
+
   lmdb_db_open(txn, LMDB_PROPERTIES, MDB_CREATE, m_properties, "Failed to open db handle for m_properties");
 
   mdb_set_dupsort(txn, m_spent_keys, compare_hash32);
@@ -1180,6 +1306,15 @@ void BlockchainLMDB::open(const std::string& filename, const int mdb_flags)
       compatible = false;
     }
 #if VERSION > 0
+    else if (*(const uint32_t*)v.mv_data < VERSION && (mdb_flags & MDB_RDONLY))
+    {
+      txn.abort();
+      mdb_env_close(m_env);
+      m_open = false;
+      LOG_PRINT_RED_L0("Existing lmdb database needs to be upgraded, which can't be done read-only.");
+      LOG_PRINT_RED_L0("Please run the daemon on it once to upgrade it.");
+      return;
+    }
     else if (*(const uint32_t*)v.mv_data < VERSION)
     {
       // Note that there was a schema change within version 0 as well.
@@ -1188,6 +1323,7 @@ void BlockchainLMDB::open(const std::string& filename, const int mdb_flags)
       txn.commit();
       m_open = true;
       migrate(*(const uint32_t *)v.mv_data);
+      load_key_image_filter();
       return;
     }
 #endif
@@ -1234,6 +1370,7 @@ void BlockchainLMDB::open(const std::string& filename, const int mdb_flags)
   txn.commit();
 
   m_open = true;
+  load_key_image_filter();
   // from here, init should be finished
 }
 
@@ -1283,6 +1420,8 @@ void BlockchainLMDB::reset()
     throw0(DB_ERROR(lmdb_error("Failed to drop m_block_heights: ", result).c_str()));
   if (auto result = mdb_drop(txn, m_txs, 0))
     throw0(DB_ERROR(lmdb_error("Failed to drop m_txs: ", result).c_str()));
+  if (auto result = mdb_drop(txn, m_txs_prunable, 0))
+    throw0(DB_ERROR(lmdb_error("Failed to drop m_txs_prunable: ", result).c_str()));
   if (auto result = mdb_drop(txn, m_tx_indices, 0))
     throw0(DB_ERROR(lmdb_error("Failed to drop m_tx_indices: ", result).c_str()));
   if (auto result = mdb_drop(txn, m_tx_outputs, 0))
@@ -1296,6 +1435,12 @@ void BlockchainLMDB::reset()
   (void)mdb_drop(txn, m_hf_starting_heights, 0); // this one is dropped in new code
   if (auto result = mdb_drop(txn, m_hf_versions, 0))
     throw0(DB_ERROR(lmdb_error("Failed to drop m_hf_versions: ", result).c_str()));
+  if (auto result = mdb_drop(txn, m_alt_blocks, 0))
+    throw0(DB_ERROR(lmdb_error("Failed to drop m_alt_blocks: ", result).c_str()));
+  if (auto result = mdb_drop(txn, m_txpool_meta, 0))
+    throw0(DB_ERROR(lmdb_error("Failed to drop m_txpool_meta: ", result).c_str()));
+  if (auto result = mdb_drop(txn, m_txpool_blob, 0))
+    throw0(DB_ERROR(lmdb_error("Failed to drop m_txpool_blob: ", result).c_str()));
   if (auto result = mdb_drop(txn, m_properties, 0))
     throw0(DB_ERROR(lmdb_error("Failed to drop m_properties: ", result).c_str()));
 
@@ -1306,6 +1451,7 @@ void BlockchainLMDB::reset()
     throw0(DB_ERROR(lmdb_error("Failed to write version to database: ", result).c_str()));
 
   txn.commit();
+  m_key_image_filter.reset(KEY_IMAGE_FILTER_MIN_CAPACITY);
   m_num_outputs = 0;
   m_cum_size = 0;
   m_cum_count = 0;
@@ -1400,6 +1546,29 @@ void BlockchainLMDB::unlock()
       auto_txn.commit(); \
   } while(0)
 
+// The below two macros are for transaction pool writes, which come from
+// whichever thread is handling the transaction. Only the thread which owns
+// m_write_txn may join it; any other thread gets a txn of its own, which
+// waits for the writer to finish.
+
+#define TXN_POOL_PREFIX(flags); \
+  mdb_txn_safe auto_txn; \
+  mdb_txn_safe* txn_ptr = &auto_txn; \
+  const bool pool_txn_joined = m_write_txn && m_writer == boost::this_thread::get_id(); \
+  if (pool_txn_joined) \
+    txn_ptr = m_write_txn; \
+  else \
+  { \
+    if (auto mdb_res = mdb_txn_begin(m_env, NULL, flags, auto_txn)) \
+      throw0(DB_ERROR(lmdb_error(std::string("Failed to create a transaction for the db in ")+__FUNCTION__+": ", mdb_res).c_str())); \
+  } \
+
+#define TXN_POOL_POSTFIX_SUCCESS() \
+  do { \
+    if (! pool_txn_joined) \
+      auto_txn.commit(); \
+  } while(0)
+
 bool BlockchainLMDB::block_exists(const crypto::hash& h, uint64_t *height) const
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
@@ -1674,6 +1843,178 @@ std::vector<crypto::hash> BlockchainLMDB::get_hashes_range(const uint64_t& h1, c
   return v;
 }
 
+void BlockchainLMDB::get_block_info_range(const uint64_t& h1, const uint64_t& h2, std::vector<block_info_t>& infos, unsigned int fields) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+  infos.clear();
+  if (h1 > h2)
+    return;
+
+  TXN_PREFIX_RDONLY();
+  RCURSOR(block_info);
+  RCURSOR(blocks);
+
+  // block_info entries are sorted by height under a single key, so the
+  // whole range is one positioned get followed by a forward walk; the
+  // versions come from the start of each block blob, walked alongside
+  infos.reserve(h2 - h1 + 1);
+  MDB_val_set(result, h1);
+  MDB_val_copy<uint64_t> block_key(h1);
+  MDB_val block_blob;
+  MDB_cursor_op op = MDB_GET_BOTH;
+  MDB_cursor_op block_op = MDB_SET;
+  for (uint64_t height = h1; height <= h2; ++height)
+  {
+    auto get_result = mdb_cursor_get(m_cur_block_info, (MDB_val *)&zerokval, &result, op);
+    if (get_result == MDB_NOTFOUND)
+      throw0(BLOCK_DNE(std::string("Attempt to get block info from height ").append(boost::lexical_cast<std::string>(height)).append(" failed -- block not in db").c_str()));
+    else if (get_result)
+      throw0(DB_ERROR(lmdb_error("Error attempting to retrieve block info from the db: ", get_result).c_str()));
+
+    const mdb_block_info *bi = (const mdb_block_info *)result.mv_data;
+    if (bi->bi_height != height)
+      throw0(DB_ERROR("Unexpected height in block info table"));
+
+    block_info_t info;
+    info.height = bi->bi_height;
+    if (fields & BI_TIMESTAMP)
+      info.timestamp = bi->bi_timestamp;
+    if (fields & BI_COINS_GENERATED)
+      info.coins_generated = bi->bi_coins;
+    if (fields & BI_SIZE)
+      info.size = bi->bi_size;
+    if (fields & BI_CUMULATIVE_DIFFICULTY)
+      info.cumulative_difficulty = bi->bi_diff;
+    if (fields & BI_HASH)
+      info.hash = bi->bi_hash;
+    if (fields & BI_CUMULATIVE_RCT_OUTPUTS)
+      info.cumulative_rct_outputs = bi->bi_cum_rct;
+    if (fields & BI_VERSIONS)
+    {
+      get_result = mdb_cursor_get(m_cur_blocks, &block_key, &block_blob, block_op);
+      if (get_result)
+        throw0(DB_ERROR(lmdb_error("Error attempting to retrieve a block from the db: ", get_result).c_str()));
+      if (*(const uint64_t *)block_key.mv_data != height)
+        throw0(DB_ERROR("Unexpected height in blocks table"));
+
+      // the block header starts with the major and minor versions, as varints
+      const uint8_t *p = (const uint8_t *)block_blob.mv_data;
+      const uint8_t *end = p + block_blob.mv_size;
+      if (tools::read_varint<8>(p, end, info.major_version) <= 0 || tools::read_varint<8>(p, end, info.minor_version) <= 0)
+        throw0(DB_ERROR("Failed to parse block header from blob retrieved from the db"));
+      block_op = MDB_NEXT;
+    }
+    infos.push_back(info);
+    op = MDB_NEXT_DUP;
+  }
+
+  TXN_POSTFIX_RDONLY();
+}
+
+void BlockchainLMDB::get_block_blobs_range(const uint64_t& h1, const uint64_t& h2, std::vector<block_blobs_t>& blocks, bool get_output_indices) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+  blocks.clear();
+  if (h1 > h2)
+    return;
+
+  TXN_PREFIX_RDONLY();
+  RCURSOR(blocks);
+  RCURSOR(tx_indices);
+  RCURSOR(txs);
+  RCURSOR(txs_prunable);
+  RCURSOR(tx_outputs);
+
+  // all blobs are copied out of the same read txn, the transactions are
+  // only looked up by hash, never parsed
+  blocks.reserve(h2 - h1 + 1);
+  uint64_t first_height = h1;
+  MDB_val_set(key, first_height);
+  MDB_val result;
+  MDB_cursor_op op = MDB_SET;
+  for (uint64_t height = h1; height <= h2; ++height)
+  {
+    auto get_result = mdb_cursor_get(m_cur_blocks, &key, &result, op);
+    if (get_result == MDB_NOTFOUND)
+      throw0(BLOCK_DNE(std::string("Attempt to get block from height ").append(boost::lexical_cast<std::string>(height)).append(" failed -- block not in db").c_str()));
+    else if (get_result)
+      throw0(DB_ERROR(lmdb_error("Error attempting to retrieve a block from the db: ", get_result).c_str()));
+    if (*(const uint64_t*)key.mv_data != height)
+      throw0(DB_ERROR("Unexpected height in blocks table"));
+    op = MDB_NEXT;
+
+    blocks.push_back(block_blobs_t());
+    block_blobs_t &entry = blocks.back();
+    entry.block.assign(reinterpret_cast<const char*>(result.mv_data), result.mv_size);
+
+    // the block has to be parsed for its transaction hashes
+    block b;
+    if (!parse_and_validate_block_from_blob(entry.block, b))
+      throw0(DB_ERROR("Failed to parse block from blob retrieved from the db"));
+
+    std::vector<crypto::hash> tx_hashes;
+    tx_hashes.reserve(b.tx_hashes.size() + 1);
+    if (get_output_indices)
+      tx_hashes.push_back(get_transaction_hash(b.miner_tx));
+    tx_hashes.insert(tx_hashes.end(), b.tx_hashes.begin(), b.tx_hashes.end());
+
+    entry.txs.reserve(b.tx_hashes.size());
+    for (size_t i = 0; i < tx_hashes.size(); ++i)
+    {
+      const bool is_miner_tx = get_output_indices && i == 0;
+      MDB_val_set(v, tx_hashes[i]);
+      get_result = mdb_cursor_get(m_cur_tx_indices, (MDB_val *)&zerokval, &v, MDB_GET_BOTH);
+      if (get_result == MDB_NOTFOUND)
+        throw0(TX_DNE(std::string("tx with hash ").append(epee::string_tools::pod_to_hex(tx_hashes[i])).append(" not found in db").c_str()));
+      else if (get_result)
+        throw0(DB_ERROR(lmdb_error("DB error attempting to fetch tx index from hash", get_result).c_str()));
+      const txindex *tip = (const txindex *)v.mv_data;
+      MDB_val_set(val_tx_id, tip->data.tx_id);
+
+      if (!is_miner_tx)
+      {
+        MDB_val tx_blob;
+        get_result = mdb_cursor_get(m_cur_txs, &val_tx_id, &tx_blob, MDB_SET);
+        if (get_result == MDB_NOTFOUND)
+          throw0(TX_DNE(std::string("tx with hash ").append(epee::string_tools::pod_to_hex(tx_hashes[i])).append(" not found in db").c_str()));
+        else if (get_result)
+          throw0(DB_ERROR(lmdb_error("DB error attempting to fetch tx from hash", get_result).c_str()));
+        entry.txs.push_back(blobdata(reinterpret_cast<const char*>(tx_blob.mv_data), tx_blob.mv_size));
+
+        get_result = mdb_cursor_get(m_cur_txs_prunable, &val_tx_id, &tx_blob, MDB_SET);
+        if (get_result == MDB_NOTFOUND)
+          entry.pruned = true;
+        else if (get_result)
+          throw0(DB_ERROR(lmdb_error("DB error attempting to fetch tx prunable data", get_result).c_str()));
+        else
+          entry.txs.back().append(reinterpret_cast<const char*>(tx_blob.mv_data), tx_blob.mv_size);
+      }
+
+      if (get_output_indices)
+      {
+        MDB_val indices;
+        get_result = mdb_cursor_get(m_cur_tx_outputs, &val_tx_id, &indices, MDB_SET);
+        entry.output_indices.push_back(std::vector<uint64_t>());
+        if (get_result == MDB_NOTFOUND)
+          LOG_PRINT_L0("WARNING: Unexpected: tx has no amount indices stored in "
+              "tx_outputs, but it should have an empty entry even if it's a tx without "
+              "outputs");
+        else if (get_result)
+          throw0(DB_ERROR(lmdb_error("DB error attempting to get data for tx_outputs[tx_index]", get_result).c_str()));
+        else
+        {
+          const uint64_t* p = (const uint64_t*)indices.mv_data;
+          entry.output_indices.back().assign(p, p + indices.mv_size / sizeof(uint64_t));
+        }
+      }
+    }
+  }
+
+  TXN_POSTFIX_RDONLY();
+}
+
 crypto::hash BlockchainLMDB::top_block_hash() const
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
@@ -1720,6 +2061,7 @@ bool BlockchainLMDB::tx_exists(const crypto::hash& h) const
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
+  db_op_timer timer(m_op_stats, DB_OP_TX_EXISTS);
 
   TXN_PREFIX_RDONLY();
   RCURSOR(tx_indices);
@@ -1760,6 +2102,7 @@ bool BlockchainLMDB::tx_exists(const crypto::hash& h, uint64_t& tx_id) const
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
+  db_op_timer timer(m_op_stats, DB_OP_TX_EXISTS);
 
   TXN_PREFIX_RDONLY();
   RCURSOR(tx_indices);
@@ -1819,33 +2162,77 @@ transaction BlockchainLMDB::get_tx(const crypto::hash& h) const
   TXN_PREFIX_RDONLY();
   RCURSOR(tx_indices);
   RCURSOR(txs);
+  RCURSOR(txs_prunable);
 
   MDB_val_set(v, h);
-  MDB_val result;
+  MDB_val result, prunable;
+  int prunable_result = MDB_NOTFOUND;
   auto get_result = mdb_cursor_get(m_cur_tx_indices, (MDB_val *)&zerokval, &v, MDB_GET_BOTH);
   if (get_result == 0)
   {
     txindex *tip = (txindex *)v.mv_data;
     MDB_val_set(val_tx_id, tip->data.tx_id);
     get_result = mdb_cursor_get(m_cur_txs, &val_tx_id, &result, MDB_SET);
+    if (get_result == 0)
+      prunable_result = mdb_cursor_get(m_cur_txs_prunable, &val_tx_id, &prunable, MDB_SET);
   }
   if (get_result == MDB_NOTFOUND)
     throw2(TX_DNE(std::string("tx with hash ").append(epee::string_tools::pod_to_hex(h)).append(" not found in db").c_str()));
   else if (get_result)
     throw0(DB_ERROR(lmdb_error("DB error attempting to fetch tx from hash", get_result).c_str()));
+  if (prunable_result && prunable_result != MDB_NOTFOUND)
+    throw0(DB_ERROR(lmdb_error("DB error attempting to fetch tx prunable data", prunable_result).c_str()));
 
   blobdata bd;
   bd.assign(reinterpret_cast<char*>(result.mv_data), result.mv_size);
 
   transaction tx;
-  if (!parse_and_validate_tx_from_blob(bd, tx))
-    throw0(DB_ERROR("Failed to parse tx from blob retrieved from the db"));
+  tx_from_blobs(bd, prunable_result ? NULL : &prunable, tx);
 
   TXN_POSTFIX_RDONLY();
 
   return tx;
 }
 
+bool BlockchainLMDB::get_tx_blob(const crypto::hash& h, blobdata& bd) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  TXN_PREFIX_RDONLY();
+  RCURSOR(tx_indices);
+  RCURSOR(txs);
+  RCURSOR(txs_prunable);
+
+  MDB_val_set(v, h);
+  MDB_val result, prunable;
+  int prunable_result = MDB_NOTFOUND;
+  auto get_result = mdb_cursor_get(m_cur_tx_indices, (MDB_val *)&zerokval, &v, MDB_GET_BOTH);
+  if (get_result == 0)
+  {
+    txindex *tip = (txindex *)v.mv_data;
+    MDB_val_set(val_tx_id, tip->data.tx_id);
+    get_result = mdb_cursor_get(m_cur_txs, &val_tx_id, &result, MDB_SET);
+    if (get_result == 0)
+      prunable_result = mdb_cursor_get(m_cur_txs_prunable, &val_tx_id, &prunable, MDB_SET);
+  }
+  if (get_result == MDB_NOTFOUND)
+    return false;
+  else if (get_result)
+    throw0(DB_ERROR(lmdb_error("DB error attempting to fetch tx from hash", get_result).c_str()));
+  if (prunable_result && prunable_result != MDB_NOTFOUND)
+    throw0(DB_ERROR(lmdb_error("DB error attempting to fetch tx prunable data", prunable_result).c_str()));
+
+  // a pruned tx is returned without its prunable data
+  bd.assign(reinterpret_cast<char*>(result.mv_data), result.mv_size);
+  if (!prunable_result)
+    bd.append(reinterpret_cast<char*>(prunable.mv_data), prunable.mv_size);
+
+  TXN_POSTFIX_RDONLY();
+
+  return true;
+}
+
 uint64_t BlockchainLMDB::get_tx_count() const
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
@@ -1960,8 +2347,9 @@ output_data_t BlockchainLMDB::get_output_key(const uint64_t &global_index) const
   blobdata bd;
   bd.assign(reinterpret_cast<char*>(result.mv_data), result.mv_size);
 
+  // only the outputs are needed, which are never pruned
   transaction tx;
-  if (!parse_and_validate_tx_from_blob(bd, tx))
+  if (!parse_and_validate_tx_base_from_blob(bd, tx))
     throw0(DB_ERROR("Failed to parse tx from blob retrieved from the db"));
 
   const tx_out tx_output = tx.vout[ot->local_index];
@@ -1977,6 +2365,7 @@ output_data_t BlockchainLMDB::get_output_key(const uint64_t& amount, const uint6
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
+  db_op_timer timer(m_op_stats, DB_OP_GET_OUTPUT_KEY);
 
   TXN_PREFIX_RDONLY();
   RCURSOR(output_amounts);
@@ -2083,6 +2472,10 @@ bool BlockchainLMDB::has_key_image(const crypto::key_image& img) const
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
+  db_op_timer timer(m_op_stats, DB_OP_HAS_KEY_IMAGE);
+
+  if (!m_key_image_filter.may_contain(img))
+    return false;
 
   bool ret;
 
@@ -2096,6 +2489,34 @@ bool BlockchainLMDB::has_key_image(const crypto::key_image& img) const
   return ret;
 }
 
+void BlockchainLMDB::load_key_image_filter()
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+  TIME_MEASURE_START(t);
+
+  uint64_t count;
+  {
+    TXN_PREFIX_RDONLY();
+    MDB_stat db_stats;
+    if (auto result = mdb_stat(m_txn, m_spent_keys, &db_stats))
+      throw0(DB_ERROR(lmdb_error("Failed to query m_spent_keys: ", result).c_str()));
+    count = db_stats.ms_entries;
+    TXN_POSTFIX_RDONLY();
+  }
+
+  // sized so the chain can double before false positives pile up, it is
+  // sized again on the next start
+  m_key_image_filter.reset(std::max<uint64_t>(count * 2, KEY_IMAGE_FILTER_MIN_CAPACITY));
+  for_all_key_images([this](const crypto::key_image &k_image) {
+    m_key_image_filter.insert(k_image);
+    return true;
+  });
+
+  TIME_MEASURE_FINISH(t);
+  LOG_PRINT_L1("Loaded " << count << " key images into a " << m_key_image_filter.size() << " byte filter in " << t << " ms");
+}
+
 bool BlockchainLMDB::for_all_key_images(std::function<bool(const crypto::key_image&)> f) const
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
@@ -2177,6 +2598,7 @@ bool BlockchainLMDB::for_all_transactions(std::function<bool(const crypto::hash&
 
   TXN_PREFIX_RDONLY();
   RCURSOR(txs);
+  RCURSOR(txs_prunable);
   RCURSOR(tx_indices);
 
   MDB_val k;
@@ -2204,9 +2626,11 @@ bool BlockchainLMDB::for_all_transactions(std::function<bool(const crypto::hash&
       throw0(DB_ERROR(lmdb_error("Failed to enumerate transactions: ", ret).c_str()));
     blobdata bd;
     bd.assign(reinterpret_cast<char*>(v.mv_data), v.mv_size);
+    ret = mdb_cursor_get(m_cur_txs_prunable, &k, &v, MDB_SET);
+    if (ret && ret != MDB_NOTFOUND)
+      throw0(DB_ERROR(lmdb_error("Failed to enumerate transactions: ", ret).c_str()));
     transaction tx;
-    if (!parse_and_validate_tx_from_blob(bd, tx))
-      throw0(DB_ERROR("Failed to parse tx from blob retrieved from the db"));
+    tx_from_blobs(bd, ret ? NULL : &v, tx);
     if (!f(hash, tx)) {
       ret = false;
       break;
@@ -2304,7 +2728,10 @@ void BlockchainLMDB::batch_commit()
 
   LOG_PRINT_L3("batch transaction: committing...");
   TIME_MEASURE_START(time1);
-  m_write_txn->commit();
+  {
+    db_op_timer timer(m_op_stats, DB_OP_COMMIT);
+    m_write_txn->commit();
+  }
   TIME_MEASURE_FINISH(time1);
   time_commit1 += time1;
   LOG_PRINT_L3("batch transaction: committed");
@@ -2327,7 +2754,20 @@ void BlockchainLMDB::batch_stop()
   check_open();
   LOG_PRINT_L3("batch transaction: committing...");
   TIME_MEASURE_START(time1);
-  m_write_txn->commit();
+  {
+    db_op_timer timer(m_op_stats, DB_OP_COMMIT);
+    try
+    {
+      m_write_txn->commit();
+    }
+    catch (...)
+    {
+      // the txn is gone whether or not the commit got anywhere, so the
+      // batch ends here too, or every later write would go to a dead txn
+      batch_abort();
+      throw;
+    }
+  }
   TIME_MEASURE_FINISH(time1);
   time_commit1 += time1;
   // for destruction of batch transaction
@@ -2350,14 +2790,41 @@ void BlockchainLMDB::batch_abort()
   // for destruction of batch transaction
   m_write_txn = nullptr;
   // explicitly call in case mdb_env_close() (BlockchainLMDB::close()) called before BlockchainLMDB destructor called.
-  m_write_batch_txn->abort();
+  // A failed commit has already freed the txn
+  if (m_write_batch_txn->m_txn)
+    m_write_batch_txn->abort();
   delete m_write_batch_txn;
   m_write_batch_txn = nullptr;
   m_batch_active = false;
   memset(&m_wcursors, 0, sizeof(m_wcursors));
+  // the txs and outputs added in the batch are gone
+  load_counts();
   LOG_PRINT_L3("batch transaction: aborted");
 }
 
+void BlockchainLMDB::load_counts()
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+
+  TXN_PREFIX_RDONLY();
+  MDB_stat db_stats;
+  if (auto result = mdb_stat(m_txn, m_txs, &db_stats))
+    throw0(DB_ERROR(lmdb_error("Failed to query m_txs: ", result).c_str()));
+  m_num_txs = db_stats.ms_entries;
+  if (auto result = mdb_stat(m_txn, m_output_txs, &db_stats))
+    throw0(DB_ERROR(lmdb_error("Failed to query m_output_txs: ", result).c_str()));
+  m_num_outputs = db_stats.ms_entries;
+  TXN_POSTFIX_RDONLY();
+}
+
+bool BlockchainLMDB::can_nest_block_txns() const
+{
+  // LMDB has no nested transactions with a writable map
+  unsigned int flags = 0;
+  mdb_env_get_flags(m_env, &flags);
+  return !(flags & MDB_WRITEMAP);
+}
+
 void BlockchainLMDB::set_batch_transactions(bool batch_transactions)
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
@@ -2460,6 +2927,19 @@ void BlockchainLMDB::block_txn_start(bool readonly)
     }
     memset(&m_wcursors, 0, sizeof(m_wcursors));
   }
+  else if (m_write_txn == m_write_batch_txn && m_writer == boost::this_thread::get_id() && can_nest_block_txns())
+  {
+    // a block in a batch gets a child txn, so if it fails halfway through
+    // it is rolled back alone and the blocks before it stay in the batch
+    mdb_txn_safe *child = new mdb_txn_safe(false);
+    if (auto mdb_res = mdb_txn_begin(m_env, m_write_batch_txn->m_txn, 0, *child))
+    {
+      delete child;
+      throw0(DB_ERROR_TXN_START(lmdb_error("Failed to create a nested transaction for the db: ", mdb_res).c_str()));
+    }
+    m_write_txn = child;
+    memset(&m_wcursors, 0, sizeof(m_wcursors));
+  }
 }
 
 void BlockchainLMDB::block_txn_stop()
@@ -2470,7 +2950,10 @@ void BlockchainLMDB::block_txn_stop()
     if (! m_batch_active)
 	{
       TIME_MEASURE_START(time1);
-      m_write_txn->commit();
+      {
+        db_op_timer timer(m_op_stats, DB_OP_COMMIT);
+        m_write_txn->commit();
+      }
       TIME_MEASURE_FINISH(time1);
       time_commit1 += time1;
 
@@ -2478,6 +2961,23 @@ void BlockchainLMDB::block_txn_stop()
       m_write_txn = nullptr;
       memset(&m_wcursors, 0, sizeof(m_wcursors));
 	}
+    else if (m_write_txn != m_write_batch_txn)
+    {
+      // merges the block into the batch, nothing is written yet
+      mdb_txn_safe *child = m_write_txn;
+      m_write_txn = m_write_batch_txn;
+      memset(&m_wcursors, 0, sizeof(m_wcursors));
+      try
+      {
+        child->commit();
+      }
+      catch (...)
+      {
+        delete child;
+        throw;
+      }
+      delete child;
+    }
   }
   else if (m_tinfo->m_ti_rtxn)
   {
@@ -2497,6 +2997,13 @@ void BlockchainLMDB::block_txn_abort()
       m_write_txn = nullptr;
       memset(&m_wcursors, 0, sizeof(m_wcursors));
     }
+    else if (m_write_txn != m_write_batch_txn)
+    {
+      m_write_txn->abort();
+      delete m_write_txn;
+      m_write_txn = m_write_batch_txn;
+      memset(&m_wcursors, 0, sizeof(m_wcursors));
+    }
   }
   else if (m_tinfo->m_ti_rtxn)
   {
@@ -2607,36 +3114,93 @@ void BlockchainLMDB::get_output_key(const uint64_t &amount, const std::vector<ui
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   TIME_MEASURE_START(db3);
   check_open();
-  outputs.clear();
+  outputs.resize(offsets.size());
+  if (offsets.empty())
+    return;
+  db_op_timer timer(m_op_stats, DB_OP_GET_OUTPUT_KEYS);
+
+  // visit the outputs in index order, so the duplicates list is walked
+  // forward a page at a time instead of being searched for each offset
+  std::vector<size_t> order(offsets.size());
+  for (size_t n = 0; n < order.size(); ++n)
+    order[n] = n;
+  if (!std::is_sorted(offsets.begin(), offsets.end()))
+    std::sort(order.begin(), order.end(), [&offsets](size_t a, size_t b) { return offsets[a] < offsets[b]; });
 
   TXN_PREFIX_RDONLY();
 
   RCURSOR(output_amounts);
 
+  // outputs are appended with consecutive amount indices, so a page of
+  // duplicates covers a contiguous range of them
+  const size_t item_size = amount == 0 ? sizeof(outkey) : sizeof(pre_rct_outkey);
+  const char *page = NULL;
+  size_t page_items = 0;
+  uint64_t page_first = 0;
+  auto find_in_page = [&](uint64_t index) -> const char* {
+    if (!page || index < page_first || index - page_first >= page_items)
+      return NULL;
+    const char *item = page + (index - page_first) * item_size;
+    // amount_index comes first in both layouts
+    return *(const uint64_t *)item == index ? item : NULL;
+  };
+  auto set_page = [&](const MDB_val &v) {
+    page = (const char *)v.mv_data;
+    page_items = v.mv_size / item_size;
+    page_first = page_items ? *(const uint64_t *)page : 0;
+  };
+
   MDB_val_set(k, amount);
-  for (const uint64_t &index : offsets)
+  for (size_t n = 0; n < order.size(); ++n)
   {
-    MDB_val_set(v, index);
+    const uint64_t index = offsets[order[n]];
+    const char *item = find_in_page(index);
 
-    auto get_result = mdb_cursor_get(m_cur_output_amounts, &k, &v, MDB_GET_BOTH);
-    if (get_result == MDB_NOTFOUND)
-      throw1(OUTPUT_DNE((std::string("Attempting to get output pubkey by global index (amount ") + boost::lexical_cast<std::string>(amount) + ", index " + boost::lexical_cast<std::string>(index) + ", count " + boost::lexical_cast<std::string>(get_num_outputs(amount)) + "), but key does not exist").c_str()));
-    else if (get_result)
-      throw0(DB_ERROR(lmdb_error("Error attempting to retrieve an output pubkey from the db", get_result).c_str()));
+    // try the next couple of pages if it's just past this one
+    for (int next = 0; !item && page && next < 2 && index >= page_first + page_items; ++next)
+    {
+      MDB_val nk, v;
+      if (mdb_cursor_get(m_cur_output_amounts, &nk, &v, MDB_NEXT_MULTIPLE))
+        break;
+      set_page(v);
+      item = find_in_page(index);
+    }
 
-    output_data_t data;
+    if (!item)
+    {
+      MDB_val_set(v, index);
+      auto get_result = mdb_cursor_get(m_cur_output_amounts, &k, &v, MDB_GET_BOTH);
+      if (get_result == MDB_NOTFOUND)
+        throw1(OUTPUT_DNE((std::string("Attempting to get output pubkey by global index (amount ") + boost::lexical_cast<std::string>(amount) + ", index " + boost::lexical_cast<std::string>(index) + ", count " + boost::lexical_cast<std::string>(get_num_outputs(amount)) + "), but key does not exist").c_str()));
+      else if (get_result)
+        throw0(DB_ERROR(lmdb_error("Error attempting to retrieve an output pubkey from the db", get_result).c_str()));
+      item = (const char *)v.mv_data;
+
+      get_result = mdb_cursor_get(m_cur_output_amounts, &k, &v, MDB_GET_MULTIPLE);
+      if (get_result)
+        throw0(DB_ERROR(lmdb_error("Error attempting to retrieve output pubkeys from the db", get_result).c_str()));
+      set_page(v);
+
+      // a fresh page was found by searching, so the rest of the outputs
+      // asked for are likely further on: hint the kernel to read ahead,
+      // as the map is opened without read-ahead
+      const uint64_t last = offsets[order.back()];
+      if (last >= page_first + page_items)
+        prefetch_pages(page, (last - page_first - page_items) * item_size);
+    }
+
+    output_data_t &data = outputs[order[n]];
     if (amount == 0)
     {
-      const outkey *okp = (const outkey *)v.mv_data;
+      const outkey *okp = (const outkey *)item;
       data = okp->data;
     }
     else
     {
-      const pre_rct_outkey *okp = (const pre_rct_outkey *)v.mv_data;
+      const pre_rct_outkey *okp = (const pre_rct_outkey *)item;
       memcpy(&data, &okp->data, sizeof(pre_rct_output_data_t));
       data.commitment = rct::zeroCommit(amount);
     }
-    outputs.push_back(data);
   }
 
   TXN_POSTFIX_RDONLY();
@@ -2733,35 +3297,39 @@ std::map<uint64_t, std::tuple<uint64_t, uint64_t, uint64_t>> BlockchainLMDB::get
   }
 
   if (unlocked || recent_cutoff > 0) {
+    // outputs are unlocked in blocks below unlocked_height, as for
+    // Blockchain::get_num_unlocked_outputs
     const uint64_t blockchain_height = height();
-    for (std::map<uint64_t, std::tuple<uint64_t, uint64_t, uint64_t>>::iterator i = histogram.begin(); i != histogram.end(); ++i) {
-      uint64_t amount = i->first;
-      uint64_t num_elems = std::get<0>(i->second);
-      while (num_elems > 0) {
-        const tx_out_index toi = get_output_tx_and_index(amount, num_elems - 1);
-        const uint64_t height = get_tx_block_height(toi.first);
-        if (height + CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE <= blockchain_height)
-          break;
-        --num_elems;
-      }
-      // modifying second does not invalidate the iterator
-      std::get<1>(i->second) = num_elems;
+    const uint64_t unlocked_height = blockchain_height > CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE ?
+        blockchain_height - CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE : 0;
 
-      if (recent_cutoff > 0)
+    // outputs are recent from the first block at or after the cutoff;
+    // block timestamps are only roughly ordered, which is near enough here
+    uint64_t recent_height = unlocked_height;
+    if (recent_cutoff > 0)
+    {
+      uint64_t lo = 0, hi = unlocked_height;
+      while (lo < hi)
       {
-        uint64_t recent = 0;
-        while (num_elems > 0) {
-          const tx_out_index toi = get_output_tx_and_index(amount, num_elems - 1);
-          const uint64_t height = get_tx_block_height(toi.first);
-          const uint64_t ts = get_block_timestamp(height);
-          if (ts < recent_cutoff)
-            break;
-          --num_elems;
-          ++recent;
-        }
-        // modifying second does not invalidate the iterator
-        std::get<2>(i->second) = recent;
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (get_block_timestamp(mid) < recent_cutoff)
+          lo = mid + 1;
+        else
+          hi = mid;
       }
+      recent_height = lo;
+    }
+
+    // both are then counts of outputs below a height, binary searched
+    for (std::map<uint64_t, std::tuple<uint64_t, uint64_t, uint64_t>>::iterator i = histogram.begin(); i != histogram.end(); ++i) {
+      const uint64_t amount = i->first;
+      if (std::get<0>(i->second) == 0)
+        continue;
+      const uint64_t num_unlocked = get_num_outputs_below_height(amount, unlocked_height);
+      // modifying second does not invalidate the iterator
+      std::get<1>(i->second) = num_unlocked;
+      if (recent_cutoff > 0)
+        std::get<2>(i->second) = num_unlocked - std::min(num_unlocked, get_num_outputs_below_height(amount, recent_height));
     }
   }
 
@@ -2770,31 +3338,149 @@ std::map<uint64_t, std::tuple<uint64_t, uint64_t, uint64_t>> BlockchainLMDB::get
   return histogram;
 }
 
-void BlockchainLMDB::check_hard_fork_info()
-{
-}
-
-void BlockchainLMDB::drop_hard_fork_info()
+uint64_t BlockchainLMDB::get_num_outputs_below_height(const uint64_t& amount, const uint64_t& height) const
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
 
-  TXN_PREFIX(0);
-
-  mdb_drop(*txn_ptr, m_hf_starting_heights, 1);
-  mdb_drop(*txn_ptr, m_hf_versions, 1);
-
-  TXN_POSTFIX_SUCCESS();
-}
-
-void BlockchainLMDB::set_hard_fork_version(uint64_t height, uint8_t version)
-{
-  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
-  check_open();
+  if (height == 0)
+    return 0;
 
-  TXN_BLOCK_PREFIX(0);
+  TXN_PREFIX_RDONLY();
+  uint64_t ret = 0;
 
-  MDB_val_copy<uint64_t> val_key(height);
+  if (amount == 0)
+  {
+    // RingCT outputs are counted per block, so this is a single lookup
+    RCURSOR(block_info);
+    MDB_stat db_stats;
+    int result = mdb_stat(m_txn, m_blocks, &db_stats);
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to query m_blocks: ", result).c_str()));
+    if (db_stats.ms_entries > 0)
+    {
+      MDB_val_copy<uint64_t> k(std::min<uint64_t>(height, db_stats.ms_entries) - 1);
+      MDB_val v = k;
+      result = mdb_cursor_get(m_cur_block_info, (MDB_val *)&zerokval, &v, MDB_GET_BOTH);
+      if (result)
+        throw0(DB_ERROR(lmdb_error("Error attempting to retrieve block info from the db: ", result).c_str()));
+      ret = ((const mdb_block_info *)v.mv_data)->bi_cum_rct;
+    }
+  }
+  else
+  {
+    // outputs of an amount are appended in block order, so their heights
+    // never decrease with the amount index; find the first one in a block
+    // at height, remembering output heights are one past their block's
+    RCURSOR(output_amounts);
+    MDB_val_copy<uint64_t> k(amount);
+    MDB_val v;
+    int result = mdb_cursor_get(m_cur_output_amounts, &k, &v, MDB_SET);
+    if (result == MDB_SUCCESS)
+    {
+      mdb_size_t num_elems = 0;
+      mdb_cursor_count(m_cur_output_amounts, &num_elems);
+      uint64_t lo = 0, hi = num_elems;
+      while (lo < hi)
+      {
+        uint64_t mid = lo + (hi - lo) / 2;
+        MDB_val_set(vi, mid);
+        result = mdb_cursor_get(m_cur_output_amounts, &k, &vi, MDB_GET_BOTH);
+        if (result)
+          throw0(DB_ERROR(lmdb_error("Error attempting to retrieve an output from the db: ", result).c_str()));
+        const pre_rct_outkey *ok = (const pre_rct_outkey *)vi.mv_data;
+        if (ok->data.height <= height)
+          lo = mid + 1;
+        else
+          hi = mid;
+      }
+      ret = lo;
+    }
+    else if (result != MDB_NOTFOUND)
+      throw0(DB_ERROR(lmdb_error("DB error attempting to get number of outputs of an amount: ", result).c_str()));
+  }
+
+  TXN_POSTFIX_RDONLY();
+
+  return ret;
+}
+
+void BlockchainLMDB::get_output_distribution(const uint64_t& amount, const uint64_t& from_height, const uint64_t& to_height, std::vector<uint64_t>& distribution, uint64_t& base) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  distribution.clear();
+  base = get_num_outputs_below_height(amount, from_height);
+  if (from_height > to_height)
+    return;
+
+  TXN_PREFIX_RDONLY();
+  distribution.reserve(to_height - from_height + 1);
+
+  if (amount == 0)
+  {
+    // the per-block RingCT counts are the distribution already
+    std::vector<block_info_t> infos;
+    get_block_info_range(from_height, to_height, infos, BI_CUMULATIVE_RCT_OUTPUTS);
+    for (const auto &bi: infos)
+      distribution.push_back(bi.cumulative_rct_outputs);
+  }
+  else
+  {
+    // count the outputs in each block, starting from the first one at
+    // from_height, then accumulate; output heights are one past their block's
+    distribution.resize(to_height - from_height + 1, 0);
+    RCURSOR(output_amounts);
+    MDB_val_copy<uint64_t> k(amount);
+    MDB_val_set(v, base);
+    int result = mdb_cursor_get(m_cur_output_amounts, &k, &v, MDB_GET_BOTH);
+    while (result == MDB_SUCCESS)
+    {
+      const pre_rct_outkey *ok = (const pre_rct_outkey *)v.mv_data;
+      if (ok->data.height - 1 > to_height)
+        break;
+      ++distribution[ok->data.height - 1 - from_height];
+      result = mdb_cursor_get(m_cur_output_amounts, &k, &v, MDB_NEXT_DUP);
+    }
+    if (result && result != MDB_NOTFOUND)
+      throw0(DB_ERROR(lmdb_error("Error attempting to retrieve an output from the db: ", result).c_str()));
+    uint64_t total = base;
+    for (auto &n: distribution)
+    {
+      total += n;
+      n = total;
+    }
+  }
+
+  TXN_POSTFIX_RDONLY();
+}
+
+void BlockchainLMDB::check_hard_fork_info()
+{
+}
+
+void BlockchainLMDB::drop_hard_fork_info()
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  TXN_PREFIX(0);
+
+  mdb_drop(*txn_ptr, m_hf_starting_heights, 1);
+  mdb_drop(*txn_ptr, m_hf_versions, 1);
+
+  TXN_POSTFIX_SUCCESS();
+}
+
+void BlockchainLMDB::set_hard_fork_version(uint64_t height, uint8_t version)
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  TXN_BLOCK_PREFIX(0);
+
+  MDB_val_copy<uint64_t> val_key(height);
   MDB_val_copy<uint8_t> val_value(version);
   int result;
   result = mdb_put(*txn_ptr, m_hf_versions, &val_key, &val_value, MDB_APPEND);
@@ -2825,6 +3511,424 @@ uint8_t BlockchainLMDB::get_hard_fork_version(uint64_t height) const
   return ret;
 }
 
+void BlockchainLMDB::add_alt_block(const crypto::hash &blkid, const alt_block_data_t &data, const blobdata &blob)
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  TXN_BLOCK_PREFIX(0);
+
+  std::string value(sizeof(data) + blob.size(), '\0');
+  memcpy(&value[0], &data, sizeof(data));
+  memcpy(&value[sizeof(data)], blob.data(), blob.size());
+
+  MDB_val_set(val_key, blkid);
+  MDB_val val_value = {value.size(), (void *)value.data()};
+  if (auto result = mdb_put(*txn_ptr, m_alt_blocks, &val_key, &val_value, 0))
+    throw1(DB_ERROR(lmdb_error("Error adding alternative block to db transaction: ", result).c_str()));
+
+  TXN_BLOCK_POSTFIX_SUCCESS();
+}
+
+void BlockchainLMDB::remove_alt_block(const crypto::hash &blkid)
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  TXN_BLOCK_PREFIX(0);
+
+  MDB_val_set(val_key, blkid);
+  auto result = mdb_del(*txn_ptr, m_alt_blocks, &val_key, NULL);
+  if (result && result != MDB_NOTFOUND)
+    throw1(DB_ERROR(lmdb_error("Error removing alternative block from db transaction: ", result).c_str()));
+
+  TXN_BLOCK_POSTFIX_SUCCESS();
+}
+
+void BlockchainLMDB::drop_alt_blocks()
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  TXN_PREFIX(0);
+
+  if (auto result = mdb_drop(*txn_ptr, m_alt_blocks, 0))
+    throw1(DB_ERROR(lmdb_error("Error dropping alternative blocks: ", result).c_str()));
+
+  TXN_POSTFIX_SUCCESS();
+}
+
+bool BlockchainLMDB::for_all_alt_blocks(std::function<bool(const crypto::hash&, const alt_block_data_t&, const blobdata&)> f) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  // the table is not opened in read-only mode
+  if (is_read_only())
+    return true;
+
+  TXN_PREFIX_RDONLY();
+  RCURSOR(alt_blocks);
+
+  MDB_val k;
+  MDB_val v;
+  bool ret = true;
+
+  MDB_cursor_op op = MDB_FIRST;
+  while (1)
+  {
+    int result = mdb_cursor_get(m_cur_alt_blocks, &k, &v, op);
+    op = MDB_NEXT;
+    if (result == MDB_NOTFOUND)
+      break;
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to enumerate alternative blocks: ", result).c_str()));
+    if (k.mv_size != sizeof(crypto::hash) || v.mv_size < sizeof(alt_block_data_t))
+      throw0(DB_ERROR("Unexpected alternative block record size"));
+
+    const crypto::hash blkid = *(const crypto::hash*)k.mv_data;
+    const alt_block_data_t data = *(const alt_block_data_t*)v.mv_data;
+    blobdata blob((const char*)v.mv_data + sizeof(alt_block_data_t), v.mv_size - sizeof(alt_block_data_t));
+    if (!f(blkid, data, blob)) {
+      ret = false;
+      break;
+    }
+  }
+
+  TXN_POSTFIX_RDONLY();
+
+  return ret;
+}
+
+bool BlockchainLMDB::has_txpool_storage() const
+{
+  // the tables are not opened in read-only mode
+  return !is_read_only();
+}
+
+void BlockchainLMDB::add_txpool_tx(const crypto::hash &txid, const txpool_tx_meta_t &meta, const blobdata &blob)
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  TXN_POOL_PREFIX(0);
+
+  MDB_val_set(k, txid);
+  MDB_val v = {sizeof(meta), (void *)&meta};
+  if (auto result = mdb_put(*txn_ptr, m_txpool_meta, &k, &v, 0))
+    throw1(DB_ERROR(lmdb_error("Error adding txpool tx metadata to db transaction: ", result).c_str()));
+  MDB_val_copy<blobdata> vblob(blob);
+  if (auto result = mdb_put(*txn_ptr, m_txpool_blob, &k, &vblob, 0))
+    throw1(DB_ERROR(lmdb_error("Error adding txpool tx blob to db transaction: ", result).c_str()));
+
+  TXN_POOL_POSTFIX_SUCCESS();
+}
+
+void BlockchainLMDB::update_txpool_tx(const crypto::hash &txid, const txpool_tx_meta_t &meta)
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  TXN_POOL_PREFIX(0);
+
+  MDB_val_set(k, txid);
+  MDB_val v;
+  auto result = mdb_get(*txn_ptr, m_txpool_meta, &k, &v);
+  if (result == MDB_NOTFOUND)
+    throw1(DB_ERROR("Attempting to update txpool tx metadata that's not in the db"));
+  if (result)
+    throw1(DB_ERROR(lmdb_error("Error finding txpool tx meta to update: ", result).c_str()));
+  v = {sizeof(meta), (void *)&meta};
+  if (auto result = mdb_put(*txn_ptr, m_txpool_meta, &k, &v, 0))
+    throw1(DB_ERROR(lmdb_error("Error updating txpool tx metadata in db transaction: ", result).c_str()));
+
+  TXN_POOL_POSTFIX_SUCCESS();
+}
+
+void BlockchainLMDB::remove_txpool_tx(const crypto::hash &txid)
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  TXN_POOL_PREFIX(0);
+
+  MDB_val_set(k, txid);
+  auto result = mdb_del(*txn_ptr, m_txpool_meta, &k, NULL);
+  if (result && result != MDB_NOTFOUND)
+    throw1(DB_ERROR(lmdb_error("Error removing txpool tx metadata from db transaction: ", result).c_str()));
+  result = mdb_del(*txn_ptr, m_txpool_blob, &k, NULL);
+  if (result && result != MDB_NOTFOUND)
+    throw1(DB_ERROR(lmdb_error("Error removing txpool tx blob from db transaction: ", result).c_str()));
+
+  TXN_POOL_POSTFIX_SUCCESS();
+}
+
+void BlockchainLMDB::drop_txpool()
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  TXN_POOL_PREFIX(0);
+
+  if (auto result = mdb_drop(*txn_ptr, m_txpool_meta, 0))
+    throw1(DB_ERROR(lmdb_error("Error dropping txpool tx metadata: ", result).c_str()));
+  if (auto result = mdb_drop(*txn_ptr, m_txpool_blob, 0))
+    throw1(DB_ERROR(lmdb_error("Error dropping txpool tx blobs: ", result).c_str()));
+
+  TXN_POOL_POSTFIX_SUCCESS();
+}
+
+uint64_t BlockchainLMDB::get_txpool_tx_count() const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  if (is_read_only())
+    return 0;
+
+  TXN_PREFIX_RDONLY();
+
+  MDB_stat db_stats;
+  if (auto result = mdb_stat(m_txn, m_txpool_meta, &db_stats))
+    throw0(DB_ERROR(lmdb_error("Failed to query m_txpool_meta: ", result).c_str()));
+
+  TXN_POSTFIX_RDONLY();
+
+  return db_stats.ms_entries;
+}
+
+bool BlockchainLMDB::for_all_txpool_txes(std::function<bool(const crypto::hash&, const txpool_tx_meta_t&, const blobdata&)> f) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  if (is_read_only())
+    return true;
+
+  TXN_PREFIX_RDONLY();
+  RCURSOR(txpool_meta);
+
+  MDB_val k;
+  MDB_val v;
+  bool ret = true;
+
+  MDB_cursor_op op = MDB_FIRST;
+  while (1)
+  {
+    int result = mdb_cursor_get(m_cur_txpool_meta, &k, &v, op);
+    op = MDB_NEXT;
+    if (result == MDB_NOTFOUND)
+      break;
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to enumerate txpool tx metadata: ", result).c_str()));
+    if (k.mv_size != sizeof(crypto::hash) || v.mv_size != sizeof(txpool_tx_meta_t))
+      throw0(DB_ERROR("Unexpected txpool tx metadata record size"));
+
+    const crypto::hash txid = *(const crypto::hash*)k.mv_data;
+    const txpool_tx_meta_t meta = *(const txpool_tx_meta_t*)v.mv_data;
+
+    MDB_val vblob;
+    result = mdb_get(m_txn, m_txpool_blob, &k, &vblob);
+    if (result == MDB_NOTFOUND)
+      throw0(DB_ERROR("Failed to find txpool tx blob to match metadata"));
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to enumerate txpool tx blob: ", result).c_str()));
+    blobdata blob((const char*)vblob.mv_data, vblob.mv_size);
+    if (!f(txid, meta, blob)) {
+      ret = false;
+      break;
+    }
+  }
+
+  TXN_POSTFIX_RDONLY();
+
+  return ret;
+}
+
+uint64_t BlockchainLMDB::prune_blockchain(uint64_t keep_blocks)
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  const uint64_t m_height = height();
+  if (m_height <= keep_blocks)
+    return 0;
+  const uint64_t prune_height = m_height - keep_blocks;
+  const uint64_t max_blocks_per_txn = 1000;
+
+  MDB_val_copy<const char*> k("pruned_height");
+  uint64_t num_pruned = 0;
+  while (1)
+  {
+    if (!m_batch_active && !m_write_txn && need_resize())
+    {
+      LOG_PRINT_L0("LMDB memory map needs to be resized, doing that now.");
+      do_resize();
+    }
+
+    TXN_BLOCK_PREFIX(0);
+
+    // blocks below this height have been pruned already
+    uint64_t pruned_height = 0;
+    MDB_val v;
+    int result = mdb_get(*txn_ptr, m_properties, &k, &v);
+    if (result == 0)
+      pruned_height = *(const uint64_t*)v.mv_data;
+    else if (result != MDB_NOTFOUND)
+      throw0(DB_ERROR(lmdb_error("Failed to get pruned height: ", result).c_str()));
+    if (pruned_height >= prune_height)
+      break;
+
+    // a long catch up is split over several txns, unless we're in a batch
+    uint64_t end_height = prune_height;
+    if (txn_ptr == &auto_txn && end_height - pruned_height > max_blocks_per_txn)
+      end_height = pruned_height + max_blocks_per_txn;
+    if (end_height - pruned_height > 1)
+      LOG_PRINT_L1("Pruning blocks " << pruned_height << " to " << end_height - 1 << " of " << prune_height);
+
+    MDB_cursor *c_tx_indices;
+    result = mdb_cursor_open(*txn_ptr, m_tx_indices, &c_tx_indices);
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to open a cursor for tx_indices: ", result).c_str()));
+
+    for (uint64_t h = pruned_height; h < end_height; ++h)
+    {
+      MDB_val_copy<uint64_t> val_height(h);
+      result = mdb_get(*txn_ptr, m_blocks, &val_height, &v);
+      if (result)
+        throw0(DB_ERROR(lmdb_error("Failed to get block for pruning: ", result).c_str()));
+      block b;
+      if (!parse_and_validate_block_from_blob(blobdata((const char*)v.mv_data, v.mv_size), b))
+        throw0(DB_ERROR("Failed to parse block from blob retrieved from the db"));
+
+      // the miner tx has nothing prunable
+      for (const crypto::hash &tx_hash: b.tx_hashes)
+      {
+        MDB_val_set(val_h, tx_hash);
+        result = mdb_cursor_get(c_tx_indices, (MDB_val *)&zerokval, &val_h, MDB_GET_BOTH);
+        if (result)
+          throw0(DB_ERROR(lmdb_error(std::string("Failed to get tx index for pruning tx ") + epee::string_tools::pod_to_hex(tx_hash) + ": ", result).c_str()));
+        const txindex *tip = (const txindex *)val_h.mv_data;
+        MDB_val_copy<uint64_t> val_tx_id(tip->data.tx_id);
+        result = mdb_get(*txn_ptr, m_txs_prunable, &val_tx_id, &v);
+        if (result == MDB_NOTFOUND)
+          continue;
+        if (result)
+          throw0(DB_ERROR(lmdb_error("Failed to get tx prunable data: ", result).c_str()));
+        // empty entries are kept, a missing one is what marks a tx as pruned
+        if (v.mv_size == 0)
+          continue;
+        result = mdb_del(*txn_ptr, m_txs_prunable, &val_tx_id, NULL);
+        if (result)
+          throw0(DB_ERROR(lmdb_error("Failed to delete tx prunable data: ", result).c_str()));
+        ++num_pruned;
+      }
+    }
+    mdb_cursor_close(c_tx_indices);
+
+    MDB_val_copy<uint64_t> val_pruned_height(end_height);
+    result = mdb_put(*txn_ptr, m_properties, &k, &val_pruned_height, 0);
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to update pruned height: ", result).c_str()));
+
+    TXN_BLOCK_POSTFIX_SUCCESS();
+  }
+
+  return num_pruned;
+}
+
+void BlockchainLMDB::get_stats(db_stats_t& stats) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  BlockchainDB::get_stats(stats);
+
+  MDB_envinfo mei;
+  mdb_env_info(m_env, &mei);
+  MDB_stat mst;
+  mdb_env_stat(m_env, &mst);
+  stats.page_size = mst.ms_psize;
+  stats.map_size = mei.me_mapsize;
+  stats.map_used = (mei.me_last_pgno + 1) * (uint64_t)mst.ms_psize;
+  stats.max_readers = mei.me_maxreaders;
+  stats.num_resizes = m_num_resizes;
+  stats.resize_time_us = m_resize_time_us;
+
+  // a header line comes first, then a line per reader slot held, or else a
+  // single line saying there is none
+  uint64_t lines = 0;
+  mdb_reader_list(m_env, [](const char *msg, void *ctx) { ++*(uint64_t*)ctx; return 0; }, &lines);
+  stats.readers_used = lines > 0 ? lines - 1 : 0;
+
+  std::vector<std::pair<const char*, MDB_dbi>> tables = {
+    {LMDB_BLOCKS, m_blocks},
+    {LMDB_BLOCK_HEIGHTS, m_block_heights},
+    {LMDB_BLOCK_INFO, m_block_info},
+    {LMDB_TXS, m_txs},
+    {LMDB_TXS_PRUNABLE, m_txs_prunable},
+    {LMDB_TX_INDICES, m_tx_indices},
+    {LMDB_TX_OUTPUTS, m_tx_outputs},
+    {LMDB_OUTPUT_TXS, m_output_txs},
+    {LMDB_OUTPUT_AMOUNTS, m_output_amounts},
+    {LMDB_SPENT_KEYS, m_spent_keys},
+    {LMDB_HF_VERSIONS, m_hf_versions},
+    {LMDB_PROPERTIES, m_properties},
+  };
+  // these aren't opened when the db is read-only
+  if (!is_read_only())
+  {
+    tables.push_back({LMDB_ALT_BLOCKS, m_alt_blocks});
+    tables.push_back({LMDB_TXPOOL_META, m_txpool_meta});
+    tables.push_back({LMDB_TXPOOL_BLOB, m_txpool_blob});
+  }
+
+  TXN_PREFIX_RDONLY();
+
+  stats.tables.reserve(tables.size());
+  for (const auto &table: tables)
+  {
+    MDB_stat ts;
+    if (auto result = mdb_stat(m_txn, table.second, &ts))
+      throw0(DB_ERROR(lmdb_error(std::string("Failed to query ") + table.first + ": ", result).c_str()));
+    db_table_stats_t t;
+    t.name = table.first;
+    t.entries = ts.ms_entries;
+    t.depth = ts.ms_depth;
+    t.branch_pages = ts.ms_branch_pages;
+    t.leaf_pages = ts.ms_leaf_pages;
+    t.overflow_pages = ts.ms_overflow_pages;
+    stats.tables.push_back(std::move(t));
+  }
+
+  TXN_POSTFIX_RDONLY();
+}
+
+bool BlockchainLMDB::copy(const std::string& path, bool compact) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  boost::filesystem::path direc(path);
+  if (boost::filesystem::exists(direc))
+  {
+    if (!boost::filesystem::is_directory(direc))
+      throw0(DB_ERROR("LMDB needs a directory path, but a file was passed"));
+  }
+  else
+  {
+    if (!boost::filesystem::create_directories(direc))
+      throw0(DB_ERROR(std::string("Failed to create directory ").append(path).c_str()));
+  }
+
+  // mdb_env_copy2 reads from a txn of its own, which the map may not be
+  // resized under, so it's counted with ours: a resize waits for the copy
+  mdb_txn_safe copy_txn;
+  if (auto result = mdb_env_copy2(m_env, path.c_str(), compact ? MDB_CP_COMPACT : 0))
+    throw0(DB_ERROR(lmdb_error(std::string("Failed to copy the db to ") + path + ": ", result).c_str()));
+  return true;
+}
+
 bool BlockchainLMDB::is_read_only() const
 {
   unsigned int flags;
@@ -3064,6 +4168,7 @@ void BlockchainLMDB::migrate_0_1()
       if (result)
         throw0(DB_ERROR(lmdb_error("Failed to get a record from block_timestamps: ", result).c_str()));
       bi.bi_timestamp = *(uint64_t *)v.mv_data;
+      bi.bi_cum_rct = 0;  // filled in by migrate_2_3
       result = mdb_cursor_put(c_cur, (MDB_val *)&zerokval, &nv, MDB_APPENDDUP);
       if (result)
         throw0(DB_ERROR(lmdb_error("Failed to put a record into block_info: ", result).c_str()));
@@ -3395,11 +4500,252 @@ void BlockchainLMDB::migrate_0_1()
   txn.commit();
 }
 
+void BlockchainLMDB::migrate_1_2()
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  uint64_t i, z;
+  int result;
+  mdb_txn_safe txn(false);
+  MDB_val k, v;
+  blobdata bd;
+
+  LOG_PRINT_YELLOW("Migrating blockchain from DB version 1 to 2 - this may take a while:", LOG_LEVEL_0);
+  LOG_PRINT_L0("moving prunable tx data from the txs table to txs_prunable...");
+
+  result = mdb_txn_begin(m_env, NULL, 0, txn);
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the db: ", result).c_str()));
+  MDB_stat ms;
+  mdb_stat(txn, m_txs, &ms);
+  z = ms.ms_entries;
+  txn.abort();
+
+  // every migrated tx gets a txs_prunable entry, so the last one there is
+  // where to pick up after an interruption
+  i = 0;
+  while (1)
+  {
+    if (need_resize())
+    {
+      LOG_PRINT_L0("LMDB memory map needs to be resized, doing that now.");
+      do_resize();
+    }
+
+    result = mdb_txn_begin(m_env, NULL, 0, txn);
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the db: ", result).c_str()));
+
+    MDB_cursor *c_txs, *c_prunable;
+    result = mdb_cursor_open(txn, m_txs, &c_txs);
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to open a cursor for txs: ", result).c_str()));
+    result = mdb_cursor_open(txn, m_txs_prunable, &c_prunable);
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to open a cursor for txs_prunable: ", result).c_str()));
+
+    uint64_t tx_id = 0;
+    result = mdb_cursor_get(c_prunable, &k, &v, MDB_LAST);
+    if (result == 0)
+      tx_id = *(const uint64_t *)k.mv_data + 1;
+    else if (result != MDB_NOTFOUND)
+      throw0(DB_ERROR(lmdb_error("Failed to get a record from txs_prunable: ", result).c_str()));
+    i = tx_id;
+
+    MDB_val_set(val_tx_id, tx_id);
+    MDB_cursor_op op = MDB_SET_RANGE;
+    uint64_t n;
+    for (n = 0; n < 1000; ++n)
+    {
+      result = mdb_cursor_get(c_txs, &val_tx_id, &v, op);
+      op = MDB_NEXT;
+      if (result == MDB_NOTFOUND)
+        break;
+      if (result)
+        throw0(DB_ERROR(lmdb_error("Failed to get a record from txs: ", result).c_str()));
+
+      const uint64_t cur_tx_id = *(const uint64_t *)val_tx_id.mv_data;
+      MDB_val_set(val_key, cur_tx_id);
+      bd.assign(reinterpret_cast<char*>(v.mv_data), v.mv_size);
+      size_t pruned_size;
+      if (!get_pruned_tx_blob_size(bd, pruned_size))
+        throw0(DB_ERROR("Failed to parse tx from blob retrieved from the db"));
+
+      MDB_val prunable = {bd.size() - pruned_size, (void *)(bd.data() + pruned_size)};
+      result = mdb_cursor_put(c_prunable, &val_key, &prunable, MDB_APPEND);
+      if (result)
+        throw0(DB_ERROR(lmdb_error("Failed to put a record into txs_prunable: ", result).c_str()));
+      if (pruned_size < bd.size())
+      {
+        MDB_val pruned = {pruned_size, (void *)bd.data()};
+        result = mdb_cursor_put(c_txs, &val_key, &pruned, MDB_CURRENT);
+        if (result)
+          throw0(DB_ERROR(lmdb_error("Failed to update a record in txs: ", result).c_str()));
+      }
+    }
+    txn.commit();
+    i += n;
+    LOGIF(1) {
+      std::cout << i << " / " << z << "  \r" << std::flush;
+    }
+    if (n < 1000)
+      break;
+  }
+
+  uint32_t version = 2;
+  v.mv_data = (void *)&version;
+  v.mv_size = sizeof(version);
+  MDB_val_copy<const char *> vk("version");
+  result = mdb_txn_begin(m_env, NULL, 0, txn);
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the db: ", result).c_str()));
+  result = mdb_put(txn, m_properties, &vk, &v, 0);
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to update version for the db: ", result).c_str()));
+  txn.commit();
+}
+
+void BlockchainLMDB::migrate_2_3()
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  uint64_t i, z, m_height;
+  int result;
+  mdb_txn_safe txn(false);
+  MDB_val k, v;
+
+  // the block_info layout before bi_cum_rct was added
+  typedef struct mdb_block_info_2
+  {
+    uint64_t bi_height;
+    uint64_t bi_timestamp;
+    uint64_t bi_coins;
+    uint64_t bi_size;
+    difficulty_type bi_diff;
+    crypto::hash bi_hash;
+  } mdb_block_info_2;
+
+  LOG_PRINT_YELLOW("Migrating blockchain from DB version 2 to 3 - this may take a while:", LOG_LEVEL_0);
+  LOG_PRINT_L0("counting RingCT outputs per block...");
+
+  if (need_resize())
+  {
+    LOG_PRINT_L0("LMDB memory map needs to be resized, doing that now.");
+    do_resize();
+  }
+
+  result = mdb_txn_begin(m_env, NULL, 0, txn);
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the db: ", result).c_str()));
+  MDB_stat ms;
+  mdb_stat(txn, m_blocks, &ms);
+  m_height = ms.ms_entries;
+
+  // RingCT outputs all live under amount 0, with the height after their block's
+  std::vector<uint64_t> num_rct_outs(m_height, 0);
+  MDB_cursor *c_amounts, *c_info, *c_infn;
+  result = mdb_cursor_open(txn, m_output_amounts, &c_amounts);
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to open a cursor for output_amounts: ", result).c_str()));
+  uint64_t amount = 0;
+  MDB_val_set(val_amount, amount);
+  result = mdb_cursor_get(c_amounts, &val_amount, &v, MDB_SET);
+  while (result == MDB_SUCCESS)
+  {
+    const outkey *ok = (const outkey *)v.mv_data;
+    if (ok->data.height == 0 || ok->data.height > m_height)
+      throw0(DB_ERROR("Output height is outside the chain"));
+    ++num_rct_outs[ok->data.height - 1];
+    result = mdb_cursor_get(c_amounts, &val_amount, &v, MDB_NEXT_DUP);
+  }
+  if (result != MDB_NOTFOUND)
+    throw0(DB_ERROR(lmdb_error("Failed to get a record from output_amounts: ", result).c_str()));
+  mdb_cursor_close(c_amounts);
+
+  // block_info is DUPFIXED, so the wider records go to a scratch table
+  // and are copied back once the old ones are gone
+  LOG_PRINT_L0("rewriting block_info...");
+  MDB_dbi infn;
+  lmdb_db_open(txn, "block_infn", MDB_INTEGERKEY | MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED, infn, "Failed to open db handle for block_infn");
+  mdb_set_dupsort(txn, infn, compare_uint64);
+  result = mdb_cursor_open(txn, m_block_info, &c_info);
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to open a cursor for block_info: ", result).c_str()));
+  result = mdb_cursor_open(txn, infn, &c_infn);
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to open a cursor for block_infn: ", result).c_str()));
+
+  uint64_t cum_rct = 0;
+  z = m_height;
+  MDB_cursor_op op = MDB_FIRST;
+  for (i = 0; ; ++i)
+  {
+    result = mdb_cursor_get(c_info, &k, &v, op);
+    op = MDB_NEXT;
+    if (result == MDB_NOTFOUND)
+      break;
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to get a record from block_info: ", result).c_str()));
+    if (v.mv_size < sizeof(mdb_block_info_2))
+      throw0(DB_ERROR("Unexpected block_info record size"));
+    mdb_block_info bi;
+    memcpy(&bi, v.mv_data, sizeof(mdb_block_info_2));
+    if (bi.bi_height != i)
+      throw0(DB_ERROR("Unexpected height in block info table"));
+    cum_rct += num_rct_outs[i];
+    bi.bi_cum_rct = cum_rct;
+    MDB_val_set(nv, bi);
+    result = mdb_cursor_put(c_infn, (MDB_val *)&zerokval, &nv, MDB_APPENDDUP);
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to put a record into block_infn: ", result).c_str()));
+    if (!(i % 10000)) {
+      LOGIF(1) {
+        std::cout << i << " / " << z << "  \r" << std::flush;
+      }
+    }
+  }
+  if (i != m_height)
+    throw0(DB_ERROR("block_info does not match the number of blocks"));
+
+  result = mdb_drop(txn, m_block_info, 0);
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to empty block_info: ", result).c_str()));
+  op = MDB_FIRST;
+  while (1)
+  {
+    result = mdb_cursor_get(c_infn, &k, &v, op);
+    op = MDB_NEXT;
+    if (result == MDB_NOTFOUND)
+      break;
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to get a record from block_infn: ", result).c_str()));
+    result = mdb_cursor_put(c_info, (MDB_val *)&zerokval, &v, MDB_APPENDDUP);
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to put a record into block_info: ", result).c_str()));
+  }
+  mdb_cursor_close(c_infn);
+  mdb_cursor_close(c_info);
+  result = mdb_drop(txn, infn, 1);
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to delete block_infn from the db: ", result).c_str()));
+
+  uint32_t version = 3;
+  v.mv_data = (void *)&version;
+  v.mv_size = sizeof(version);
+  MDB_val_copy<const char *> vk("version");
+  result = mdb_put(txn, m_properties, &vk, &v, 0);
+  if (result)
+    throw0(DB_ERROR(lmdb_error("Failed to update version for the db: ", result).c_str()));
+  txn.commit();
+}
+
 void BlockchainLMDB::migrate(const uint32_t oldversion)
 {
   switch(oldversion) {
   case 0:
     migrate_0_1(); /* FALLTHRU */
+  case 1:
+    migrate_1_2(); /* FALLTHRU */
+  case 2:
+    migrate_2_3(); /* FALLTHRU */
   default:
     ;
   }
@@ -30,6 +30,7 @@
 #include <atomic>
 
 #include "blockchain_db/blockchain_db.h"
+#include "blockchain_db/key_image_filter.h"
 #include "cryptonote_protocol/blobdatatype.h" // for type blobdata
 #include "ringct/rctTypes.h"
 #include <boost/thread/tss.hpp>
@@ -51,12 +52,18 @@ typedef struct mdb_txn_cursors
   MDB_cursor *m_txc_output_amounts;
 
   MDB_cursor *m_txc_txs;
+  MDB_cursor *m_txc_txs_prunable;
   MDB_cursor *m_txc_tx_indices;
   MDB_cursor *m_txc_tx_outputs;
 
   MDB_cursor *m_txc_spent_keys;
 
   MDB_cursor *m_txc_hf_versions;
+
+  MDB_cursor *m_txc_alt_blocks;
+
+  MDB_cursor *m_txc_txpool_meta;
+  MDB_cursor *m_txc_txpool_blob;
 } mdb_txn_cursors;
 
 #define m_cur_blocks	m_cursors->m_txc_blocks
@@ -65,10 +72,14 @@ typedef struct mdb_txn_cursors
 #define m_cur_output_txs	m_cursors->m_txc_output_txs
 #define m_cur_output_amounts	m_cursors->m_txc_output_amounts
 #define m_cur_txs	m_cursors->m_txc_txs
+#define m_cur_txs_prunable	m_cursors->m_txc_txs_prunable
 #define m_cur_tx_indices	m_cursors->m_txc_tx_indices
 #define m_cur_tx_outputs	m_cursors->m_txc_tx_outputs
 #define m_cur_spent_keys	m_cursors->m_txc_spent_keys
 #define m_cur_hf_versions	m_cursors->m_txc_hf_versions
+#define m_cur_alt_blocks	m_cursors->m_txc_alt_blocks
+#define m_cur_txpool_meta	m_cursors->m_txc_txpool_meta
+#define m_cur_txpool_blob	m_cursors->m_txc_txpool_blob
 
 typedef struct mdb_rflags
 {
@@ -79,10 +90,14 @@ typedef struct mdb_rflags
   bool m_rf_output_txs;
   bool m_rf_output_amounts;
   bool m_rf_txs;
+  bool m_rf_txs_prunable;
   bool m_rf_tx_indices;
   bool m_rf_tx_outputs;
   bool m_rf_spent_keys;
   bool m_rf_hf_versions;
+  bool m_rf_alt_blocks;
+  bool m_rf_txpool_meta;
+  bool m_rf_txpool_blob;
 } mdb_rflags;
 
 typedef struct mdb_threadinfo
@@ -197,6 +212,10 @@ public:
 
   virtual std::vector<crypto::hash> get_hashes_range(const uint64_t& h1, const uint64_t& h2) const;
 
+  virtual void get_block_info_range(const uint64_t& h1, const uint64_t& h2, std::vector<block_info_t>& infos, unsigned int fields = BI_ALL) const;
+
+  virtual void get_block_blobs_range(const uint64_t& h1, const uint64_t& h2, std::vector<block_blobs_t>& blocks, bool get_output_indices) const;
+
   virtual crypto::hash top_block_hash() const;
 
   virtual block get_top_block() const;
@@ -210,6 +229,8 @@ public:
 
   virtual transaction get_tx(const crypto::hash& h) const;
 
+  virtual bool get_tx_blob(const crypto::hash& h, blobdata& bd) const;
+
   virtual uint64_t get_tx_count() const;
 
   virtual std::vector<transaction> get_tx_list(const std::vector<crypto::hash>& hlist) const;
@@ -250,6 +271,7 @@ public:
   virtual void batch_commit();
   virtual void batch_stop();
   virtual void batch_abort();
+  virtual bool can_nest_block_txns() const;
 
   virtual void block_txn_start(bool readonly);
   virtual void block_txn_stop();
@@ -272,6 +294,16 @@ public:
    */
   std::map<uint64_t, std::tuple<uint64_t, uint64_t, uint64_t>> get_output_histogram(const std::vector<uint64_t> &amounts, bool unlocked, uint64_t recent_cutoff) const;
 
+  virtual uint64_t get_num_outputs_below_height(const uint64_t& amount, const uint64_t& height) const;
+
+  virtual void get_output_distribution(const uint64_t& amount, const uint64_t& from_height, const uint64_t& to_height, std::vector<uint64_t>& distribution, uint64_t& base) const;
+
+  virtual uint64_t prune_blockchain(uint64_t keep_blocks);
+
+  virtual void get_stats(db_stats_t& stats) const;
+
+  virtual bool copy(const std::string& path, bool compact) const;
+
 private:
   void do_resize(uint64_t size_increase=0);
 
@@ -283,6 +315,7 @@ private:
                 , const size_t& block_size
                 , const difficulty_type& cumulative_difficulty
                 , const uint64_t& coins_generated
+                , uint64_t num_rct_outs
                 , const crypto::hash& block_hash
                 );
 
@@ -317,6 +350,21 @@ private:
   virtual void check_hard_fork_info();
   virtual void drop_hard_fork_info();
 
+  // Alternative blocks
+  virtual void add_alt_block(const crypto::hash &blkid, const alt_block_data_t &data, const blobdata &blob);
+  virtual void remove_alt_block(const crypto::hash &blkid);
+  virtual void drop_alt_blocks();
+  virtual bool for_all_alt_blocks(std::function<bool(const crypto::hash&, const alt_block_data_t&, const blobdata&)> f) const;
+
+  // Transaction pool
+  virtual bool has_txpool_storage() const;
+  virtual void add_txpool_tx(const crypto::hash &txid, const txpool_tx_meta_t &meta, const blobdata &blob);
+  virtual void update_txpool_tx(const crypto::hash &txid, const txpool_tx_meta_t &meta);
+  virtual void remove_txpool_tx(const crypto::hash &txid);
+  virtual void drop_txpool();
+  virtual uint64_t get_txpool_tx_count() const;
+  virtual bool for_all_txpool_txes(std::function<bool(const crypto::hash&, const txpool_tx_meta_t&, const blobdata&)> f) const;
+
   /**
    * @brief convert a tx output to a blob for storage
    *
@@ -335,6 +383,19 @@ private:
    */
   tx_out output_from_blob(const blobdata& blob) const;
 
+  /**
+   * @brief parse a transaction from its stored blobs
+   *
+   * The prunable data, if still there, is appended to the pruned blob and
+   * the whole transaction is parsed.  Otherwise only the part kept by
+   * pruning is parsed, and the transaction is marked as pruned.
+   *
+   * @param bd the transaction's blob from the txs table
+   * @param prunable the transaction's prunable data, or NULL if it was pruned
+   * @param tx return-by-reference the transaction
+   */
+  void tx_from_blobs(blobdata& bd, const MDB_val *prunable, transaction& tx) const;
+
   void check_open() const;
 
   virtual bool is_read_only() const;
@@ -342,12 +403,24 @@ private:
   // fix up anything that may be wrong due to past bugs
   virtual void fixup();
 
+  // fill the key image filter from the spent_keys table
+  void load_key_image_filter();
+
+  // reset the tx and output counts from the db, after a batch is lost
+  void load_counts();
+
   // migrate from older DB version to current
   void migrate(const uint32_t oldversion);
 
   // migrate from DB version 0 to 1
   void migrate_0_1();
 
+  // migrate from DB version 1 to 2
+  void migrate_1_2();
+
+  // migrate from DB version 2 to 3
+  void migrate_2_3();
+
   MDB_env* m_env;
 
   MDB_dbi m_blocks;
@@ -355,6 +428,7 @@ private:
   MDB_dbi m_block_info;
 
   MDB_dbi m_txs;
+  MDB_dbi m_txs_prunable;
   MDB_dbi m_tx_indices;
   MDB_dbi m_tx_outputs;
 
@@ -366,6 +440,11 @@ private:
   MDB_dbi m_hf_starting_heights;
   MDB_dbi m_hf_versions;
 
+  MDB_dbi m_alt_blocks;
+
+  MDB_dbi m_txpool_meta;
+  MDB_dbi m_txpool_blob;
+
   MDB_dbi m_properties;
 
   uint64_t m_num_txs;
@@ -383,18 +462,27 @@ private:
   mdb_txn_cursors m_wcursors;
   mutable boost::thread_specific_ptr<mdb_threadinfo> m_tinfo;
 
+  // answers most lookups for unspent key images without touching the DB
+  key_image_filter m_key_image_filter;
+
+  std::atomic<uint64_t> m_num_resizes;
+  std::atomic<uint64_t> m_resize_time_us;  // spent with all txns stalled
+
 #if defined(__arm__)
   // force a value so it can compile with 32-bit ARM
   constexpr static uint64_t DEFAULT_MAPSIZE = 1LL << 31;
-#else
-#if defined(ENABLE_AUTO_RESIZE)
+#elif defined(_WIN32)
+  // the data file takes up the whole map size on Windows
   constexpr static uint64_t DEFAULT_MAPSIZE = 1LL << 30;
 #else
-  constexpr static uint64_t DEFAULT_MAPSIZE = 1LL << 33;
-#endif
+  // only address space is reserved, the data file grows as it's written to,
+  // so resizes (which wait for every reader to finish) are rarely needed
+  constexpr static uint64_t DEFAULT_MAPSIZE = sizeof(size_t) < 8 ? 1LL << 31 : 1LL << 36;
 #endif
 
   constexpr static float RESIZE_PERCENT = 0.8f;
+
+  constexpr static uint64_t KEY_IMAGE_FILTER_MIN_CAPACITY = 1 << 20;
 };
 
 }  // namespace cryptonote
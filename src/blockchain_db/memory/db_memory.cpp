@@ -0,0 +1,1533 @@
+// Copyright (c) 2014-2017, The Monero Project
+// Copyright (c) 2017, SUMOKOIN
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "db_memory.h"
+
+#include <algorithm>
+#include <memory>  // std::shared_ptr
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "cryptonote_core/cryptonote_format_utils.h"
+#include "crypto/crypto.h"
+#include "ringct/rctOps.h"
+
+using epee::string_tools::pod_to_hex;
+
+namespace
+{
+
+template <typename T>
+inline void throw0(const T &e)
+{
+  LOG_PRINT_L0(e.what());
+  throw e;
+}
+
+template <typename T>
+inline void throw1(const T &e)
+{
+  LOG_PRINT_L1(e.what());
+  throw e;
+}
+
+template <typename T>
+inline void throw2(const T &e)
+{
+  LOG_PRINT_L2(e.what());
+  throw e;
+}
+
+typedef boost::shared_lock<boost::shared_mutex> read_lock;
+typedef boost::unique_lock<boost::shared_mutex> write_lock;
+
+}  // anonymous namespace
+
+namespace cryptonote
+{
+
+namespace
+{
+
+// parse a transaction from its stored blobs, see BlockchainLMDB::tx_from_blobs
+void tx_from_blobs(blobdata& bd, const blobdata *prunable, transaction& tx)
+{
+  if (prunable)
+  {
+    bd.append(*prunable);
+    if (!parse_and_validate_tx_from_blob(bd, tx))
+      throw0(DB_ERROR("Failed to parse tx from blob retrieved from the db"));
+  }
+  else if (!parse_and_validate_tx_base_from_blob(bd, tx))
+  {
+    throw0(DB_ERROR("Failed to parse pruned tx from blob retrieved from the db"));
+  }
+}
+
+void block_from_blob(const blobdata& bd, block& b)
+{
+  if (!parse_and_validate_block_from_blob(bd, b))
+    throw0(DB_ERROR("Failed to parse block from blob retrieved from the db"));
+}
+
+}  // anonymous namespace
+
+BlockchainMemory::BlockchainMemory(bool batch_transactions)
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  m_folder = "thishsouldnotexistbecauseitisgibberish";
+  m_open = false;
+
+  m_batch_transactions = batch_transactions;
+  m_write_txn = false;
+  m_batch_active = false;
+  m_pruned_height = 0;
+
+  m_hardfork = nullptr;
+}
+
+BlockchainMemory::~BlockchainMemory()
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+
+  // batch transaction shouldn't be active at this point. If it is, consider it aborted.
+  if (m_batch_active)
+    batch_abort();
+  if (m_open)
+    close();
+}
+
+void BlockchainMemory::check_open() const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  if (!m_open)
+    throw0(DB_ERROR("DB operation attempted on a not-open DB instance"));
+}
+
+void BlockchainMemory::log_undo(std::function<void()> undo)
+{
+  if (m_write_txn || m_batch_active)
+    m_undo.push_back(std::move(undo));
+}
+
+void BlockchainMemory::rollback(size_t marker)
+{
+  while (m_undo.size() > marker)
+  {
+    const std::function<void()> undo = std::move(m_undo.back());
+    m_undo.pop_back();
+    undo();
+  }
+}
+
+void BlockchainMemory::clear()
+{
+  m_blocks.clear();
+  m_block_heights.clear();
+  m_txs.clear();
+  m_tx_indices.clear();
+  m_output_amounts.clear();
+  m_output_txs.clear();
+  m_spent_keys.clear();
+  m_hf_versions.clear();
+  m_pruned_height = 0;
+  m_undo.clear();
+  m_txn_markers.clear();
+}
+
+const BlockchainMemory::mem_block& BlockchainMemory::block_at(uint64_t height) const
+{
+  if (height >= m_blocks.size())
+    throw0(BLOCK_DNE(std::string("Attempt to get block from height ").append(boost::lexical_cast<std::string>(height)).append(" failed -- block not in db").c_str()));
+  return m_blocks[height];
+}
+
+const BlockchainMemory::mem_tx& BlockchainMemory::tx_by_hash(const crypto::hash& h) const
+{
+  const auto i = m_tx_indices.find(h);
+  if (i == m_tx_indices.end())
+    throw2(TX_DNE(std::string("tx with hash ").append(pod_to_hex(h)).append(" not found in db").c_str()));
+  return m_txs[i->second];
+}
+
+const BlockchainMemory::mem_output& BlockchainMemory::output_at(uint64_t amount, uint64_t index) const
+{
+  const auto i = m_output_amounts.find(amount);
+  if (i == m_output_amounts.end() || index >= i->second.size())
+    throw1(OUTPUT_DNE((std::string("Attempting to get output by amount and amount index (amount ") + boost::lexical_cast<std::string>(amount) + ", index " + boost::lexical_cast<std::string>(index) + "), but it does not exist").c_str()));
+  return i->second[index];
+}
+
+uint64_t BlockchainMemory::num_outputs_below_height(uint64_t amount, uint64_t height) const
+{
+  if (height == 0)
+    return 0;
+
+  // RingCT outputs are counted per block
+  if (amount == 0)
+    return m_blocks.empty() ? 0 : m_blocks[std::min<uint64_t>(height, m_blocks.size()) - 1].cumulative_rct_outputs;
+
+  // outputs of an amount are appended in block order, so their heights
+  // never decrease with the amount index; they are one past their block's
+  const auto i = m_output_amounts.find(amount);
+  if (i == m_output_amounts.end())
+    return 0;
+  const auto first = std::lower_bound(i->second.begin(), i->second.end(), height,
+      [](const mem_output &mo, uint64_t h) { return mo.data.height <= h; });
+  return first - i->second.begin();
+}
+
+void BlockchainMemory::open(const std::string& filename, const int db_flags)
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+
+  if (m_open)
+    throw0(DB_OPEN_FAILURE("Attempted to open db, but it's already open"));
+
+  // nothing is read from or written to the folder, it only names the db
+  m_folder = filename;
+  m_open = true;
+  LOG_PRINT_L0("Using an in-memory database, the blockchain will not be saved");
+}
+
+void BlockchainMemory::close()
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  if (m_batch_active)
+  {
+    LOG_PRINT_L3("close() first calling batch_abort() due to active batch transaction");
+    batch_abort();
+  }
+
+  write_lock lock(m_lock);
+  clear();
+  m_open = false;
+}
+
+void BlockchainMemory::sync()
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+}
+
+void BlockchainMemory::reset()
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+
+  write_lock lock(m_lock);
+  clear();
+}
+
+std::vector<std::string> BlockchainMemory::get_filenames() const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  return std::vector<std::string>();
+}
+
+std::string BlockchainMemory::get_db_name() const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+
+  return std::string("memory");
+}
+
+bool BlockchainMemory::lock()
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  return false;
+}
+
+void BlockchainMemory::unlock()
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+}
+
+bool BlockchainMemory::is_read_only() const
+{
+  return false;
+}
+
+void BlockchainMemory::add_block(const block& blk, const size_t& block_size, const difficulty_type& cumulative_difficulty, const uint64_t& coins_generated,
+    uint64_t num_rct_outs, const crypto::hash& blk_hash)
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  write_lock lock(m_lock);
+  const uint64_t m_height = m_blocks.size();
+
+  if (m_block_heights.find(blk_hash) != m_block_heights.end())
+    throw1(BLOCK_EXISTS("Attempting to add block that's already in the db"));
+
+  if (m_height > 0)
+  {
+    const auto parent = m_block_heights.find(blk.prev_id);
+    if (parent == m_block_heights.end())
+    {
+      LOG_PRINT_L3("m_height: " << m_height);
+      LOG_PRINT_L3("parent_key: " << blk.prev_id);
+      throw0(DB_ERROR("Failed to get top block hash to check for new block's parent"));
+    }
+    if (parent->second != m_height - 1)
+      throw0(BLOCK_PARENT_DNE("Top block is not new block's parent"));
+  }
+
+  mem_block mb;
+  mb.blob = block_to_blob(blk);
+  mb.timestamp = blk.timestamp;
+  mb.coins_generated = coins_generated;
+  mb.size = block_size;
+  mb.cumulative_difficulty = cumulative_difficulty;
+  mb.hash = blk_hash;
+  mb.cumulative_rct_outputs = num_rct_outs + (m_height > 0 ? m_blocks.back().cumulative_rct_outputs : 0);
+  mb.major_version = blk.major_version;
+  mb.minor_version = blk.minor_version;
+  mb.first_tx_id = m_txs.size();
+
+  m_blocks.push_back(std::move(mb));
+  m_block_heights[blk_hash] = m_height;
+
+  log_undo([this, blk_hash]() {
+    m_block_heights.erase(blk_hash);
+    m_blocks.pop_back();
+  });
+}
+
+void BlockchainMemory::remove_block()
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  write_lock lock(m_lock);
+
+  if (m_blocks.empty())
+    throw0(BLOCK_DNE ("Attempting to remove block from an empty blockchain"));
+
+  const auto mb = std::make_shared<mem_block>(std::move(m_blocks.back()));
+  m_blocks.pop_back();
+  m_block_heights.erase(mb->hash);
+
+  log_undo([this, mb]() {
+    m_block_heights[mb->hash] = m_blocks.size();
+    m_blocks.push_back(*mb);
+  });
+}
+
+uint64_t BlockchainMemory::add_transaction_data(const crypto::hash& blk_hash, const transaction& tx, const crypto::hash& tx_hash)
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  write_lock lock(m_lock);
+
+  const auto i = m_tx_indices.find(tx_hash);
+  if (i != m_tx_indices.end())
+    throw1(TX_EXISTS(std::string("Attempting to add transaction that's already in the db (tx id ").append(boost::lexical_cast<std::string>(i->second)).append(")").c_str()));
+
+  // kept apart like in BlockchainLMDB, so the prunable data can be dropped
+  const blobdata bd = tx_to_blob(tx);
+  size_t pruned_size;
+  if (!get_pruned_tx_blob_size(bd, pruned_size))
+    throw0(DB_ERROR("Failed to find the prunable data of tx"));
+
+  const uint64_t tx_id = m_txs.size();
+  mem_tx mtx;
+  mtx.hash = tx_hash;
+  mtx.blob = bd.substr(0, pruned_size);
+  mtx.pruned = tx.pruned;
+  if (!tx.pruned)
+    mtx.prunable = bd.substr(pruned_size);
+  mtx.unlock_time = tx.unlock_time;
+  // the block is already in, as with BlockchainLMDB's height()
+  mtx.block_id = m_blocks.size();
+
+  m_txs.push_back(std::move(mtx));
+  m_tx_indices[tx_hash] = tx_id;
+
+  log_undo([this, tx_hash]() {
+    m_tx_indices.erase(tx_hash);
+    m_txs.pop_back();
+  });
+
+  return tx_id;
+}
+
+void BlockchainMemory::remove_transaction_data(const crypto::hash& tx_hash, const transaction& tx)
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  write_lock lock(m_lock);
+
+  const auto i = m_tx_indices.find(tx_hash);
+  if (i == m_tx_indices.end())
+    throw1(TX_DNE("Attempting to remove transaction that isn't in the db"));
+  if (i->second + 1 != m_txs.size())
+    throw0(DB_ERROR("Attempting to remove a transaction which is not the most recent one"));
+
+  const mem_tx &mtx = m_txs.back();
+  if (mtx.amount_output_indices.empty() && !tx.vout.empty())
+    throw0(DB_ERROR("tx has outputs, but no output indices found"));
+  if (mtx.amount_output_indices.size() != tx.vout.size())
+    throw0(DB_ERROR("tx has a different number of outputs than output indices"));
+
+  // the tx's outputs were the last ones added, and go first
+  struct removed_output
+  {
+    mem_output output;
+    mem_output_tx output_tx;
+  };
+  const auto outputs = std::make_shared<std::vector<removed_output>>();
+  outputs->reserve(tx.vout.size());
+  const bool is_pseudo_rct = tx.version >= 2 && tx.vin.size() == 1 && tx.vin[0].type() == typeid(txin_gen);
+  for (size_t n = tx.vout.size(); n-- > 0;)
+  {
+    const uint64_t amount = is_pseudo_rct ? 0 : tx.vout[n].amount;
+    const uint64_t out_index = mtx.amount_output_indices[n];
+    const auto a = m_output_amounts.find(amount);
+    if (a == m_output_amounts.end() || a->second.size() != out_index + 1)
+      throw0(DB_ERROR(std::string("Error removing output index ").append(boost::lexical_cast<std::string>(out_index)).append(": not the most recent output of its amount").c_str()));
+    if (m_output_txs.empty() || a->second.back().output_id + 1 != m_output_txs.size())
+      throw0(DB_ERROR("Unexpected: global output index not found in m_output_txs"));
+    outputs->push_back({a->second.back(), m_output_txs.back()});
+    a->second.pop_back();
+    if (a->second.empty())
+      m_output_amounts.erase(a);
+    m_output_txs.pop_back();
+  }
+
+  const auto removed = std::make_shared<mem_tx>(std::move(m_txs.back()));
+  m_txs.pop_back();
+  m_tx_indices.erase(i);
+
+  log_undo([this, removed, outputs]() {
+    m_tx_indices[removed->hash] = m_txs.size();
+    m_txs.push_back(*removed);
+    for (auto o = outputs->rbegin(); o != outputs->rend(); ++o)
+    {
+      m_output_amounts[o->output_tx.amount].push_back(o->output);
+      m_output_txs.push_back(o->output_tx);
+    }
+  });
+}
+
+uint64_t BlockchainMemory::add_output(const crypto::hash& tx_hash,
+    const tx_out& tx_output,
+    const uint64_t& local_index,
+    const uint64_t unlock_time,
+    const rct::key *commitment)
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  write_lock lock(m_lock);
+
+  if (tx_output.target.type() != typeid(txout_to_key))
+    throw0(DB_ERROR("Wrong output type: expected txout_to_key"));
+  if (tx_output.amount == 0 && !commitment)
+    throw0(DB_ERROR("RCT output without commitment"));
+
+  const uint64_t amount = tx_output.amount;
+  std::vector<mem_output> &outputs = m_output_amounts[amount];
+  const uint64_t amount_index = outputs.size();
+
+  mem_output mo = mem_output();
+  mo.output_id = m_output_txs.size();
+  mo.data.pubkey = boost::get<txout_to_key>(tx_output.target).key;
+  mo.data.unlock_time = unlock_time;
+  mo.data.height = m_blocks.size();
+  if (amount == 0)
+    mo.data.commitment = *commitment;
+
+  outputs.push_back(mo);
+  m_output_txs.push_back({tx_hash, local_index, amount, amount_index});
+
+  log_undo([this, amount]() {
+    m_output_txs.pop_back();
+    const auto a = m_output_amounts.find(amount);
+    a->second.pop_back();
+    if (a->second.empty())
+      m_output_amounts.erase(a);
+  });
+
+  return amount_index;
+}
+
+void BlockchainMemory::add_tx_amount_output_indices(const uint64_t tx_id,
+    const std::vector<uint64_t>& amount_output_indices)
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  write_lock lock(m_lock);
+
+  if (tx_id >= m_txs.size())
+    throw0(TX_DNE("Attempting to add output indices to a tx which is not in the db"));
+  m_txs[tx_id].amount_output_indices = amount_output_indices;
+
+  log_undo([this, tx_id]() {
+    m_txs[tx_id].amount_output_indices.clear();
+  });
+}
+
+void BlockchainMemory::add_spent_key(const crypto::key_image& k_image)
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  write_lock lock(m_lock);
+
+  if (!m_spent_keys.insert(k_image).second)
+    throw1(KEY_IMAGE_EXISTS("Attempting to add spent key image that's already in the db"));
+
+  log_undo([this, k_image]() {
+    m_spent_keys.erase(k_image);
+  });
+}
+
+void BlockchainMemory::remove_spent_key(const crypto::key_image& k_image)
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  write_lock lock(m_lock);
+
+  if (m_spent_keys.erase(k_image))
+  {
+    log_undo([this, k_image]() {
+      m_spent_keys.insert(k_image);
+    });
+  }
+}
+
+bool BlockchainMemory::block_exists(const crypto::hash& h, uint64_t *height) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  read_lock lock(m_lock);
+
+  const auto i = m_block_heights.find(h);
+  if (i == m_block_heights.end())
+  {
+    LOG_PRINT_L3("Block with hash " << epee::string_tools::pod_to_hex(h) << " not found in db");
+    return false;
+  }
+  if (height)
+    *height = i->second;
+  return true;
+}
+
+block BlockchainMemory::get_block(const crypto::hash& h) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+
+  return get_block_from_height(get_block_height(h));
+}
+
+uint64_t BlockchainMemory::get_block_height(const crypto::hash& h) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  read_lock lock(m_lock);
+
+  const auto i = m_block_heights.find(h);
+  if (i == m_block_heights.end())
+    throw1(BLOCK_DNE("Attempted to retrieve non-existent block height"));
+  return i->second;
+}
+
+block_header BlockchainMemory::get_block_header(const crypto::hash& h) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+
+  // block_header object is automatically cast from block object
+  return get_block(h);
+}
+
+block BlockchainMemory::get_block_from_height(const uint64_t& height) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+
+  blobdata bd;
+  {
+    read_lock lock(m_lock);
+    bd = block_at(height).blob;
+  }
+
+  block b;
+  block_from_blob(bd, b);
+  return b;
+}
+
+uint64_t BlockchainMemory::get_block_timestamp(const uint64_t& height) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  read_lock lock(m_lock);
+
+  return block_at(height).timestamp;
+}
+
+uint64_t BlockchainMemory::get_top_block_timestamp() const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  read_lock lock(m_lock);
+
+  // if no blocks, return 0
+  if (m_blocks.empty())
+    return 0;
+  return m_blocks.back().timestamp;
+}
+
+size_t BlockchainMemory::get_block_size(const uint64_t& height) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  read_lock lock(m_lock);
+
+  return block_at(height).size;
+}
+
+difficulty_type BlockchainMemory::get_block_cumulative_difficulty(const uint64_t& height) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__ << "  height: " << height);
+  check_open();
+  read_lock lock(m_lock);
+
+  return block_at(height).cumulative_difficulty;
+}
+
+difficulty_type BlockchainMemory::get_block_difficulty(const uint64_t& height) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  read_lock lock(m_lock);
+
+  const difficulty_type diff1 = block_at(height).cumulative_difficulty;
+  const difficulty_type diff2 = height != 0 ? m_blocks[height - 1].cumulative_difficulty : 0;
+  return diff1 - diff2;
+}
+
+uint64_t BlockchainMemory::get_block_already_generated_coins(const uint64_t& height) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  read_lock lock(m_lock);
+
+  return block_at(height).coins_generated;
+}
+
+crypto::hash BlockchainMemory::get_block_hash_from_height(const uint64_t& height) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  read_lock lock(m_lock);
+
+  return block_at(height).hash;
+}
+
+std::vector<block> BlockchainMemory::get_blocks_range(const uint64_t& h1, const uint64_t& h2) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  std::vector<block> v;
+
+  for (uint64_t height = h1; height <= h2; ++height)
+  {
+    v.push_back(get_block_from_height(height));
+  }
+
+  return v;
+}
+
+std::vector<crypto::hash> BlockchainMemory::get_hashes_range(const uint64_t& h1, const uint64_t& h2) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  read_lock lock(m_lock);
+  std::vector<crypto::hash> v;
+
+  for (uint64_t height = h1; height <= h2; ++height)
+  {
+    v.push_back(block_at(height).hash);
+  }
+
+  return v;
+}
+
+void BlockchainMemory::get_block_info_range(const uint64_t& h1, const uint64_t& h2, std::vector<block_info_t>& infos, unsigned int fields) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+
+  infos.clear();
+  if (h1 > h2)
+    return;
+
+  read_lock lock(m_lock);
+  block_at(h2);
+  infos.reserve(h2 - h1 + 1);
+  for (uint64_t height = h1; height <= h2; ++height)
+  {
+    // everything is at hand, so the mask only saves copying
+    const mem_block &mb = m_blocks[height];
+    block_info_t bi;
+    bi.height = height;
+    bi.timestamp = mb.timestamp;
+    bi.coins_generated = mb.coins_generated;
+    bi.size = mb.size;
+    bi.cumulative_difficulty = mb.cumulative_difficulty;
+    if (fields & BI_HASH)
+      bi.hash = mb.hash;
+    bi.cumulative_rct_outputs = mb.cumulative_rct_outputs;
+    bi.major_version = mb.major_version;
+    bi.minor_version = mb.minor_version;
+    infos.push_back(bi);
+  }
+}
+
+void BlockchainMemory::get_block_blobs_range(const uint64_t& h1, const uint64_t& h2, std::vector<block_blobs_t>& blocks, bool get_output_indices) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+
+  blocks.clear();
+  if (h1 > h2)
+    return;
+
+  read_lock lock(m_lock);
+  block_at(h2);
+  blocks.reserve(h2 - h1 + 1);
+  for (uint64_t height = h1; height <= h2; ++height)
+  {
+    const mem_block &mb = m_blocks[height];
+    const uint64_t end_tx_id = height + 1 < m_blocks.size() ? m_blocks[height + 1].first_tx_id : m_txs.size();
+    if (mb.first_tx_id >= end_tx_id)
+      throw0(TX_DNE("Miner tx of block not found in db"));
+
+    blocks.push_back(block_blobs_t());
+    block_blobs_t &entry = blocks.back();
+    entry.block = mb.blob;
+    entry.txs.reserve(end_tx_id - mb.first_tx_id - 1);
+    if (get_output_indices)
+      entry.output_indices.reserve(end_tx_id - mb.first_tx_id);
+    for (uint64_t tx_id = mb.first_tx_id; tx_id < end_tx_id; ++tx_id)
+    {
+      const mem_tx &mtx = m_txs[tx_id];
+      if (tx_id != mb.first_tx_id)
+      {
+        // a pruned tx is returned without its prunable data
+        entry.txs.push_back(mtx.blob);
+        if (mtx.pruned)
+          entry.pruned = true;
+        else
+          entry.txs.back().append(mtx.prunable);
+      }
+      if (get_output_indices)
+        entry.output_indices.push_back(mtx.amount_output_indices);
+    }
+  }
+}
+
+crypto::hash BlockchainMemory::top_block_hash() const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  read_lock lock(m_lock);
+
+  if (!m_blocks.empty())
+    return m_blocks.back().hash;
+  return null_hash;
+}
+
+block BlockchainMemory::get_top_block() const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+
+  blobdata bd;
+  {
+    read_lock lock(m_lock);
+    if (m_blocks.empty())
+      return block();
+    bd = m_blocks.back().blob;
+  }
+
+  block b;
+  block_from_blob(bd, b);
+  return b;
+}
+
+uint64_t BlockchainMemory::height() const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  read_lock lock(m_lock);
+
+  return m_blocks.size();
+}
+
+bool BlockchainMemory::tx_exists(const crypto::hash& h) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  db_op_timer timer(m_op_stats, DB_OP_TX_EXISTS);
+  read_lock lock(m_lock);
+
+  if (m_tx_indices.find(h) == m_tx_indices.end())
+  {
+    LOG_PRINT_L1("transaction with hash " << epee::string_tools::pod_to_hex(h) << " not found in db");
+    return false;
+  }
+  return true;
+}
+
+bool BlockchainMemory::tx_exists(const crypto::hash& h, uint64_t& tx_id) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  db_op_timer timer(m_op_stats, DB_OP_TX_EXISTS);
+  read_lock lock(m_lock);
+
+  const auto i = m_tx_indices.find(h);
+  if (i == m_tx_indices.end())
+  {
+    LOG_PRINT_L1("transaction with hash " << epee::string_tools::pod_to_hex(h) << " not found in db");
+    return false;
+  }
+  tx_id = i->second;
+  return true;
+}
+
+uint64_t BlockchainMemory::get_tx_unlock_time(const crypto::hash& h) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  read_lock lock(m_lock);
+
+  return tx_by_hash(h).unlock_time;
+}
+
+transaction BlockchainMemory::get_tx(const crypto::hash& h) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+
+  blobdata bd, prunable;
+  bool pruned;
+  {
+    read_lock lock(m_lock);
+    const mem_tx &mtx = tx_by_hash(h);
+    bd = mtx.blob;
+    prunable = mtx.prunable;
+    pruned = mtx.pruned;
+  }
+
+  transaction tx;
+  tx_from_blobs(bd, pruned ? NULL : &prunable, tx);
+  return tx;
+}
+
+bool BlockchainMemory::get_tx_blob(const crypto::hash& h, blobdata& bd) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  read_lock lock(m_lock);
+
+  const auto i = m_tx_indices.find(h);
+  if (i == m_tx_indices.end())
+    return false;
+
+  // a pruned tx is returned without its prunable data
+  const mem_tx &mtx = m_txs[i->second];
+  bd = mtx.blob;
+  if (!mtx.pruned)
+    bd.append(mtx.prunable);
+  return true;
+}
+
+uint64_t BlockchainMemory::get_tx_count() const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  read_lock lock(m_lock);
+
+  return m_txs.size();
+}
+
+std::vector<transaction> BlockchainMemory::get_tx_list(const std::vector<crypto::hash>& hlist) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  std::vector<transaction> v;
+
+  for (auto& h : hlist)
+  {
+    v.push_back(get_tx(h));
+  }
+
+  return v;
+}
+
+uint64_t BlockchainMemory::get_tx_block_height(const crypto::hash& h) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  read_lock lock(m_lock);
+
+  return tx_by_hash(h).block_id;
+}
+
+uint64_t BlockchainMemory::get_num_outputs(const uint64_t& amount) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  read_lock lock(m_lock);
+
+  const auto i = m_output_amounts.find(amount);
+  return i == m_output_amounts.end() ? 0 : i->second.size();
+}
+
+output_data_t BlockchainMemory::get_output_key(const uint64_t &global_index) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+
+  output_data_t od;
+  uint64_t amount;
+  {
+    read_lock lock(m_lock);
+    if (global_index >= m_output_txs.size())
+      throw1(OUTPUT_DNE("output with given index not in db"));
+    const mem_output_tx &ot = m_output_txs[global_index];
+    amount = ot.amount;
+    od = output_at(ot.amount, ot.amount_index).data;
+  }
+
+  if (amount != 0)
+    od.commitment = rct::zeroCommit(amount);
+  return od;
+}
+
+output_data_t BlockchainMemory::get_output_key(const uint64_t& amount, const uint64_t& index)
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  db_op_timer timer(m_op_stats, DB_OP_GET_OUTPUT_KEY);
+
+  output_data_t od;
+  {
+    read_lock lock(m_lock);
+    od = output_at(amount, index).data;
+  }
+
+  if (amount != 0)
+    od.commitment = rct::zeroCommit(amount);
+  return od;
+}
+
+void BlockchainMemory::get_output_key(const uint64_t &amount, const std::vector<uint64_t> &offsets, std::vector<output_data_t> &outputs)
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  outputs.resize(offsets.size());
+  if (offsets.empty())
+    return;
+  db_op_timer timer(m_op_stats, DB_OP_GET_OUTPUT_KEYS);
+
+  {
+    read_lock lock(m_lock);
+    for (size_t n = 0; n < offsets.size(); ++n)
+      outputs[n] = output_at(amount, offsets[n]).data;
+  }
+
+  // pre-RingCT outputs are all committed to with the same mask
+  if (amount != 0)
+  {
+    const rct::key commitment = rct::zeroCommit(amount);
+    for (auto &od: outputs)
+      od.commitment = commitment;
+  }
+}
+
+tx_out_index BlockchainMemory::get_output_tx_and_index_from_global(const uint64_t& output_id) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  read_lock lock(m_lock);
+
+  if (output_id >= m_output_txs.size())
+    throw1(OUTPUT_DNE("output with given index not in db"));
+  const mem_output_tx &ot = m_output_txs[output_id];
+  return tx_out_index(ot.tx_hash, ot.local_index);
+}
+
+tx_out_index BlockchainMemory::get_output_tx_and_index(const uint64_t& amount, const uint64_t& index) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  read_lock lock(m_lock);
+
+  const mem_output_tx &ot = m_output_txs[output_at(amount, index).output_id];
+  return tx_out_index(ot.tx_hash, ot.local_index);
+}
+
+void BlockchainMemory::get_output_tx_and_index(const uint64_t& amount, const std::vector<uint64_t> &offsets, std::vector<tx_out_index> &indices) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  indices.clear();
+  indices.reserve(offsets.size());
+
+  read_lock lock(m_lock);
+  for (const uint64_t &index : offsets)
+  {
+    const mem_output_tx &ot = m_output_txs[output_at(amount, index).output_id];
+    indices.push_back(tx_out_index(ot.tx_hash, ot.local_index));
+  }
+}
+
+std::vector<uint64_t> BlockchainMemory::get_tx_amount_output_indices(const uint64_t tx_id) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  read_lock lock(m_lock);
+
+  if (tx_id >= m_txs.size())
+    throw1(TX_DNE("Attempting to get the output indices of a tx which is not in the db"));
+  return m_txs[tx_id].amount_output_indices;
+}
+
+bool BlockchainMemory::has_key_image(const crypto::key_image& img) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  db_op_timer timer(m_op_stats, DB_OP_HAS_KEY_IMAGE);
+  read_lock lock(m_lock);
+
+  return m_spent_keys.find(img) != m_spent_keys.end();
+}
+
+// The for_all functions don't hold the lock while calling back, as the
+// function may well look things up in the db itself.
+
+bool BlockchainMemory::for_all_key_images(std::function<bool(const crypto::key_image&)> f) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+
+  std::vector<crypto::key_image> key_images;
+  {
+    read_lock lock(m_lock);
+    key_images.assign(m_spent_keys.begin(), m_spent_keys.end());
+  }
+
+  for (const crypto::key_image &k_image: key_images)
+  {
+    if (!f(k_image))
+      return false;
+  }
+  return true;
+}
+
+bool BlockchainMemory::for_all_blocks(std::function<bool(uint64_t, const crypto::hash&, const cryptonote::block&)> f) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+
+  for (uint64_t height = 0; ; ++height)
+  {
+    blobdata bd;
+    crypto::hash hash;
+    {
+      read_lock lock(m_lock);
+      if (height >= m_blocks.size())
+        break;
+      bd = m_blocks[height].blob;
+      hash = m_blocks[height].hash;
+    }
+    block b;
+    block_from_blob(bd, b);
+    if (!f(height, hash, b))
+      return false;
+  }
+  return true;
+}
+
+bool BlockchainMemory::for_all_transactions(std::function<bool(const crypto::hash&, const cryptonote::transaction&)> f) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+
+  for (uint64_t tx_id = 0; ; ++tx_id)
+  {
+    blobdata bd, prunable;
+    bool pruned;
+    crypto::hash hash;
+    {
+      read_lock lock(m_lock);
+      if (tx_id >= m_txs.size())
+        break;
+      const mem_tx &mtx = m_txs[tx_id];
+      bd = mtx.blob;
+      prunable = mtx.prunable;
+      pruned = mtx.pruned;
+      hash = mtx.hash;
+    }
+    transaction tx;
+    tx_from_blobs(bd, pruned ? NULL : &prunable, tx);
+    if (!f(hash, tx))
+      return false;
+  }
+  return true;
+}
+
+bool BlockchainMemory::for_all_outputs(std::function<bool(uint64_t amount, const crypto::hash &tx_hash, size_t tx_idx)> f) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+
+  std::vector<uint64_t> amounts;
+  {
+    read_lock lock(m_lock);
+    amounts.reserve(m_output_amounts.size());
+    for (const auto &a: m_output_amounts)
+      amounts.push_back(a.first);
+  }
+
+  for (const uint64_t amount: amounts)
+  {
+    for (uint64_t index = 0; ; ++index)
+    {
+      tx_out_index toi;
+      {
+        read_lock lock(m_lock);
+        const auto a = m_output_amounts.find(amount);
+        if (a == m_output_amounts.end() || index >= a->second.size())
+          break;
+        const mem_output_tx &ot = m_output_txs[a->second[index].output_id];
+        toi = tx_out_index(ot.tx_hash, ot.local_index);
+      }
+      if (!f(amount, toi.first, toi.second))
+        return false;
+    }
+  }
+  return true;
+}
+
+bool BlockchainMemory::batch_start(uint64_t batch_num_blocks)
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  if (! m_batch_transactions)
+    throw0(DB_ERROR("batch transactions not enabled"));
+  check_open();
+  write_lock lock(m_lock);
+  if (m_batch_active)
+    return false;
+  if (m_write_txn)
+    throw0(DB_ERROR("batch transaction attempted, but m_write_txn already in use"));
+
+  m_writer = boost::this_thread::get_id();
+  m_batch_active = true;
+
+  LOG_PRINT_L3("batch transaction: begin");
+  return true;
+}
+
+void BlockchainMemory::batch_stop()
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  if (! m_batch_transactions)
+    throw0(DB_ERROR("batch transactions not enabled"));
+  check_open();
+  write_lock lock(m_lock);
+  if (! m_batch_active)
+    throw0(DB_ERROR("batch transaction not in progress"));
+
+  // everything is in already, there's only the undo log to drop
+  db_op_timer timer(m_op_stats, DB_OP_COMMIT);
+  m_undo.clear();
+  m_txn_markers.clear();
+  m_batch_active = false;
+  LOG_PRINT_L3("batch transaction: end");
+}
+
+void BlockchainMemory::batch_abort()
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  if (! m_batch_transactions)
+    throw0(DB_ERROR("batch transactions not enabled"));
+  check_open();
+  write_lock lock(m_lock);
+  if (! m_batch_active)
+    throw0(DB_ERROR("batch transaction not in progress"));
+
+  rollback(0);
+  m_txn_markers.clear();
+  m_batch_active = false;
+  LOG_PRINT_L3("batch transaction: aborted");
+}
+
+void BlockchainMemory::set_batch_transactions(bool batch_transactions)
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  if ((batch_transactions) && (m_batch_transactions))
+  {
+    LOG_PRINT_L0("WARNING: batch transaction mode already enabled, but asked to enable batch mode");
+  }
+  m_batch_transactions = batch_transactions;
+  LOG_PRINT_L3("batch transactions " << (m_batch_transactions ? "enabled" : "disabled"));
+}
+
+void BlockchainMemory::block_txn_start(bool readonly)
+{
+  // reads need no txn
+  if (readonly)
+    return;
+
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  write_lock lock(m_lock);
+  if (! m_batch_active && m_write_txn)
+    throw0(DB_ERROR_TXN_START((std::string("Attempted to start new write txn when write txn already exists in ")+__FUNCTION__).c_str()));
+  if (! m_batch_active)
+  {
+    m_writer = boost::this_thread::get_id();
+    m_write_txn = true;
+  }
+  else if (m_writer == boost::this_thread::get_id())
+  {
+    // a block in a batch gets a nested txn, so if it fails halfway through
+    // it is rolled back alone and the blocks before it stay in the batch
+    m_txn_markers.push_back(m_undo.size());
+  }
+}
+
+void BlockchainMemory::block_txn_stop()
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  write_lock lock(m_lock);
+  if (m_writer != boost::this_thread::get_id())
+    return;
+  if (m_write_txn)
+  {
+    db_op_timer timer(m_op_stats, DB_OP_COMMIT);
+    m_undo.clear();
+    m_write_txn = false;
+  }
+  else if (m_batch_active && !m_txn_markers.empty())
+  {
+    // the changes now belong to the batch
+    m_txn_markers.pop_back();
+  }
+}
+
+void BlockchainMemory::block_txn_abort()
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  write_lock lock(m_lock);
+  if (m_writer != boost::this_thread::get_id())
+    return;
+  if (m_write_txn)
+  {
+    rollback(0);
+    m_write_txn = false;
+  }
+  else if (m_batch_active && !m_txn_markers.empty())
+  {
+    rollback(m_txn_markers.back());
+    m_txn_markers.pop_back();
+  }
+}
+
+uint64_t BlockchainMemory::add_block(const block& blk, const size_t& block_size, const difficulty_type& cumulative_difficulty, const uint64_t& coins_generated,
+    const std::vector<transaction>& txs)
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  uint64_t m_height = height();
+
+  try
+  {
+    BlockchainDB::add_block(blk, block_size, cumulative_difficulty, coins_generated, txs);
+  }
+  catch (DB_ERROR_TXN_START& e)
+  {
+    throw;
+  }
+  catch (...)
+  {
+    block_txn_abort();
+    throw;
+  }
+
+  return ++m_height;
+}
+
+void BlockchainMemory::pop_block(block& blk, std::vector<transaction>& txs)
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+
+  block_txn_start(false);
+
+  try
+  {
+    BlockchainDB::pop_block(blk, txs);
+    block_txn_stop();
+  }
+  catch (...)
+  {
+    block_txn_abort();
+    throw;
+  }
+}
+
+std::map<uint64_t, std::tuple<uint64_t, uint64_t, uint64_t>> BlockchainMemory::get_output_histogram(const std::vector<uint64_t> &amounts, bool unlocked, uint64_t recent_cutoff) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  read_lock lock(m_lock);
+
+  std::map<uint64_t, std::tuple<uint64_t, uint64_t, uint64_t>> histogram;
+  if (amounts.empty())
+  {
+    for (const auto &a: m_output_amounts)
+      histogram[a.first] = std::make_tuple(a.second.size(), 0, 0);
+  }
+  else
+  {
+    for (const auto &amount: amounts)
+    {
+      const auto a = m_output_amounts.find(amount);
+      histogram[amount] = std::make_tuple(a == m_output_amounts.end() ? 0 : a->second.size(), 0, 0);
+    }
+  }
+
+  if (unlocked || recent_cutoff > 0) {
+    // outputs are unlocked in blocks below unlocked_height, as for
+    // Blockchain::get_num_unlocked_outputs
+    const uint64_t blockchain_height = m_blocks.size();
+    const uint64_t unlocked_height = blockchain_height > CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE ?
+        blockchain_height - CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE : 0;
+
+    // outputs are recent from the first block at or after the cutoff;
+    // block timestamps are only roughly ordered, which is near enough here
+    uint64_t recent_height = unlocked_height;
+    if (recent_cutoff > 0)
+    {
+      recent_height = std::partition_point(m_blocks.begin(), m_blocks.begin() + unlocked_height,
+          [recent_cutoff](const mem_block &mb) { return mb.timestamp < recent_cutoff; }) - m_blocks.begin();
+    }
+
+    for (auto &entry: histogram)
+    {
+      if (std::get<0>(entry.second) == 0)
+        continue;
+      const uint64_t num_unlocked = num_outputs_below_height(entry.first, unlocked_height);
+      std::get<1>(entry.second) = num_unlocked;
+      if (recent_cutoff > 0)
+        std::get<2>(entry.second) = num_unlocked - std::min(num_unlocked, num_outputs_below_height(entry.first, recent_height));
+    }
+  }
+
+  return histogram;
+}
+
+uint64_t BlockchainMemory::get_num_outputs_below_height(const uint64_t& amount, const uint64_t& height) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  read_lock lock(m_lock);
+
+  return num_outputs_below_height(amount, height);
+}
+
+void BlockchainMemory::get_output_distribution(const uint64_t& amount, const uint64_t& from_height, const uint64_t& to_height, std::vector<uint64_t>& distribution, uint64_t& base) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  read_lock lock(m_lock);
+
+  distribution.clear();
+  base = num_outputs_below_height(amount, from_height);
+  if (from_height > to_height)
+    return;
+
+  block_at(to_height);
+  distribution.reserve(to_height - from_height + 1);
+
+  if (amount == 0)
+  {
+    // the per-block RingCT counts are the distribution already
+    for (uint64_t height = from_height; height <= to_height; ++height)
+      distribution.push_back(m_blocks[height].cumulative_rct_outputs);
+  }
+  else
+  {
+    // count the outputs in each block, starting from the first one at
+    // from_height, then accumulate; output heights are one past their block's
+    distribution.resize(to_height - from_height + 1, 0);
+    const auto a = m_output_amounts.find(amount);
+    if (a != m_output_amounts.end())
+    {
+      for (uint64_t index = base; index < a->second.size(); ++index)
+      {
+        const uint64_t height = a->second[index].data.height - 1;
+        if (height > to_height)
+          break;
+        ++distribution[height - from_height];
+      }
+    }
+    uint64_t total = base;
+    for (auto &n: distribution)
+    {
+      total += n;
+      n = total;
+    }
+  }
+}
+
+uint64_t BlockchainMemory::prune_blockchain(uint64_t keep_blocks)
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  write_lock lock(m_lock);
+
+  const uint64_t m_height = m_blocks.size();
+  if (m_height <= keep_blocks)
+    return 0;
+  const uint64_t prune_height = m_height - keep_blocks;
+  if (m_pruned_height >= prune_height)
+    return 0;
+
+  const uint64_t pruned_height = m_pruned_height;
+  uint64_t num_pruned = 0;
+  for (uint64_t h = pruned_height; h < prune_height; ++h)
+  {
+    const uint64_t end_tx_id = h + 1 < m_height ? m_blocks[h + 1].first_tx_id : m_txs.size();
+
+    // the miner tx has nothing prunable
+    for (uint64_t tx_id = m_blocks[h].first_tx_id + 1; tx_id < end_tx_id; ++tx_id)
+    {
+      mem_tx &mtx = m_txs[tx_id];
+      // empty data is kept, only a tx which had some is marked as pruned
+      if (mtx.pruned || mtx.prunable.empty())
+        continue;
+      const auto prunable = std::make_shared<blobdata>();
+      prunable->swap(mtx.prunable);
+      mtx.pruned = true;
+      log_undo([this, tx_id, prunable]() {
+        m_txs[tx_id].prunable = *prunable;
+        m_txs[tx_id].pruned = false;
+      });
+      ++num_pruned;
+    }
+  }
+
+  m_pruned_height = prune_height;
+  log_undo([this, pruned_height]() {
+    m_pruned_height = pruned_height;
+  });
+
+  return num_pruned;
+}
+
+void BlockchainMemory::get_stats(db_stats_t& stats) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+
+  BlockchainDB::get_stats(stats);
+
+  read_lock lock(m_lock);
+  uint64_t num_outputs = 0;
+  for (const auto &a: m_output_amounts)
+    num_outputs += a.second.size();
+  // the containers stand in for tables, with only their entries to count
+  const std::pair<const char*, uint64_t> tables[] = {
+    {"blocks", m_blocks.size()},
+    {"txs", m_txs.size()},
+    {"output_amounts", num_outputs},
+    {"spent_keys", m_spent_keys.size()},
+    {"hf_versions", m_hf_versions.size()},
+  };
+  for (const auto &table: tables)
+  {
+    db_table_stats_t t = db_table_stats_t();
+    t.name = table.first;
+    t.entries = table.second;
+    stats.tables.push_back(t);
+  }
+}
+
+void BlockchainMemory::check_hard_fork_info()
+{
+}
+
+void BlockchainMemory::drop_hard_fork_info()
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  write_lock lock(m_lock);
+
+  const auto versions = std::make_shared<std::vector<uint8_t>>();
+  versions->swap(m_hf_versions);
+  log_undo([this, versions]() {
+    m_hf_versions = *versions;
+  });
+}
+
+void BlockchainMemory::set_hard_fork_version(uint64_t height, uint8_t version)
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  write_lock lock(m_lock);
+
+  const size_t old_size = m_hf_versions.size();
+  if (height >= old_size)
+    m_hf_versions.resize(height + 1, 0);
+  const uint8_t old_version = m_hf_versions[height];
+  m_hf_versions[height] = version;
+
+  log_undo([this, height, old_version, old_size]() {
+    m_hf_versions[height] = old_version;
+    m_hf_versions.resize(old_size);
+  });
+}
+
+uint8_t BlockchainMemory::get_hard_fork_version(uint64_t height) const
+{
+  LOG_PRINT_L3("BlockchainMemory::" << __func__);
+  check_open();
+  read_lock lock(m_lock);
+
+  if (height >= m_hf_versions.size() || m_hf_versions[height] == 0)
+    throw0(DB_ERROR(("Error attempting to retrieve a hard fork version at height " + boost::lexical_cast<std::string>(height) + " from the db").c_str()));
+  return m_hf_versions[height];
+}
+
+}  // namespace cryptonote
@@ -0,0 +1,323 @@
+// Copyright (c) 2014-2017, The Monero Project
+// Copyright (c) 2017, SUMOKOIN
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#pragma once
+
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "blockchain_db/blockchain_db.h"
+#include "cryptonote_protocol/blobdatatype.h" // for type blobdata
+
+namespace cryptonote
+{
+
+// A BlockchainDB kept entirely in memory, for benchmarking validation apart
+// from storage costs, and for short-lived nodes.  Nothing is written to disk,
+// so the chain is lost when the db is closed.
+//
+// Everything indexed by a dense number (height, tx id, global output index,
+// amount index) is kept in a vector at that index, so lookups are a single
+// array access.  Hashes and key images go in hash tables.
+//
+// Write transactions are emulated with an undo log: while a block txn or a
+// batch is open, every change records how to revert itself, and aborting runs
+// those back to where the txn started.  A block txn started within a batch is
+// nested, so a block which fails halfway is rolled back alone, as with LMDB.
+//
+// Each call takes a lock on the containers, but readers are not isolated
+// from a write txn in progress: another thread may see a block which is being
+// added before it is complete.  The Blockchain and pool locks already keep
+// the daemon's readers away from a block while it is being added.
+class BlockchainMemory : public BlockchainDB
+{
+public:
+  BlockchainMemory(bool batch_transactions=true);
+  ~BlockchainMemory();
+
+  virtual void open(const std::string& filename, const int db_flags=0);
+
+  virtual void close();
+
+  virtual void sync();
+
+  virtual void reset();
+
+  virtual std::vector<std::string> get_filenames() const;
+
+  virtual std::string get_db_name() const;
+
+  virtual bool lock();
+
+  virtual void unlock();
+
+  virtual bool block_exists(const crypto::hash& h, uint64_t *height = NULL) const;
+
+  virtual block get_block(const crypto::hash& h) const;
+
+  virtual uint64_t get_block_height(const crypto::hash& h) const;
+
+  virtual block_header get_block_header(const crypto::hash& h) const;
+
+  virtual block get_block_from_height(const uint64_t& height) const;
+
+  virtual uint64_t get_block_timestamp(const uint64_t& height) const;
+
+  virtual uint64_t get_top_block_timestamp() const;
+
+  virtual size_t get_block_size(const uint64_t& height) const;
+
+  virtual difficulty_type get_block_cumulative_difficulty(const uint64_t& height) const;
+
+  virtual difficulty_type get_block_difficulty(const uint64_t& height) const;
+
+  virtual uint64_t get_block_already_generated_coins(const uint64_t& height) const;
+
+  virtual crypto::hash get_block_hash_from_height(const uint64_t& height) const;
+
+  virtual std::vector<block> get_blocks_range(const uint64_t& h1, const uint64_t& h2) const;
+
+  virtual std::vector<crypto::hash> get_hashes_range(const uint64_t& h1, const uint64_t& h2) const;
+
+  virtual void get_block_info_range(const uint64_t& h1, const uint64_t& h2, std::vector<block_info_t>& infos, unsigned int fields = BI_ALL) const;
+
+  virtual void get_block_blobs_range(const uint64_t& h1, const uint64_t& h2, std::vector<block_blobs_t>& blocks, bool get_output_indices) const;
+
+  virtual crypto::hash top_block_hash() const;
+
+  virtual block get_top_block() const;
+
+  virtual uint64_t height() const;
+
+  virtual bool tx_exists(const crypto::hash& h) const;
+  virtual bool tx_exists(const crypto::hash& h, uint64_t& tx_index) const;
+
+  virtual uint64_t get_tx_unlock_time(const crypto::hash& h) const;
+
+  virtual transaction get_tx(const crypto::hash& h) const;
+
+  virtual bool get_tx_blob(const crypto::hash& h, blobdata& bd) const;
+
+  virtual uint64_t get_tx_count() const;
+
+  virtual std::vector<transaction> get_tx_list(const std::vector<crypto::hash>& hlist) const;
+
+  virtual uint64_t get_tx_block_height(const crypto::hash& h) const;
+
+  virtual uint64_t get_num_outputs(const uint64_t& amount) const;
+
+  virtual output_data_t get_output_key(const uint64_t& amount, const uint64_t& index);
+  virtual output_data_t get_output_key(const uint64_t& global_index) const;
+  virtual void get_output_key(const uint64_t &amount, const std::vector<uint64_t> &offsets, std::vector<output_data_t> &outputs);
+
+  virtual tx_out_index get_output_tx_and_index_from_global(const uint64_t& index) const;
+
+  virtual tx_out_index get_output_tx_and_index(const uint64_t& amount, const uint64_t& index) const;
+  virtual void get_output_tx_and_index(const uint64_t& amount, const std::vector<uint64_t> &offsets, std::vector<tx_out_index> &indices) const;
+
+  virtual std::vector<uint64_t> get_tx_amount_output_indices(const uint64_t tx_id) const;
+
+  virtual bool has_key_image(const crypto::key_image& img) const;
+
+  virtual bool for_all_key_images(std::function<bool(const crypto::key_image&)>) const;
+  virtual bool for_all_blocks(std::function<bool(uint64_t, const crypto::hash&, const cryptonote::block&)>) const;
+  virtual bool for_all_transactions(std::function<bool(const crypto::hash&, const cryptonote::transaction&)>) const;
+  virtual bool for_all_outputs(std::function<bool(uint64_t amount, const crypto::hash &tx_hash, size_t tx_idx)> f) const;
+
+  virtual uint64_t add_block( const block& blk
+                            , const size_t& block_size
+                            , const difficulty_type& cumulative_difficulty
+                            , const uint64_t& coins_generated
+                            , const std::vector<transaction>& txs
+                            );
+
+  virtual void set_batch_transactions(bool batch_transactions);
+  virtual bool batch_start(uint64_t batch_num_blocks=0);
+  virtual void batch_stop();
+  virtual void batch_abort();
+  virtual bool can_nest_block_txns() const { return true; }
+
+  virtual void block_txn_start(bool readonly);
+  virtual void block_txn_stop();
+  virtual void block_txn_abort();
+
+  virtual void pop_block(block& blk, std::vector<transaction>& txs);
+
+  virtual bool can_thread_bulk_indices() const { return true; }
+
+  /**
+   * @brief return a histogram of outputs on the blockchain
+   *
+   * @param amounts optional set of amounts to lookup
+   * @param unlocked whether to restrict count to unlocked outputs
+   * @param recent_cutoff timestamp to determine which outputs are recent
+   *
+   * @return a set of amount/instances
+   */
+  std::map<uint64_t, std::tuple<uint64_t, uint64_t, uint64_t>> get_output_histogram(const std::vector<uint64_t> &amounts, bool unlocked, uint64_t recent_cutoff) const;
+
+  virtual uint64_t get_num_outputs_below_height(const uint64_t& amount, const uint64_t& height) const;
+
+  virtual void get_output_distribution(const uint64_t& amount, const uint64_t& from_height, const uint64_t& to_height, std::vector<uint64_t>& distribution, uint64_t& base) const;
+
+  virtual uint64_t prune_blockchain(uint64_t keep_blocks);
+
+  virtual void get_stats(db_stats_t& stats) const;
+
+private:
+  struct mem_block
+  {
+    blobdata        blob;
+    uint64_t        timestamp;
+    uint64_t        coins_generated;
+    uint64_t        size;
+    difficulty_type cumulative_difficulty;
+    crypto::hash    hash;
+    uint64_t        cumulative_rct_outputs;
+    uint8_t         major_version;
+    uint8_t         minor_version;
+    uint64_t        first_tx_id;  // the miner tx's, the block's txs follow it
+  };
+
+  struct mem_tx
+  {
+    crypto::hash          hash;
+    blobdata              blob;      // the part kept by pruning
+    blobdata              prunable;  // the rest, if not pruned
+    bool                  pruned;
+    uint64_t              unlock_time;
+    uint64_t              block_id;
+    std::vector<uint64_t> amount_output_indices;
+  };
+
+  struct mem_output
+  {
+    uint64_t      output_id;
+    output_data_t data;  // the commitment is only set for RingCT outputs
+  };
+
+  struct mem_output_tx
+  {
+    crypto::hash tx_hash;
+    uint64_t     local_index;
+    uint64_t     amount;
+    uint64_t     amount_index;
+  };
+
+  virtual void add_block( const block& blk
+                , const size_t& block_size
+                , const difficulty_type& cumulative_difficulty
+                , const uint64_t& coins_generated
+                , uint64_t num_rct_outs
+                , const crypto::hash& block_hash
+                );
+
+  virtual void remove_block();
+
+  virtual uint64_t add_transaction_data(const crypto::hash& blk_hash, const transaction& tx, const crypto::hash& tx_hash);
+
+  virtual void remove_transaction_data(const crypto::hash& tx_hash, const transaction& tx);
+
+  virtual uint64_t add_output(const crypto::hash& tx_hash,
+      const tx_out& tx_output,
+      const uint64_t& local_index,
+      const uint64_t unlock_time,
+      const rct::key *commitment
+      );
+
+  virtual void add_tx_amount_output_indices(const uint64_t tx_id,
+      const std::vector<uint64_t>& amount_output_indices
+      );
+
+  virtual void add_spent_key(const crypto::key_image& k_image);
+
+  virtual void remove_spent_key(const crypto::key_image& k_image);
+
+  // Hard fork
+  virtual void set_hard_fork_version(uint64_t height, uint8_t version);
+  virtual uint8_t get_hard_fork_version(uint64_t height) const;
+  virtual void check_hard_fork_info();
+  virtual void drop_hard_fork_info();
+
+  void check_open() const;
+
+  virtual bool is_read_only() const;
+
+  // the helpers below expect m_lock to be held by the caller
+
+  // record how to revert a change, if a write txn or batch is open
+  void log_undo(std::function<void()> undo);
+
+  // revert the changes logged after the given undo log position
+  void rollback(size_t marker);
+
+  void clear();
+
+  const mem_block& block_at(uint64_t height) const;
+
+  const mem_tx& tx_by_hash(const crypto::hash& h) const;
+
+  const mem_output& output_at(uint64_t amount, uint64_t index) const;
+
+  uint64_t num_outputs_below_height(uint64_t amount, uint64_t height) const;
+
+  mutable boost::shared_mutex m_lock;
+
+  std::vector<mem_block> m_blocks;
+  std::unordered_map<crypto::hash, uint64_t> m_block_heights;
+
+  std::vector<mem_tx> m_txs;
+  std::unordered_map<crypto::hash, uint64_t> m_tx_indices;
+
+  // outputs of each amount, in amount index order
+  std::map<uint64_t, std::vector<mem_output>> m_output_amounts;
+  std::vector<mem_output_tx> m_output_txs;
+
+  std::unordered_set<crypto::key_image> m_spent_keys;
+
+  std::vector<uint8_t> m_hf_versions;  // 0 where not set
+
+  uint64_t m_pruned_height;  // blocks below this have been pruned already
+
+  std::string m_folder;
+
+  std::vector<std::function<void()>> m_undo;  // reverts changes, newest last
+  std::vector<size_t> m_txn_markers;  // undo log positions where open txns started
+  bool m_write_txn;  // whether a block txn outside of a batch is open
+  boost::thread::id m_writer;
+
+  bool m_batch_transactions; // support for batch transactions
+  bool m_batch_active; // whether batch transaction is in progress
+};
+
+}  // namespace cryptonote
@@ -589,10 +589,8 @@ int import_from_file(FakeCore& simple_core, const std::string& import_file_path,
 int main(int argc, char* argv[])
 {
   std::string default_db_type = "lmdb";
-  std::string default_db_engine_compiled = "blockchain_db";
 
   std::unordered_set<std::string> db_types_all = cryptonote::blockchain_db_types;
-  db_types_all.insert("memory");
 
   std::string available_dbs = join_set_strings(db_types_all, ", ");
   available_dbs = "available: " + available_dbs;
@@ -737,7 +735,6 @@ int main(int argc, char* argv[])
 
 
   std::string db_type;
-  std::string db_engine_compiled;
   int db_flags = 0;
   int res = 0;
   res = parse_db_arguments(db_arg_str, db_type, db_flags);
@@ -753,15 +750,6 @@ int main(int argc, char* argv[])
     return 1;
   }
 
-  if ((db_type == "lmdb") || (db_type == "berkeley"))
-  {
-    db_engine_compiled = "blockchain_db";
-  }
-  else
-  {
-    db_engine_compiled = "memory";
-  }
-
   LOG_PRINT_L0("database: " << db_type);
   LOG_PRINT_L0("database flags: " << db_flags);
   LOG_PRINT_L0("verify:  " << std::boolalpha << opt_verify << std::noboolalpha);
@@ -790,19 +778,6 @@ int main(int argc, char* argv[])
   // properties to do so. Both ways work, but fake core isn't necessary in that
   // circumstance.
 
-  // for multi_db_runtime:
-  if (db_type == "lmdb" || db_type == "berkeley")
-  {
-    fake_core_db simple_core(m_config_folder, opt_testnet, opt_batch, db_type, db_flags);
-    import_from_file(simple_core, import_file_path, block_stop);
-  }
-  else
-  {
-    std::cerr << "database type unrecognized" << ENDL;
-    return 1;
-  }
-
-  // for multi_db_compile:
   fake_core_db simple_core(m_config_folder, opt_testnet, opt_batch, db_type, db_flags);
 
   if (! vm["pop-blocks"].defaulted())
@@ -104,6 +104,29 @@ void BlocksdatFile::write_block(const crypto::hash& block_hash)
   *m_raw_data_file << data;
 }
 
+// the exported hashes are trusted by --fast-sync-file, so make sure the
+// stored blocks hash to what the index says and chain together
+bool BlocksdatFile::verify_block(const crypto::hash &block_hash, const crypto::hash &prev_hash)
+{
+  block b;
+  if (!m_blockchain_storage->get_block_by_hash(block_hash, b))
+  {
+    LOG_PRINT_RED_L0("block " << m_cur_height << " not found: " << block_hash);
+    return false;
+  }
+  if (get_block_hash(b) != block_hash)
+  {
+    LOG_PRINT_RED_L0("block " << m_cur_height << " does not hash to its indexed hash " << block_hash);
+    return false;
+  }
+  if (m_cur_height > 0 && b.prev_id != prev_hash)
+  {
+    LOG_PRINT_RED_L0("block " << m_cur_height << " does not follow block " << prev_hash);
+    return false;
+  }
+  return true;
+}
+
 bool BlocksdatFile::close()
 {
   if (m_raw_data_file->fail())
@@ -135,20 +158,25 @@ bool BlocksdatFile::store_blockchain_raw(Blockchain* _blockchain_storage, tx_mem
     block_stop = m_blockchain_storage->get_current_blockchain_height() - 1;
     LOG_PRINT_L0("Using block height of source blockchain: " << block_stop);
   }
-  LOG_PRINT_L0("Storing blocks raw data...");
+  LOG_PRINT_L0("Storing and verifying block hashes...");
   if (!BlocksdatFile::open_writer(output_file, block_stop))
   {
     LOG_PRINT_RED_L0("failed to open raw file for write");
     return false;
   }
+  crypto::hash prev_hash = null_hash;
   for (m_cur_height = block_start; m_cur_height <= block_stop; ++m_cur_height)
   {
     // this method's height refers to 0-based height (genesis block = height 0)
     crypto::hash hash = m_blockchain_storage->get_block_id_by_height(m_cur_height);
-    write_block(hash);
-    if (m_cur_height % NUM_BLOCKS_PER_CHUNK == 0) {
-      num_blocks_written += NUM_BLOCKS_PER_CHUNK;
+    if (!verify_block(hash, prev_hash))
+    {
+      BlocksdatFile::close();
+      return false;
     }
+    write_block(hash);
+    prev_hash = hash;
+    ++num_blocks_written;
     if (m_cur_height % progress_interval == 0) {
       std::cout << refresh_string;
       std::cout << "block " << m_cur_height << "/" << block_stop << std::flush;
@@ -74,6 +74,7 @@ protected:
   bool initialize_file(uint64_t block_stop);
   bool close();
   void write_block(const crypto::hash &block_hash);
+  bool verify_block(const crypto::hash &block_hash, const crypto::hash &prev_hash);
 
 private:
 
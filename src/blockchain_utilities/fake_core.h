@@ -34,6 +34,7 @@
 #include "cryptonote_core/tx_pool.h"
 #include "blockchain_db/blockchain_db.h"
 #include "blockchain_db/lmdb/db_lmdb.h"
+#include "blockchain_db/memory/db_memory.h"
 #if defined(BERKELEY_DB)
 #include "blockchain_db/berkeleydb/db_bdb.h"
 #endif
@@ -60,8 +61,6 @@ struct fake_core_db
   // for multi_db_runtime:
   fake_core_db(const boost::filesystem::path &path, const bool use_testnet=false, const bool do_batch=true, const std::string& db_type="lmdb", const int db_flags=0) : m_pool(m_storage), m_storage(m_pool)
   {
-    m_pool.init(path.string());
-
     BlockchainDB* db = nullptr;
     if (db_type == "lmdb")
       db = new BlockchainLMDB();
@@ -69,6 +68,8 @@ struct fake_core_db
     else if (db_type == "berkeley")
       db = new BlockchainBDB();
 #endif
+    else if (db_type == "memory")
+      db = new BlockchainMemory();
     else
     {
       LOG_ERROR("Attempted to use non-existent database type: " << db_type);
@@ -99,6 +100,9 @@ struct fake_core_db
 
     m_storage.init(db, m_hardfork, use_testnet);
 
+    m_pool.init(path.string());
+    m_storage.clear_txpool_for_hash_check();
+
     if (do_batch)
       m_storage.get_db().set_batch_transactions(do_batch);
     support_batch = true;
@@ -104,6 +104,11 @@ namespace command_line
   , "Sync up most of the way by using embedded, known block hashes."
   , 1
   };
+  const command_line::arg_descriptor<std::string> arg_fast_sync_file = {
+    "fast-sync-file"
+  , "Sync up most of the way by using trusted block hashes from a file made by blockchain_export --blocksdat."
+  , ""
+  };
   const command_line::arg_descriptor<uint64_t> arg_prep_blocks_threads = {
     "prep-blocks-threads"
   , "Max number of threads to use when preparing block hashes in groups."
@@ -124,4 +129,34 @@ namespace command_line
   , "How many blocks to sync at once during chain synchronization."
   , BLOCKS_SYNCHRONIZING_DEFAULT_COUNT
   };
+  const command_line::arg_descriptor<size_t> arg_max_txpool_size  = {
+    "max-txpool-size"
+  , "Set maximum txpool size in bytes, the lowest fee per byte transactions are evicted past it."
+  , DEFAULT_TXPOOL_MAX_SIZE
+  };
+  const command_line::arg_descriptor<uint64_t> arg_alt_blocks_max_memory  = {
+    "alt-blocks-max-memory"
+  , "Approximate number of bytes of alternative blocks to keep, weakest chains are dropped first."
+  , CRYPTONOTE_ALT_BLOCKS_MAX_MEMORY
+  };
+  const command_line::arg_descriptor<uint64_t> arg_db_persist_alt_blocks  = {
+    "db-persist-alt-blocks"
+  , "Keep alternative blocks in the database across restarts."
+  , 1
+  };
+  const command_line::arg_descriptor<uint64_t> arg_db_max_size  = {
+    "db-max-size"
+  , "Maximum size of the database in MiB, reserved up front so it seldom needs resizing (0 for the default)."
+  , 0
+  };
+  const command_line::arg_descriptor<bool> arg_prune_blockchain  = {
+    "prune-blockchain"
+  , "Drop the prunable signature data of transactions in older blocks."
+  , false
+  };
+  const command_line::arg_descriptor<uint64_t> arg_prune_blockchain_keep_blocks  = {
+    "prune-blockchain-keep-blocks"
+  , "Number of recent blocks to keep whole when pruning."
+  , CRYPTONOTE_PRUNING_KEEP_BLOCKS
+  };
 }
@@ -217,8 +217,15 @@ namespace command_line
   extern const arg_descriptor<std::string> arg_db_type;
   extern const arg_descriptor<std::string> arg_db_sync_mode;
   extern const arg_descriptor<uint64_t> arg_fast_block_sync;
+  extern const arg_descriptor<std::string> arg_fast_sync_file;
   extern const arg_descriptor<uint64_t> arg_prep_blocks_threads;
   extern const arg_descriptor<uint64_t> arg_db_auto_remove_logs;
   extern const arg_descriptor<uint64_t> arg_show_time_stats;
   extern const arg_descriptor<size_t> arg_block_sync_size;
+  extern const arg_descriptor<size_t> arg_max_txpool_size;
+  extern const arg_descriptor<uint64_t> arg_alt_blocks_max_memory;
+  extern const arg_descriptor<uint64_t> arg_db_persist_alt_blocks;
+  extern const arg_descriptor<uint64_t> arg_db_max_size;
+  extern const arg_descriptor<bool> arg_prune_blockchain;
+  extern const arg_descriptor<uint64_t> arg_prune_blockchain_keep_blocks;
 }
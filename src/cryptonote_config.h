@@ -80,6 +80,9 @@
 #define DYNAMIC_FEE_PER_KB_BASE_BLOCK_REWARD            ((uint64_t)1000000) // 64 * pow(10, 9)
 
 #define ORPHANED_BLOCKS_MAX_COUNT                       100
+#define CRYPTONOTE_ALT_BLOCKS_MAX_MEMORY                ((uint64_t)64*1024*1024) //bytes of alternative blocks kept by default
+#define CRYPTONOTE_PRUNING_KEEP_BLOCKS                  10080 //recent blocks whose prunable tx data is kept when pruning, a week
+#define CRYPTONOTE_ALT_BLOCK_LIVETIME                   604800 //seconds, one week
 
 #define DIFFICULTY_TARGET                               60  // seconds
 #define DIFFICULTY_WINDOW                               93  // blocks
@@ -99,6 +102,8 @@
 
 #define CRYPTONOTE_MEMPOOL_TX_LIVETIME                  86400 //seconds, one day
 #define CRYPTONOTE_MEMPOOL_TX_FROM_ALT_BLOCK_LIVETIME   604800 //seconds, one week
+#define DEFAULT_TXPOOL_MAX_SIZE                         ((size_t)648000000) //bytes, about 3 days of full 300KB blocks
+#define TXPOOL_CHANGES_LOG_SIZE                         10000 //pool changes kept for clients polling for changes
 
 #define COMMAND_RPC_GET_BLOCKS_FAST_MAX_COUNT           100
 
@@ -119,6 +124,8 @@
 #define P2P_IP_BLOCKTIME                                (60*60*24)  //24 hour
 #define P2P_IP_FAILS_BEFORE_BLOCK                       10
 #define P2P_IDLE_CONNECTION_KILL_INTERVAL               (5*60)		//5 minutes
+#define P2P_TX_RELAY_BATCH_MAX_SIZE                     (256*1024)  //bytes of txes in a single relay notification
+#define P2P_TX_RELAY_KNOWN_TXES_MAX                     20000       //txes remembered as known per peer
 
 #define P2P_SUPPORT_FLAG_FLUFFY_BLOCKS                  0x01
 #define P2P_SUPPORT_FLAGS                               P2P_SUPPORT_FLAG_FLUFFY_BLOCKS
@@ -103,8 +103,8 @@ static const uint64_t testnet_hard_fork_version_1_till = (uint64_t)-1;
 
 //------------------------------------------------------------------
 Blockchain::Blockchain(tx_memory_pool& tx_pool) :
-  m_db(), m_tx_pool(tx_pool), m_hardfork(NULL), m_timestamps_and_difficulties_height(0), m_current_block_cumul_sz_limit(0), m_is_in_checkpoint_zone(false),
-  m_is_blockchain_storing(false), m_enforce_dns_checkpoints(false), m_max_prepare_blocks_threads(4), m_db_blocks_per_sync(1), m_db_sync_mode(db_async), m_fast_sync(true), m_show_time_stats(false), m_sync_counter(0), m_cancel(false)
+  m_db(), m_tx_pool(tx_pool), m_hardfork(NULL), m_timestamps(DIFFICULTY_BLOCKS_COUNT), m_difficulties(DIFFICULTY_BLOCKS_COUNT), m_timestamps_and_difficulties_height(0), m_current_block_cumul_sz_limit(0), m_is_in_checkpoint_zone(false),
+  m_is_blockchain_storing(false), m_enforce_dns_checkpoints(false), m_max_prepare_blocks_threads(4), m_db_blocks_per_sync(1), m_db_sync_mode(db_async), m_fast_sync(true), m_show_time_stats(false), m_sync_counter(0), m_alt_blocks_memory(0), m_alt_blocks_max_memory(CRYPTONOTE_ALT_BLOCKS_MAX_MEMORY), m_persist_alt_blocks(false), m_prune_keep_blocks(0), m_cancel(false), m_incoming_batch(false)
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
 }
@@ -337,6 +337,14 @@ bool Blockchain::init(BlockchainDB* db, const bool testnet, const cryptonote::te
     m_db->fixup();
   }
 
+  if (m_prune_keep_blocks && !m_db->is_read_only())
+  {
+    // catch up on blocks added while not pruning
+    uint64_t num_pruned = m_db->prune_blockchain(m_prune_keep_blocks);
+    if (num_pruned)
+      LOG_PRINT_L0("Pruned " << num_pruned << " transactions");
+  }
+
   m_db->block_txn_start(true);
   // check how far behind we are
   uint64_t top_block_timestamp = m_db->get_top_block_timestamp();
@@ -357,6 +365,11 @@ bool Blockchain::init(BlockchainDB* db, const bool testnet, const cryptonote::te
     load_compiled_in_block_hashes();
 #endif
 
+  if (m_persist_alt_blocks && !fakechain)
+    load_alt_blocks();
+
+  sync_rct_outputs_distribution();
+
   LOG_PRINT_GREEN("Blockchain initialized. last block: " << m_db->height() - 1 << ", " << epee::misc_utils::get_time_interval_string(timestamp_diff) << " time ago, current difficulty: " << get_difficulty_for_next_block(), LOG_LEVEL_0);
   m_db->block_txn_stop();
 
@@ -403,6 +416,113 @@ bool Blockchain::store_blockchain()
   return true;
 }
 //------------------------------------------------------------------
+void Blockchain::async_store_blockchain()
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  try
+  {
+    store_blockchain();
+  }
+  catch (const std::exception &e)
+  {
+    LOG_ERROR("Error syncing blockchain db: " << e.what());
+  }
+  m_sync_pending.clear();
+}
+//------------------------------------------------------------------
+bool Blockchain::start_db_snapshot(const std::string &path, bool compact, std::string &error)
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  boost::unique_lock<boost::mutex> lock(m_snapshot_lock);
+  if (m_snapshot.running)
+  {
+    error = "A snapshot is being saved to " + m_snapshot.path + " already";
+    return false;
+  }
+  if (m_snapshot_thread.joinable())
+    m_snapshot_thread.join();
+
+  // what the copy will take, as far as can be told beforehand
+  db_stats_t stats;
+  m_db->get_stats(stats);
+  uint64_t estimate = stats.map_used;
+  if (compact)
+  {
+    // the meta pages, then the pages in use
+    estimate = 2 * stats.page_size;
+    for (const auto &t: stats.tables)
+      estimate += (t.branch_pages + t.leaf_pages + t.overflow_pages) * stats.page_size;
+  }
+
+  m_snapshot = db_snapshot_status();
+  m_snapshot.running = true;
+  m_snapshot.path = path;
+  m_snapshot.compact = compact;
+  m_snapshot.bytes_estimate = estimate;
+  m_snapshot.start_time = time(NULL);
+  m_snapshot_thread = boost::thread(&Blockchain::save_db_snapshot, this);
+  return true;
+}
+//------------------------------------------------------------------
+void Blockchain::save_db_snapshot()
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  std::string path;
+  bool compact;
+  {
+    boost::unique_lock<boost::mutex> lock(m_snapshot_lock);
+    path = m_snapshot.path;
+    compact = m_snapshot.compact;
+  }
+
+  LOG_PRINT_L0("Saving " << (compact ? "a compacted" : "a") << " db snapshot to " << path);
+  TIME_MEASURE_START(t);
+  std::string error;
+  try
+  {
+    if (!m_db->copy(path, compact))
+      error = "This database type does not support snapshots";
+  }
+  catch (const std::exception &e)
+  {
+    error = e.what();
+  }
+  TIME_MEASURE_FINISH(t);
+
+  if (error.empty())
+    LOG_PRINT_L0("db snapshot saved to " << path << ", took " << t << " ms");
+  else
+    LOG_ERROR("Failed to save a db snapshot to " << path << ": " << error);
+
+  boost::unique_lock<boost::mutex> lock(m_snapshot_lock);
+  m_snapshot.running = false;
+  m_snapshot.end_time = time(NULL);
+  m_snapshot.error = error;
+}
+//------------------------------------------------------------------
+Blockchain::db_snapshot_status Blockchain::get_db_snapshot_status() const
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  db_snapshot_status status;
+  {
+    boost::unique_lock<boost::mutex> lock(m_snapshot_lock);
+    status = m_snapshot;
+  }
+  if (status.path.empty())
+    return status;
+
+  // the copy is written to files in the directory as it goes
+  boost::system::error_code ec;
+  for (boost::filesystem::directory_iterator i(status.path, ec), end; !ec && i != end; i.increment(ec))
+  {
+    const uint64_t size = boost::filesystem::file_size(i->path(), ec);
+    if (!ec)
+      status.bytes_written += size;
+    ec.clear();
+  }
+  return status;
+}
+//------------------------------------------------------------------
 bool Blockchain::deinit()
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
@@ -414,6 +534,12 @@ bool Blockchain::deinit()
   m_async_pool.join_all();
   m_async_service.stop();
 
+  if (m_snapshot_thread.joinable())
+  {
+    LOG_PRINT_L0("Waiting for the db snapshot to be saved");
+    m_snapshot_thread.join();
+  }
+
   // as this should be called if handling a SIGSEGV, need to check
   // if m_db is a NULL pointer (and thus may have caused the illegal
   // memory operation), otherwise we may cause a loop.
@@ -449,8 +575,6 @@ block Blockchain::pop_block_from_blockchain()
   LOG_PRINT_L3("Blockchain::" << __func__);
   CRITICAL_REGION_LOCAL(m_blockchain_lock);
 
-  m_timestamps_and_difficulties_height = 0;
-
   block popped_block;
   std::vector<transaction> popped_txs;
 
@@ -462,15 +586,23 @@ block Blockchain::pop_block_from_blockchain()
   // so we re-throw
   catch (const std::exception& e)
   {
+    m_timestamps_and_difficulties_height = 0;
+    m_rct_outputs_distribution.clear();
     LOG_ERROR("Error popping block from blockchain: " << e.what());
     throw;
   }
   catch (...)
   {
+    m_timestamps_and_difficulties_height = 0;
+    m_rct_outputs_distribution.clear();
     LOG_ERROR("Error popping block from blockchain, throwing!");
     throw;
   }
 
+  pop_difficulty_window(m_db->height());
+  if (m_rct_outputs_distribution.size() > m_db->height())
+    m_rct_outputs_distribution.pop_back();
+
   // return transactions from popped block to the tx_pool
   for (transaction& tx : popped_txs)
   {
@@ -511,7 +643,10 @@ bool Blockchain::reset_and_set_genesis_block(const block& b)
   LOG_PRINT_L3("Blockchain::" << __func__);
   CRITICAL_REGION_LOCAL(m_blockchain_lock);
   m_alternative_chains.clear();
+  m_alt_blocks_memory = 0;
   m_db->reset();
+  m_timestamps_and_difficulties_height = 0;
+  m_rct_outputs_distribution.clear();
   m_hardfork->init();
 
   block_verification_context bvc = boost::value_initialized<block_verification_context>();
@@ -627,10 +762,10 @@ bool Blockchain::get_block_by_hash(const crypto::hash &h, block &blk) const
   // try to find block in alternative chain
   catch (const BLOCK_DNE& e)
   {
-    blocks_ext_by_hash::const_iterator it_alt = m_alternative_chains.find(h);
+    alt_blocks_container::const_iterator it_alt = m_alternative_chains.find(h);
     if (m_alternative_chains.end() != it_alt)
     {
-      blk = it_alt->second.bl;
+      blk = it_alt->bei.bl;
       return true;
     }
   }
@@ -660,8 +795,8 @@ void Blockchain::get_all_known_block_ids(std::list<crypto::hash> &main, std::lis
     main.push_back(a);
   }
 
-  for (const blocks_ext_by_hash::value_type &v: m_alternative_chains)
-    alt.push_back(v.first);
+  for (const alt_block_entry &v: m_alternative_chains)
+    alt.push_back(v.id);
 
   for (const blocks_ext_by_hash::value_type &v: m_invalid_blocks)
     invalid.push_back(v.first);
@@ -675,51 +810,89 @@ difficulty_type Blockchain::get_difficulty_for_next_block()
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
   CRITICAL_REGION_LOCAL(m_blockchain_lock);
-  std::vector<uint64_t> timestamps;
-  std::vector<difficulty_type> difficulties;
   auto height = m_db->height();
-  size_t difficult_block_count = DIFFICULTY_BLOCKS_COUNT;
 
   // ND: Speedup
-  // 1. Keep a list of the last 735 (or less) blocks that is used to compute difficulty,
-  //    then when the next block difficulty is queried, push the latest height data and
-  //    pop the oldest one from the list. This only requires 1x read per height instead
-  //    of doing 735 (DIFFICULTY_BLOCKS_COUNT).
+  // 1. Keep a ring buffer of the last 735 (or less) blocks that is used to compute difficulty,
+  //    then when the next block difficulty is queried, push the latest height data, which
+  //    drops the oldest one from the buffer. This only requires 1x read per height instead
+  //    of doing 735 (DIFFICULTY_BLOCKS_COUNT), and repeated queries at the same height
+  //    need no read at all. Popped blocks are taken out again in pop_block_from_blockchain,
+  //    so reorgs do not force a full reload either.
   if (m_timestamps_and_difficulties_height != 0 && ((height - m_timestamps_and_difficulties_height) == 1))
   {
-    uint64_t index = height - 1;
-    m_timestamps.push_back(m_db->get_block_timestamp(index));
-    m_difficulties.push_back(m_db->get_block_cumulative_difficulty(index));
-
-    while (m_timestamps.size() > difficult_block_count)
-      m_timestamps.erase(m_timestamps.begin());
-    while (m_difficulties.size() > difficult_block_count)
-      m_difficulties.erase(m_difficulties.begin());
+    std::vector<block_info_t> infos;
+    m_db->get_block_info_range(height - 1, height - 1, infos, BI_TIMESTAMP | BI_CUMULATIVE_DIFFICULTY);
+    m_timestamps.push_back(infos.front().timestamp);
+    m_difficulties.push_back(infos.front().cumulative_difficulty);
 
     m_timestamps_and_difficulties_height = height;
-    timestamps = m_timestamps;
-    difficulties = m_difficulties;
   }
-  else
+  else if (m_timestamps_and_difficulties_height != height)
   {
-    size_t offset = height - std::min < size_t >(height, static_cast<size_t>(difficult_block_count));
-    if (offset == 0)
-      ++offset;
+    load_difficulty_window(height);
+  }
 
-    timestamps.clear();
-    difficulties.clear();
-    for (; offset < height; offset++)
+  std::vector<uint64_t> timestamps(m_timestamps.begin(), m_timestamps.end());
+  std::vector<difficulty_type> difficulties(m_difficulties.begin(), m_difficulties.end());
+  size_t target = DIFFICULTY_TARGET;
+  return next_difficulty(timestamps, difficulties, target);
+}
+//------------------------------------------------------------------
+void Blockchain::load_difficulty_window(uint64_t height)
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  size_t difficult_block_count = DIFFICULTY_BLOCKS_COUNT;
+
+  m_timestamps.clear();
+  m_difficulties.clear();
+
+  size_t offset = height - std::min < size_t >(height, static_cast<size_t>(difficult_block_count));
+  if (offset == 0)
+    ++offset;
+
+  if (offset < height)
+  {
+    std::vector<block_info_t> infos;
+    m_db->get_block_info_range(offset, height - 1, infos, BI_TIMESTAMP | BI_CUMULATIVE_DIFFICULTY);
+    for (const auto &bi : infos)
     {
-      timestamps.push_back(m_db->get_block_timestamp(offset));
-      difficulties.push_back(m_db->get_block_cumulative_difficulty(offset));
+      m_timestamps.push_back(bi.timestamp);
+      m_difficulties.push_back(bi.cumulative_difficulty);
     }
+  }
 
-    m_timestamps_and_difficulties_height = height;
-    m_timestamps = timestamps;
-    m_difficulties = difficulties;
+  m_timestamps_and_difficulties_height = height;
+}
+//------------------------------------------------------------------
+void Blockchain::pop_difficulty_window(uint64_t new_height)
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  size_t difficult_block_count = DIFFICULTY_BLOCKS_COUNT;
+
+  // the window was computed before the popped block was added, it is still valid
+  if (m_timestamps_and_difficulties_height == new_height)
+    return;
+
+  if (m_timestamps_and_difficulties_height == 0 || m_timestamps_and_difficulties_height != new_height + 1 || m_timestamps.empty())
+  {
+    m_timestamps_and_difficulties_height = 0;
+    return;
   }
-  size_t target = DIFFICULTY_TARGET;
-  return next_difficulty(timestamps, difficulties, target);
+
+  // drop the popped block, and bring back the block which slides into the window
+  m_timestamps.pop_back();
+  m_difficulties.pop_back();
+  if (new_height > difficult_block_count)
+  {
+    uint64_t index = new_height - difficult_block_count;
+    std::vector<block_info_t> infos;
+    m_db->get_block_info_range(index, index, infos, BI_TIMESTAMP | BI_CUMULATIVE_DIFFICULTY);
+    m_timestamps.push_front(infos.front().timestamp);
+    m_difficulties.push_front(infos.front().cumulative_difficulty);
+  }
+
+  m_timestamps_and_difficulties_height = new_height;
 }
 //------------------------------------------------------------------
 // This function removes blocks from the blockchain until it gets to the
@@ -736,8 +909,6 @@ bool Blockchain::rollback_blockchain_switching(std::list<block>& original_chain,
     return true;
   }
 
-  m_timestamps_and_difficulties_height = 0;
-
   // remove blocks from blockchain until we get back to where we should be.
   while (m_db->height() != rollback_height)
   {
@@ -767,18 +938,16 @@ bool Blockchain::rollback_blockchain_switching(std::list<block>& original_chain,
 //------------------------------------------------------------------
 // This function attempts to switch to an alternate chain, returning
 // boolean based on success therein.
-bool Blockchain::switch_to_alternative_blockchain(std::list<blocks_ext_by_hash::iterator>& alt_chain, bool discard_disconnected_chain)
+bool Blockchain::switch_to_alternative_blockchain(alt_chain_type& alt_chain, bool discard_disconnected_chain)
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
   CRITICAL_REGION_LOCAL(m_blockchain_lock);
 
-  m_timestamps_and_difficulties_height = 0;
-
   // if empty alt chain passed (not sure how that could happen), return false
   CHECK_AND_ASSERT_MES(alt_chain.size(), false, "switch_to_alternative_blockchain: empty chain passed");
 
   // verify that main chain has front of alt chain's parent block
-  if (!m_db->block_exists(alt_chain.front()->second.bl.prev_id))
+  if (!m_db->block_exists(alt_chain.front()->bei.bl.prev_id))
   {
     LOG_ERROR("Attempting to move to an alternate chain, but it doesn't appear to connect to the main chain!");
     return false;
@@ -787,7 +956,7 @@ bool Blockchain::switch_to_alternative_blockchain(std::list<blocks_ext_by_hash::
   // pop blocks from the blockchain until the top block is the parent
   // of the front block of the alt chain.
   std::list<block> disconnected_chain;
-  while (m_db->top_block_hash() != alt_chain.front()->second.bl.prev_id)
+  while (m_db->top_block_hash() != alt_chain.front()->bei.bl.prev_id)
   {
     block b = pop_block_from_blockchain();
     disconnected_chain.push_front(b);
@@ -802,7 +971,7 @@ bool Blockchain::switch_to_alternative_blockchain(std::list<blocks_ext_by_hash::
     block_verification_context bvc = boost::value_initialized<block_verification_context>();
 
     // add block to main chain
-    bool r = handle_block_to_main_chain(ch_ent->second.bl, bvc);
+    bool r = handle_block_to_main_chain(ch_ent->bei.bl, bvc);
 
     // if adding block to main chain failed, rollback to previous state and
     // return false
@@ -818,15 +987,17 @@ bool Blockchain::switch_to_alternative_blockchain(std::list<blocks_ext_by_hash::
       // FIXME: Why do we keep invalid blocks around?  Possibly in case we hear
       // about them again so we can immediately dismiss them, but needs some
       // looking into.
-      add_block_as_invalid(ch_ent->second, get_block_hash(ch_ent->second.bl));
-      LOG_PRINT_L1("The block was inserted as invalid while connecting new alternative chain, block_id: " << get_block_hash(ch_ent->second.bl));
-      m_alternative_chains.erase(*alt_ch_iter++);
+      add_block_as_invalid(ch_ent->bei, ch_ent->id);
+      LOG_PRINT_L1("The block was inserted as invalid while connecting new alternative chain, block_id: " << ch_ent->id);
 
-      for(auto alt_ch_to_orph_iter = alt_ch_iter; alt_ch_to_orph_iter != alt_chain.end(); )
+      for(auto alt_ch_to_orph_iter = std::next(alt_ch_iter); alt_ch_to_orph_iter != alt_chain.end(); ++alt_ch_to_orph_iter)
       {
-        add_block_as_invalid((*alt_ch_to_orph_iter)->second, (*alt_ch_to_orph_iter)->first);
-        m_alternative_chains.erase(*alt_ch_to_orph_iter++);
+        add_block_as_invalid((*alt_ch_to_orph_iter)->bei, (*alt_ch_to_orph_iter)->id);
       }
+
+      // the rest of the chain, and any other branch built on the invalid
+      // block, descends from it
+      remove_alt_block_subtree(ch_ent);
       return false;
     }
   }
@@ -851,7 +1022,7 @@ bool Blockchain::switch_to_alternative_blockchain(std::list<blocks_ext_by_hash::
   //removing alt_chain entries from alternative chains container
   for (auto ch_ent: alt_chain)
   {
-    m_alternative_chains.erase(ch_ent);
+    remove_alt_block(ch_ent);
   }
 
   m_hardfork->reorganize_from_chain_height(split_height);
@@ -862,7 +1033,7 @@ bool Blockchain::switch_to_alternative_blockchain(std::list<blocks_ext_by_hash::
 //------------------------------------------------------------------
 // This function calculates the difficulty target for the block being added to
 // an alternate chain.
-difficulty_type Blockchain::get_next_difficulty_for_alternative_chain(const std::list<blocks_ext_by_hash::iterator>& alt_chain, block_extended_info& bei) const
+difficulty_type Blockchain::get_next_difficulty_for_alternative_chain(const alt_chain_type& alt_chain, block_extended_info& bei) const
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
   std::vector<uint64_t> timestamps;
@@ -876,7 +1047,7 @@ difficulty_type Blockchain::get_next_difficulty_for_alternative_chain(const std:
     CRITICAL_REGION_LOCAL(m_blockchain_lock);
 
     // Figure out start and stop offsets for main chain blocks
-    size_t main_chain_stop_offset = alt_chain.size() ? alt_chain.front()->second.height : bei.height;
+    size_t main_chain_stop_offset = alt_chain.size() ? alt_chain.front()->bei.height : bei.height;
     size_t main_chain_count = difficult_block_count - std::min(static_cast<size_t>(difficult_block_count), alt_chain.size());
     main_chain_count = std::min(main_chain_count, main_chain_stop_offset);
     size_t main_chain_start_offset = main_chain_stop_offset - main_chain_count;
@@ -885,10 +1056,17 @@ difficulty_type Blockchain::get_next_difficulty_for_alternative_chain(const std:
       ++main_chain_start_offset; //skip genesis block
 
     // get difficulties and timestamps from relevant main chain blocks
-    for (; main_chain_start_offset < main_chain_stop_offset; ++main_chain_start_offset)
+    if (main_chain_start_offset < main_chain_stop_offset)
     {
-      timestamps.push_back(m_db->get_block_timestamp(main_chain_start_offset));
-      cumulative_difficulties.push_back(m_db->get_block_cumulative_difficulty(main_chain_start_offset));
+      std::vector<block_info_t> infos;
+      m_db->get_block_info_range(main_chain_start_offset, main_chain_stop_offset - 1, infos, BI_TIMESTAMP | BI_CUMULATIVE_DIFFICULTY);
+      timestamps.reserve(infos.size() + alt_chain.size());
+      cumulative_difficulties.reserve(infos.size() + alt_chain.size());
+      for (const auto &bi : infos)
+      {
+        timestamps.push_back(bi.timestamp);
+        cumulative_difficulties.push_back(bi.cumulative_difficulty);
+      }
     }
 
     // make sure we haven't accidentally grabbed too many blocks...maybe don't need this check?
@@ -896,8 +1074,8 @@ difficulty_type Blockchain::get_next_difficulty_for_alternative_chain(const std:
 
     for (auto it : alt_chain)
     {
-      timestamps.push_back(it->second.bl.timestamp);
-      cumulative_difficulties.push_back(it->second.cumulative_difficulty);
+      timestamps.push_back(it->bei.bl.timestamp);
+      cumulative_difficulties.push_back(it->bei.cumulative_difficulty);
     }
   }
   // if the alt chain is long enough for the difficulty calc, grab difficulties
@@ -911,8 +1089,8 @@ difficulty_type Blockchain::get_next_difficulty_for_alternative_chain(const std:
     // get difficulties and timestamps from most recent blocks in alt chain
     BOOST_REVERSE_FOREACH(auto it, alt_chain)
     {
-      timestamps[max_i - count] = it->second.bl.timestamp;
-      cumulative_difficulties[max_i - count] = it->second.cumulative_difficulty;
+      timestamps[max_i - count] = it->bei.bl.timestamp;
+      cumulative_difficulties[max_i - count] = it->bei.cumulative_difficulty;
       count++;
       if (count >= difficult_block_count)
         break;
@@ -1062,14 +1240,13 @@ void Blockchain::get_last_n_blocks_sizes(std::vector<size_t>& sz, size_t count)
   if(h == 0)
     return;
 
-  m_db->block_txn_start(true);
   // add size of last <count> blocks to vector <sz> (or less, if blockchain size < count)
   size_t start_offset = h - std::min<size_t>(h, count);
-  for(size_t i = start_offset; i < h; i++)
-  {
-    sz.push_back(m_db->get_block_size(i));
-  }
-  m_db->block_txn_stop();
+  std::vector<block_info_t> infos;
+  m_db->get_block_info_range(start_offset, h - 1, infos, BI_SIZE);
+  sz.reserve(sz.size() + infos.size());
+  for (const auto &bi: infos)
+    sz.push_back(bi.size);
 }
 //------------------------------------------------------------------
 uint64_t Blockchain::get_current_cumulative_blocksize_limit() const
@@ -1133,7 +1310,7 @@ bool Blockchain::create_block_template(block& b, const account_public_address& m
       LOG_ERROR("Creating block template: error: transaction not found");
       continue;
     }
-    tx_memory_pool::tx_details &cur_tx = cur_res->second;
+    const tx_memory_pool::tx_details &cur_tx = *cur_res->second;
     real_txs_size += cur_tx.blob_size;
     real_fee += cur_tx.fee;
     if (cur_tx.blob_size != get_object_blobsize(cur_tx.tx))
@@ -1253,10 +1430,14 @@ bool Blockchain::complete_timestamps_vector(uint64_t start_top_height, std::vect
   size_t need_elements = blockchain_timestamp_check_window - timestamps.size();
   CHECK_AND_ASSERT_MES(start_top_height < m_db->height(), false, "internal error: passed start_height not < " << " m_db->height() -- " << start_top_height << " >= " << m_db->height());
   size_t stop_offset = start_top_height > need_elements ? start_top_height - need_elements : 0;
-  while (start_top_height != stop_offset)
+  if (start_top_height != stop_offset)
   {
-    timestamps.push_back(m_db->get_block_timestamp(start_top_height));
-    --start_top_height;
+    // timestamps are appended from start_top_height downwards
+    std::vector<block_info_t> infos;
+    m_db->get_block_info_range(stop_offset + 1, start_top_height, infos, BI_TIMESTAMP);
+    timestamps.reserve(timestamps.size() + infos.size());
+    for (auto it = infos.rbegin(); it != infos.rend(); ++it)
+      timestamps.push_back(it->timestamp);
   }
   return true;
 }
@@ -1271,7 +1452,6 @@ bool Blockchain::handle_alternative_block(const block& b, const crypto::hash& id
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
   CRITICAL_REGION_LOCAL(m_blockchain_lock);
-  m_timestamps_and_difficulties_height = 0;
   uint64_t block_height = get_block_height(b);
   if(0 == block_height)
   {
@@ -1307,14 +1487,14 @@ bool Blockchain::handle_alternative_block(const block& b, const crypto::hash& id
     //we have new block in alternative chain
 
     //build alternative subchain, front -> mainchain, back -> alternative head
-    blocks_ext_by_hash::iterator alt_it = it_prev; //m_alternative_chains.find()
-    std::list<blocks_ext_by_hash::iterator> alt_chain;
+    //by following the parent links, which end at the main chain
+    const alt_block_entry *prev_entry = it_prev != m_alternative_chains.end() ? &*it_prev : NULL;
+    alt_chain_type alt_chain;
     std::vector<uint64_t> timestamps;
-    while(alt_it != m_alternative_chains.end())
+    for (const alt_block_entry *alt_it = prev_entry; alt_it; alt_it = alt_it->prev)
     {
       alt_chain.push_front(alt_it);
-      timestamps.push_back(alt_it->second.bl.timestamp);
-      alt_it = m_alternative_chains.find(alt_it->second.bl.prev_id);
+      timestamps.push_back(alt_it->bei.bl.timestamp);
     }
 
     // if block to be added connects to known blocks that aren't part of the
@@ -1322,20 +1502,20 @@ bool Blockchain::handle_alternative_block(const block& b, const crypto::hash& id
     if(alt_chain.size())
     {
       // make sure alt chain doesn't somehow start past the end of the main chain
-      CHECK_AND_ASSERT_MES(m_db->height() > alt_chain.front()->second.height, false, "main blockchain wrong height");
+      CHECK_AND_ASSERT_MES(m_db->height() > alt_chain.front()->height, false, "main blockchain wrong height");
 
       // make sure that the blockchain contains the block that should connect
       // this alternate chain with it.
-      if (!m_db->block_exists(alt_chain.front()->second.bl.prev_id))
+      if (!m_db->block_exists(alt_chain.front()->bei.bl.prev_id))
       {
         LOG_PRINT_L1("alternate chain does not appear to connect to main chain...");
         return false;
       }
 
       // make sure block connects correctly to the main chain
-      auto h = m_db->get_block_hash_from_height(alt_chain.front()->second.height - 1);
-      CHECK_AND_ASSERT_MES(h == alt_chain.front()->second.bl.prev_id, false, "alternative chain has wrong connection to main chain");
-      complete_timestamps_vector(m_db->get_block_height(alt_chain.front()->second.bl.prev_id), timestamps);
+      auto h = m_db->get_block_hash_from_height(alt_chain.front()->height - 1);
+      CHECK_AND_ASSERT_MES(h == alt_chain.front()->bei.bl.prev_id, false, "alternative chain has wrong connection to main chain");
+      complete_timestamps_vector(alt_chain.front()->height - 1, timestamps);
     }
     // if block not associated with known alternate chain
     else
@@ -1359,7 +1539,7 @@ bool Blockchain::handle_alternative_block(const block& b, const crypto::hash& id
     // FIXME: consider moving away from block_extended_info at some point
     block_extended_info bei = boost::value_initialized<block_extended_info>();
     bei.bl = b;
-    bei.height = alt_chain.size() ? it_prev->second.height + 1 : m_db->get_block_height(b.prev_id) + 1;
+    bei.height = alt_chain.size() ? prev_entry->height + 1 : m_db->get_block_height(b.prev_id) + 1;
 
     bool is_a_checkpoint;
     if(!m_checkpoints.check_block(bei.height, id, is_a_checkpoint))
@@ -1396,7 +1576,7 @@ bool Blockchain::handle_alternative_block(const block& b, const crypto::hash& id
     difficulty_type main_chain_cumulative_difficulty = m_db->get_block_cumulative_difficulty(m_db->height() - 1);
     if (alt_chain.size())
     {
-      bei.cumulative_difficulty = it_prev->second.cumulative_difficulty;
+      bei.cumulative_difficulty = prev_entry->cumulative_difficulty;
     }
     else
     {
@@ -1407,15 +1587,15 @@ bool Blockchain::handle_alternative_block(const block& b, const crypto::hash& id
 
     // add block to alternate blocks storage,
     // as well as the current "alt chain" container
-    auto i_res = m_alternative_chains.insert(blocks_ext_by_hash::value_type(id, bei));
-    CHECK_AND_ASSERT_MES(i_res.second, false, "insertion of new alternative block returned as it already exist");
-    alt_chain.push_back(i_res.first);
+    const alt_block_entry *entry = add_alt_block(id, bei, prev_entry);
+    CHECK_AND_ASSERT_MES(entry, false, "insertion of new alternative block returned as it already exist");
+    alt_chain.push_back(entry);
 
     // FIXME: is it even possible for a checkpoint to show up not on the main chain?
     if(is_a_checkpoint)
     {
       //do reorganize!
-      LOG_PRINT_GREEN("###### REORGANIZE on height: " << alt_chain.front()->second.height << " of " << m_db->height() - 1 << ", checkpoint is found in alternative chain on height " << bei.height, LOG_LEVEL_0);
+      LOG_PRINT_GREEN("###### REORGANIZE on height: " << alt_chain.front()->height << " of " << m_db->height() - 1 << ", checkpoint is found in alternative chain on height " << bei.height, LOG_LEVEL_0);
 
       bool r = switch_to_alternative_blockchain(alt_chain, true);
 
@@ -1427,7 +1607,7 @@ bool Blockchain::handle_alternative_block(const block& b, const crypto::hash& id
     } else if(main_chain_cumulative_difficulty < bei.cumulative_difficulty) //check if difficulty bigger then in main chain
     {
       //do reorganize!
-      LOG_PRINT_GREEN("###### REORGANIZE on height: " << alt_chain.front()->second.height << " of " << m_db->height() - 1 << " with cum_difficulty " << m_db->get_block_cumulative_difficulty(m_db->height() - 1) << std::endl << " alternative blockchain size: " << alt_chain.size() << " with cum_difficulty " << bei.cumulative_difficulty, LOG_LEVEL_0);
+      LOG_PRINT_GREEN("###### REORGANIZE on height: " << alt_chain.front()->height << " of " << m_db->height() - 1 << " with cum_difficulty " << m_db->get_block_cumulative_difficulty(m_db->height() - 1) << std::endl << " alternative blockchain size: " << alt_chain.size() << " with cum_difficulty " << bei.cumulative_difficulty, LOG_LEVEL_0);
 
       bool r = switch_to_alternative_blockchain(alt_chain, false);
       if (r)
@@ -1499,47 +1679,53 @@ bool Blockchain::handle_get_objects(NOTIFY_REQUEST_GET_OBJECTS::request& arg, NO
   CRITICAL_REGION_LOCAL(m_blockchain_lock);
   m_db->block_txn_start(true);
   rsp.current_blockchain_height = get_current_blockchain_height();
-  std::list<block> blocks;
-  get_blocks(arg.blocks, blocks, rsp.missed_ids);
 
-  for (const auto& bl: blocks)
+  // the blobs are sent as stored, nothing is parsed and serialized again
+  for (const auto& block_hash: arg.blocks)
   {
-    std::list<crypto::hash> missed_tx_ids;
-    std::list<transaction> txs;
-
-    // FIXME: s/rsp.missed_ids/missed_tx_id/ ?  Seems like rsp.missed_ids
-    //        is for missed blocks, not missed transactions as well.
-    get_transactions(bl.tx_hashes, txs, missed_tx_ids);
-
-    if (missed_tx_ids.size() != 0)
+    uint64_t height;
+    if (!m_db->block_exists(block_hash, &height))
     {
-      LOG_ERROR("Error retrieving blocks, missed " << missed_tx_ids.size()
-          << " transactions for block with hash: " << get_block_hash(bl)
-          << std::endl
-      );
+      rsp.missed_ids.push_back(block_hash);
+      continue;
+    }
 
-      // append missed transaction hashes to response missed_ids field,
-      // as done below if any standalone transactions were requested
-      // and missed.
-      rsp.missed_ids.splice(rsp.missed_ids.end(), missed_tx_ids);
-	  m_db->block_txn_stop();
+    std::vector<block_blobs_t> blobs;
+    try
+    {
+      m_db->get_block_blobs_range(height, height, blobs, false);
+    }
+    catch (const std::exception& e)
+    {
+      LOG_ERROR("Error retrieving block with hash: " << block_hash << ": " << e.what());
+      m_db->block_txn_stop();
       return false;
     }
 
+    // peers need the whole transactions to validate the block
+    if (blobs.front().pruned)
+    {
+      rsp.missed_ids.push_back(block_hash);
+      continue;
+    }
+
     rsp.blocks.push_back(block_complete_entry());
     block_complete_entry& e = rsp.blocks.back();
-    //pack block
-    e.block = t_serializable_object_to_blob(bl);
-    //pack transactions
-    for (transaction& tx: txs)
-      e.txs.push_back(t_serializable_object_to_blob(tx));
+    e.block = std::move(blobs.front().block);
+    for (blobdata& tx_blob: blobs.front().txs)
+      e.txs.push_back(std::move(tx_blob));
   }
   //get another transactions, if need
-  std::list<transaction> txs;
-  get_transactions(arg.txs, txs, rsp.missed_ids);
-  //pack aside transactions
-  for (const auto& tx: txs)
-    rsp.txs.push_back(t_serializable_object_to_blob(tx));
+  for (const auto& tx_hash: arg.txs)
+  {
+    blobdata tx_blob;
+    transaction tx;
+    // a pruned tx can't be validated by the peer, so it is reported as missed
+    if (m_db->get_tx_blob(tx_hash, tx_blob) && parse_and_validate_tx_from_blob_maybe_pruned(tx_blob, tx) && !tx.pruned)
+      rsp.txs.push_back(std::move(tx_blob));
+    else
+      rsp.missed_ids.push_back(tx_hash);
+  }
 
   m_db->block_txn_stop();
   return true;
@@ -1550,9 +1736,9 @@ bool Blockchain::get_alternative_blocks(std::list<block>& blocks) const
   LOG_PRINT_L3("Blockchain::" << __func__);
   CRITICAL_REGION_LOCAL(m_blockchain_lock);
 
-  for (const auto& alt_bl: m_alternative_chains)
+  for (const auto& alt_bl: m_alternative_chains.get<alt_block_by_height>())
   {
-    blocks.push_back(alt_bl.second.bl);
+    blocks.push_back(alt_bl.bei.bl);
   }
   return true;
 }
@@ -1564,182 +1750,328 @@ size_t Blockchain::get_alternative_blocks_count() const
   return m_alternative_chains.size();
 }
 //------------------------------------------------------------------
-// This function adds the output specified by <amount, i> to the result_outs container
-// unlocked and other such checks should be done by here.
-void Blockchain::add_out_to_get_random_outs(COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::outs_for_amount& result_outs, uint64_t amount, size_t i) const
+const Blockchain::alt_block_entry* Blockchain::add_alt_block(const crypto::hash& id, const block_extended_info& bei, const alt_block_entry* prev, bool store, time_t receive_time)
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
   CRITICAL_REGION_LOCAL(m_blockchain_lock);
 
-  COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::out_entry& oen = *result_outs.outs.insert(result_outs.outs.end(), COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::out_entry());
-  oen.global_amount_index = i;
-  output_data_t data = m_db->get_output_key(amount, i);
-  oen.out_key = data.pubkey;
+  const blobdata blob = block_to_blob(bei.bl);
+
+  alt_block_entry entry;
+  entry.id = id;
+  entry.height = bei.height;
+  entry.cumulative_difficulty = bei.cumulative_difficulty;
+  entry.bei = bei;
+  entry.prev = prev;
+  entry.children = 0;
+  entry.receive_time = receive_time ? receive_time : time(NULL);
+  entry.memory = sizeof(alt_block_entry) + blob.size();
+
+  auto i_res = m_alternative_chains.insert(entry);
+  if (!i_res.second)
+    return NULL;
+  const alt_block_entry *added = &*i_res.first;
+  if (prev)
+    ++prev->children;
+  m_alt_blocks_memory += entry.memory;
+
+  // blocks may be stored before their parent, as when main chain blocks
+  // are popped back into the store, and were linked to the main chain then
+  auto range = m_alternative_chains.get<alt_block_by_height>().equal_range(bei.height + 1);
+  for (auto it = range.first; it != range.second; ++it)
+  {
+    if (!it->prev && it->bei.bl.prev_id == id)
+    {
+      it->prev = added;
+      ++added->children;
+    }
+  }
+
+  if (store && m_persist_alt_blocks)
+  {
+    alt_block_data_t data;
+    data.height = bei.height;
+    data.cumulative_size = bei.block_cumulative_size;
+    data.cumulative_difficulty = bei.cumulative_difficulty;
+    data.already_generated_coins = bei.already_generated_coins;
+    data.receive_time = added->receive_time;
+    try
+    {
+      m_db->add_alt_block(id, data, blob);
+    }
+    catch (const std::exception &e)
+    {
+      LOG_PRINT_L1("Failed to store alternative block " << id << ": " << e.what());
+    }
+  }
+
+  return added;
 }
 //------------------------------------------------------------------
-// This function takes an RPC request for mixins and creates an RPC response
-// with the requested mixins.
-// TODO: figure out why this returns boolean / if we should be returning false
-// in some cases
-bool Blockchain::get_random_outs_for_amounts(const COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::request& req, COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::response& res) const
+void Blockchain::remove_alt_block(const alt_block_entry* entry)
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
   CRITICAL_REGION_LOCAL(m_blockchain_lock);
 
-  // for each amount that we need to get mixins for, get <n> random outputs
-  // from BlockchainDB where <n> is req.outs_count (number of mixins).
-  for (uint64_t amount : req.amounts)
+  // any children now connect directly to the main chain
+  if (entry->children)
   {
-    auto num_outs = m_db->get_num_outputs(amount);
-    // ensure we don't include outputs that aren't yet eligible to be used
-    // outpouts are sorted by height
-    while (num_outs > 0)
+    auto range = m_alternative_chains.get<alt_block_by_height>().equal_range(entry->height + 1);
+    for (auto it = range.first; it != range.second; ++it)
     {
-      const tx_out_index toi = m_db->get_output_tx_and_index(amount, num_outs - 1);
-      const uint64_t height = m_db->get_tx_block_height(toi.first);
-      if (height + CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE <= m_db->height())
-        break;
-      --num_outs;
+      if (it->prev == entry)
+        it->prev = NULL;
     }
+  }
+  if (entry->prev)
+    --entry->prev->children;
+  m_alt_blocks_memory -= entry->memory;
 
-    // create outs_for_amount struct and populate amount field
-    COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::outs_for_amount& result_outs = *res.outs.insert(res.outs.end(), COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::outs_for_amount());
-    result_outs.amount = amount;
+  if (m_persist_alt_blocks)
+  {
+    try
+    {
+      m_db->remove_alt_block(entry->id);
+    }
+    catch (const std::exception &e)
+    {
+      LOG_PRINT_L1("Failed to remove stored alternative block " << entry->id << ": " << e.what());
+    }
+  }
 
-    std::unordered_set<uint64_t> seen_indices;
+  m_alternative_chains.erase(m_alternative_chains.iterator_to(*entry));
+}
+//------------------------------------------------------------------
+size_t Blockchain::remove_alt_block_subtree(const alt_block_entry* entry)
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  CRITICAL_REGION_LOCAL(m_blockchain_lock);
 
-    // if there aren't enough outputs to mix with (or just enough),
-    // use all of them.  Eventually this should become impossible.
-    if (num_outs <= req.outs_count)
+  // gather descendants height by height, parents before children
+  const auto &by_height = m_alternative_chains.get<alt_block_by_height>();
+  std::vector<const alt_block_entry*> entries(1, entry);
+  for (size_t n = 0; n < entries.size(); ++n)
+  {
+    const alt_block_entry *parent = entries[n];
+    if (!parent->children)
+      continue;
+    auto range = by_height.equal_range(parent->height + 1);
+    for (auto it = range.first; it != range.second; ++it)
     {
-      for (uint64_t i = 0; i < num_outs; i++)
-      {
-        // get tx_hash, tx_out_index from DB
-        tx_out_index toi = m_db->get_output_tx_and_index(amount, i);
+      if (it->prev == parent)
+        entries.push_back(&*it);
+    }
+  }
 
-        // if tx is unlocked, add output to result_outs
-        if (is_tx_spendtime_unlocked(m_db->get_tx_unlock_time(toi.first)))
-        {
-          add_out_to_get_random_outs(result_outs, amount, i);
-        }
+  // remove children before their parents
+  for (auto it = entries.rbegin(); it != entries.rend(); ++it)
+    remove_alt_block(*it);
+  return entries.size();
+}
+//------------------------------------------------------------------
+void Blockchain::prune_alt_blocks()
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  CRITICAL_REGION_LOCAL(m_blockchain_lock);
 
-      }
-    }
-    else
+  if (m_alternative_chains.empty())
+    return;
+
+  const size_t count = m_alternative_chains.size();
+
+  // blocks at or below the last checkpoint can never be switched to
+  const uint64_t blockchain_height = m_db->height();
+  const auto &by_height = m_alternative_chains.get<alt_block_by_height>();
+  while (!by_height.empty() && !m_checkpoints.is_alternative_block_allowed(blockchain_height, by_height.begin()->height))
+    remove_alt_block_subtree(&*by_height.begin());
+
+  // drop chain tips nobody has built on for a long time, walking down
+  // each chain while its blocks are also stale
+  const time_t now = time(NULL);
+  std::vector<const alt_block_entry*> stale;
+  for (const alt_block_entry &entry: m_alternative_chains)
+  {
+    if (!entry.children && entry.receive_time + CRYPTONOTE_ALT_BLOCK_LIVETIME < now)
+      stale.push_back(&entry);
+  }
+  for (const alt_block_entry *entry: stale)
+  {
+    while (entry && !entry->children && entry->receive_time + CRYPTONOTE_ALT_BLOCK_LIVETIME < now)
     {
-      // while we still need more mixins
-      while (result_outs.outs.size() < req.outs_count)
-      {
-        // if we've gone through every possible output, we've gotten all we can
-        if (seen_indices.size() == num_outs)
-        {
-          break;
-        }
+      const alt_block_entry *prev = entry->prev;
+      remove_alt_block(entry);
+      entry = prev;
+    }
+  }
 
-        // get a random output index from the DB.  If we've already seen it,
-        // return to the top of the loop and try again, otherwise add it to the
-        // list of output indices we've seen.
+  // over the memory cap, drop the weakest chain tips first; children always
+  // have more cumulative difficulty than their parent, so a tip is found
+  // before reaching the strongest entry, and equal difficulties are kept in
+  // insertion order, oldest first
+  const auto &by_difficulty = m_alternative_chains.get<alt_block_by_cumulative_difficulty>();
+  while (m_alt_blocks_memory > m_alt_blocks_max_memory && !by_difficulty.empty())
+  {
+    auto it = by_difficulty.begin();
+    while (it->children)
+      ++it;
+    remove_alt_block(&*it);
+  }
 
-        // triangular distribution over [a,b) with a=0, mode c=b=up_index_limit
-        uint64_t r = crypto::rand<uint64_t>() % ((uint64_t)1 << 53);
-        double frac = std::sqrt((double)r / ((uint64_t)1 << 53));
-        uint64_t i = (uint64_t)(frac*num_outs);
-        // just in case rounding up to 1 occurs after sqrt
-        if (i == num_outs)
-          --i;
+  if (m_alternative_chains.size() != count)
+    LOG_PRINT_L1("Pruned " << count - m_alternative_chains.size() << " alternative blocks, " << m_alternative_chains.size() << " left using " << m_alt_blocks_memory << " bytes");
+}
+//------------------------------------------------------------------
+void Blockchain::load_alt_blocks()
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  CRITICAL_REGION_LOCAL(m_blockchain_lock);
 
-        if (seen_indices.count(i))
-        {
-          continue;
-        }
-        seen_indices.emplace(i);
+  std::vector<std::pair<crypto::hash, block_extended_info>> blocks;
+  std::unordered_map<crypto::hash, time_t> receive_times;
+  std::vector<crypto::hash> stale;
+  try
+  {
+    m_db->for_all_alt_blocks([&](const crypto::hash &id, const alt_block_data_t &data, const blobdata &blob) {
+      block_extended_info bei = boost::value_initialized<block_extended_info>();
+      if (!parse_and_validate_block_from_blob(blob, bei.bl))
+      {
+        stale.push_back(id);
+        return true;
+      }
+      bei.height = data.height;
+      bei.block_cumulative_size = data.cumulative_size;
+      bei.cumulative_difficulty = data.cumulative_difficulty;
+      bei.already_generated_coins = data.already_generated_coins;
+      blocks.push_back(std::make_pair(id, bei));
+      receive_times[id] = data.receive_time;
+      return true;
+    });
 
-        // get tx_hash, tx_out_index from DB
-        tx_out_index toi = m_db->get_output_tx_and_index(amount, i);
+    // parents are lower than their children, so they get linked first
+    std::sort(blocks.begin(), blocks.end(), [](const std::pair<crypto::hash, block_extended_info> &a, const std::pair<crypto::hash, block_extended_info> &b) {
+      return a.second.height < b.second.height;
+    });
 
-        // if the output's transaction is unlocked, add the output's index to
-        // our list.
-        if (is_tx_spendtime_unlocked(m_db->get_tx_unlock_time(toi.first)))
-        {
-          add_out_to_get_random_outs(result_outs, amount, i);
-        }
+    for (const auto &b: blocks)
+    {
+      const crypto::hash &id = b.first;
+      const block_extended_info &bei = b.second;
+      const alt_block_entry *prev = NULL;
+      auto it_prev = m_alternative_chains.find(bei.bl.prev_id);
+      if (it_prev != m_alternative_chains.end())
+        prev = &*it_prev;
+      else if (!m_db->block_exists(bei.bl.prev_id))
+      {
+        // the chain it was on got pruned, or the main chain got popped
+        stale.push_back(id);
+        continue;
       }
+      if (m_db->block_exists(id) || !add_alt_block(id, bei, prev, false, receive_times[id]))
+        stale.push_back(id);
     }
+
+    for (const crypto::hash &id: stale)
+      m_db->remove_alt_block(id);
   }
-  return true;
+  catch (const std::exception &e)
+  {
+    LOG_PRINT_L0("Failed to load stored alternative blocks: " << e.what());
+  }
+
+  LOG_PRINT_L1("Loaded " << m_alternative_chains.size() << " alternative blocks, dropped " << stale.size() << " stale ones");
+  prune_alt_blocks();
 }
 //------------------------------------------------------------------
-// This function adds the ringct output at index i to the list
+// This function adds the output specified by <amount, i> to the result_outs container
 // unlocked and other such checks should be done by here.
-void Blockchain::add_out_to_get_rct_random_outs(std::list<COMMAND_RPC_GET_RANDOM_RCT_OUTPUTS::out_entry>& outs, uint64_t amount, size_t i) const
+void Blockchain::add_out_to_get_random_outs(COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::outs_for_amount& result_outs, uint64_t amount, size_t i) const
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
   CRITICAL_REGION_LOCAL(m_blockchain_lock);
 
-  COMMAND_RPC_GET_RANDOM_RCT_OUTPUTS::out_entry& oen = *outs.insert(outs.end(), COMMAND_RPC_GET_RANDOM_RCT_OUTPUTS::out_entry());
-  oen.amount = amount;
+  COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::out_entry& oen = *result_outs.outs.insert(result_outs.outs.end(), COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::out_entry());
   oen.global_amount_index = i;
   output_data_t data = m_db->get_output_key(amount, i);
   oen.out_key = data.pubkey;
-  oen.commitment = data.commitment;
 }
 //------------------------------------------------------------------
-// This function takes an RPC request for mixins and creates an RPC response
-// with the requested mixins.
-// TODO: figure out why this returns boolean / if we should be returning false
-// in some cases
-bool Blockchain::get_random_rct_outs(const COMMAND_RPC_GET_RANDOM_RCT_OUTPUTS::request& req, COMMAND_RPC_GET_RANDOM_RCT_OUTPUTS::response& res) const
+void Blockchain::sync_rct_outputs_distribution() const
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  const uint64_t height = m_db->height();
+  if (m_rct_outputs_distribution.size() > height)
+    m_rct_outputs_distribution.resize(height);
+  if (m_rct_outputs_distribution.size() < height)
+  {
+    std::vector<block_info_t> infos;
+    m_db->get_block_info_range(m_rct_outputs_distribution.size(), height - 1, infos, BI_CUMULATIVE_RCT_OUTPUTS);
+    m_rct_outputs_distribution.reserve(height);
+    for (const auto &bi: infos)
+      m_rct_outputs_distribution.push_back(bi.cumulative_rct_outputs);
+  }
+}
+//------------------------------------------------------------------
+uint64_t Blockchain::get_num_unlocked_outputs(uint64_t amount) const
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
   CRITICAL_REGION_LOCAL(m_blockchain_lock);
 
-  // for each amount that we need to get mixins for, get <n> random outputs
-  // from BlockchainDB where <n> is req.outs_count (number of mixins).
-  auto num_outs = m_db->get_num_outputs(0);
-  // ensure we don't include outputs that aren't yet eligible to be used
-  // outpouts are sorted by height
-  while (num_outs > 0)
+  // an output may be used once the height stored with it, which is one
+  // past its block's, is buried deep enough, so outputs in blocks below
+  // limit are unlocked
+  const uint64_t height = m_db->height();
+  if (height <= CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE)
+    return 0;
+  const uint64_t limit = height - CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE;
+
+  if (amount == 0)
   {
-    const tx_out_index toi = m_db->get_output_tx_and_index(0, num_outs - 1);
-    const uint64_t height = m_db->get_tx_block_height(toi.first);
-    if (height + CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE <= m_db->height())
-      break;
-    --num_outs;
+    sync_rct_outputs_distribution();
+    return m_rct_outputs_distribution[limit - 1];
   }
+  return m_db->get_num_outputs_below_height(amount, limit);
+}
+//------------------------------------------------------------------
+void Blockchain::pick_random_outputs(uint64_t amount, uint64_t num_outs, uint64_t count, std::vector<uint64_t> &indices, std::vector<output_data_t> &outputs) const
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  CRITICAL_REGION_LOCAL(m_blockchain_lock);
 
-  std::unordered_set<uint64_t> seen_indices;
+  std::vector<uint64_t> candidates;
+  std::vector<output_data_t> data;
 
   // if there aren't enough outputs to mix with (or just enough),
   // use all of them.  Eventually this should become impossible.
-  if (num_outs <= req.outs_count)
+  if (num_outs <= count)
   {
     for (uint64_t i = 0; i < num_outs; i++)
+      candidates.push_back(i);
+    m_db->get_output_key(amount, candidates, data);
+    for (size_t n = 0; n < candidates.size(); ++n)
     {
-      // get tx_hash, tx_out_index from DB
-      tx_out_index toi = m_db->get_output_tx_and_index(0, i);
-
-      // if tx is unlocked, add output to result_outs
-      if (is_tx_spendtime_unlocked(m_db->get_tx_unlock_time(toi.first)))
+      // if tx is unlocked, add output to the result
+      if (is_tx_spendtime_unlocked(data[n].unlock_time))
       {
-        add_out_to_get_rct_random_outs(res.outs, 0, i);
+        indices.push_back(candidates[n]);
+        outputs.push_back(data[n]);
       }
     }
+    return;
   }
-  else
-  {
-    // while we still need more mixins
-    while (res.outs.size() < req.outs_count)
-    {
-      // if we've gone through every possible output, we've gotten all we can
-      if (seen_indices.size() == num_outs)
-      {
-        break;
-      }
 
-      // get a random output index from the DB.  If we've already seen it,
-      // return to the top of the loop and try again, otherwise add it to the
-      // list of output indices we've seen.
+  std::unordered_set<uint64_t> seen_indices;
 
+  // while we still need more mixins, draw as many new indices as are
+  // missing and look them all up at once
+  while (indices.size() < count)
+  {
+    // if we've gone through every possible output, we've gotten all we can
+    if (seen_indices.size() == num_outs)
+      break;
+
+    candidates.clear();
+    while (indices.size() + candidates.size() < count && seen_indices.size() < num_outs)
+    {
       // triangular distribution over [a,b) with a=0, mode c=b=up_index_limit
       uint64_t r = crypto::rand<uint64_t>() % ((uint64_t)1 << 53);
       double frac = std::sqrt((double)r / ((uint64_t)1 << 53));
@@ -1748,23 +2080,96 @@ bool Blockchain::get_random_rct_outs(const COMMAND_RPC_GET_RANDOM_RCT_OUTPUTS::r
       if (i == num_outs)
         --i;
 
-      if (seen_indices.count(i))
-      {
+      // if we've already seen it, try again
+      if (!seen_indices.insert(i).second)
         continue;
-      }
-      seen_indices.emplace(i);
-
-      // get tx_hash, tx_out_index from DB
-      tx_out_index toi = m_db->get_output_tx_and_index(0, i);
+      candidates.push_back(i);
+    }
 
-      // if the output's transaction is unlocked, add the output's index to
-      // our list.
-      if (is_tx_spendtime_unlocked(m_db->get_tx_unlock_time(toi.first)))
+    m_db->get_output_key(amount, candidates, data);
+    for (size_t n = 0; n < candidates.size(); ++n)
+    {
+      // if the output's transaction is unlocked, add the output to our list
+      if (is_tx_spendtime_unlocked(data[n].unlock_time))
       {
-        add_out_to_get_rct_random_outs(res.outs, 0, i);
+        indices.push_back(candidates[n]);
+        outputs.push_back(data[n]);
       }
     }
   }
+}
+//------------------------------------------------------------------
+// This function takes an RPC request for mixins and creates an RPC response
+// with the requested mixins.
+// TODO: figure out why this returns boolean / if we should be returning false
+// in some cases
+bool Blockchain::get_random_outs_for_amounts(const COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::request& req, COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::response& res) const
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+
+  // for each amount that we need to get mixins for, get <n> random outputs
+  // from BlockchainDB where <n> is req.outs_count (number of mixins).
+  for (uint64_t amount : req.amounts)
+  {
+    // ensure we don't include outputs that aren't yet eligible to be used
+    const uint64_t num_outs = get_num_unlocked_outputs(amount);
+
+    // create outs_for_amount struct and populate amount field
+    COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::outs_for_amount& result_outs = *res.outs.insert(res.outs.end(), COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::outs_for_amount());
+    result_outs.amount = amount;
+
+    std::vector<uint64_t> indices;
+    std::vector<output_data_t> outputs;
+    pick_random_outputs(amount, num_outs, req.outs_count, indices, outputs);
+    for (size_t n = 0; n < indices.size(); ++n)
+    {
+      COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::out_entry& oen = *result_outs.outs.insert(result_outs.outs.end(), COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::out_entry());
+      oen.global_amount_index = indices[n];
+      oen.out_key = outputs[n].pubkey;
+    }
+  }
+  return true;
+}
+//------------------------------------------------------------------
+// This function adds the ringct output at index i to the list
+// unlocked and other such checks should be done by here.
+void Blockchain::add_out_to_get_rct_random_outs(std::list<COMMAND_RPC_GET_RANDOM_RCT_OUTPUTS::out_entry>& outs, uint64_t amount, size_t i) const
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+
+  COMMAND_RPC_GET_RANDOM_RCT_OUTPUTS::out_entry& oen = *outs.insert(outs.end(), COMMAND_RPC_GET_RANDOM_RCT_OUTPUTS::out_entry());
+  oen.amount = amount;
+  oen.global_amount_index = i;
+  output_data_t data = m_db->get_output_key(amount, i);
+  oen.out_key = data.pubkey;
+  oen.commitment = data.commitment;
+}
+//------------------------------------------------------------------
+// This function takes an RPC request for mixins and creates an RPC response
+// with the requested mixins.
+// TODO: figure out why this returns boolean / if we should be returning false
+// in some cases
+bool Blockchain::get_random_rct_outs(const COMMAND_RPC_GET_RANDOM_RCT_OUTPUTS::request& req, COMMAND_RPC_GET_RANDOM_RCT_OUTPUTS::response& res) const
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+
+  // ensure we don't include outputs that aren't yet eligible to be used
+  const uint64_t num_outs = get_num_unlocked_outputs(0);
+
+  std::vector<uint64_t> indices;
+  std::vector<output_data_t> outputs;
+  pick_random_outputs(0, num_outs, req.outs_count, indices, outputs);
+  for (size_t n = 0; n < indices.size(); ++n)
+  {
+    COMMAND_RPC_GET_RANDOM_RCT_OUTPUTS::out_entry& oen = *res.outs.insert(res.outs.end(), COMMAND_RPC_GET_RANDOM_RCT_OUTPUTS::out_entry());
+    oen.amount = 0;
+    oen.global_amount_index = indices[n];
+    oen.out_key = outputs[n].pubkey;
+    oen.commitment = outputs[n].commitment;
+  }
 
   if (res.outs.size() < req.outs_count)
     return false;
@@ -2019,7 +2424,7 @@ bool Blockchain::find_blockchain_supplement(const std::list<crypto::hash>& qbloc
 // find split point between ours and foreign blockchain (or start at
 // blockchain height <req_start_block>), and return up to max_count FULL
 // blocks by reference.
-bool Blockchain::find_blockchain_supplement(const uint64_t req_start_block, const std::list<crypto::hash>& qblock_ids, std::list<std::pair<block, std::list<transaction> > >& blocks, uint64_t& total_height, uint64_t& start_height, size_t max_count) const
+bool Blockchain::find_blockchain_supplement(const uint64_t req_start_block, const std::list<crypto::hash>& qblock_ids, std::vector<block_blobs_t>& blocks, uint64_t& total_height, uint64_t& start_height, size_t max_count) const
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
   CRITICAL_REGION_LOCAL(m_blockchain_lock);
@@ -2043,14 +2448,17 @@ bool Blockchain::find_blockchain_supplement(const uint64_t req_start_block, cons
   }
 
   total_height = get_current_blockchain_height();
-  size_t count = 0;
-  for(size_t i = start_height; i < total_height && count < max_count; i++, count++)
+  if (start_height >= total_height || max_count == 0)
+    return true;
+  const uint64_t end_height = std::min<uint64_t>(total_height, start_height + max_count) - 1;
+  try
   {
-    blocks.resize(blocks.size()+1);
-    blocks.back().first = m_db->get_block_from_height(i);
-    std::list<crypto::hash> mis;
-    get_transactions(blocks.back().first.tx_hashes, blocks.back().second, mis);
-    CHECK_AND_ASSERT_MES(!mis.size(), false, "internal error, transaction from block not found");
+    m_db->get_block_blobs_range(start_height, end_height, blocks, true);
+  }
+  catch (const std::exception& e)
+  {
+    LOG_ERROR("internal error, failed to get blocks " << start_height << "-" << end_height << ": " << e.what());
+    return false;
   }
   return true;
 }
@@ -2210,7 +2618,7 @@ bool Blockchain::get_tx_outputs_gindexs(const crypto::hash& tx_id, std::vector<u
 // This function overloads its sister function with
 // an extra value (hash of highest block that holds an output used as input)
 // as a return-by-reference.
-bool Blockchain::check_tx_inputs(transaction& tx, uint64_t& max_used_block_height, crypto::hash& max_used_block_id, tx_verification_context &tvc, bool kept_by_block)
+bool Blockchain::check_tx_inputs(transaction& tx, uint64_t& max_used_block_height, crypto::hash& max_used_block_id, tx_verification_context &tvc, bool kept_by_block, bool rct_semantics_verified)
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
   CRITICAL_REGION_LOCAL(m_blockchain_lock);
@@ -2232,7 +2640,7 @@ bool Blockchain::check_tx_inputs(transaction& tx, uint64_t& max_used_block_heigh
 #endif
 
   TIME_MEASURE_START(a);
-  bool res = check_tx_inputs(tx, tvc, &max_used_block_height);
+  bool res = check_tx_inputs(tx, tvc, &max_used_block_height, rct_semantics_verified);
   TIME_MEASURE_FINISH(a);
   if(m_show_time_stats)
     LOG_PRINT_L0("HASH: " << "+" << " VIN/VOUT: " << tx.vin.size() << "/" << tx.vout.size() << " H: " << max_used_block_height << " chcktx: " << a + m_fake_scan_time);
@@ -2245,6 +2653,22 @@ bool Blockchain::check_tx_inputs(transaction& tx, uint64_t& max_used_block_heigh
   return true;
 }
 //------------------------------------------------------------------
+bool Blockchain::check_tx_rct_semantics(const transaction& tx)
+{
+  const rct::rctSig &rv = tx.rct_signatures;
+  switch (rv.type)
+  {
+  case rct::RCTTypeSimple:
+    return rct::verRctSimple(rv, true);
+  case rct::RCTTypeFull:
+    return rct::verRct(rv, true);
+  default:
+    // null and unknown types are rejected by check_tx_inputs
+    LOG_PRINT_L1("Unsupported rct type: " << rv.type);
+    return false;
+  }
+}
+//------------------------------------------------------------------
 bool Blockchain::check_tx_outputs(const transaction& tx, tx_verification_context &tvc)
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
@@ -2360,7 +2784,7 @@ bool Blockchain::expand_transaction_2(transaction &tx, const crypto::hash &tx_pr
 //        check_tx_input() rather than here, and use this function simply
 //        to iterate the inputs as necessary (splitting the task
 //        using threads, etc.)
-bool Blockchain::check_tx_inputs(transaction& tx, tx_verification_context &tvc, uint64_t* pmax_used_block_height)
+bool Blockchain::check_tx_inputs(transaction& tx, tx_verification_context &tvc, uint64_t* pmax_used_block_height, bool rct_semantics_verified)
 {
   PERF_TIMER(check_tx_inputs);
   LOG_PRINT_L3("Blockchain::" << __func__);
@@ -2611,7 +3035,7 @@ bool Blockchain::check_tx_inputs(transaction& tx, tx_verification_context &tvc,
       }
     }
 
-    if (!rct::verRctSimple(rv))
+    if ((!rct_semantics_verified && !rct::verRctSimple(rv, true)) || !rct::verRctSimple(rv, false))
     {
       LOG_PRINT_L1("Failed to check ringct signatures!");
       return false;
@@ -2669,7 +3093,7 @@ bool Blockchain::check_tx_inputs(transaction& tx, tx_verification_context &tvc,
       }
     }
 
-    if (!rct::verRct(rv))
+    if ((!rct_semantics_verified && !rct::verRct(rv, true)) || !rct::verRct(rv, false))
     {
       LOG_PRINT_L1("Failed to check ringct signatures!");
       return false;
@@ -2932,10 +3356,11 @@ bool Blockchain::check_block_timestamp(const block& b) const
 
   // need most recent 60 blocks, get index of first of those
   size_t offset = h - blockchain_timestamp_check_window;
-  for(;offset < h; ++offset)
-  {
-    timestamps.push_back(m_db->get_block_timestamp(offset));
-  }
+  std::vector<block_info_t> infos;
+  m_db->get_block_info_range(offset, h - 1, infos, BI_TIMESTAMP);
+  timestamps.reserve(infos.size());
+  for (const auto &bi: infos)
+    timestamps.push_back(bi.timestamp);
 
   return check_block_timestamp(timestamps, b);
 }
@@ -3288,6 +3713,19 @@ leave:
     LOG_ERROR("Blocks that failed verification should not reach here");
   }
 
+  if (m_prune_keep_blocks)
+  {
+    try
+    {
+      m_db->prune_blockchain(m_prune_keep_blocks);
+    }
+    catch (const std::exception& e)
+    {
+      // the block is in, pruning just gets retried with the next one
+      LOG_ERROR("Error pruning blockchain, what = " << e.what());
+    }
+  }
+
   TIME_MEASURE_FINISH(addblock);
 
   // do this after updating the hard fork state since the size limit may change due to fork
@@ -3351,7 +3789,9 @@ bool Blockchain::add_new_block(const block& bl_, block_verification_context& bvc
     //chain switching or wrong block
     bvc.m_added_to_main_chain = false;
     m_db->block_txn_stop();
-    return handle_alternative_block(bl, id, bvc);
+    bool r = handle_alternative_block(bl, id, bvc);
+    prune_alt_blocks();
+    return r;
     //never relay alternative blocks
   }
 
@@ -3437,7 +3877,7 @@ void Blockchain::set_enforce_dns_checkpoints(bool enforce_checkpoints)
 }
 
 //------------------------------------------------------------------
-void Blockchain::block_longhash_worker(cn_pow_hash_v2& hash_ctx, const std::vector<block> &blocks, std::unordered_map<crypto::hash, crypto::hash> &map)
+void Blockchain::block_longhash_worker(cn_pow_hash_v2& hash_ctx, const std::vector<const prepared_block*> &blocks, std::unordered_map<crypto::hash, crypto::hash> &map)
 {
   TIME_MEASURE_START(t);
 
@@ -3448,10 +3888,9 @@ void Blockchain::block_longhash_worker(cn_pow_hash_v2& hash_ctx, const std::vect
   {
     if (m_cancel)
        return;
-    crypto::hash id = get_block_hash(block);
      crypto::hash pow;
-     get_block_longhash(block, hash_ctx, pow);
-    map.emplace(id, pow);
+     get_block_longhash(block->bl, hash_ctx, pow);
+    map.emplace(block->hash, pow);
   }
 
   
@@ -3464,21 +3903,51 @@ bool Blockchain::cleanup_handle_incoming_blocks(bool force_sync)
   LOG_PRINT_YELLOW("Blockchain::" << __func__, LOG_LEVEL_3);
   CRITICAL_REGION_LOCAL(m_blockchain_lock);
   TIME_MEASURE_START(t1);
+  bool committed = true;
+
+  if (m_incoming_batch)
+  {
+    // one commit for the whole group of blocks; blocks which failed were
+    // already rolled back on their own
+    try
+    {
+      m_db->batch_stop();
+    }
+    catch (const std::exception &e)
+    {
+      // the db has dropped the batch, and its blocks with it. What is kept
+      // here about the chain is reset, but the tx pool and alt blocks were
+      // changed for those blocks as well, so the caller has to stop
+      LOG_ERROR("Error committing blocks to the db, the blockchain is back at height " << m_db->height() << ": " << e.what());
+      m_timestamps_and_difficulties_height = 0;
+      m_rct_outputs_distribution.clear();
+      m_hardfork->reorganize_from_chain_height(m_db->height());
+      committed = false;
+    }
+    m_incoming_batch = false;
+    m_blockchain_lock.unlock();
+    m_tx_pool.unlock();
+  }
 
   if (m_sync_counter > 0)
   {
-    if (force_sync)
+    if (force_sync && m_db_sync_mode != db_async)
     {
       if(m_db_sync_mode != db_nosync)
         store_blockchain();
       m_sync_counter = 0;
     }
-    else if (m_db_blocks_per_sync && m_sync_counter >= m_db_blocks_per_sync)
+    else if (force_sync || (m_db_blocks_per_sync && m_sync_counter >= m_db_blocks_per_sync))
     {
       if(m_db_sync_mode == db_async)
       {
-        m_sync_counter = 0;
-        m_async_service.dispatch(boost::bind(&Blockchain::store_blockchain, this));
+        // only one sync is queued at a time; while it runs the counter
+        // keeps counting, so blocks committed meanwhile get the next one
+        if (!m_sync_pending.test_and_set())
+        {
+          m_sync_counter = 0;
+          m_async_service.dispatch(boost::bind(&Blockchain::async_store_blockchain, this));
+        }
       }
       else if(m_db_sync_mode == db_sync)
       {
@@ -3497,7 +3966,52 @@ bool Blockchain::cleanup_handle_incoming_blocks(bool force_sync)
   m_blocks_txs_check.clear();
   m_check_txin_table.clear();
 
-  return true;
+  return committed;
+}
+
+//------------------------------------------------------------------
+void Blockchain::scan_table_worker(const std::vector<std::pair<const transaction*, std::unordered_map<crypto::key_image, std::vector<output_data_t>>*>> &tx_tables,
+    size_t begin, size_t end, const std::map<uint64_t, std::vector<uint64_t>> &offset_map, const std::map<uint64_t, std::vector<output_data_t>> &tx_map) const
+{
+  for (size_t i = begin; i < end; ++i)
+  {
+    if (m_cancel)
+      return;
+
+    const transaction &tx = *tx_tables[i].first;
+    auto &table = *tx_tables[i].second;
+
+    for (const auto &txin : tx.vin)
+    {
+      const txin_to_key &in_to_key = boost::get < txin_to_key > (txin);
+      auto needed_offsets = relative_output_offsets_to_absolute(in_to_key.key_offsets);
+
+      std::vector<output_data_t> outputs;
+      auto offsets_it = offset_map.find(in_to_key.amount);
+      auto outputs_it = tx_map.find(in_to_key.amount);
+      if (offsets_it != offset_map.end() && outputs_it != tx_map.end())
+      {
+        // offset_map entries are sorted and unique, and tx_map entries are
+        // in the same order, so the position of an offset indexes its output
+        const std::vector<uint64_t> &offsets_found = offsets_it->second;
+        const std::vector<output_data_t> &outputs_found = outputs_it->second;
+        outputs.reserve(needed_offsets.size());
+        for (const uint64_t & offset_needed : needed_offsets)
+        {
+          auto it = std::lower_bound(offsets_found.begin(), offsets_found.end(), offset_needed);
+          if (it == offsets_found.end() || *it != offset_needed)
+            break;
+
+          size_t pos = std::distance(offsets_found.begin(), it);
+          if (pos >= outputs_found.size())
+            break;
+          outputs.push_back(outputs_found[pos]);
+        }
+      }
+
+      table.emplace(in_to_key.k_image, std::move(outputs));
+    }
+  }
 }
 
 //------------------------------------------------------------------
@@ -3518,6 +4032,101 @@ void Blockchain::output_scan_worker(const uint64_t amount, const std::vector<uin
   }
 }
 
+//------------------------------------------------------------------
+// parses one incoming block and all of its transactions, computing the
+// hashes later stages key their tables by
+static void parse_block_entry(const block_complete_entry &entry, prepared_block &pblock, char &result)
+{
+  result = false;
+  if (!parse_and_validate_block_from_blob(entry.block, pblock.bl))
+    return;
+  pblock.hash = get_block_hash(pblock.bl);
+
+  pblock.txs.resize(entry.txs.size());
+  size_t i = 0;
+  for (const auto &tx_blob : entry.txs)
+  {
+    prepared_tx &ptx = pblock.txs[i++];
+    if (!parse_and_validate_tx_from_blob(tx_blob, ptx.tx, ptx.tx_hash, ptx.tx_prefix_hash))
+      return;
+    ptx.blob_size = tx_blob.size();
+  }
+  result = true;
+}
+
+//------------------------------------------------------------------
+bool Blockchain::parse_incoming_blocks(const std::list<block_complete_entry> &blocks_entry, std::vector<prepared_block> &blocks) const
+{
+  LOG_PRINT_YELLOW("Blockchain::" << __func__, LOG_LEVEL_3);
+  TIME_MEASURE_START(parse);
+
+  blocks.clear();
+  blocks.resize(blocks_entry.size());
+  std::vector<char> results(blocks_entry.size(), false);
+
+  uint64_t threads = tools::get_max_concurrency();
+  if (threads > m_max_prepare_blocks_threads)
+    threads = m_max_prepare_blocks_threads;
+
+  if (blocks_entry.size() > 1 && threads > 1)
+  {
+    boost::asio::io_service ioservice;
+    boost::thread_group threadpool;
+    std::unique_ptr < boost::asio::io_service::work > work(new boost::asio::io_service::work(ioservice));
+
+    for (uint64_t i = 0; i < threads; i++)
+    {
+      threadpool.create_thread(boost::bind(&boost::asio::io_service::run, &ioservice));
+    }
+
+    size_t i = 0;
+    for (const auto &entry : blocks_entry)
+    {
+      ioservice.dispatch(boost::bind(&parse_block_entry, std::cref(entry), std::ref(blocks[i]), std::ref(results[i])));
+      ++i;
+    }
+
+    work.reset();
+    threadpool.join_all();
+    ioservice.stop();
+  }
+  else
+  {
+    size_t i = 0;
+    for (const auto &entry : blocks_entry)
+    {
+      parse_block_entry(entry, blocks[i], results[i]);
+      ++i;
+    }
+  }
+
+  for (size_t i = 0; i < results.size(); ++i)
+  {
+    if (!results[i])
+    {
+      LOG_PRINT_L1("Failed to parse block or transaction " << i << " of incoming blocks");
+      blocks.clear();
+      return false;
+    }
+  }
+
+  TIME_MEASURE_FINISH(parse);
+  if (m_show_time_stats)
+    LOG_PRINT_L0("Parse blocks took: " << parse << " ms");
+
+  return true;
+}
+
+//------------------------------------------------------------------
+bool Blockchain::prepare_handle_incoming_blocks(const std::list<block_complete_entry> &blocks_entry)
+{
+  std::vector<prepared_block> blocks;
+  if (!parse_incoming_blocks(blocks_entry, blocks))
+    return false;
+
+  return prepare_handle_incoming_blocks(blocks);
+}
+
 //------------------------------------------------------------------
 // ND: Speedups:
 // 1. Thread long_hash computations if possible (m_max_prepare_blocks_threads = nthreads, default = 4)
@@ -3525,10 +4134,39 @@ void Blockchain::output_scan_worker(const uint64_t amount, const std::vector<uin
 //    vs [k_image, output_keys] (m_scan_table). This is faster because it takes advantage of bulk queries
 //    and is threaded if possible. The table (m_scan_table) will be used later when querying output
 //    keys.
-bool Blockchain::prepare_handle_incoming_blocks(const std::list<block_complete_entry> &blocks_entry)
+// Blocks and txs come in already parsed (see parse_incoming_blocks), so none of
+// the blobs are parsed again here.
+bool Blockchain::prepare_handle_incoming_blocks(const std::vector<prepared_block> &blocks_entry)
 {
   LOG_PRINT_YELLOW("Blockchain::" << __func__, LOG_LEVEL_3);
   TIME_MEASURE_START(prepare);
+
+  // group the blocks into one db batch; the locks are then held until
+  // cleanup_handle_incoming_blocks, so nothing else writes while it's open.
+  // The pool is locked first, as add_new_block and everything else does
+  if (blocks_entry.size() > 1 && m_db->can_nest_block_txns())
+  {
+    m_tx_pool.lock();
+    m_blockchain_lock.lock();
+    bool started = false;
+    if (!m_incoming_batch)
+    {
+      try
+      {
+        started = m_incoming_batch = m_db->batch_start(blocks_entry.size());
+      }
+      catch (const std::exception &e)
+      {
+        LOG_PRINT_L1("Not batching incoming blocks: " << e.what());
+      }
+    }
+    if (!started)
+    {
+      m_blockchain_lock.unlock();
+      m_tx_pool.unlock();
+    }
+  }
+
   CRITICAL_REGION_LOCAL(m_blockchain_lock);
 
   if(blocks_entry.size() == 0)
@@ -3546,65 +4184,46 @@ bool Blockchain::prepare_handle_incoming_blocks(const std::list<block_complete_e
     if(threads > m_max_prepare_blocks_threads)
       threads = m_max_prepare_blocks_threads;
 
-    uint64_t height = m_db->height();
     std::vector<boost::thread *> thread_list;
     int batches = blocks_entry.size() / threads;
     int extra = blocks_entry.size() % threads;
     LOG_PRINT_L1("block_batches: " << batches);
     std::vector<std::unordered_map<crypto::hash, crypto::hash>> maps(threads);
-    std::vector < std::vector < block >> blocks(threads);
+    std::vector < std::vector < const prepared_block* >> blocks(threads);
     auto it = blocks_entry.begin();
 
-    for (uint64_t i = 0; i < threads; i++)
+    // check first block and skip all blocks if its not chained properly
+    crypto::hash tophash = m_db->top_block_hash();
+    if (it->bl.prev_id != tophash)
+    {
+      LOG_PRINT_L1("Skipping prepare blocks. New blocks don't belong to chain.");
+      return true;
+    }
+
+    for (uint64_t i = 0; i < threads && !blocks_exist; i++)
     {
       for (int j = 0; j < batches; j++)
       {
-        block block;
-
-        if (!parse_and_validate_block_from_blob(it->block, block))
-        {
-          std::advance(it, 1);
-          continue;
-        }
-
-        // check first block and skip all blocks if its not chained properly
-        if (i == 0 && j == 0)
-        {
-          crypto::hash tophash = m_db->top_block_hash();
-          if (block.prev_id != tophash)
-          {
-            LOG_PRINT_L1("Skipping prepare blocks. New blocks don't belong to chain.");
-            return true;
-          }
-        }
-        if (have_block(get_block_hash(block)))
+        if (have_block(it->hash))
         {
           blocks_exist = true;
           break;
         }
 
-        blocks[i].push_back(block);
+        blocks[i].push_back(&*it);
         std::advance(it, 1);
       }
     }
 
     for (int i = 0; i < extra && !blocks_exist; i++)
     {
-      block block;
-
-      if (!parse_and_validate_block_from_blob(it->block, block))
-      {
-        std::advance(it, 1);
-        continue;
-      }
-
-      if (have_block(get_block_hash(block)))
+      if (have_block(it->hash))
       {
         blocks_exist = true;
         break;
       }
 
-      blocks[i].push_back(block);
+      blocks[i].push_back(&*it);
       std::advance(it, 1);
     }
 
@@ -3682,14 +4301,10 @@ bool Blockchain::prepare_handle_incoming_blocks(const std::list<block_complete_e
     if (m_cancel)
       return false;
 
-    for (const auto &tx_blob : entry.txs)
+    for (const auto &ptx : entry.txs)
     {
-      crypto::hash tx_hash = null_hash;
-      crypto::hash tx_prefix_hash = null_hash;
-      transaction tx;
-
-      if (!parse_and_validate_tx_from_blob(tx_blob, tx, tx_hash, tx_prefix_hash))
-        SCAN_TABLE_QUIT("Could not parse tx from incoming blocks.");
+      const transaction &tx = ptx.tx;
+      const crypto::hash &tx_prefix_hash = ptx.tx_prefix_hash;
 
       auto its = m_scan_table.find(tx_prefix_hash);
       if (its != m_scan_table.end())
@@ -3737,17 +4352,18 @@ bool Blockchain::prepare_handle_incoming_blocks(const std::list<block_complete_e
           offset_map[in_to_key.amount].push_back(offset);
 
       }
-
-      // sort and remove duplicate absolute_offsets in offset_map
-      for (auto &offsets : offset_map)
-      {
-        std::sort(offsets.second.begin(), offsets.second.end());
-        auto last = std::unique(offsets.second.begin(), offsets.second.end());
-        offsets.second.erase(last, offsets.second.end());
-      }
     }
   }
 
+  // sort and remove duplicate absolute_offsets in offset_map, this keeps them
+  // binary searchable when building the per-tx tables below
+  for (auto &offsets : offset_map)
+  {
+    std::sort(offsets.second.begin(), offsets.second.end());
+    auto last = std::unique(offsets.second.begin(), offsets.second.end());
+    offsets.second.erase(last, offsets.second.end());
+  }
+
   // [output] stores all transactions for each tx_out_index::hash found
   std::vector<std::unordered_map<crypto::hash, cryptonote::transaction>> transactions(amounts.size());
 
@@ -3785,60 +4401,54 @@ bool Blockchain::prepare_handle_incoming_blocks(const std::list<block_complete_e
     }
   }
 
-  int total_txs = 0;
-
-  // now generate a table for each tx_prefix and k_image hashes
+  // collect the table of each tx, the tables are then filled in independently
+  std::vector<std::pair<const transaction*, std::unordered_map<crypto::key_image, std::vector<output_data_t>>*>> tx_tables;
   for (const auto &entry : blocks_entry)
   {
-    if (m_cancel)
-      return false;
-
-    for (const auto &tx_blob : entry.txs)
+    for (const auto &ptx : entry.txs)
     {
-      crypto::hash tx_hash = null_hash;
-      crypto::hash tx_prefix_hash = null_hash;
-      transaction tx;
-
-      if (!parse_and_validate_tx_from_blob(tx_blob, tx, tx_hash, tx_prefix_hash))
-        SCAN_TABLE_QUIT("Could not parse tx from incoming blocks.");
-
-      ++total_txs;
-      auto its = m_scan_table.find(tx_prefix_hash);
+      auto its = m_scan_table.find(ptx.tx_prefix_hash);
       if (its == m_scan_table.end())
         SCAN_TABLE_QUIT("Tx not found on scan table from incoming blocks.");
+      tx_tables.push_back(std::make_pair(&ptx.tx, &its->second));
+    }
+  }
+  size_t total_txs = tx_tables.size();
 
-      for (const auto &txin : tx.vin)
-      {
-        const txin_to_key &in_to_key = boost::get < txin_to_key > (txin);
-        auto needed_offsets = relative_output_offsets_to_absolute(in_to_key.key_offsets);
-
-        std::vector<output_data_t> outputs;
-        for (const uint64_t & offset_needed : needed_offsets)
-        {
-          size_t pos = 0;
-          bool found = false;
-
-          for (const uint64_t &offset_found : offset_map[in_to_key.amount])
-          {
-            if (offset_needed == offset_found)
-            {
-              found = true;
-              break;
-            }
+  if (m_cancel)
+    return false;
 
-            ++pos;
-          }
+  // now generate a table for each tx_prefix and k_image hashes
+  threads = std::min<uint64_t>(tools::get_max_concurrency(), m_max_prepare_blocks_threads);
+  if (threads > 1 && total_txs > 1)
+  {
+    boost::asio::io_service ioservice;
+    boost::thread_group threadpool;
+    std::unique_ptr < boost::asio::io_service::work > work(new boost::asio::io_service::work(ioservice));
 
-          if (found && pos < tx_map[in_to_key.amount].size())
-            outputs.push_back(tx_map[in_to_key.amount].at(pos));
-          else
-            break;
-        }
+    for (uint64_t i = 0; i < threads; i++)
+    {
+      threadpool.create_thread(boost::bind(&boost::asio::io_service::run, &ioservice));
+    }
 
-        its->second.emplace(in_to_key.k_image, outputs);
-      }
+    const size_t chunk = (total_txs + threads - 1) / threads;
+    for (size_t begin = 0; begin < total_txs; begin += chunk)
+    {
+      size_t end = std::min(begin + chunk, total_txs);
+      ioservice.dispatch(boost::bind(&Blockchain::scan_table_worker, this, std::cref(tx_tables), begin, end, std::cref(offset_map), std::cref(tx_map)));
     }
+
+    work.reset();
+    threadpool.join_all();
+    ioservice.stop();
   }
+  else
+  {
+    scan_table_worker(tx_tables, 0, total_txs, offset_map, tx_map);
+  }
+
+  if (m_cancel)
+    return false;
 
   TIME_MEASURE_FINISH(scantable);
   if (total_txs > 0)
@@ -3859,6 +4469,24 @@ void Blockchain::set_user_options(uint64_t maxthreads, uint64_t blocks_per_sync,
   m_max_prepare_blocks_threads = maxthreads;
 }
 
+void Blockchain::set_alt_blocks_options(bool persist, uint64_t max_memory)
+{
+  m_persist_alt_blocks = persist;
+  m_alt_blocks_max_memory = max_memory;
+}
+
+void Blockchain::set_pruning(uint64_t keep_blocks)
+{
+  // the most recent blocks may still be reorganized away, and are needed
+  // whole to serve them to syncing peers
+  m_prune_keep_blocks = std::max<uint64_t>(keep_blocks, CRYPTONOTE_MINED_MONEY_UNLOCK_WINDOW);
+}
+
+void Blockchain::set_fast_sync_file(const std::string& filename)
+{
+  m_fast_sync_file = filename;
+}
+
 HardFork::State Blockchain::get_hard_fork_state() const
 {
   return m_hardfork->get_state();
@@ -3874,6 +4502,37 @@ std::map<uint64_t, std::tuple<uint64_t, uint64_t, uint64_t>> Blockchain:: get_ou
   return m_db->get_output_histogram(amounts, unlocked, recent_cutoff);
 }
 
+bool Blockchain::get_output_distribution(uint64_t amount, uint64_t from_height, uint64_t to_height, std::vector<uint64_t> &distribution, uint64_t &base) const
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+
+  const uint64_t height = m_db->height();
+  if (to_height == 0 || to_height >= height)
+    to_height = height - 1;
+  if (from_height > to_height)
+    return false;
+
+  if (amount == 0)
+  {
+    sync_rct_outputs_distribution();
+    base = from_height ? m_rct_outputs_distribution[from_height - 1] : 0;
+    distribution.assign(m_rct_outputs_distribution.begin() + from_height, m_rct_outputs_distribution.begin() + to_height + 1);
+    return true;
+  }
+
+  try
+  {
+    m_db->get_output_distribution(amount, from_height, to_height, distribution, base);
+  }
+  catch (const std::exception &e)
+  {
+    LOG_ERROR("Failed to get output distribution for amount " << amount << ": " << e.what());
+    return false;
+  }
+  return true;
+}
+
 void Blockchain::cancel()
 {
   m_cancel = true;
@@ -3886,44 +4545,109 @@ void Blockchain::load_compiled_in_block_hashes()
   {
     if (get_blocks_dat_size(m_testnet) > 4)
     {
-      const unsigned char *p = get_blocks_dat_start(m_testnet);
-      const uint32_t nblocks = *p | ((*(p+1))<<8) | ((*(p+2))<<16) | ((*(p+3))<<24);
-      const size_t size_needed = 4 + nblocks * sizeof(crypto::hash);
-      if(nblocks > 0 && nblocks > m_db->height() && get_blocks_dat_size(m_testnet) >= size_needed)
+      std::vector<crypto::hash> hashes;
+      if(parse_block_hashes(get_blocks_dat_start(m_testnet), get_blocks_dat_size(m_testnet), hashes) && hashes.size() > m_db->height())
       {
-        LOG_PRINT_L0("Loading precomputed blocks: " << nblocks);
-        p += sizeof(uint32_t);
-        for (uint32_t i = 0; i < nblocks; i++)
-        {
-          crypto::hash hash;
-          memcpy(hash.data, p, sizeof(hash.data));
-          p += sizeof(hash.data);
-          m_blocks_hash_check.push_back(hash);
-        }
-
-        // FIXME: clear tx_pool because the process might have been
-        // terminated and caused it to store txs kept by blocks.
-        // The core will not call check_tx_inputs(..) for these
-        // transactions in this case. Consequently, the sanity check
-        // for tx hashes will fail in handle_block_to_main_chain(..)
-        std::list<transaction> txs;
-        m_tx_pool.get_transactions(txs);
-
-        size_t blob_size;
-        uint64_t fee;
-        bool relayed;
-        transaction pool_tx;
-        for(const transaction &tx : txs)
-        {
-          crypto::hash tx_hash = get_transaction_hash(tx);
-          m_tx_pool.take_tx(tx_hash, pool_tx, blob_size, fee, relayed);
-        }
+        LOG_PRINT_L0("Loading precomputed blocks: " << hashes.size());
+        m_blocks_hash_check = std::move(hashes);
       }
     }
   }
+
+  if (m_fast_sync && !m_fast_sync_file.empty())
+    load_fast_sync_file_block_hashes();
+}
+
+void Blockchain::load_fast_sync_file_block_hashes()
+{
+  std::string data;
+  if (!epee::file_io_utils::load_file_to_string(m_fast_sync_file, data))
+  {
+    LOG_ERROR("Failed to read fast sync file " << m_fast_sync_file);
+    return;
+  }
+
+  std::vector<crypto::hash> hashes;
+  if (!parse_block_hashes((const unsigned char*)data.data(), data.size(), hashes))
+  {
+    LOG_ERROR("Fast sync file " << m_fast_sync_file << " is malformed, ignoring it");
+    return;
+  }
+
+  const uint64_t height = m_db->height();
+  if (hashes.size() <= m_blocks_hash_check.size() || hashes.size() <= height)
+  {
+    LOG_PRINT_L0("Fast sync file " << m_fast_sync_file << " does not go past the current block hashes, ignoring it");
+    return;
+  }
+
+  if (!std::equal(m_blocks_hash_check.begin(), m_blocks_hash_check.end(), hashes.begin()))
+  {
+    LOG_ERROR("Fast sync file " << m_fast_sync_file << " disagrees with the precomputed block hashes, ignoring it");
+    return;
+  }
+
+  // each block hash commits to its parent, so checking our top block is
+  // enough to know the file agrees with the whole local chain
+  if (height > 0 && m_db->get_block_hash_from_height(height - 1) != hashes[height - 1])
+  {
+    LOG_ERROR("Fast sync file " << m_fast_sync_file << " disagrees with the local blockchain at height " << height - 1 << ", ignoring it");
+    return;
+  }
+
+  LOG_PRINT_L0("Loading " << hashes.size() << " block hashes from fast sync file " << m_fast_sync_file);
+  m_blocks_hash_check = std::move(hashes);
+}
+
+bool Blockchain::parse_block_hashes(const unsigned char *data, size_t size, std::vector<crypto::hash>& hashes)
+{
+  if (size < sizeof(uint32_t))
+    return false;
+  const unsigned char *p = data;
+  const uint32_t nblocks = *p | ((*(p+1))<<8) | ((*(p+2))<<16) | ((*(p+3))<<24);
+  const size_t size_needed = 4 + nblocks * sizeof(crypto::hash);
+  if (nblocks == 0 || size < size_needed)
+    return false;
+
+  p += sizeof(uint32_t);
+  hashes.clear();
+  hashes.reserve(nblocks);
+  for (uint32_t i = 0; i < nblocks; i++)
+  {
+    crypto::hash hash;
+    memcpy(hash.data, p, sizeof(hash.data));
+    p += sizeof(hash.data);
+    hashes.push_back(hash);
+  }
+  return true;
 }
 #endif
 
+void Blockchain::clear_txpool_for_hash_check()
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  if (!m_blocks_hash_check.empty())
+  {
+    // FIXME: clear tx_pool because the process might have been
+    // terminated and caused it to store txs kept by blocks.
+    // The core will not call check_tx_inputs(..) for these
+    // transactions in this case. Consequently, the sanity check
+    // for tx hashes will fail in handle_block_to_main_chain(..)
+    std::list<transaction> txs;
+    m_tx_pool.get_transactions(txs);
+
+    size_t blob_size;
+    uint64_t fee;
+    bool relayed;
+    transaction pool_tx;
+    for(const transaction &tx : txs)
+    {
+      crypto::hash tx_hash = get_transaction_hash(tx);
+      m_tx_pool.take_tx(tx_hash, pool_tx, blob_size, fee, relayed);
+    }
+  }
+}
+
 bool Blockchain::for_all_key_images(std::function<bool(const crypto::key_image&)> f) const
 {
   return m_db->for_all_key_images(f);
@@ -3943,3 +4667,8 @@ bool Blockchain::for_all_outputs(std::function<bool(uint64_t amount, const crypt
 {
   return m_db->for_all_outputs(f);;
 }
+
+namespace cryptonote {
+// used by core, which can't see the template's definition
+template bool Blockchain::get_transactions(const std::vector<crypto::hash>&, std::list<transaction>&, std::list<crypto::hash>&) const;
+}
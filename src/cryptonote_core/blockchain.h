@@ -37,7 +37,9 @@
 #include <boost/multi_index/global_fun.hpp>
 #include <boost/multi_index/hashed_index.hpp>
 #include <boost/multi_index/member.hpp>
+#include <boost/multi_index/ordered_index.hpp>
 #include <boost/foreach.hpp>
+#include <boost/circular_buffer.hpp>
 #include <atomic>
 #include <unordered_map>
 #include <unordered_set>
@@ -54,6 +56,7 @@
 #include "crypto/hash.h"
 #include "checkpoints.h"
 #include "hardfork.h"
+#include "prepared_block.h"
 #include "blockchain_db/blockchain_db.h"
 
 namespace cryptonote
@@ -129,6 +132,16 @@ namespace cryptonote
      */
     bool init(BlockchainDB* db, HardFork*& hf, const bool testnet = false);
 
+    /**
+     * @brief empties the tx pool if precomputed block hashes are in use
+     *
+     * A pool stored by a terminated process may still hold transactions
+     * kept by blocks, which are not checked again when the blocks are
+     * added against the precomputed hashes.  This has to be called once
+     * the pool has been loaded.
+     */
+    void clear_txpool_for_hash_check();
+
     /**
      * @brief Uninitializes the blockchain state
      *
@@ -221,12 +234,43 @@ namespace cryptonote
      */
     bool prepare_handle_incoming_blocks(const std::list<block_complete_entry>  &blocks);
 
+    /**
+     * @brief performs some preprocessing on a group of already parsed incoming blocks
+     *
+     * Also opens a database batch for the group, so its blocks are
+     * committed together.  If it does, the blockchain lock stays held from
+     * here until cleanup_handle_incoming_blocks, which must always follow.
+     *
+     * @param blocks the incoming blocks, as parsed by parse_incoming_blocks
+     *
+     * @return false on erroneous blocks, else true
+     */
+    bool prepare_handle_incoming_blocks(const std::vector<prepared_block> &blocks);
+
+    /**
+     * @brief parses a group of incoming blocks and their transactions, in parallel
+     *
+     * Each block and tx blob is parsed exactly once, and the hashes needed by
+     * later processing stages are computed along the way.
+     *
+     * @param blocks_entry the incoming blocks
+     * @param blocks return-by-reference the parsed blocks, in the same order
+     *
+     * @return false if any block or transaction fails to parse, else true
+     */
+    bool parse_incoming_blocks(const std::list<block_complete_entry> &blocks_entry, std::vector<prepared_block> &blocks) const;
+
     /**
      * @brief incoming blocks post-processing, cleanup, and disk sync
      *
+     * Commits the batch opened by prepare_handle_incoming_blocks and
+     * releases the blockchain lock.  In async mode the disk sync is left
+     * to the async thread, and requests made while one is still running
+     * are folded into it.
+     *
      * @param force_sync if true, and Blockchain is handling syncing to disk, always sync
      *
-     * @return true
+     * @return false if the batch could not be committed, else true
      */
     bool cleanup_handle_incoming_blocks(bool force_sync = false);
 
@@ -401,14 +445,14 @@ namespace cryptonote
      *
      * @param req_start_block if non-zero, specifies a start point (otherwise find most recent commonality)
      * @param qblock_ids the foreign chain's "short history" (see get_short_chain_history)
-     * @param blocks return-by-reference the blocks and their transactions
+     * @param blocks return-by-reference the blocks and their transactions, as stored, with their output indices
      * @param total_height return-by-reference our current blockchain height
      * @param start_height return-by-reference the height of the first block returned
      * @param max_count the max number of blocks to get
      *
      * @return true if a block found in common or req_start_block specified, else false
      */
-    bool find_blockchain_supplement(const uint64_t req_start_block, const std::list<crypto::hash>& qblock_ids, std::list<std::pair<block, std::list<transaction> > >& blocks, uint64_t& total_height, uint64_t& start_height, size_t max_count) const;
+    bool find_blockchain_supplement(const uint64_t req_start_block, const std::list<crypto::hash>& qblock_ids, std::vector<block_blobs_t>& blocks, uint64_t& total_height, uint64_t& start_height, size_t max_count) const;
 
     /**
      * @brief retrieves a set of blocks and their transactions, and possibly other transactions
@@ -495,6 +539,43 @@ namespace cryptonote
      */
     bool store_blockchain();
 
+    /**
+     * @brief the state of the db snapshot being saved, or of the last one
+     */
+    struct db_snapshot_status
+    {
+      bool running = false;         //!< whether it is being saved
+      std::string path;             //!< the directory it is saved to, empty if there was none yet
+      bool compact = false;         //!< whether it leaves out free pages
+      uint64_t bytes_written = 0;   //!< the size of the files in the directory
+      uint64_t bytes_estimate = 0;  //!< the expected size of the snapshot, 0 if unknown
+      uint64_t start_time = 0;      //!< when it was started
+      uint64_t end_time = 0;        //!< when it ended, 0 if still running
+      std::string error;            //!< why it failed, empty if it didn't
+    };
+
+    /**
+     * @brief starts saving a copy of the db in the background
+     *
+     * The copy is consistent, and the blockchain stays in use meanwhile,
+     * see BlockchainDB::copy.  Its progress is had from
+     * get_db_snapshot_status.  Only one snapshot is saved at a time.
+     *
+     * @param path the directory to save to, on this host
+     * @param compact whether to leave out free pages
+     * @param error return-by-reference why it couldn't be started
+     *
+     * @return false if a snapshot is being saved already, otherwise true
+     */
+    bool start_db_snapshot(const std::string &path, bool compact, std::string &error);
+
+    /**
+     * @brief gets the state of the db snapshot being saved, or of the last one
+     *
+     * @return the snapshot's state
+     */
+    db_snapshot_status get_db_snapshot_status() const;
+
     /**
      * @brief validates a transaction's inputs
      *
@@ -508,10 +589,25 @@ namespace cryptonote
      * @param max_used_block_id return-by-reference block hash of most recent input
      * @param tvc returned information about tx verification
      * @param kept_by_block whether or not the transaction is from a previously-verified block
+     * @param rct_semantics_verified whether check_tx_rct_semantics already passed for the transaction
      *
      * @return false if any input is invalid, otherwise true
      */
-    bool check_tx_inputs(transaction& tx, uint64_t& pmax_used_block_height, crypto::hash& max_used_block_id, tx_verification_context &tvc, bool kept_by_block = false);
+    bool check_tx_inputs(transaction& tx, uint64_t& pmax_used_block_height, crypto::hash& max_used_block_id, tx_verification_context &tvc, bool kept_by_block = false, bool rct_semantics_verified = false);
+
+    /**
+     * @brief checks the parts of a transaction's rct signatures which do not depend on the blockchain
+     *
+     * These are the range proofs and, for simple rct signatures, the sum
+     * of the commitments.  They are the bulk of the verification work, and
+     * as they need no blockchain lookups, they can be checked for many
+     * transactions at once before the transactions are handed to the pool.
+     *
+     * @param tx the transaction to check
+     *
+     * @return true if the checks pass, otherwise false
+     */
+    static bool check_tx_rct_semantics(const transaction& tx);
 
     /**
      * @brief get dynamic per kB fee for a given block size
@@ -698,6 +794,37 @@ namespace cryptonote
     void set_user_options(uint64_t block_threads, uint64_t blocks_per_sync,
         blockchain_db_sync_mode sync_mode, bool fast_sync);
 
+    /**
+     * @brief sets the alternative block store options
+     *
+     * @param persist whether to keep alternative blocks in the database across restarts
+     * @param max_memory the approximate number of bytes of alternative blocks to keep
+     */
+    void set_alt_blocks_options(bool persist, uint64_t max_memory);
+
+    /**
+     * @brief prunes old transaction data as blocks are added
+     *
+     * The prunable data of transactions in all but the most recent
+     * keep_blocks blocks is dropped from the database.  Pruned blocks
+     * are still served to wallets, but no longer to syncing peers.
+     *
+     * @param keep_blocks the number of recent blocks to keep whole
+     */
+    void set_pruning(uint64_t keep_blocks);
+
+    /**
+     * @brief sets a file of trusted block hashes to fast sync against
+     *
+     * The file has the same format as the compiled-in block hashes, as
+     * written by blockchain_export --blocksdat from a fully verified node.
+     * It is used instead of the compiled-in hashes when it covers more
+     * blocks and agrees with them.
+     *
+     * @param filename the path to the file, or empty for none
+     */
+    void set_fast_sync_file(const std::string& filename);
+
     /**
      * @brief set whether or not to show/print time statistics
      *
@@ -777,6 +904,24 @@ namespace cryptonote
      */
     std::map<uint64_t, std::tuple<uint64_t, uint64_t, uint64_t>> get_output_histogram(const std::vector<uint64_t> &amounts, bool unlocked, uint64_t recent_cutoff) const;
 
+    /**
+     * @brief get the cumulative number of outputs of an amount per block
+     *
+     * For each height from from_height to to_height inclusively, gives
+     * the number of outputs of the amount created up to that block.  A
+     * to_height of 0, or past the top block, means up to the top block.
+     * RingCT outputs (amount 0) are served from memory.
+     *
+     * @param amount the output amount (0 for RingCT outputs)
+     * @param from_height the first height
+     * @param to_height the last height
+     * @param distribution return-by-reference the cumulative counts
+     * @param base return-by-reference the number of outputs below from_height
+     *
+     * @return false if the range is empty or the lookup fails, otherwise true
+     */
+    bool get_output_distribution(uint64_t amount, uint64_t from_height, uint64_t to_height, std::vector<uint64_t> &distribution, uint64_t &base) const;
+
     /**
      * @brief perform a check on all key images in the blockchain
      *
@@ -835,6 +980,19 @@ namespace cryptonote
         std::vector<output_data_t> &outputs, std::unordered_map<crypto::hash,
         cryptonote::transaction> &txs) const;
 
+    /**
+     * @brief fills in the per-tx scan tables for a range of transactions
+     *
+     * @param tx_tables the transactions and the tables to fill in for them
+     * @param begin the index of the first transaction to process
+     * @param end one past the index of the last transaction to process
+     * @param offset_map the sorted absolute offsets fetched, per amount
+     * @param tx_map the outputs fetched for offset_map, per amount
+     */
+    void scan_table_worker(const std::vector<std::pair<const transaction*, std::unordered_map<crypto::key_image, std::vector<output_data_t>>*>> &tx_tables,
+        size_t begin, size_t end, const std::map<uint64_t, std::vector<uint64_t>> &offset_map,
+        const std::map<uint64_t, std::vector<output_data_t>> &tx_map) const;
+
     /**
      * @brief computes the "short" and "long" hashes for a set of blocks
      *
@@ -843,7 +1001,7 @@ namespace cryptonote
      * @param map return-by-reference the hashes for each block
      */
     
-	void block_longhash_worker(cn_pow_hash_v2& hash_ctx, const std::vector<block> &blocks, std::unordered_map<crypto::hash, crypto::hash> &map);
+	void block_longhash_worker(cn_pow_hash_v2& hash_ctx, const std::vector<const prepared_block*> &blocks, std::unordered_map<crypto::hash, crypto::hash> &map);
 
     void cancel();
 
@@ -860,6 +1018,39 @@ namespace cryptonote
 
     typedef std::unordered_map<crypto::hash, block_extended_info> blocks_ext_by_hash;
 
+    /**
+     * @brief an entry in the alternative block store
+     *
+     * Each entry points to the entry of its parent block, so an alternative
+     * chain can be walked back to the main chain without hash lookups.
+     */
+    struct alt_block_entry
+    {
+      crypto::hash id; //!< the block's hash
+      uint64_t height; //!< the block's height
+      difficulty_type cumulative_difficulty; //!< the accumulated difficulty after the block
+      block_extended_info bei; //!< the block and its metadata
+      mutable const alt_block_entry *prev; //!< the parent's entry, or NULL if the parent is on the main chain
+      mutable size_t children; //!< the number of entries whose parent is this one
+      time_t receive_time; //!< when the block was added to the store
+      size_t memory; //!< approximate memory used by the entry
+    };
+
+    struct alt_block_by_id {};
+    struct alt_block_by_height {};
+    struct alt_block_by_cumulative_difficulty {};
+
+    typedef boost::multi_index_container<
+      alt_block_entry,
+      boost::multi_index::indexed_by<
+        boost::multi_index::hashed_unique<boost::multi_index::tag<alt_block_by_id>, boost::multi_index::member<alt_block_entry, crypto::hash, &alt_block_entry::id>>,
+        boost::multi_index::ordered_non_unique<boost::multi_index::tag<alt_block_by_height>, boost::multi_index::member<alt_block_entry, uint64_t, &alt_block_entry::height>>,
+        boost::multi_index::ordered_non_unique<boost::multi_index::tag<alt_block_by_cumulative_difficulty>, boost::multi_index::member<alt_block_entry, difficulty_type, &alt_block_entry::cumulative_difficulty>>
+      >
+    > alt_blocks_container;
+
+    typedef std::list<const alt_block_entry*> alt_chain_type;
+
     typedef std::unordered_map<crypto::hash, block> blocks_by_hash;
 
     typedef std::map<uint64_t, std::vector<std::pair<crypto::hash, size_t>>> outputs_container; //crypto::hash - tx hash, size_t - index of out in transaction
@@ -883,6 +1074,7 @@ namespace cryptonote
     // SHA-3 hashes for each block and for fast pow checking
     std::vector<crypto::hash> m_blocks_hash_check;
     std::vector<crypto::hash> m_blocks_txs_check;
+    std::string m_fast_sync_file;
 
     blockchain_db_sync_mode m_db_sync_mode;
     bool m_fast_sync;
@@ -892,16 +1084,25 @@ namespace cryptonote
     uint64_t m_fake_pow_calc_time;
     uint64_t m_fake_scan_time;
     uint64_t m_sync_counter;
-    std::vector<uint64_t> m_timestamps;
-    std::vector<difficulty_type> m_difficulties;
+    boost::circular_buffer<uint64_t> m_timestamps;
+    boost::circular_buffer<difficulty_type> m_difficulties;
     uint64_t m_timestamps_and_difficulties_height;
 
+    // cumulative RingCT outputs as of each block, synced lazily with the db
+    mutable std::vector<uint64_t> m_rct_outputs_distribution;
+
     boost::asio::io_service m_async_service;
     boost::thread_group m_async_pool;
     std::unique_ptr<boost::asio::io_service::work> m_async_work_idle;
 
     // all alternative chains
-    blocks_ext_by_hash m_alternative_chains; // crypto::hash -> block_extended_info
+    alt_blocks_container m_alternative_chains;
+    size_t m_alt_blocks_memory;
+    uint64_t m_alt_blocks_max_memory;
+    bool m_persist_alt_blocks;
+
+    // number of recent blocks kept whole, 0 if not pruning
+    uint64_t m_prune_keep_blocks;
 
     // some invalid blocks
     blocks_ext_by_hash m_invalid_blocks;     // crypto::hash -> block_extended_info
@@ -920,6 +1121,18 @@ namespace cryptonote
 
     std::atomic<bool> m_cancel;
 
+    // whether prepare_handle_incoming_blocks opened a db batch, and left
+    // the pool and blockchain locks held for it; only touched under them
+    bool m_incoming_batch;
+
+    // set while an async disk sync is queued or running
+    std::atomic_flag m_sync_pending = ATOMIC_FLAG_INIT;
+
+    // the db snapshot being saved, or the last one
+    boost::thread m_snapshot_thread;
+    mutable boost::mutex m_snapshot_lock;
+    db_snapshot_status m_snapshot;
+
     /**
      * @brief collects the keys for all outputs being "spent" as an input
      *
@@ -981,10 +1194,11 @@ namespace cryptonote
      * @param tx the transaction to validate
      * @param tvc returned information about tx verification
      * @param pmax_related_block_height return-by-pointer the height of the most recent block in the input set
+     * @param rct_semantics_verified whether check_tx_rct_semantics already passed for the transaction
      *
      * @return false if any validation step fails, otherwise true
      */
-    bool check_tx_inputs(transaction& tx, tx_verification_context &tvc, uint64_t* pmax_used_block_height = NULL);
+    bool check_tx_inputs(transaction& tx, tx_verification_context &tvc, uint64_t* pmax_used_block_height = NULL, bool rct_semantics_verified = false);
 
     /**
      * @brief performs a blockchain reorganization according to the longest chain rule
@@ -998,7 +1212,7 @@ namespace cryptonote
      *
      * @return false if the reorganization fails, otherwise true
      */
-    bool switch_to_alternative_blockchain(std::list<blocks_ext_by_hash::iterator>& alt_chain, bool discard_disconnected_chain);
+    bool switch_to_alternative_blockchain(alt_chain_type& alt_chain, bool discard_disconnected_chain);
 
     /**
      * @brief removes the most recent block from the blockchain
@@ -1059,7 +1273,57 @@ namespace cryptonote
      *
      * @return the difficulty requirement
      */
-    difficulty_type get_next_difficulty_for_alternative_chain(const std::list<blocks_ext_by_hash::iterator>& alt_chain, block_extended_info& bei) const;
+    difficulty_type get_next_difficulty_for_alternative_chain(const alt_chain_type& alt_chain, block_extended_info& bei) const;
+
+    /**
+     * @brief adds a block to the alternative block store
+     *
+     * @param id the block's hash
+     * @param bei the block and its metadata
+     * @param prev the parent's entry, or NULL if the parent is on the main chain
+     * @param store whether to also write the block to the database, if persistence is enabled
+     * @param receive_time when the block was received, 0 for now
+     *
+     * @return the new entry, or NULL if the block was already stored
+     */
+    const alt_block_entry* add_alt_block(const crypto::hash& id, const block_extended_info& bei, const alt_block_entry* prev, bool store = true, time_t receive_time = 0);
+
+    /**
+     * @brief removes an entry from the alternative block store
+     *
+     * Children of the entry are re-linked to the main chain, so this must
+     * only be called once the entry's block is part of the main chain, or
+     * after its children have been removed.
+     *
+     * @param entry the entry to remove
+     */
+    void remove_alt_block(const alt_block_entry* entry);
+
+    /**
+     * @brief removes an entry and all its descendants from the alternative block store
+     *
+     * @param entry the entry to remove
+     *
+     * @return the number of entries removed
+     */
+    size_t remove_alt_block_subtree(const alt_block_entry* entry);
+
+    /**
+     * @brief evicts alternative blocks which are stale or over the memory cap
+     *
+     * Blocks which can no longer be accepted because of checkpoints, or
+     * which were received too long ago, are removed first.  Then, while the
+     * store uses more than the memory cap, the chain tip with the lowest
+     * cumulative difficulty is removed, oldest first.
+     *
+     * Must not be called while an alternative chain is being handled.
+     */
+    void prune_alt_blocks();
+
+    /**
+     * @brief loads alternative blocks stored in the database
+     */
+    void load_alt_blocks();
 
     /**
      * @brief sanity checks a miner transaction before validating an entire block
@@ -1125,6 +1389,41 @@ namespace cryptonote
      */
     void add_out_to_get_random_outs(COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::outs_for_amount& result_outs, uint64_t amount, size_t i) const;
 
+    /**
+     * @brief brings the in-memory RingCT output distribution up to the db height
+     *
+     * Drops entries for blocks which are no longer in the chain, and
+     * loads the ones for new blocks from the block metadata.
+     */
+    void sync_rct_outputs_distribution() const;
+
+    /**
+     * @brief gets the number of outputs of an amount old enough to be spent
+     *
+     * Outputs are sorted by height, so this is the number of outputs in
+     * blocks at least CRYPTONOTE_DEFAULT_TX_SPENDABLE_AGE deep.
+     *
+     * @param amount the output amount (0 for RingCT outputs)
+     *
+     * @return the number of outputs which may be used as mixins
+     */
+    uint64_t get_num_unlocked_outputs(uint64_t amount) const;
+
+    /**
+     * @brief picks random unlocked outputs of an amount to mix with
+     *
+     * Indices are drawn from a triangular distribution favouring recent
+     * outputs, and their data is fetched in bulk for each round of draws.
+     * If there are no more than count outputs, all unlocked ones are used.
+     *
+     * @param amount the output amount (0 for RingCT outputs)
+     * @param num_outs the number of outputs to pick from
+     * @param count the number of outputs wanted
+     * @param indices return-by-reference the picked amount output indices
+     * @param outputs return-by-reference the picked outputs' data
+     */
+    void pick_random_outputs(uint64_t amount, uint64_t num_outs, uint64_t count, std::vector<uint64_t> &indices, std::vector<output_data_t> &outputs) const;
+
     /**
      * @brief adds the given output to the requested set of random ringct outputs
      *
@@ -1212,6 +1511,37 @@ namespace cryptonote
      */
     uint64_t get_adjusted_time() const;
 
+    /**
+     * @brief reloads the difficulty window for the given chain height from the db
+     *
+     * @param height the current blockchain height
+     */
+    void load_difficulty_window(uint64_t height);
+
+    /**
+     * @brief updates the difficulty window after the top block was popped
+     *
+     * If the window cannot be adjusted in place, it is invalidated and will
+     * be reloaded on the next call to get_difficulty_for_next_block.
+     *
+     * @param new_height the blockchain height after the pop
+     */
+    void pop_difficulty_window(uint64_t new_height);
+
+    /**
+     * @brief stores the blockchain from the async thread
+     *
+     * Errors are logged rather than thrown, so they don't end the thread.
+     */
+    void async_store_blockchain();
+
+    /**
+     * @brief saves the db snapshot set up by start_db_snapshot
+     *
+     * Run by the snapshot thread; errors go to the snapshot's status.
+     */
+    void save_db_snapshot();
+
     /**
      * @brief finish an alternate chain's timestamp window from the main chain
      *
@@ -1264,6 +1594,28 @@ namespace cryptonote
      */
     void load_compiled_in_block_hashes();
 
+    /**
+     * @brief loads block hashes from the fast sync file, if any
+     *
+     * The hashes replace the ones already loaded only if they extend them
+     * and agree with the blocks already in the blockchain.
+     */
+    void load_fast_sync_file_block_hashes();
+
+    /**
+     * @brief parses a set of block hashes in blocks.dat format
+     *
+     * The data is a 32 bit little endian block count, followed by that
+     * many block hashes in height order.
+     *
+     * @param data the raw data
+     * @param size the size of the raw data
+     * @param hashes return-by-reference the block hashes
+     *
+     * @return false if the data is empty or truncated, otherwise true
+     */
+    static bool parse_block_hashes(const unsigned char *data, size_t size, std::vector<crypto::hash>& hashes);
+
     /**
      * @brief expands v2 transaction data from blockchain
      *
@@ -192,11 +192,18 @@ namespace cryptonote
     std::vector<std::vector<crypto::signature> > signatures; //count signatures  always the same as inputs count
     rct::rctSig rct_signatures;
 
+    // set when the prunable signature data was not loaded along with the rest
+    bool pruned;
+
     transaction();
     virtual ~transaction();
     void set_null();
 
     BEGIN_SERIALIZE_OBJECT()
+      // the object may have been loaded pruned before, by serialize_base
+      if (!typename Archive<W>::is_saving())
+        pruned = false;
+
       FIELDS(*static_cast<transaction_prefix *>(this))
 
       if (version == 1)
@@ -239,7 +246,7 @@ namespace cryptonote
           bool r = rct_signatures.serialize_rctsig_base(ar, vin.size(), vout.size());
           if (!r || !ar.stream().good()) return false;
           ar.end_object();
-          if (rct_signatures.type != rct::RCTTypeNull)
+          if (!pruned && rct_signatures.type != rct::RCTTypeNull)
           {
             ar.tag("rctsig_prunable");
             ar.begin_object();
@@ -252,6 +259,28 @@ namespace cryptonote
       }
     END_SERIALIZE()
 
+    // prefix and RingCT base only, the part of a transaction kept by pruning
+    template<bool W, template <bool> class Archive>
+    bool serialize_base(Archive<W> &ar)
+    {
+      FIELDS(*static_cast<transaction_prefix *>(this))
+
+      if (version != 1)
+      {
+        ar.tag("rct_signatures");
+        if (!vin.empty())
+        {
+          ar.begin_object();
+          bool r = rct_signatures.serialize_rctsig_base(ar, vin.size(), vout.size());
+          if (!r || !ar.stream().good()) return false;
+          ar.end_object();
+        }
+      }
+      if (!typename Archive<W>::is_saving())
+        pruned = true;
+      return true;
+    }
+
   private:
     static size_t get_signature_size(const txin_v& tx_in);
   };
@@ -279,6 +308,7 @@ namespace cryptonote
     extra.clear();
     signatures.clear();
     rct_signatures.type = rct::RCTTypeNull;
+    pruned = false;
   }
 
   inline
@@ -37,6 +37,7 @@ using namespace epee;
 #include "cryptonote_core.h"
 #include "common/command_line.h"
 #include "common/util.h"
+#include "common/threadpool.h"
 #include "warnings.h"
 #include "crypto/crypto.h"
 #include "cryptonote_config.h"
@@ -47,6 +48,7 @@ using namespace epee;
 #include "ringct/rctTypes.h"
 #include "blockchain_db/blockchain_db.h"
 #include "blockchain_db/lmdb/db_lmdb.h"
+#include "blockchain_db/memory/db_memory.h"
 #if defined(BERKELEY_DB)
 #include "blockchain_db/berkeleydb/db_bdb.h"
 #endif
@@ -140,10 +142,17 @@ namespace cryptonote
     command_line::add_arg(desc, command_line::arg_db_type);
     command_line::add_arg(desc, command_line::arg_prep_blocks_threads);
     command_line::add_arg(desc, command_line::arg_fast_block_sync);
+    command_line::add_arg(desc, command_line::arg_fast_sync_file);
     command_line::add_arg(desc, command_line::arg_db_sync_mode);
     command_line::add_arg(desc, command_line::arg_show_time_stats);
     command_line::add_arg(desc, command_line::arg_db_auto_remove_logs);
     command_line::add_arg(desc, command_line::arg_block_sync_size);
+    command_line::add_arg(desc, command_line::arg_max_txpool_size);
+    command_line::add_arg(desc, command_line::arg_alt_blocks_max_memory);
+    command_line::add_arg(desc, command_line::arg_db_persist_alt_blocks);
+    command_line::add_arg(desc, command_line::arg_db_max_size);
+    command_line::add_arg(desc, command_line::arg_prune_blockchain);
+    command_line::add_arg(desc, command_line::arg_prune_blockchain_keep_blocks);
   }
   //-----------------------------------------------------------------------------------------------
   bool core::handle_command_line(const boost::program_options::variables_map& vm)
@@ -254,9 +263,6 @@ namespace cryptonote
     m_fakechain = test_options != NULL;
     bool r = handle_command_line(vm);
 
-    r = m_mempool.init(m_fakechain ? std::string() : m_config_folder);
-    CHECK_AND_ASSERT_MES(r, false, "Failed to initialize memory pool");
-
     std::string db_type = command_line::get_arg(vm, command_line::arg_db_type);
     std::string db_sync_mode = command_line::get_arg(vm, command_line::arg_db_sync_mode);
     bool fast_sync = command_line::get_arg(vm, command_line::arg_fast_block_sync) != 0;
@@ -314,6 +320,11 @@ namespace cryptonote
       return false;
 #endif
     }
+    else if (db_type == "memory")
+    {
+      // nothing is synced, so the sync modes make no difference
+      db = new BlockchainMemory();
+    }
     else
     {
       LOG_ERROR("Attempted to use non-existent database type");
@@ -383,6 +394,7 @@ namespace cryptonote
 
       bool auto_remove_logs = command_line::get_arg(vm, command_line::arg_db_auto_remove_logs) != 0;
       db->set_auto_remove_logs(auto_remove_logs);
+      db->set_max_size(command_line::get_arg(vm, command_line::arg_db_max_size) << 20);
       db->open(filename, db_flags);
       if(!db->m_open)
         return false;
@@ -396,7 +408,21 @@ namespace cryptonote
     m_blockchain_storage.set_user_options(blocks_threads,
         blocks_per_sync, sync_mode, fast_sync);
 
+    bool persist_alt_blocks = command_line::get_arg(vm, command_line::arg_db_persist_alt_blocks) != 0;
+    uint64_t alt_blocks_max_memory = command_line::get_arg(vm, command_line::arg_alt_blocks_max_memory);
+    m_blockchain_storage.set_alt_blocks_options(persist_alt_blocks, alt_blocks_max_memory);
+    if (command_line::get_arg(vm, command_line::arg_prune_blockchain))
+      m_blockchain_storage.set_pruning(command_line::get_arg(vm, command_line::arg_prune_blockchain_keep_blocks));
+    m_blockchain_storage.set_fast_sync_file(command_line::get_arg(vm, command_line::arg_fast_sync_file));
+
     r = m_blockchain_storage.init(db, m_testnet, test_options);
+    CHECK_AND_ASSERT_MES(r, false, "Failed to initialize blockchain storage");
+
+    // the pool is stored in the blockchain database, so is loaded after it
+    m_mempool.set_txpool_max_size(command_line::get_arg(vm, command_line::arg_max_txpool_size));
+    r = m_mempool.init(m_fakechain ? std::string() : m_config_folder);
+    CHECK_AND_ASSERT_MES(r, false, "Failed to initialize memory pool");
+    m_blockchain_storage.clear_txpool_for_hash_check();
 
     // now that we have a valid m_blockchain_storage, we can clean out any
     // transactions in the pool that do not conform to the current fork
@@ -404,7 +430,6 @@ namespace cryptonote
 
     bool show_time_stats = command_line::get_arg(vm, command_line::arg_show_time_stats) != 0;
     m_blockchain_storage.set_show_time_stats(show_time_stats);
-    CHECK_AND_ASSERT_MES(r, false, "Failed to initialize blockchain storage");
 
     block_sync_size = command_line::get_arg(vm, command_line::arg_block_sync_size);
     if (block_sync_size == 0)
@@ -480,17 +505,121 @@ namespace cryptonote
       return false;
     }
 
-    crypto::hash tx_hash = null_hash;
-    crypto::hash tx_prefixt_hash = null_hash;
-    transaction tx;
+    prepared_tx ptx;
+    ptx.tx_hash = null_hash;
+    ptx.tx_prefix_hash = null_hash;
+    ptx.blob_size = tx_blob.size();
 
-    if(!parse_tx_from_blob(tx, tx_hash, tx_prefixt_hash, tx_blob))
+    if(!parse_tx_from_blob(ptx.tx, ptx.tx_hash, ptx.tx_prefix_hash, tx_blob))
     {
       LOG_PRINT_L1("WRONG TRANSACTION BLOB, Failed to parse, rejected");
       tvc.m_verifivation_failed = true;
       return false;
     }
-    //std::cout << "!"<< tx.vin.size() << std::endl;
+
+    return handle_incoming_tx_post_parse(ptx, tvc, keeped_by_block, relayed);
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool core::handle_incoming_tx(const prepared_tx& tx, tx_verification_context& tvc, bool keeped_by_block, bool relayed)
+  {
+    tvc = boost::value_initialized<tx_verification_context>();
+    //want to process all transactions sequentially
+    CRITICAL_REGION_LOCAL(m_incoming_tx_lock);
+
+    if(tx.blob_size > get_max_tx_size())
+    {
+      LOG_PRINT_L1("WRONG TRANSACTION BLOB, too big size " << tx.blob_size << ", rejected");
+      tvc.m_verifivation_failed = true;
+      tvc.m_too_big = true;
+      return false;
+    }
+
+    return handle_incoming_tx_post_parse(tx, tvc, keeped_by_block, relayed);
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool core::handle_incoming_txs(const std::list<blobdata>& tx_blobs, std::vector<crypto::hash>& tx_hashes, std::vector<tx_verification_context>& tvc, bool keeped_by_block, bool relayed)
+  {
+    std::vector<prepared_tx> ptxs(tx_blobs.size());
+    std::vector<char> checked(tx_blobs.size(), 0);
+    std::vector<char> rct_verified(tx_blobs.size(), 0);
+    tvc.assign(tx_blobs.size(), boost::value_initialized<tx_verification_context>());
+
+    // parsing and signature checks don't need the blockchain, so spread them
+    // over the thread pool; the pool still sees the txes one at a time
+    tools::threadpool& tpool = tools::threadpool::getInstance();
+    tools::threadpool::waiter waiter;
+    size_t i = 0;
+    for (const blobdata& tx_blob : tx_blobs)
+    {
+      tpool.submit(&waiter, [&, i]() {
+        if(tx_blob.size() > get_max_tx_size())
+        {
+          LOG_PRINT_L1("WRONG TRANSACTION BLOB, too big size " << tx_blob.size() << ", rejected");
+          tvc[i].m_verifivation_failed = true;
+          tvc[i].m_too_big = true;
+          return;
+        }
+
+        prepared_tx& ptx = ptxs[i];
+        ptx.tx_hash = null_hash;
+        ptx.tx_prefix_hash = null_hash;
+        ptx.blob_size = tx_blob.size();
+        if(!parse_tx_from_blob(ptx.tx, ptx.tx_hash, ptx.tx_prefix_hash, tx_blob))
+        {
+          LOG_PRINT_L1("WRONG TRANSACTION BLOB, Failed to parse, rejected");
+          tvc[i].m_verifivation_failed = true;
+          return;
+        }
+
+        if(!check_incoming_tx(ptx, tvc[i], keeped_by_block))
+          return;
+        checked[i] = 1;
+
+        // txes we already have are skipped by add_new_tx, don't verify them
+        if(m_mempool.have_tx(ptx.tx_hash) || m_blockchain_storage.have_tx(ptx.tx_hash))
+          return;
+
+        if(!Blockchain::check_tx_rct_semantics(ptx.tx))
+        {
+          LOG_PRINT_L1("WRONG TRANSACTION BLOB, Failed to check tx " << ptx.tx_hash << " ringct semantics, rejected");
+          tvc[i].m_verifivation_failed = true;
+          checked[i] = 0;
+          return;
+        }
+        rct_verified[i] = 1;
+      });
+      ++i;
+    }
+    waiter.wait();
+
+    tx_hashes.resize(ptxs.size());
+    for (i = 0; i < ptxs.size(); ++i)
+      tx_hashes[i] = ptxs[i].tx_hash;
+
+    //want to process all transactions sequentially
+    CRITICAL_REGION_LOCAL(m_incoming_tx_lock);
+
+    bool ok = true;
+    for (i = 0; i < ptxs.size(); ++i)
+    {
+      if (!checked[i] || !add_incoming_tx(ptxs[i], tvc[i], keeped_by_block, relayed, rct_verified[i]))
+        ok = false;
+    }
+    return ok;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool core::handle_incoming_tx_post_parse(const prepared_tx& ptx, tx_verification_context& tvc, bool keeped_by_block, bool relayed)
+  {
+    if(!check_incoming_tx(ptx, tvc, keeped_by_block))
+      return false;
+
+    return add_incoming_tx(ptx, tvc, keeped_by_block, relayed, false);
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool core::check_incoming_tx(const prepared_tx& ptx, tx_verification_context& tvc, bool keeped_by_block) const
+  {
+    const transaction &tx = ptx.tx;
+    const crypto::hash &tx_hash = ptx.tx_hash;
 
     //uint8_t version = m_blockchain_storage.get_current_hard_fork_version();
     const size_t max_tx_version = CURRENT_TRANSACTION_VERSION;
@@ -515,7 +644,14 @@ namespace cryptonote
       return false;
     }
 
-    bool r = add_new_tx(tx, tx_hash, tx_prefixt_hash, tx_blob.size(), tvc, keeped_by_block, relayed);
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool core::add_incoming_tx(const prepared_tx& ptx, tx_verification_context& tvc, bool keeped_by_block, bool relayed, bool rct_semantics_verified)
+  {
+    const crypto::hash &tx_hash = ptx.tx_hash;
+
+    bool r = add_new_tx(ptx.tx, tx_hash, ptx.tx_prefix_hash, ptx.blob_size, tvc, keeped_by_block, relayed, rct_semantics_verified);
     if(tvc.m_verifivation_failed)
     {LOG_PRINT_RED_L1("Transaction verification failed: " << tx_hash);}
     else if(tvc.m_verifivation_impossible)
@@ -682,7 +818,7 @@ namespace cryptonote
     crypto::hash tx_prefix_hash = get_transaction_prefix_hash(tx);
     blobdata bl;
     t_serializable_object_to_blob(tx, bl);
-    return add_new_tx(tx, tx_hash, tx_prefix_hash, bl.size(), tvc, keeped_by_block, relayed);
+    return add_new_tx(tx, tx_hash, tx_prefix_hash, bl.size(), tvc, keeped_by_block, relayed, false);
   }
   //-----------------------------------------------------------------------------------------------
   size_t core::get_blockchain_total_transactions() const
@@ -690,7 +826,7 @@ namespace cryptonote
     return m_blockchain_storage.get_total_transactions();
   }
   //-----------------------------------------------------------------------------------------------
-  bool core::add_new_tx(const transaction& tx, const crypto::hash& tx_hash, const crypto::hash& tx_prefix_hash, size_t blob_size, tx_verification_context& tvc, bool keeped_by_block, bool relayed)
+  bool core::add_new_tx(const transaction& tx, const crypto::hash& tx_hash, const crypto::hash& tx_prefix_hash, size_t blob_size, tx_verification_context& tvc, bool keeped_by_block, bool relayed, bool rct_semantics_verified)
   {
     if(m_mempool.have_tx(tx_hash))
     {
@@ -705,7 +841,7 @@ namespace cryptonote
     }
 
     uint8_t version = m_blockchain_storage.get_current_hard_fork_version();
-    return m_mempool.add_tx(tx, tx_hash, blob_size, tvc, keeped_by_block, relayed, version);
+    return m_mempool.add_tx(tx, tx_hash, blob_size, tvc, keeped_by_block, relayed, version, rct_semantics_verified);
   }
   //-----------------------------------------------------------------------------------------------
   bool core::relay_txpool_transactions()
@@ -729,18 +865,19 @@ namespace cryptonote
     return true;
   }
   //-----------------------------------------------------------------------------------------------
-  void core::on_transaction_relayed(const cryptonote::blobdata& tx_blob)
+  bool core::on_transaction_relayed(const cryptonote::blobdata& tx_blob, crypto::hash& tx_hash)
   {
     std::list<std::pair<crypto::hash, cryptonote::transaction>> txs;
     cryptonote::transaction tx;
-    crypto::hash tx_hash, tx_prefix_hash;
+    crypto::hash tx_prefix_hash;
     if (!parse_and_validate_tx_from_blob(tx_blob, tx, tx_hash, tx_prefix_hash))
     {
       LOG_ERROR("Failed to parse relayed transaction");
-      return;
+      return false;
     }
     txs.push_back(std::make_pair(tx_hash, std::move(tx)));
     m_mempool.set_relayed(txs);
+    return true;
   }
   //-----------------------------------------------------------------------------------------------
   bool core::get_block_template(block& b, const account_public_address& adr, difficulty_type& diffic, uint64_t& height, const blobdata& ex_nonce)
@@ -753,7 +890,7 @@ namespace cryptonote
     return m_blockchain_storage.find_blockchain_supplement(qblock_ids, resp);
   }
   //-----------------------------------------------------------------------------------------------
-  bool core::find_blockchain_supplement(const uint64_t req_start_block, const std::list<crypto::hash>& qblock_ids, std::list<std::pair<block, std::list<transaction> > >& blocks, uint64_t& total_height, uint64_t& start_height, size_t max_count) const
+  bool core::find_blockchain_supplement(const uint64_t req_start_block, const std::list<crypto::hash>& qblock_ids, std::vector<block_blobs_t>& blocks, uint64_t& total_height, uint64_t& start_height, size_t max_count) const
   {
     return m_blockchain_storage.find_blockchain_supplement(req_start_block, qblock_ids, blocks, total_height, start_height, max_count);
   }
@@ -858,15 +995,39 @@ namespace cryptonote
     return true;
   }
 
+  //-----------------------------------------------------------------------------------------------
+  bool core::prepare_handle_incoming_blocks(const std::vector<prepared_block> &blocks)
+  {
+    m_blockchain_storage.prepare_handle_incoming_blocks(blocks);
+    return true;
+  }
+
+  //-----------------------------------------------------------------------------------------------
+  bool core::parse_incoming_blocks(const std::list<block_complete_entry> &blocks_entry, std::vector<prepared_block> &blocks) const
+  {
+    return m_blockchain_storage.parse_incoming_blocks(blocks_entry, blocks);
+  }
+
   //-----------------------------------------------------------------------------------------------
   bool core::cleanup_handle_incoming_blocks(bool force_sync)
   {
-    m_blockchain_storage.cleanup_handle_incoming_blocks(force_sync);
+    if (!m_blockchain_storage.cleanup_handle_incoming_blocks(force_sync))
+    {
+      // the node's state no longer matches its database
+      LOG_ERROR("Failed to commit incoming blocks, stopping the daemon");
+      graceful_exit();
+      return false;
+    }
     return true;
   }
 
   //-----------------------------------------------------------------------------------------------
   bool core::handle_incoming_block(const blobdata& block_blob, block_verification_context& bvc, bool update_miner_blocktemplate)
+  {
+    return handle_incoming_block(block_blob, NULL, bvc, update_miner_blocktemplate);
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool core::handle_incoming_block(const blobdata& block_blob, const block *b, block_verification_context& bvc, bool update_miner_blocktemplate)
   {
     // load json & DNS checkpoints every 10min/hour respectively,
     // and verify them with respect to what blocks we already have
@@ -880,14 +1041,19 @@ namespace cryptonote
       return false;
     }
 
-    block b = AUTO_VAL_INIT(b);
-    if(!parse_and_validate_block_from_blob(block_blob, b))
+    block lb;
+    if (!b)
     {
-      LOG_PRINT_L1("Failed to parse and validate new block");
-      bvc.m_verifivation_failed = true;
-      return false;
+      lb = AUTO_VAL_INIT(lb);
+      if(!parse_and_validate_block_from_blob(block_blob, lb))
+      {
+        LOG_PRINT_L1("Failed to parse and validate new block");
+        bvc.m_verifivation_failed = true;
+        return false;
+      }
+      b = &lb;
     }
-    add_new_block(b, bvc);
+    add_new_block(*b, bvc);
     if(update_miner_blocktemplate && bvc.m_added_to_main_chain)
        update_miner_block_template();
     return true;
@@ -941,11 +1107,26 @@ namespace cryptonote
     return m_mempool.get_transaction(id, tx);
   }  
   //-----------------------------------------------------------------------------------------------
+  void core::get_pool_transaction_hashes(std::vector<crypto::hash>& hashes, uint64_t& revision) const
+  {
+    m_mempool.get_transaction_hashes(hashes, revision);
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool core::get_pool_changes_since(uint64_t revision, std::vector<crypto::hash>& added, std::vector<crypto::hash>& removed, uint64_t& current_revision) const
+  {
+    return m_mempool.get_changes_since(revision, added, removed, current_revision);
+  }
+  //-----------------------------------------------------------------------------------------------
   bool core::get_pool_transactions_and_spent_keys_info(std::vector<tx_info>& tx_infos, std::vector<spent_key_image_info>& key_image_infos) const
   {
     return m_mempool.get_transactions_and_spent_keys_info(tx_infos, key_image_infos);
   }
   //-----------------------------------------------------------------------------------------------
+  void core::get_pool_size_stats(uint64_t &bytes, uint64_t &max_bytes, uint64_t &evicted) const
+  {
+    m_mempool.get_size_stats(bytes, max_bytes, evicted);
+  }
+  //-----------------------------------------------------------------------------------------------
   bool core::get_short_chain_history(std::list<crypto::hash>& ids) const
   {
     return m_blockchain_storage.get_short_chain_history(ids);
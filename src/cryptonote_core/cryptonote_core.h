@@ -113,6 +113,36 @@ namespace cryptonote
       */
      bool handle_incoming_tx(const blobdata& tx_blob, tx_verification_context& tvc, bool keeped_by_block, bool relayed);
 
+     /**
+      * @brief handles a batch of incoming transactions
+      *
+      * The transactions are parsed and checked, including the parts of
+      * their signatures which do not depend on the blockchain, in parallel.
+      * Those which pass are then passed along to the transaction pool one
+      * after the other, in the order given.
+      *
+      * @param tx_blobs the txs to handle
+      * @param tx_hashes return-by-reference the hash of each transaction, or null_hash if it could not be parsed
+      * @param tvc return-by-reference metadata about each transaction's validity
+      * @param keeped_by_block if the transactions have been in a block
+      * @param relayed whether or not the transactions were relayed to us
+      *
+      * @return true if all the transactions made it to the transaction pool, otherwise false
+      */
+     bool handle_incoming_txs(const std::list<blobdata>& tx_blobs, std::vector<crypto::hash>& tx_hashes, std::vector<tx_verification_context>& tvc, bool keeped_by_block, bool relayed);
+
+     /**
+      * @brief handles an incoming transaction which has already been parsed
+      *
+      * @param tx the parsed tx to handle, as produced by parse_incoming_blocks
+      * @param tvc metadata about the transaction's validity
+      * @param keeped_by_block if the transaction has been in a block
+      * @param relayed whether or not the transaction was relayed to us
+      *
+      * @return true if the transaction made it to the transaction pool, otherwise false
+      */
+     bool handle_incoming_tx(const prepared_tx& tx, tx_verification_context& tvc, bool keeped_by_block, bool relayed);
+
      /**
       * @brief handles an incoming block
       *
@@ -129,6 +159,13 @@ namespace cryptonote
       */
      bool handle_incoming_block(const blobdata& block_blob, block_verification_context& bvc, bool update_miner_blocktemplate = true);
 
+     /**
+      * @copydoc handle_incoming_block(const blobdata&, block_verification_context&, bool)
+      *
+      * @param b the already parsed block_blob, or NULL to parse it here
+      */
+     bool handle_incoming_block(const blobdata& block_blob, const block *b, block_verification_context& bvc, bool update_miner_blocktemplate = true);
+
      /**
       * @copydoc Blockchain::prepare_handle_incoming_blocks
       *
@@ -136,6 +173,20 @@ namespace cryptonote
       */
      bool prepare_handle_incoming_blocks(const std::list<block_complete_entry>  &blocks);
 
+     /**
+      * @copydoc Blockchain::prepare_handle_incoming_blocks(const std::vector<prepared_block>&)
+      *
+      * @note see Blockchain::prepare_handle_incoming_blocks
+      */
+     bool prepare_handle_incoming_blocks(const std::vector<prepared_block> &blocks);
+
+     /**
+      * @copydoc Blockchain::parse_incoming_blocks
+      *
+      * @note see Blockchain::parse_incoming_blocks
+      */
+     bool parse_incoming_blocks(const std::list<block_complete_entry> &blocks_entry, std::vector<prepared_block> &blocks) const;
+
      /**
       * @copydoc Blockchain::cleanup_handle_incoming_blocks
       *
@@ -183,8 +234,13 @@ namespace cryptonote
 
      /**
       * @brief called when a transaction is relayed
+      *
+      * @param tx the transaction's blob
+      * @param tx_hash return-by-reference the transaction's hash
+      *
+      * @return false if the blob could not be parsed, otherwise true
       */
-     virtual void on_transaction_relayed(const cryptonote::blobdata& tx);
+     virtual bool on_transaction_relayed(const cryptonote::blobdata& tx, crypto::hash& tx_hash);
 
 
      /**
@@ -388,6 +444,20 @@ namespace cryptonote
       */
      bool get_pool_transaction(const crypto::hash& id, transaction& tx) const;     
 
+     /**
+      * @copydoc tx_memory_pool::get_transaction_hashes
+      *
+      * @note see tx_memory_pool::get_transaction_hashes
+      */
+     void get_pool_transaction_hashes(std::vector<crypto::hash>& hashes, uint64_t& revision) const;
+
+     /**
+      * @copydoc tx_memory_pool::get_changes_since
+      *
+      * @note see tx_memory_pool::get_changes_since
+      */
+     bool get_pool_changes_since(uint64_t revision, std::vector<crypto::hash>& added, std::vector<crypto::hash>& removed, uint64_t& current_revision) const;
+
      /**
       * @copydoc tx_memory_pool::get_pool_transactions_and_spent_keys_info
       *
@@ -395,6 +465,13 @@ namespace cryptonote
       */
      bool get_pool_transactions_and_spent_keys_info(std::vector<tx_info>& tx_infos, std::vector<spent_key_image_info>& key_image_infos) const;
 
+     /**
+      * @copydoc tx_memory_pool::get_size_stats
+      *
+      * @note see tx_memory_pool::get_size_stats
+      */
+     void get_pool_size_stats(uint64_t &bytes, uint64_t &max_bytes, uint64_t &evicted) const;
+
      /**
       * @copydoc tx_memory_pool::get_transactions_count
       *
@@ -431,11 +508,11 @@ namespace cryptonote
      bool find_blockchain_supplement(const std::list<crypto::hash>& qblock_ids, NOTIFY_RESPONSE_CHAIN_ENTRY::request& resp) const;
 
      /**
-      * @copydoc Blockchain::find_blockchain_supplement(const uint64_t, const std::list<crypto::hash>&, std::list<std::pair<block, std::list<transaction> > >&, uint64_t&, uint64_t&, size_t) const
+      * @copydoc Blockchain::find_blockchain_supplement(const uint64_t, const std::list<crypto::hash>&, std::vector<block_blobs_t>&, uint64_t&, uint64_t&, size_t) const
       *
-      * @note see Blockchain::find_blockchain_supplement(const uint64_t, const std::list<crypto::hash>&, std::list<std::pair<block, std::list<transaction> > >&, uint64_t&, uint64_t&, size_t) const
+      * @note see Blockchain::find_blockchain_supplement(const uint64_t, const std::list<crypto::hash>&, std::vector<block_blobs_t>&, uint64_t&, uint64_t&, size_t) const
       */
-     bool find_blockchain_supplement(const uint64_t req_start_block, const std::list<crypto::hash>& qblock_ids, std::list<std::pair<block, std::list<transaction> > >& blocks, uint64_t& total_height, uint64_t& start_height, size_t max_count) const;
+     bool find_blockchain_supplement(const uint64_t req_start_block, const std::list<crypto::hash>& qblock_ids, std::vector<block_blobs_t>& blocks, uint64_t& total_height, uint64_t& start_height, size_t max_count) const;
 
      /**
       * @brief gets some stats about the daemon
@@ -629,6 +706,42 @@ namespace cryptonote
 
    private:
 
+     /**
+      * @brief checks a parsed incoming transaction and passes it along to the pool
+      *
+      * @param tx the parsed transaction
+      * @param tvc metadata about the transaction's validity
+      * @param keeped_by_block if the transaction has been in a block
+      * @param relayed whether or not the transaction was relayed to us
+      *
+      * @return true if the transaction made it to the transaction pool, otherwise false
+      */
+     bool handle_incoming_tx_post_parse(const prepared_tx& tx, tx_verification_context& tvc, bool keeped_by_block, bool relayed);
+
+     /**
+      * @brief checks a parsed incoming transaction without looking at the blockchain
+      *
+      * @param tx the parsed transaction
+      * @param tvc metadata about the transaction's validity
+      * @param keeped_by_block if the transaction has been in a block
+      *
+      * @return true if the transaction passes the checks, otherwise false
+      */
+     bool check_incoming_tx(const prepared_tx& tx, tx_verification_context& tvc, bool keeped_by_block) const;
+
+     /**
+      * @brief passes a checked incoming transaction along to the pool
+      *
+      * @param tx the parsed transaction
+      * @param tvc metadata about the transaction's validity
+      * @param keeped_by_block if the transaction has been in a block
+      * @param relayed whether or not the transaction was relayed to us
+      * @param rct_semantics_verified whether Blockchain::check_tx_rct_semantics already passed for the transaction
+      *
+      * @return true if the transaction made it to the transaction pool, otherwise false
+      */
+     bool add_incoming_tx(const prepared_tx& tx, tx_verification_context& tvc, bool keeped_by_block, bool relayed, bool rct_semantics_verified);
+
      /**
       * @copydoc add_new_tx(const transaction&, tx_verification_context&, bool)
       *
@@ -636,9 +749,10 @@ namespace cryptonote
       * @param tx_prefix_hash the transaction prefix' hash
       * @param blob_size the size of the transaction
       * @param relayed whether or not the transaction was relayed to us
+      * @param rct_semantics_verified whether Blockchain::check_tx_rct_semantics already passed for the transaction
       *
       */
-     bool add_new_tx(const transaction& tx, const crypto::hash& tx_hash, const crypto::hash& tx_prefix_hash, size_t blob_size, tx_verification_context& tvc, bool keeped_by_block, bool relayed);
+     bool add_new_tx(const transaction& tx, const crypto::hash& tx_hash, const crypto::hash& tx_prefix_hash, size_t blob_size, tx_verification_context& tvc, bool keeped_by_block, bool relayed, bool rct_semantics_verified);
 
      /**
       * @brief add a new transaction to the transaction pool
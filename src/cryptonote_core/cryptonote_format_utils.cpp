@@ -96,6 +96,47 @@ namespace cryptonote
     return true;
   }
   //---------------------------------------------------------------
+  bool parse_and_validate_tx_base_from_blob(const blobdata& tx_blob, transaction& tx)
+  {
+    std::stringstream ss;
+    ss << tx_blob;
+    binary_archive<false> ba(ss);
+    bool r = tx.serialize_base(ba);
+    CHECK_AND_ASSERT_MES(r, false, "Failed to parse transaction base from blob");
+    return true;
+  }
+  //---------------------------------------------------------------
+  bool parse_and_validate_tx_from_blob_maybe_pruned(const blobdata& tx_blob, transaction& tx)
+  {
+    // a pruned blob ends right after the base, anything more is the rest
+    std::stringstream ss;
+    ss << tx_blob;
+    binary_archive<false> ba(ss);
+    bool r = tx.serialize_base(ba);
+    CHECK_AND_ASSERT_MES(r, false, "Failed to parse transaction base from blob");
+    if ((size_t)ss.tellg() != tx_blob.size())
+      return parse_and_validate_tx_from_blob(tx_blob, tx);
+    if (tx.version == 1 || tx.rct_signatures.type == rct::RCTTypeNull)
+      tx.pruned = false;
+    return true;
+  }
+  //---------------------------------------------------------------
+  bool get_pruned_tx_blob_size(const blobdata& tx_blob, size_t& pruned_size)
+  {
+    // only the RingCT signatures are prunable, everything else is kept
+    std::stringstream ss;
+    ss << tx_blob;
+    binary_archive<false> ba(ss);
+    transaction tx;
+    bool r = tx.serialize_base(ba);
+    CHECK_AND_ASSERT_MES(r, false, "Failed to parse transaction base from blob");
+    if (tx.version == 1 || tx.rct_signatures.type == rct::RCTTypeNull)
+      pruned_size = tx_blob.size();
+    else
+      pruned_size = ss.tellg();
+    return true;
+  }
+  //---------------------------------------------------------------
   bool parse_and_validate_tx_from_blob(const blobdata& tx_blob, transaction& tx, crypto::hash& tx_hash, crypto::hash& tx_prefix_hash)
   {
     std::stringstream ss;
@@ -36,15 +36,23 @@
 
 using namespace cryptonote;
 
-static uint8_t get_block_vote(const cryptonote::block &b)
+// block versions are read from the db this many blocks at a time
+static const uint64_t BLOCK_INFO_CHUNK_SIZE = 1000;
+
+static uint8_t get_block_vote(uint8_t minor_version)
 {
   // Pre-hardfork blocks have a minor version hardcoded to 0.
   // For the purposes of voting, we consider 0 to refer to
   // version number 1, which is what all blocks from the genesis
   // block are. It makes things simpler.
-  if (b.minor_version == 0)
+  if (minor_version == 0)
     return 1;
-  return b.minor_version;
+  return minor_version;
+}
+
+static uint8_t get_block_vote(const cryptonote::block &b)
+{
+  return get_block_vote(b.minor_version);
 }
 
 static uint8_t get_block_version(const cryptonote::block &b)
@@ -231,11 +239,14 @@ bool HardFork::reorganize_from_block_height(uint64_t height)
   while (current_fork_index > 0 && heights[current_fork_index].version > start_version) {
     --current_fork_index;
   }
-  for (uint64_t h = rescan_height; h <= height; ++h) {
-    cryptonote::block b = db.get_block_from_height(h);
-    const uint8_t v = get_effective_version(get_block_vote(b));
-    last_versions[v]++;
-    versions.push_back(v);
+  std::vector<block_info_t> infos;
+  for (uint64_t h = rescan_height; h <= height; h += BLOCK_INFO_CHUNK_SIZE) {
+    db.get_block_info_range(h, std::min(h + BLOCK_INFO_CHUNK_SIZE - 1, height), infos, BI_VERSIONS);
+    for (const block_info_t &bi: infos) {
+      const uint8_t v = get_effective_version(get_block_vote(bi.minor_version));
+      last_versions[v]++;
+      versions.push_back(v);
+    }
   }
 
   uint8_t voted = get_voted_fork_index(height + 1);
@@ -244,8 +255,10 @@ bool HardFork::reorganize_from_block_height(uint64_t height)
   }
 
   const uint64_t bc_height = db.height();
-  for (uint64_t h = height + 1; h < bc_height; ++h) {
-    add(db.get_block_from_height(h), h);
+  for (uint64_t h = height + 1; h < bc_height; h += BLOCK_INFO_CHUNK_SIZE) {
+    db.get_block_info_range(h, std::min(h + BLOCK_INFO_CHUNK_SIZE, bc_height) - 1, infos, BI_VERSIONS);
+    for (const block_info_t &bi: infos)
+      add(bi.major_version, get_block_vote(bi.minor_version), bi.height);
   }
 
   if (stop_batch) {
@@ -275,11 +288,15 @@ bool HardFork::rescan_from_block_height(uint64_t height)
 
   for (size_t n = 0; n < 256; ++n)
     last_versions[n] = 0;
-  for (uint64_t h = height; h < db.height(); ++h) {
-    cryptonote::block b = db.get_block_from_height(h);
-    const uint8_t v = get_effective_version(get_block_vote(b));
-    last_versions[v]++;
-    versions.push_back(v);
+  const uint64_t bc_height = db.height();
+  std::vector<block_info_t> infos;
+  for (uint64_t h = height; h < bc_height; h += BLOCK_INFO_CHUNK_SIZE) {
+    db.get_block_info_range(h, std::min(h + BLOCK_INFO_CHUNK_SIZE, bc_height) - 1, infos, BI_VERSIONS);
+    for (const block_info_t &bi: infos) {
+      const uint8_t v = get_effective_version(get_block_vote(bi.minor_version));
+      last_versions[v]++;
+      versions.push_back(v);
+    }
   }
 
   uint8_t lastv = db.get_hard_fork_version(db.height() - 1);
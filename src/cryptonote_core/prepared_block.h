@@ -0,0 +1,63 @@
+// Copyright (c) 2014-2017, The Monero Project
+// Copyright (c) 2017, SUMOKOIN
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+#include <vector>
+
+#include "cryptonote_basic.h"
+#include "crypto/hash.h"
+
+namespace cryptonote
+{
+  /**
+   * @brief a transaction of an incoming block, parsed once with its hashes
+   */
+  struct prepared_tx
+  {
+    transaction tx; //!< the parsed transaction
+    crypto::hash tx_hash; //!< the transaction's hash
+    crypto::hash tx_prefix_hash; //!< the transaction's prefix hash
+    size_t blob_size; //!< the size in bytes of the transaction blob
+  };
+
+  /**
+   * @brief a block of an incoming batch, parsed once with its transactions
+   *
+   * A batch of these is built by Blockchain::parse_incoming_blocks and then
+   * reused by every later stage of block handling (PoW precomputation, scan
+   * table construction, tx and block verification), so that no block or tx
+   * blob of the batch has to be parsed more than once.
+   */
+  struct prepared_block
+  {
+    block bl; //!< the parsed block
+    crypto::hash hash; //!< the block's hash
+    std::vector<prepared_tx> txs; //!< the block's parsed transactions, in block order
+  };
+}
@@ -74,17 +74,100 @@ namespace cryptonote
     {
       return amount * ACCEPT_THRESHOLD;
     }
+
+    // Rounding tx fee/blob_size ratio so that txs with the same priority would be sorted by receive_time
+    uint32_t get_fee_per_size_ratio(uint64_t fee, size_t blob_size)
+    {
+      return (uint32_t)(fee / (double)blob_size);
+    }
   }
   //---------------------------------------------------------------------------------
   //---------------------------------------------------------------------------------
-  tx_memory_pool::tx_memory_pool(Blockchain& bchs): m_blockchain(bchs)
+  const spent_key_images_index::stripe& spent_key_images_index::get_stripe(const crypto::key_image& k_image) const
   {
-
+    return m_stripes[std::hash<crypto::key_image>()(k_image) % STRIPES];
+  }
+  //---------------------------------------------------------------------------------
+  spent_key_images_index::stripe& spent_key_images_index::get_stripe(const crypto::key_image& k_image)
+  {
+    return m_stripes[std::hash<crypto::key_image>()(k_image) % STRIPES];
+  }
+  //---------------------------------------------------------------------------------
+  bool spent_key_images_index::has(const crypto::key_image& k_image) const
+  {
+    const stripe& s = get_stripe(k_image);
+    boost::lock_guard<boost::mutex> lock(s.lock);
+    return s.images.find(k_image) != s.images.end();
+  }
+  //---------------------------------------------------------------------------------
+  bool spent_key_images_index::add(const crypto::key_image& k_image, const crypto::hash& id, bool allow_conflict)
+  {
+    stripe& s = get_stripe(k_image);
+    boost::lock_guard<boost::mutex> lock(s.lock);
+    std::unordered_set<crypto::hash>& txs = s.images[k_image];
+    if (!allow_conflict && !txs.empty())
+      return false;
+    return txs.insert(id).second;
+  }
+  //---------------------------------------------------------------------------------
+  bool spent_key_images_index::remove(const crypto::key_image& k_image, const crypto::hash& id)
+  {
+    stripe& s = get_stripe(k_image);
+    boost::lock_guard<boost::mutex> lock(s.lock);
+    auto it = s.images.find(k_image);
+    if (it == s.images.end() || !it->second.erase(id))
+      return false;
+    if (it->second.empty())
+      s.images.erase(it);
+    return true;
   }
   //---------------------------------------------------------------------------------
-  bool tx_memory_pool::add_tx(const transaction &tx, /*const crypto::hash& tx_prefix_hash,*/ const crypto::hash &id, size_t blob_size, tx_verification_context& tvc, bool kept_by_block, bool relayed, uint8_t version)
+  void spent_key_images_index::clear()
+  {
+    for (stripe& s : m_stripes)
+    {
+      boost::lock_guard<boost::mutex> lock(s.lock);
+      s.images.clear();
+    }
+  }
+  //---------------------------------------------------------------------------------
+  key_images_container spent_key_images_index::get_all() const
+  {
+    key_images_container images;
+    for (const stripe& s : m_stripes)
+    {
+      boost::lock_guard<boost::mutex> lock(s.lock);
+      images.insert(s.images.begin(), s.images.end());
+    }
+    return images;
+  }
+  //---------------------------------------------------------------------------------
+  void spent_key_images_index::set_all(const key_images_container& images)
+  {
+    clear();
+    for (const auto& i : images)
+    {
+      stripe& s = get_stripe(i.first);
+      boost::lock_guard<boost::mutex> lock(s.lock);
+      s.images.insert(i);
+    }
+  }
+  //---------------------------------------------------------------------------------
+  //---------------------------------------------------------------------------------
+  tx_memory_pool::tx_memory_pool(Blockchain& bchs): m_txpool_max_size(DEFAULT_TXPOOL_MAX_SIZE), m_txpool_size(0), m_txpool_evicted(0), m_db_persist(false), m_blockchain(bchs)
+  {
+    // start from the clock so that a revision a client got before a restart
+    // is older than anything in the change log
+    m_revision = m_changes_floor = ((uint64_t)time(NULL)) << 20;
+    m_snapshot_stale = true;
+  }
+  //---------------------------------------------------------------------------------
+  bool tx_memory_pool::add_tx(const transaction &tx, /*const crypto::hash& tx_prefix_hash,*/ const crypto::hash &id, size_t blob_size, tx_verification_context& tvc, bool kept_by_block, bool relayed, uint8_t version, bool rct_semantics_verified)
   {
     PERF_TIMER(add_tx);
+    // created before the pool lock is taken, so it runs after it's released
+    epee::misc_utils::auto_scope_leave_caller db_flusher = epee::misc_utils::create_scope_leave_handler([this]() { flush_db_journal(false); });
+
     if (tx.version < 2)
     {
       // v0, v1 never accepted
@@ -120,6 +203,21 @@ namespace cryptonote
       return false;
     }
 
+    // when the pool is full, only take transactions paying more per byte
+    // than the ones which would be evicted to make room for them
+    if (!kept_by_block)
+    {
+      CRITICAL_REGION_LOCAL(m_transactions_lock);
+      if (m_txpool_size + blob_size > m_txpool_max_size && !m_txs_by_fee_and_receive_time.empty() &&
+          get_fee_per_size_ratio(fee, blob_size) <= m_txs_by_fee_and_receive_time.rbegin()->first.first)
+      {
+        LOG_PRINT_L1("Transaction with id= " << id << " has too low a fee per byte for the full pool");
+        tvc.m_verifivation_failed = true;
+        tvc.m_fee_too_low = true;
+        return false;
+      }
+    }
+
     size_t tx_size_limit = TRANSACTION_SIZE_LIMIT_V2;
     if (version < 3) {
       tx_size_limit = TRANSACTION_SIZE_LIMIT;
@@ -190,7 +288,7 @@ namespace cryptonote
     uint64_t max_used_block_height = 0;
     tx_details txd;
     txd.tx = tx;
-    bool ch_inp_res = m_blockchain.check_tx_inputs(txd.tx, max_used_block_height, max_used_block_id, tvc, kept_by_block);
+    bool ch_inp_res = m_blockchain.check_tx_inputs(txd.tx, max_used_block_height, max_used_block_id, tvc, kept_by_block, rct_semantics_verified);
     CRITICAL_REGION_LOCAL(m_transactions_lock);
     if(!ch_inp_res)
     {
@@ -198,16 +296,16 @@ namespace cryptonote
       // may become valid again, so ignore the failed inputs check.
       if(kept_by_block)
       {
-        auto txd_p = m_transactions.insert(transactions_container::value_type(id, txd));
+        txd.blob_size = blob_size;
+        txd.fee = fee;
+        txd.max_used_block_id = null_hash;
+        txd.max_used_block_height = 0;
+        txd.kept_by_block = kept_by_block;
+        txd.receive_time = receive_time;
+        txd.last_relayed_time = time(NULL);
+        txd.relayed = relayed;
+        auto txd_p = m_transactions.insert(transactions_container::value_type(id, std::make_shared<const tx_details>(std::move(txd))));
         CHECK_AND_ASSERT_MES(txd_p.second, false, "transaction already exists at inserting in memory pool");
-        txd_p.first->second.blob_size = blob_size;
-        txd_p.first->second.fee = fee;
-        txd_p.first->second.max_used_block_id = null_hash;
-        txd_p.first->second.max_used_block_height = 0;
-        txd_p.first->second.kept_by_block = kept_by_block;
-        txd_p.first->second.receive_time = receive_time;
-        txd_p.first->second.last_relayed_time = time(NULL);
-        txd_p.first->second.relayed = relayed;
         tvc.m_verifivation_impossible = true;
         tvc.m_added_to_pool = true;
       }else
@@ -219,44 +317,67 @@ namespace cryptonote
     }else
     {
       //update transactions container
-      auto txd_p = m_transactions.insert(transactions_container::value_type(id, txd));
+      txd.blob_size = blob_size;
+      txd.kept_by_block = kept_by_block;
+      txd.fee = fee;
+      txd.max_used_block_id = max_used_block_id;
+      txd.max_used_block_height = max_used_block_height;
+      txd.last_failed_height = 0;
+      txd.last_failed_id = null_hash;
+      txd.receive_time = receive_time;
+      txd.last_relayed_time = time(NULL);
+      txd.relayed = relayed;
+      auto txd_p = m_transactions.insert(transactions_container::value_type(id, std::make_shared<const tx_details>(std::move(txd))));
       CHECK_AND_ASSERT_MES(txd_p.second, false, "internal error: transaction already exists at inserting in memorypool");
-      txd_p.first->second.blob_size = blob_size;
-      txd_p.first->second.kept_by_block = kept_by_block;
-      txd_p.first->second.fee = fee;
-      txd_p.first->second.max_used_block_id = max_used_block_id;
-      txd_p.first->second.max_used_block_height = max_used_block_height;
-      txd_p.first->second.last_failed_height = 0;
-      txd_p.first->second.last_failed_id = null_hash;
-      txd_p.first->second.receive_time = receive_time;
-      txd_p.first->second.last_relayed_time = time(NULL);
-      txd_p.first->second.relayed = relayed;
       tvc.m_added_to_pool = true;
 
-      if(txd_p.first->second.fee > 0)
+      if(fee > 0)
         tvc.m_should_be_relayed = true;
     }
 
     // assume failure during verification steps until success is certain
     tvc.m_verifivation_failed = true;
 
-    BOOST_FOREACH(const auto& in, tx.vin)
+    // the key images were checked without the pool lock, so another
+    // transaction spending one of them may have been added since
+    for (size_t n = 0; n < tx.vin.size(); ++n)
     {
-      CHECKED_GET_SPECIFIC_VARIANT(in, const txin_to_key, txin, false);
-      std::unordered_set<crypto::hash>& kei_image_set = m_spent_key_images[txin.k_image];
-      CHECK_AND_ASSERT_MES(kept_by_block || kei_image_set.size() == 0, false, "internal error: kept_by_block=" << kept_by_block
-                                          << ",  kei_image_set.size()=" << kei_image_set.size() << ENDL << "txin.k_image=" << txin.k_image << ENDL
-                                          << "tx_id=" << id );
-      auto ins_res = kei_image_set.insert(id);
-      CHECK_AND_ASSERT_MES(ins_res.second, false, "internal error: try to insert duplicate iterator in key_image set");
+      CHECKED_GET_SPECIFIC_VARIANT(tx.vin[n], const txin_to_key, txin, false);
+      if (!m_spent_key_images.add(txin.k_image, id, kept_by_block))
+      {
+        LOG_PRINT_L1("Transaction with id= "<< id << " used already spent key image " << txin.k_image);
+        for (size_t i = 0; i < n; ++i)
+          m_spent_key_images.remove(boost::get<txin_to_key>(tx.vin[i]).k_image, id);
+        m_transactions.erase(id);
+        tvc.m_added_to_pool = false;
+        tvc.m_should_be_relayed = false;
+        tvc.m_double_spend = true;
+        return false;
+      }
     }
 
     tvc.m_verifivation_failed = false;
 
-    // Rounding tx fee/blob_size ratio so that txs with the same priority would be sorted by receive_time
-    uint32_t fee_per_size_ratio = (uint32_t)(fee / (double)blob_size);
-    //LOG_PRINT_L1("Tx fee/size ratio (rounded): " << fee_per_size_ratio << ", original: " << (fee / (double)blob_size));
-    m_txs_by_fee_and_receive_time.emplace(std::pair<uint32_t, std::time_t>(fee_per_size_ratio, receive_time), id);
+    m_txs_by_fee_and_receive_time.insert(get_sorted_key(id, *m_transactions.find(id)->second));
+    m_txpool_size += blob_size;
+
+    prune(m_txpool_max_size);
+    if (!m_transactions.count(id))
+    {
+      LOG_PRINT_L1("Transaction with id= " << id << " was evicted as soon as it was added, the pool is full");
+      tvc.m_added_to_pool = false;
+      tvc.m_should_be_relayed = false;
+      tvc.m_verifivation_failed = true;
+      tvc.m_fee_too_low = true;
+      return false;
+    }
+
+    // transactions which could not be verified are left for the next rebuild
+    if (ch_inp_res)
+      add_to_block_template(id, *m_transactions.find(id)->second);
+
+    journal_add(id, *m_transactions.find(id)->second);
+    record_change(id, true);
 
     return true;
   }
@@ -281,23 +402,8 @@ namespace cryptonote
     BOOST_FOREACH(const txin_v& vi, tx.vin)
     {
       CHECKED_GET_SPECIFIC_VARIANT(vi, const txin_to_key, txin, false);
-      auto it = m_spent_key_images.find(txin.k_image);
-      CHECK_AND_ASSERT_MES(it != m_spent_key_images.end(), false, "failed to find transaction input in key images. img=" << txin.k_image << ENDL
-                                    << "transaction id = " << get_transaction_hash(tx));
-      std::unordered_set<crypto::hash>& key_image_set =  it->second;
-      CHECK_AND_ASSERT_MES(key_image_set.size(), false, "empty key_image set, img=" << txin.k_image << ENDL
-        << "transaction id = " << actual_hash);
-
-      auto it_in_set = key_image_set.find(actual_hash);
-      CHECK_AND_ASSERT_MES(it_in_set != key_image_set.end(), false, "transaction id not found in key_image set, img=" << txin.k_image << ENDL
+      CHECK_AND_ASSERT_MES(m_spent_key_images.remove(txin.k_image, actual_hash), false, "transaction id not found in key_image set, img=" << txin.k_image << ENDL
         << "transaction id = " << actual_hash);
-      key_image_set.erase(it_in_set);
-      if(!key_image_set.size())
-      {
-        //it is now empty hash container for this key_image
-        m_spent_key_images.erase(it);
-      }
-
     }
     return true;
   }
@@ -309,16 +415,20 @@ namespace cryptonote
     if(it == m_transactions.end())
       return false;
 
-    auto sorted_it = find_tx_in_sorted_container(id);
+    auto sorted_it = find_tx_in_sorted_container(id, *it->second);
 
     if (sorted_it == m_txs_by_fee_and_receive_time.end())
       return false;
 
-    tx = it->second.tx;
-    blob_size = it->second.blob_size;
-    fee = it->second.fee;
-    relayed = it->second.relayed;
-    remove_transaction_keyimages(it->second.tx);
+    tx = it->second->tx;
+    blob_size = it->second->blob_size;
+    fee = it->second->fee;
+    relayed = it->second->relayed;
+    remove_transaction_keyimages(it->second->tx);
+    remove_from_block_template(id);
+    journal_remove(id);
+    record_change(id, false);
+    m_txpool_size -= it->second->blob_size;
     m_transactions.erase(it);
     m_txs_by_fee_and_receive_time.erase(sorted_it);
     return true;
@@ -327,15 +437,18 @@ namespace cryptonote
   void tx_memory_pool::on_idle()
   {
     m_remove_stuck_tx_interval.do_call([this](){return remove_stuck_transactions();});
+    flush_db_journal(false);
+  }
+  //---------------------------------------------------------------------------------
+  tx_by_fee_and_receive_time_entry tx_memory_pool::get_sorted_key(const crypto::hash& id, const tx_details& txd)
+  {
+    uint32_t fee_per_size_ratio = get_fee_per_size_ratio(txd.fee, txd.blob_size);
+    return tx_by_fee_and_receive_time_entry(std::pair<uint32_t, std::time_t>(fee_per_size_ratio, txd.receive_time), id);
   }
   //---------------------------------------------------------------------------------
-  sorted_tx_container::iterator tx_memory_pool::find_tx_in_sorted_container(const crypto::hash& id) const
+  sorted_tx_container::iterator tx_memory_pool::find_tx_in_sorted_container(const crypto::hash& id, const tx_details& txd) const
   {
-    return std::find_if( m_txs_by_fee_and_receive_time.begin(), m_txs_by_fee_and_receive_time.end()
-                       , [&](const sorted_tx_container::value_type& a){
-                         return a.second == id;
-                       }
-    );
+    return m_txs_by_fee_and_receive_time.find(get_sorted_key(id, txd));
   }
   //---------------------------------------------------------------------------------
   //TODO: investigate whether boolean return is appropriate
@@ -344,14 +457,14 @@ namespace cryptonote
     CRITICAL_REGION_LOCAL(m_transactions_lock);
     for(auto it = m_transactions.begin(); it!= m_transactions.end();)
     {
-      uint64_t tx_age = time(nullptr) - it->second.receive_time;
+      uint64_t tx_age = time(nullptr) - it->second->receive_time;
 
-      if((tx_age > CRYPTONOTE_MEMPOOL_TX_LIVETIME && !it->second.kept_by_block) ||
-         (tx_age > CRYPTONOTE_MEMPOOL_TX_FROM_ALT_BLOCK_LIVETIME && it->second.kept_by_block) )
+      if((tx_age > CRYPTONOTE_MEMPOOL_TX_LIVETIME && !it->second->kept_by_block) ||
+         (tx_age > CRYPTONOTE_MEMPOOL_TX_FROM_ALT_BLOCK_LIVETIME && it->second->kept_by_block) )
       {
         LOG_PRINT_L1("Tx " << it->first << " removed from tx pool due to outdated, age: " << tx_age );
-        remove_transaction_keyimages(it->second.tx);
-        auto sorted_it = find_tx_in_sorted_container(it->first);
+        remove_transaction_keyimages(it->second->tx);
+        auto sorted_it = find_tx_in_sorted_container(it->first, *it->second);
         if (sorted_it == m_txs_by_fee_and_receive_time.end())
         {
           LOG_PRINT_L1("Removing tx " << it->first << " from tx pool, but it was not found in the sorted txs container!");
@@ -361,6 +474,10 @@ namespace cryptonote
           m_txs_by_fee_and_receive_time.erase(sorted_it);
         }
         m_timed_out_transactions.insert(it->first);
+        remove_from_block_template(it->first);
+        journal_remove(it->first);
+        record_change(it->first, false);
+        m_txpool_size -= it->second->blob_size;
         auto pit = it++;
         m_transactions.erase(pit);
       }else
@@ -372,20 +489,20 @@ namespace cryptonote
   //TODO: investigate whether boolean return is appropriate
   bool tx_memory_pool::get_relayable_transactions(std::list<std::pair<crypto::hash, cryptonote::transaction>> &txs) const
   {
-    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    const std::shared_ptr<const pool_snapshot> snapshot = get_snapshot();
     const time_t now = time(NULL);
-    for(auto it = m_transactions.begin(); it!= m_transactions.end();)
+    for(auto it = snapshot->begin(); it!= snapshot->end();)
     {
       // 0 fee transactions are never relayed
-      if(it->second.fee > 0 && now - it->second.last_relayed_time > get_relay_delay(now, it->second.receive_time))
+      if(it->second->fee > 0 && now - it->second->last_relayed_time > get_relay_delay(now, it->second->receive_time))
       {
         // if the tx is older than half the max lifetime, we don't re-relay it, to avoid a problem
         // mentioned by smooth where nodes would flush txes at slightly different times, causing
         // flushed txes to be re-added when received from a node which was just about to flush it
-        time_t max_age = it->second.kept_by_block ? CRYPTONOTE_MEMPOOL_TX_FROM_ALT_BLOCK_LIVETIME : CRYPTONOTE_MEMPOOL_TX_LIVETIME;
-        if (now - it->second.receive_time <= max_age / 2)
+        time_t max_age = it->second->kept_by_block ? CRYPTONOTE_MEMPOOL_TX_FROM_ALT_BLOCK_LIVETIME : CRYPTONOTE_MEMPOOL_TX_LIVETIME;
+        if (now - it->second->receive_time <= max_age / 2)
         {
-          txs.push_back(std::make_pair(it->first, it->second.tx));
+          txs.push_back(std::make_pair(it->first, it->second->tx));
         }
       }
       ++it;
@@ -402,8 +519,13 @@ namespace cryptonote
       auto i = m_transactions.find(it->first);
       if (i != m_transactions.end())
       {
-        i->second.relayed = true;
-        i->second.last_relayed_time = now;
+        // snapshots may share the details, so they're replaced by a copy
+        std::shared_ptr<tx_details> txd = std::make_shared<tx_details>(*i->second);
+        txd->relayed = true;
+        txd->last_relayed_time = now;
+        journal_update(i->first, *txd);
+        i->second = txd;
+        m_snapshot_stale = true;
       }
     }
   }
@@ -415,20 +537,61 @@ namespace cryptonote
   }
   //---------------------------------------------------------------------------------
   void tx_memory_pool::get_transactions(std::list<transaction>& txs) const
+  {
+    const std::shared_ptr<const pool_snapshot> snapshot = get_snapshot();
+    BOOST_FOREACH(const auto& tx_vt, *snapshot)
+      txs.push_back(tx_vt.second->tx);
+  }
+  //---------------------------------------------------------------------------------
+  void tx_memory_pool::get_transaction_hashes(std::vector<crypto::hash>& hashes, uint64_t& revision) const
+  {
+    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    hashes.reserve(hashes.size() + m_transactions.size());
+    for (const auto& tx_vt : m_transactions)
+      hashes.push_back(tx_vt.first);
+    revision = m_revision;
+  }
+  //---------------------------------------------------------------------------------
+  bool tx_memory_pool::get_changes_since(uint64_t revision, std::vector<crypto::hash>& added, std::vector<crypto::hash>& removed, uint64_t& current_revision) const
   {
     CRITICAL_REGION_LOCAL(m_transactions_lock);
-    BOOST_FOREACH(const auto& tx_vt, m_transactions)
-      txs.push_back(tx_vt.second.tx);
+    current_revision = m_revision;
+    if (revision < m_changes_floor || revision > m_revision)
+      return false;
+
+    // net effect of the changes on each transaction: added, removed, or both (dropped)
+    std::unordered_map<crypto::hash, std::pair<bool, bool>> net;
+    auto it = std::upper_bound(m_changes.begin(), m_changes.end(), revision, [](uint64_t r, const pool_change& c) { return r < c.revision; });
+    for (; it != m_changes.end(); ++it)
+    {
+      std::pair<bool, bool>& n = net[it->id];
+      if (it->added)
+        n.first = true;
+      else if (n.first)
+        n.first = false;
+      else
+        n.second = true;
+    }
+    for (const auto& n : net)
+    {
+      if (n.second.first && !n.second.second)
+        added.push_back(n.first);
+      else if (!n.second.first && n.second.second)
+        removed.push_back(n.first);
+    }
+    return true;
   }
   //------------------------------------------------------------------
   //TODO: investigate whether boolean return is appropriate
   bool tx_memory_pool::get_transactions_and_spent_keys_info(std::vector<tx_info>& tx_infos, std::vector<spent_key_image_info>& key_image_infos) const
   {
-    CRITICAL_REGION_LOCAL(m_transactions_lock);
-    for (const auto& tx_vt : m_transactions)
+    const std::shared_ptr<const pool_snapshot> snapshot = get_snapshot();
+    // taken from the snapshot's transactions so both lists agree
+    key_images_container spent_key_images;
+    for (const auto& tx_vt : *snapshot)
     {
       tx_info txi;
-      const tx_details& txd = tx_vt.second;
+      const tx_details& txd = *tx_vt.second;
       txi.id_hash = epee::string_tools::pod_to_hex(tx_vt.first);
       txi.tx_json = obj_to_json_str(*const_cast<transaction*>(&txd.tx));
       txi.blob_size = txd.blob_size;
@@ -442,9 +605,14 @@ namespace cryptonote
       txi.relayed = txd.relayed;
       txi.last_relayed_time = txd.last_relayed_time;
       tx_infos.push_back(txi);
+      for (const auto& in : txd.tx.vin)
+      {
+        if (in.type() == typeid(txin_to_key))
+          spent_key_images[boost::get<txin_to_key>(in).k_image].insert(tx_vt.first);
+      }
     }
 
-    for (const key_images_container::value_type& kee : m_spent_key_images) {
+    for (const key_images_container::value_type& kee : spent_key_images) {
       const crypto::key_image& k_image = kee.first;
       const std::unordered_set<crypto::hash>& kei_image_set = kee.second;
       spent_key_image_info ki;
@@ -464,17 +632,21 @@ namespace cryptonote
     auto it = m_transactions.find(id);
     if(it == m_transactions.end())
       return false;
-    tx = it->second.tx;
+    tx = it->second->tx;
     return true;
   }
   //---------------------------------------------------------------------------------
   bool tx_memory_pool::on_blockchain_inc(uint64_t new_block_height, const crypto::hash& top_block_id)
   {
+    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    m_block_template.valid = false;
     return true;
   }
   //---------------------------------------------------------------------------------
   bool tx_memory_pool::on_blockchain_dec(uint64_t new_block_height, const crypto::hash& top_block_id)
   {
+    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    m_block_template.valid = false;
     return true;
   }
   //---------------------------------------------------------------------------------
@@ -488,7 +660,6 @@ namespace cryptonote
   //---------------------------------------------------------------------------------
   bool tx_memory_pool::have_tx_keyimges_as_spent(const transaction& tx) const
   {
-    CRITICAL_REGION_LOCAL(m_transactions_lock);
     BOOST_FOREACH(const auto& in, tx.vin)
     {
       CHECKED_GET_SPECIFIC_VARIANT(in, const txin_to_key, tokey_in, true);//should never fail
@@ -500,8 +671,7 @@ namespace cryptonote
   //---------------------------------------------------------------------------------
   bool tx_memory_pool::have_tx_keyimg_as_spent(const crypto::key_image& key_im) const
   {
-    CRITICAL_REGION_LOCAL(m_transactions_lock);
-    return m_spent_key_images.end() != m_spent_key_images.find(key_im);
+    return m_spent_key_images.has(key_im);
   }
   //---------------------------------------------------------------------------------
   void tx_memory_pool::lock() const
@@ -514,44 +684,56 @@ namespace cryptonote
     m_transactions_lock.unlock();
   }
   //---------------------------------------------------------------------------------
-  bool tx_memory_pool::is_transaction_ready_to_go(tx_details& txd) const
+  bool tx_memory_pool::is_transaction_ready_to_go(std::shared_ptr<const tx_details>& txd) const
   {
     //not the best implementation at this time, sorry :(
     //check is ring_signature already checked ?
-    if(txd.max_used_block_id == null_hash)
+    if(txd->max_used_block_id == null_hash)
     {//not checked, lets try to check
 
-      if(txd.last_failed_id != null_hash && m_blockchain.get_current_blockchain_height() > txd.last_failed_height && txd.last_failed_id == m_blockchain.get_block_id_by_height(txd.last_failed_height))
+      if(txd->last_failed_id != null_hash && m_blockchain.get_current_blockchain_height() > txd->last_failed_height && txd->last_failed_id == m_blockchain.get_block_id_by_height(txd->last_failed_height))
         return false;//we already sure that this tx is broken for this height
 
+      // the check updates the details, so it works on a copy which
+      // replaces them, as snapshots may share the old ones
+      std::shared_ptr<tx_details> checked = std::make_shared<tx_details>(*txd);
       tx_verification_context tvc;
-      if(!m_blockchain.check_tx_inputs(txd.tx, txd.max_used_block_height, txd.max_used_block_id, tvc))
+      bool r = m_blockchain.check_tx_inputs(checked->tx, checked->max_used_block_height, checked->max_used_block_id, tvc);
+      if(!r)
       {
-        txd.last_failed_height = m_blockchain.get_current_blockchain_height()-1;
-        txd.last_failed_id = m_blockchain.get_block_id_by_height(txd.last_failed_height);
-        return false;
+        checked->last_failed_height = m_blockchain.get_current_blockchain_height()-1;
+        checked->last_failed_id = m_blockchain.get_block_id_by_height(checked->last_failed_height);
       }
+      txd = checked;
+      m_snapshot_stale = true;
+      if(!r)
+        return false;
     }else
     {
-      if(txd.max_used_block_height >= m_blockchain.get_current_blockchain_height())
+      if(txd->max_used_block_height >= m_blockchain.get_current_blockchain_height())
         return false;
       if(true)
       {
         //if we already failed on this height and id, skip actual ring signature check
-        if(txd.last_failed_id == m_blockchain.get_block_id_by_height(txd.last_failed_height))
+        if(txd->last_failed_id == m_blockchain.get_block_id_by_height(txd->last_failed_height))
           return false;
         //check ring signature again, it is possible (with very small chance) that this transaction become again valid
+        std::shared_ptr<tx_details> checked = std::make_shared<tx_details>(*txd);
         tx_verification_context tvc;
-        if(!m_blockchain.check_tx_inputs(txd.tx, txd.max_used_block_height, txd.max_used_block_id, tvc))
+        bool r = m_blockchain.check_tx_inputs(checked->tx, checked->max_used_block_height, checked->max_used_block_id, tvc);
+        if(!r)
         {
-          txd.last_failed_height = m_blockchain.get_current_blockchain_height()-1;
-          txd.last_failed_id = m_blockchain.get_block_id_by_height(txd.last_failed_height);
-          return false;
+          checked->last_failed_height = m_blockchain.get_current_blockchain_height()-1;
+          checked->last_failed_id = m_blockchain.get_block_id_by_height(checked->last_failed_height);
         }
+        txd = checked;
+        m_snapshot_stale = true;
+        if(!r)
+          return false;
       }
     }
     //if we here, transaction seems valid, but, anyway, check for key_images collisions with blockchain, just to be sure
-    if(m_blockchain.have_tx_keyimges_as_spent(txd.tx))
+    if(m_blockchain.have_tx_keyimges_as_spent(txd->tx))
       return false;
 
     //transaction is ok.
@@ -583,9 +765,9 @@ namespace cryptonote
   std::string tx_memory_pool::print_pool(bool short_format) const
   {
     std::stringstream ss;
-    CRITICAL_REGION_LOCAL(m_transactions_lock);
-    for (const transactions_container::value_type& txe : m_transactions) {
-      const tx_details& txd = txe.second;
+    const std::shared_ptr<const pool_snapshot> snapshot = get_snapshot();
+    for (const pool_snapshot::value_type& txe : *snapshot) {
+      const tx_details& txd = *txe.second;
       ss << "id: " << txe.first << std::endl;
       if (!short_format) {
         ss << obj_to_json_str(*const_cast<transaction*>(&txd.tx)) << std::endl;
@@ -607,6 +789,22 @@ namespace cryptonote
   {
     CRITICAL_REGION_LOCAL(m_transactions_lock);
 
+    if (m_block_template.valid && m_block_template.height == height && m_block_template.median_size == median_size &&
+        m_block_template.already_generated_coins == already_generated_coins)
+    {
+      bl.tx_hashes.insert(bl.tx_hashes.end(), m_block_template.tx_hashes.begin(), m_block_template.tx_hashes.end());
+      total_size = m_block_template.total_size;
+      fee = m_block_template.fee;
+      LOG_PRINT_L2("Block template reused with " << m_block_template.tx_hashes.size() << " txes, size " << total_size
+        << ", coinbase " << print_money(m_block_template.best_coinbase));
+      return true;
+    }
+
+    m_block_template.valid = false;
+    m_block_template.tx_hashes.clear();
+    m_block_template.tx_set.clear();
+    m_block_template.k_images.clear();
+
     uint64_t best_coinbase = 0;
     total_size = 0;
     fee = 0;
@@ -615,17 +813,17 @@ namespace cryptonote
     get_block_reward(median_size, total_size, already_generated_coins, best_coinbase, height);
 
     size_t max_total_size = (200 * median_size) / 100 - CRYPTONOTE_COINBASE_BLOB_RESERVED_SIZE;
-    std::unordered_set<crypto::key_image> k_images;
+    std::unordered_set<crypto::key_image>& k_images = m_block_template.k_images;
 
     LOG_PRINT_L2("Filling block template, median size " << median_size << ", " << m_txs_by_fee_and_receive_time.size() << " txes in the pool");
     auto sorted_it = m_txs_by_fee_and_receive_time.begin();
     while (sorted_it != m_txs_by_fee_and_receive_time.end())
     {
       auto tx_it = m_transactions.find(sorted_it->second);
-      LOG_PRINT_L2("Considering " << tx_it->first << ", size " << tx_it->second.blob_size << ", current block size " << total_size << "/" << max_total_size << ", current coinbase " << print_money(best_coinbase));
+      LOG_PRINT_L2("Considering " << tx_it->first << ", size " << tx_it->second->blob_size << ", current block size " << total_size << "/" << max_total_size << ", current coinbase " << print_money(best_coinbase));
 
       // Can not exceed maximum block size
-      if (max_total_size < total_size + tx_it->second.blob_size)
+      if (max_total_size < total_size + tx_it->second->blob_size)
       {
         LOG_PRINT_L2("  would exceed maximum block size");
         sorted_it++;
@@ -635,13 +833,13 @@ namespace cryptonote
       // If we're getting lower coinbase tx,
       // stop including more tx
       uint64_t block_reward;
-      if (!get_block_reward(median_size, total_size + tx_it->second.blob_size + CRYPTONOTE_COINBASE_BLOB_RESERVED_SIZE, already_generated_coins, block_reward, height))
+      if (!get_block_reward(median_size, total_size + tx_it->second->blob_size + CRYPTONOTE_COINBASE_BLOB_RESERVED_SIZE, already_generated_coins, block_reward, height))
       {
         LOG_PRINT_L2("  would exceed maximum block size");
         sorted_it++;
         continue;
       }
-      uint64_t coinbase = block_reward + fee + tx_it->second.fee;
+      uint64_t coinbase = block_reward + fee + tx_it->second->fee;
       if (coinbase < template_accept_threshold(best_coinbase))
       {
         LOG_PRINT_L2("  would decrease coinbase to " << print_money(coinbase));
@@ -658,7 +856,7 @@ namespace cryptonote
         sorted_it++;
         continue;
       }
-      if (have_key_images(k_images, tx_it->second.tx))
+      if (have_key_images(k_images, tx_it->second->tx))
       {
         LOG_PRINT_L2("  key images already seen");
         sorted_it++;
@@ -666,11 +864,14 @@ namespace cryptonote
       }
 
       bl.tx_hashes.push_back(tx_it->first);
-      total_size += tx_it->second.blob_size;
-      fee += tx_it->second.fee;
+      m_block_template.tx_hashes.push_back(tx_it->first);
+      m_block_template.tx_set.insert(tx_it->first);
+      m_block_template.lowest = *sorted_it;
+      total_size += tx_it->second->blob_size;
+      fee += tx_it->second->fee;
       best_coinbase = coinbase;
 
-      append_key_images(k_images, tx_it->second.tx);
+      append_key_images(k_images, tx_it->second->tx);
       sorted_it++;
       LOG_PRINT_L2("  added, new block size " << total_size << "/" << max_total_size << ", coinbase " << print_money(best_coinbase));
     }
@@ -678,9 +879,65 @@ namespace cryptonote
     LOG_PRINT_L2("Block template filled with " << bl.tx_hashes.size() << " txes, size "
       << total_size << "/" << max_total_size << ", coinbase " << print_money(best_coinbase)
       << " (including " << print_money(fee) << " in fees)");
+
+    m_block_template.height = height;
+    m_block_template.median_size = median_size;
+    m_block_template.already_generated_coins = already_generated_coins;
+    m_block_template.total_size = total_size;
+    m_block_template.fee = fee;
+    m_block_template.best_coinbase = best_coinbase;
+    m_block_template.valid = true;
     return true;
   }
   //---------------------------------------------------------------------------------
+  void tx_memory_pool::add_to_block_template(const crypto::hash& id, const tx_details& txd)
+  {
+    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    if (!m_block_template.valid)
+      return;
+
+    const size_t median_size = m_block_template.median_size;
+    const size_t max_total_size = (200 * median_size) / 100 - CRYPTONOTE_COINBASE_BLOB_RESERVED_SIZE;
+    const size_t total_size = m_block_template.total_size + txd.blob_size;
+    const tx_by_fee_and_receive_time_entry key = get_sorted_key(id, txd);
+
+    // same rules as fill_block_template, except that the inputs were
+    // just checked by add_tx and need not be checked again
+    uint64_t block_reward;
+    if (max_total_size < total_size ||
+        !get_block_reward(median_size, total_size + CRYPTONOTE_COINBASE_BLOB_RESERVED_SIZE, m_block_template.already_generated_coins, block_reward, m_block_template.height) ||
+        block_reward + m_block_template.fee + txd.fee < template_accept_threshold(m_block_template.best_coinbase) ||
+        have_key_images(m_block_template.k_images, txd.tx))
+    {
+      // a full rebuild would have picked this one before some of those
+      // already in the template, so the template is no longer the best
+      if (!m_block_template.tx_hashes.empty() && txCompare()(key, m_block_template.lowest))
+      {
+        LOG_PRINT_L2("Tx " << id << " does not fit the block template but outranks it, dropping the template");
+        m_block_template.valid = false;
+      }
+      return;
+    }
+
+    m_block_template.tx_hashes.push_back(id);
+    m_block_template.tx_set.insert(id);
+    append_key_images(m_block_template.k_images, txd.tx);
+    if (m_block_template.tx_hashes.size() == 1 || txCompare()(m_block_template.lowest, key))
+      m_block_template.lowest = key;
+    m_block_template.total_size = total_size;
+    m_block_template.fee += txd.fee;
+    m_block_template.best_coinbase = block_reward + m_block_template.fee;
+    LOG_PRINT_L2("Tx " << id << " added to the block template, new size " << total_size << "/" << max_total_size
+      << ", coinbase " << print_money(m_block_template.best_coinbase));
+  }
+  //---------------------------------------------------------------------------------
+  void tx_memory_pool::remove_from_block_template(const crypto::hash& id)
+  {
+    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    if (m_block_template.valid && m_block_template.tx_set.count(id))
+      m_block_template.valid = false;
+  }
+  //---------------------------------------------------------------------------------
   size_t tx_memory_pool::validate(uint8_t version)
   {
     CRITICAL_REGION_LOCAL(m_transactions_lock);
@@ -692,10 +949,10 @@ namespace cryptonote
     }
 
     for (auto it = m_transactions.begin(); it != m_transactions.end(); ) {
-      if (it->second.blob_size >= tx_size_limit) {
-        LOG_PRINT_L1("Transaction " << get_transaction_hash(it->second.tx) << " is too big (" << it->second.blob_size << " bytes), removing it from pool");
-        remove_transaction_keyimages(it->second.tx);
-        auto sorted_it = find_tx_in_sorted_container(it->first);
+      if (it->second->blob_size >= tx_size_limit) {
+        LOG_PRINT_L1("Transaction " << get_transaction_hash(it->second->tx) << " is too big (" << it->second->blob_size << " bytes), removing it from pool");
+        remove_transaction_keyimages(it->second->tx);
+        auto sorted_it = find_tx_in_sorted_container(it->first, *it->second);
         if (sorted_it == m_txs_by_fee_and_receive_time.end())
         {
           LOG_PRINT_L1("Removing tx " << it->first << " from tx pool, but it was not found in the sorted txs container!");
@@ -704,6 +961,10 @@ namespace cryptonote
         {
           m_txs_by_fee_and_receive_time.erase(sorted_it);
         }
+        remove_from_block_template(it->first);
+        journal_remove(it->first);
+        record_change(it->first, false);
+        m_txpool_size -= it->second->blob_size;
         auto pit = it++;
         m_transactions.erase(pit);
         ++n_removed;
@@ -714,38 +975,242 @@ namespace cryptonote
     return n_removed;
   }
   //---------------------------------------------------------------------------------
+  void tx_memory_pool::prune(size_t bytes)
+  {
+    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    if (m_txpool_size <= bytes)
+      return;
+
+    // the sorted container has the highest fee per byte first
+    auto sorted_it = m_txs_by_fee_and_receive_time.end();
+    while (m_txpool_size > bytes && sorted_it != m_txs_by_fee_and_receive_time.begin())
+    {
+      --sorted_it;
+      auto it = m_transactions.find(sorted_it->second);
+      if (it == m_transactions.end() || it->second->kept_by_block)
+        continue;
+
+      LOG_PRINT_L1("Evicting tx " << it->first << " from the full tx pool, fee per byte " << sorted_it->first.first);
+      remove_transaction_keyimages(it->second->tx);
+      remove_from_block_template(it->first);
+      journal_remove(it->first);
+      record_change(it->first, false);
+      m_txpool_size -= it->second->blob_size;
+      m_transactions.erase(it);
+      sorted_it = m_txs_by_fee_and_receive_time.erase(sorted_it);
+      ++m_txpool_evicted;
+    }
+  }
+  //---------------------------------------------------------------------------------
+  void tx_memory_pool::set_txpool_max_size(size_t bytes)
+  {
+    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    m_txpool_max_size = bytes;
+  }
+  //---------------------------------------------------------------------------------
+  void tx_memory_pool::get_size_stats(uint64_t &bytes, uint64_t &max_bytes, uint64_t &evicted) const
+  {
+    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    bytes = m_txpool_size;
+    max_bytes = m_txpool_max_size;
+    evicted = m_txpool_evicted;
+  }
+  //---------------------------------------------------------------------------------
+  txpool_tx_meta_t tx_memory_pool::get_tx_meta(const tx_details& txd)
+  {
+    txpool_tx_meta_t meta;
+    meta.max_used_block_id = txd.max_used_block_id;
+    meta.last_failed_id = txd.last_failed_id;
+    meta.blob_size = txd.blob_size;
+    meta.fee = txd.fee;
+    meta.max_used_block_height = txd.max_used_block_height;
+    meta.last_failed_height = txd.last_failed_height;
+    meta.receive_time = txd.receive_time;
+    meta.last_relayed_time = txd.last_relayed_time;
+    meta.kept_by_block = txd.kept_by_block;
+    meta.relayed = txd.relayed;
+    return meta;
+  }
+  //---------------------------------------------------------------------------------
+  std::shared_ptr<const tx_memory_pool::pool_snapshot> tx_memory_pool::get_snapshot() const
+  {
+    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    if (m_snapshot_stale || !m_snapshot)
+    {
+      std::shared_ptr<pool_snapshot> snapshot = std::make_shared<pool_snapshot>();
+      snapshot->reserve(m_transactions.size());
+      for (const auto& tx_vt : m_transactions)
+        snapshot->push_back(tx_vt);
+      m_snapshot = snapshot;
+      m_snapshot_stale = false;
+    }
+    return m_snapshot;
+  }
+  //---------------------------------------------------------------------------------
+  void tx_memory_pool::record_change(const crypto::hash& id, bool added)
+  {
+    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    m_snapshot_stale = true;
+    m_changes.push_back({++m_revision, id, added});
+    while (m_changes.size() > TXPOOL_CHANGES_LOG_SIZE)
+    {
+      m_changes_floor = m_changes.front().revision;
+      m_changes.pop_front();
+    }
+  }
+  //---------------------------------------------------------------------------------
+  void tx_memory_pool::journal_add(const crypto::hash& id, const tx_details& txd)
+  {
+    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    if (!m_db_persist)
+      return;
+    m_db_journal.push_back({id, false, get_tx_meta(txd), tx_to_blob(txd.tx)});
+  }
+  //---------------------------------------------------------------------------------
+  void tx_memory_pool::journal_update(const crypto::hash& id, const tx_details& txd)
+  {
+    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    if (!m_db_persist)
+      return;
+    m_db_journal.push_back({id, false, get_tx_meta(txd), blobdata()});
+  }
+  //---------------------------------------------------------------------------------
+  void tx_memory_pool::journal_remove(const crypto::hash& id)
+  {
+    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    if (!m_db_persist)
+      return;
+    m_db_journal.push_back({id, true, txpool_tx_meta_t(), blobdata()});
+  }
+  //---------------------------------------------------------------------------------
+  void tx_memory_pool::flush_db_journal(bool wait)
+  {
+    boost::unique_lock<boost::mutex> flush_lock(m_db_flush_lock, boost::defer_lock);
+    if (wait)
+      flush_lock.lock();
+    else if (!flush_lock.try_lock())
+      return;
+
+    std::vector<db_journal_entry> journal;
+    CRITICAL_REGION_BEGIN(m_transactions_lock);
+    journal.swap(m_db_journal);
+    CRITICAL_REGION_END();
+
+    BlockchainDB& db = m_blockchain.get_db();
+    for (const db_journal_entry& entry : journal)
+    {
+      try
+      {
+        if (entry.remove)
+          db.remove_txpool_tx(entry.id);
+        else if (entry.blob.empty())
+          db.update_txpool_tx(entry.id, entry.meta);
+        else
+          db.add_txpool_tx(entry.id, entry.meta, entry.blob);
+      }
+      catch (const std::exception &e)
+      {
+        LOG_ERROR("Failed to write tx " << entry.id << " to the pool database: " << e.what());
+      }
+    }
+  }
+  //---------------------------------------------------------------------------------
   //TODO: investigate whether only ever returning true is correct
   bool tx_memory_pool::init(const std::string& config_folder)
   {
-    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    CRITICAL_REGION_BEGIN(m_transactions_lock);
 
     m_config_folder = config_folder;
     if (m_config_folder.empty())
       return true;
 
+    m_db_persist = m_blockchain.get_db().has_txpool_storage();
+
     std::string state_file_path = config_folder + "/" + CRYPTONOTE_POOLDATA_FILENAME;
     boost::system::error_code ec;
-    if(!boost::filesystem::exists(state_file_path, ec))
-      return true;
-    bool res = tools::unserialize_obj_from_file(*this, state_file_path);
-    if(!res)
+    if(boost::filesystem::exists(state_file_path, ec))
     {
-      LOG_ERROR("Failed to load memory pool from file " << state_file_path);
+      bool res = tools::unserialize_obj_from_file(*this, state_file_path);
+      if(!res)
+      {
+        LOG_ERROR("Failed to load memory pool from file " << state_file_path);
 
-      m_transactions.clear();
-      m_txs_by_fee_and_receive_time.clear();
-      m_spent_key_images.clear();
+        m_transactions.clear();
+        m_txs_by_fee_and_receive_time.clear();
+        m_spent_key_images.clear();
+      }
+
+      // the state file is left by older versions, move it into the database
+      if (m_db_persist)
+      {
+        LOG_PRINT_L0("Moving " << m_transactions.size() << " txes from " << state_file_path << " to the database");
+        for (const auto& tx : m_transactions)
+          journal_add(tx.first, *tx.second);
+        boost::filesystem::remove(state_file_path, ec);
+      }
+    }
+
+    if (m_db_persist)
+    {
+      try
+      {
+        m_blockchain.get_db().for_all_txpool_txes([this](const crypto::hash &id, const txpool_tx_meta_t &meta, const blobdata &blob) {
+          if (m_transactions.count(id))
+            return true;
+          tx_details txd;
+          if (!parse_and_validate_tx_from_blob(blob, txd.tx))
+          {
+            LOG_ERROR("Failed to parse tx " << id << " from the pool database, removing it");
+            journal_remove(id);
+            return true;
+          }
+          // the pool may have missed blocks being added if we were stopped uncleanly
+          if (m_blockchain.have_tx(id) || m_blockchain.have_tx_keyimges_as_spent(txd.tx))
+          {
+            LOG_PRINT_L1("Tx " << id << " from the pool database is already in the blockchain, removing it");
+            journal_remove(id);
+            return true;
+          }
+          txd.blob_size = meta.blob_size;
+          txd.fee = meta.fee;
+          txd.max_used_block_id = meta.max_used_block_id;
+          txd.max_used_block_height = meta.max_used_block_height;
+          txd.kept_by_block = meta.kept_by_block;
+          txd.last_failed_height = meta.last_failed_height;
+          txd.last_failed_id = meta.last_failed_id;
+          txd.receive_time = meta.receive_time;
+          txd.last_relayed_time = meta.last_relayed_time;
+          txd.relayed = meta.relayed;
+          for (const auto& in : txd.tx.vin)
+          {
+            CHECKED_GET_SPECIFIC_VARIANT(in, const txin_to_key, txin, false);
+            m_spent_key_images.add(txin.k_image, id, true);
+          }
+          m_transactions.insert(transactions_container::value_type(id, std::make_shared<const tx_details>(std::move(txd))));
+          return true;
+        });
+      }
+      catch (const std::exception &e)
+      {
+        LOG_ERROR("Failed to load memory pool from the database: " << e.what());
+      }
     }
 
     // no need to store queue of sorted transactions, as it's easy to generate.
+    m_txpool_size = 0;
     for (const auto& tx : m_transactions)
     {
-      // Rounding tx fee/blob_size ratio so that txs with same priority level
-      // and the ratios not much diff would be sorted by receive_time
-      uint32_t fee_per_size_ratio = (uint32_t)(tx.second.fee / (double)tx.second.blob_size);
-      m_txs_by_fee_and_receive_time.emplace(std::pair<uint32_t, time_t>(fee_per_size_ratio, tx.second.receive_time), tx.first);
+      m_txs_by_fee_and_receive_time.insert(get_sorted_key(tx.first, *tx.second));
+      m_txpool_size += tx.second->blob_size;
     }
 
+    // the maximum size may have been lowered since the pool was saved
+    prune(m_txpool_max_size);
+
+    CRITICAL_REGION_END();
+
+    flush_db_journal(true);
+
     // Ignore deserialization error
     return true;
   }
@@ -762,6 +1227,14 @@ namespace cryptonote
       return true;
     }
 
+    // every change was written through to the database as it happened
+    if (m_db_persist)
+    {
+      flush_db_journal(true);
+      LOG_PRINT_L1("Memory pool store deactivated successfully");
+      return true;
+    }
+
     if (!tools::create_directories_if_necessary(m_config_folder))
     {
       LOG_ERROR("Failed to create memory pool data directory: " << m_config_folder);
@@ -36,7 +36,10 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <queue>
+#include <deque>
+#include <memory>
 #include <boost/serialization/version.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/utility.hpp>
 
 #include "string_tools.h"
@@ -45,6 +48,7 @@
 #include "cryptonote_basic_impl.h"
 #include "verification_context.h"
 #include "crypto/hash.h"
+#include "blockchain_db/blockchain_db.h"
 #include "rpc/core_rpc_server_commands_defs.h"
 
 namespace cryptonote
@@ -60,21 +64,107 @@ namespace cryptonote
   class txCompare
   {
   public:
-    bool operator()(const tx_by_fee_and_receive_time_entry& a, const tx_by_fee_and_receive_time_entry& b)
+    bool operator()(const tx_by_fee_and_receive_time_entry& a, const tx_by_fee_and_receive_time_entry& b) const
     {
       // sort by greatest first, not least
       if (a.first.first > b.first.first) return true;
       else if (a.first.first < b.first.first) return false;
       else if (a.first.second < b.first.second) return true;
       else if (a.first.second > b.first.second) return false;
-      else if (a.second != b.second) return true;
-      else return false;
+      // ties are ordered by hash so that an entry can be found by its key
+      else return memcmp(a.second.data, b.second.data, sizeof(a.second.data)) < 0;
     }
   };
 
   //! container for sorting transactions by fee per unit size
   typedef std::set<tx_by_fee_and_receive_time_entry, txCompare> sorted_tx_container;
 
+  //TODO: confirm the below comments and investigate whether or not this
+  //      is the desired behavior
+  //! map key images to transactions which spent them
+  /*! this seems odd, but it seems that multiple transactions can exist
+   *  in the pool which both have the same spent key.  This would happen
+   *  in the event of a reorg where someone creates a new/different
+   *  transaction on the assumption that the original will not be in a
+   *  block again.
+   */
+  typedef std::unordered_map<crypto::key_image, std::unordered_set<crypto::hash> > key_images_container;
+
+  /**
+   * @brief the key images spent by pool transactions, split into stripes
+   *
+   * Each stripe has its own lock, so looking up key images, and adding
+   * transactions which spend unrelated key images, neither wait on each
+   * other nor on the pool lock.
+   */
+  class spent_key_images_index
+  {
+  public:
+    /**
+     * @brief check if a key image is spent by a transaction in the pool
+     *
+     * @param k_image the key image to look for
+     *
+     * @return true if it is spent, otherwise false
+     */
+    bool has(const crypto::key_image& k_image) const;
+
+    /**
+     * @brief record a transaction as spending a key image
+     *
+     * @param k_image the key image spent
+     * @param id the hash of the transaction spending it
+     * @param allow_conflict whether another transaction may already spend it
+     *
+     * @return false if another transaction spends it and that is not allowed,
+     *         or if the transaction was already recorded, otherwise true
+     */
+    bool add(const crypto::key_image& k_image, const crypto::hash& id, bool allow_conflict);
+
+    /**
+     * @brief forget a transaction spending a key image
+     *
+     * @param k_image the key image spent
+     * @param id the hash of the transaction spending it
+     *
+     * @return false if the transaction was not recorded as spending it, otherwise true
+     */
+    bool remove(const crypto::key_image& k_image, const crypto::hash& id);
+
+    /**
+     * @brief forget all key images
+     */
+    void clear();
+
+    /**
+     * @brief get a copy of all the key images and the transactions spending them
+     *
+     * @return the key images
+     */
+    key_images_container get_all() const;
+
+    /**
+     * @brief replace the contents of the index
+     *
+     * @param images the key images and the transactions spending them
+     */
+    void set_all(const key_images_container& images);
+
+  private:
+    static const size_t STRIPES = 16;
+
+    struct stripe
+    {
+      mutable boost::mutex lock;  //!< lock for this stripe
+      key_images_container images;  //!< the key images falling in this stripe
+    };
+
+    stripe& get_stripe(const crypto::key_image& k_image);
+    const stripe& get_stripe(const crypto::key_image& k_image) const;
+
+    stripe m_stripes[STRIPES];
+  };
+
   /**
    * @brief Transaction pool, handles transactions which are not part of a block
    *
@@ -85,7 +175,7 @@ namespace cryptonote
    *   storing the transactions
    *   organizing the transactions by fee per size
    *   taking/giving transactions to and from various other components
-   *   saving the transactions to disk on shutdown
+   *   storing the transactions in the blockchain database as they come and go
    *   helping create a new block template by choosing transactions for it
    *
    */
@@ -105,8 +195,9 @@ namespace cryptonote
      *
      * @param id the transaction's hash
      * @param blob_size the transaction's size
+     * @param rct_semantics_verified whether Blockchain::check_tx_rct_semantics already passed for the transaction
      */
-    bool add_tx(const transaction &tx, const crypto::hash &id, size_t blob_size, tx_verification_context& tvc, bool kept_by_block, bool relayed, uint8_t version);
+    bool add_tx(const transaction &tx, const crypto::hash &id, size_t blob_size, tx_verification_context& tvc, bool kept_by_block, bool relayed, uint8_t version, bool rct_semantics_verified = false);
 
     /**
      * @brief add a transaction to the transaction pool
@@ -151,7 +242,8 @@ namespace cryptonote
     /**
      * @brief action to take when notified of a block added to the blockchain
      *
-     * Currently does nothing
+     * Drops the cached block template, as it was built for the previous
+     * height.
      *
      * @param new_block_height the height of the blockchain after the change
      * @param top_block_id the hash of the new top block
@@ -163,7 +255,8 @@ namespace cryptonote
     /**
      * @brief action to take when notified of a block removed from the blockchain
      *
-     * Currently does nothing
+     * Drops the cached block template, as it was built for the previous
+     * height.
      *
      * @param new_block_height the height of the blockchain after the change
      * @param top_block_id the hash of the new top block
@@ -194,7 +287,14 @@ namespace cryptonote
     /**
      * @brief loads pool state (if any) from disk, and initializes pool
      *
-     * @param config_folder folder name where pool state will be
+     * If the blockchain database can store the pool, the pool is loaded
+     * from it, and every later change is written through to it.  A pool
+     * state file left by an older version is moved into the database.
+     * Otherwise the pool is loaded from the state file.  Must be called
+     * after the blockchain is initialized.
+     *
+     * @param config_folder folder name where pool state will be, or
+     * empty to not keep pool state at all
      *
      * @return true
      */
@@ -203,9 +303,11 @@ namespace cryptonote
     /**
      * @brief attempts to save the transaction pool state to disk
      *
-     * Currently fails (returns false) if the data directory from init()
-     * does not exist and cannot be created, but returns true even if
-     * saving to disk is unsuccessful.
+     * Writes any pool changes the database has not seen yet.  If the
+     * database cannot store the pool, the pool is saved to the state file
+     * instead, in which case this fails (returns false) if the data
+     * directory from init() does not exist and cannot be created, but
+     * returns true even if saving to disk is unsuccessful.
      *
      * @return true in most cases (see above)
      */
@@ -214,11 +316,17 @@ namespace cryptonote
     /**
      * @brief Chooses transactions for a block to include
      *
+     * The selection is cached, and kept up to date as transactions arrive,
+     * so repeated calls for the same height only copy it.  It is rebuilt
+     * from the whole pool after a new block, or when a transaction it
+     * contains leaves the pool.
+     *
      * @param bl return-by-reference the block to fill in with transactions
      * @param median_size the current median block size
      * @param already_generated_coins the current total number of coins "minted"
      * @param total_size return-by-reference the total size of the new block
      * @param fee return-by-reference the total of fees from the included transactions
+     * @param height the height of the new block
      *
      * @return true
      */
@@ -231,6 +339,31 @@ namespace cryptonote
      */
     void get_transactions(std::list<transaction>& txs) const;
 
+    /**
+     * @brief get the hashes of all transactions in the pool
+     *
+     * @param hashes return-by-reference the hashes of the transactions
+     * @param revision return-by-reference the pool revision the hashes are for
+     */
+    void get_transaction_hashes(std::vector<crypto::hash>& hashes, uint64_t& revision) const;
+
+    /**
+     * @brief get the transactions added to and removed from the pool since a revision
+     *
+     * A transaction which was added and removed again since the given revision
+     * is left out of both lists.  If the revision is too old to be in the
+     * change log, or is from before the daemon was restarted, the caller has
+     * to fetch the whole pool again.
+     *
+     * @param revision the pool revision the caller last saw
+     * @param added return-by-reference the hashes of the transactions added since
+     * @param removed return-by-reference the hashes of the transactions removed since
+     * @param current_revision return-by-reference the current pool revision
+     *
+     * @return true if the changes were found, false if a full resync is needed
+     */
+    bool get_changes_since(uint64_t revision, std::vector<crypto::hash>& added, std::vector<crypto::hash>& removed, uint64_t& current_revision) const;
+
     /**
      * @brief get information about all transactions and key images in the pool
      *
@@ -303,6 +436,26 @@ namespace cryptonote
      */
     size_t validate(uint8_t version);
 
+    /**
+     * @brief set the maximum total size of the transactions in the pool
+     *
+     * When the pool grows past this size, the transactions paying the
+     * least per byte are evicted, and new transactions paying no more
+     * than those are refused.
+     *
+     * @param bytes the maximum size, in bytes
+     */
+    void set_txpool_max_size(size_t bytes);
+
+    /**
+     * @brief get the pool's size and eviction statistics
+     *
+     * @param bytes return-by-reference the total size of the transactions in the pool
+     * @param max_bytes return-by-reference the maximum total size
+     * @param evicted return-by-reference the number of transactions evicted since startup
+     */
+    void get_size_stats(uint64_t &bytes, uint64_t &max_bytes, uint64_t &evicted) const;
+
 
 #define CURRENT_MEMPOOL_ARCHIVE_VER    11
 #define CURRENT_MEMPOOL_TX_DETAILS_ARCHIVE_VER    11
@@ -324,8 +477,22 @@ namespace cryptonote
       if(version < CURRENT_MEMPOOL_ARCHIVE_VER )
         return;
       CRITICAL_REGION_LOCAL(m_transactions_lock);
-      a & m_transactions;
-      a & m_spent_key_images;
+      // stored by value, as older versions did
+      stored_transactions_container transactions;
+      if (!archive_t::is_loading::value)
+        for (const auto& tx_vt : m_transactions)
+          transactions.insert(stored_transactions_container::value_type(tx_vt.first, *tx_vt.second));
+      a & transactions;
+      if (archive_t::is_loading::value)
+        for (auto& tx_vt : transactions)
+          m_transactions.insert(transactions_container::value_type(tx_vt.first, std::make_shared<const tx_details>(std::move(tx_vt.second))));
+      // stored as a plain map, as older versions did
+      key_images_container spent_key_images;
+      if (!archive_t::is_loading::value)
+        spent_key_images = m_spent_key_images.get_all();
+      a & spent_key_images;
+      if (archive_t::is_loading::value)
+        m_spent_key_images.set_all(spent_key_images);
       a & m_timed_out_transactions;
     }
 
@@ -367,6 +534,9 @@ namespace cryptonote
     };
 
   private:
+    //! an unchanging list of the pool's transactions, shared by readers
+    typedef std::vector<std::pair<crypto::hash, std::shared_ptr<const tx_details>>> pool_snapshot;
+
 
     /**
      * @brief remove old transactions from the pool
@@ -379,6 +549,16 @@ namespace cryptonote
      */
     bool remove_stuck_transactions();
 
+    /**
+     * @brief evict the lowest fee per byte transactions until the pool fits
+     *
+     * Transactions which have been in a block are not evicted, as they
+     * are likely to be mined again soon.
+     *
+     * @param bytes the size the pool must fit in
+     */
+    void prune(size_t bytes);
+
     /**
      * @brief check if a transaction in the pool has a given spent key image
      *
@@ -438,25 +618,126 @@ namespace cryptonote
     /**
      * @brief check if a transaction is a valid candidate for inclusion in a block
      *
+     * If checking the inputs changes the info, txd is replaced by a
+     * changed copy.
+     *
      * @param txd the transaction to check (and info about it)
      *
      * @return true if the transaction is good to go, otherwise false
      */
-    bool is_transaction_ready_to_go(tx_details& txd) const;
+    bool is_transaction_ready_to_go(std::shared_ptr<const tx_details>& txd) const;
 
-    //! map transactions (and related info) by their hashes
-    typedef std::unordered_map<crypto::hash, tx_details > transactions_container;
+    /**
+     * @brief try to add a newly verified transaction to the cached block template
+     *
+     * The transaction is appended if it fits under the same rules as
+     * fill_block_template uses.  If it does not fit, but pays more per
+     * byte than a transaction already in the template, the template is
+     * dropped so the next request rebuilds it.
+     *
+     * @param id the hash of the transaction
+     * @param txd the transaction's details
+     */
+    void add_to_block_template(const crypto::hash& id, const tx_details& txd);
+
+    /**
+     * @brief get the database encoding of a transaction's details
+     *
+     * @param txd the transaction's details
+     *
+     * @return the details to store
+     */
+    static txpool_tx_meta_t get_tx_meta(const tx_details& txd);
+
+    /**
+     * @brief get a list of the pool's transactions for reading
+     *
+     * The list is shared until the pool changes, so readers only hold the
+     * pool lock to rebuild it, and do the rest of their work without it.
+     * It shares the transactions' details with the pool, so rebuilding it
+     * copies pointers only.
+     *
+     * @return the snapshot
+     */
+    std::shared_ptr<const pool_snapshot> get_snapshot() const;
+
+    /**
+     * @brief record a transaction entering or leaving the pool in the change log
+     *
+     * @param id the hash of the transaction
+     * @param added whether the transaction was added or removed
+     */
+    void record_change(const crypto::hash& id, bool added);
 
-    //TODO: confirm the below comments and investigate whether or not this
-    //      is the desired behavior
-    //! map key images to transactions which spent them
-    /*! this seems odd, but it seems that multiple transactions can exist
-     *  in the pool which both have the same spent key.  This would happen
-     *  in the event of a reorg where someone creates a new/different
-     *  transaction on the assumption that the original will not be in a
-     *  block again.
+    /**
+     * @brief queue a transaction to be stored in the database
+     *
+     * @param id the hash of the transaction
+     * @param txd the transaction's details
+     */
+    void journal_add(const crypto::hash& id, const tx_details& txd);
+
+    /**
+     * @brief queue an update of a stored transaction's details
+     *
+     * @param id the hash of the transaction
+     * @param txd the transaction's new details
+     */
+    void journal_update(const crypto::hash& id, const tx_details& txd);
+
+    /**
+     * @brief queue the removal of a transaction from the database
+     *
+     * @param id the hash of the transaction
+     */
+    void journal_remove(const crypto::hash& id);
+
+    /**
+     * @brief write the queued pool changes to the database
+     *
+     * Must not be called with the pool locked: the database may have to
+     * wait for a block being added, which itself takes the pool lock.
+     * Changes are written in the order they were queued.
+     *
+     * @param wait if false, return at once when another thread is writing
      */
-    typedef std::unordered_map<crypto::key_image, std::unordered_set<crypto::hash> > key_images_container;
+    void flush_db_journal(bool wait);
+
+    /**
+     * @brief drop the cached block template if it contains a given transaction
+     *
+     * @param id the hash of the transaction leaving the pool
+     */
+    void remove_from_block_template(const crypto::hash& id);
+
+    /**
+     * @brief the transactions last chosen for a block template
+     */
+    struct block_template_cache
+    {
+      bool valid;  //!< whether the fields below can be used
+      uint64_t height;  //!< the height the template was built for
+      size_t median_size;  //!< the median block size the template was built for
+      uint64_t already_generated_coins;  //!< the coins generated when the template was built
+      std::vector<crypto::hash> tx_hashes;  //!< the chosen transactions, in order
+      std::unordered_set<crypto::hash> tx_set;  //!< the chosen transactions, for lookup
+      std::unordered_set<crypto::key_image> k_images;  //!< key images spent by the chosen transactions
+      size_t total_size;  //!< the total size of the chosen transactions
+      uint64_t fee;  //!< the total fee of the chosen transactions
+      uint64_t best_coinbase;  //!< the coinbase amount with the chosen transactions
+      tx_by_fee_and_receive_time_entry lowest;  //!< sorted key of the lowest ranked chosen transaction
+
+      block_template_cache(): valid(false) {}
+    };
+
+    //! map transactions (and related info) by their hashes
+    /*! the details are never changed in place, but replaced by a changed
+     *  copy, so that snapshots can share them
+     */
+    typedef std::unordered_map<crypto::hash, std::shared_ptr<const tx_details> > transactions_container;
+
+    //! transactions by value, as stored in the pool state file
+    typedef std::unordered_map<crypto::hash, tx_details > stored_transactions_container;
 
 #if defined(DEBUG_CREATE_BLOCK_TEMPLATE)
 public:
@@ -468,7 +749,11 @@ private:
 #endif
 
     //! container for spent key images from the transactions in the pool
-    key_images_container m_spent_key_images;  
+    spent_key_images_index m_spent_key_images;
+
+    //! copy of the pool for readers, rebuilt when they find it stale
+    mutable std::shared_ptr<const pool_snapshot> m_snapshot;
+    mutable bool m_snapshot_stale;  //!< whether the pool changed since the snapshot was taken
 
     //TODO: this time should be a named constant somewhere, not hard-coded
     //! interval on which to check for stale/"stuck" transactions
@@ -478,14 +763,28 @@ private:
     //!< container for transactions organized by fee per size and receive time
     sorted_tx_container m_txs_by_fee_and_receive_time;
 
+    /**
+     * @brief get the key of a transaction in the sorted container
+     *
+     * @param id the hash of the transaction
+     * @param txd the transaction's details
+     *
+     * @return the key
+     */
+    static tx_by_fee_and_receive_time_entry get_sorted_key(const crypto::hash& id, const tx_details& txd);
+
     /**
      * @brief get an iterator to a transaction in the sorted container
      *
+     * The key is rebuilt from the transaction's details, so this is a
+     * logarithmic lookup rather than a scan.
+     *
      * @param id the hash of the transaction to look for
+     * @param txd the transaction's details
      *
      * @return an iterator, possibly to the end of the container if not found
      */
-    sorted_tx_container::iterator find_tx_in_sorted_container(const crypto::hash& id) const;
+    sorted_tx_container::iterator find_tx_in_sorted_container(const crypto::hash& id, const tx_details& txd) const;
 
     //! transactions which are unlikely to be included in blocks
     /*! These transactions are kept in RAM in case they *are* included
@@ -493,6 +792,41 @@ private:
      */
     std::unordered_set<crypto::hash> m_timed_out_transactions;
 
+    size_t m_txpool_max_size;  //!< the maximum total size of the transactions in the pool
+    size_t m_txpool_size;  //!< the total size of the transactions in the pool
+    uint64_t m_txpool_evicted;  //!< the number of transactions evicted to fit the maximum size
+
+    block_template_cache m_block_template;  //!< the cached block template
+
+    /**
+     * @brief a pool change waiting to be written to the database
+     */
+    struct db_journal_entry
+    {
+      crypto::hash id;  //!< the hash of the transaction
+      bool remove;  //!< whether the transaction left the pool
+      txpool_tx_meta_t meta;  //!< the transaction's details, unless removed
+      blobdata blob;  //!< the transaction's blob, or empty to only update the details
+    };
+
+    /**
+     * @brief a transaction entering or leaving the pool
+     */
+    struct pool_change
+    {
+      uint64_t revision;  //!< the pool revision this change produced
+      crypto::hash id;  //!< the hash of the transaction
+      bool added;  //!< whether the transaction was added or removed
+    };
+
+    uint64_t m_revision;  //!< bumped every time a transaction enters or leaves the pool
+    std::deque<pool_change> m_changes;  //!< the most recent changes, oldest first
+    uint64_t m_changes_floor;  //!< the oldest revision changes can be given since
+
+    bool m_db_persist;  //!< whether pool changes are written to the database
+    std::vector<db_journal_entry> m_db_journal;  //!< changes not written to the database yet
+    boost::mutex m_db_flush_lock;  //!< serializes writing the journal to the database
+
     std::string m_config_folder;  //!< the folder to save state to
     Blockchain& m_blockchain;  //!< reference to the Blockchain object
   };
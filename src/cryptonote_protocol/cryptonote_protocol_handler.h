@@ -46,8 +46,13 @@
 #include "cryptonote_core/connection_context.h"
 #include "cryptonote_core/cryptonote_stat_info.h"
 #include "cryptonote_core/verification_context.h"
+#include "cryptonote_core/prepared_block.h"
 // #include <netinet/in.h>
 #include <boost/circular_buffer.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/uuid/uuid.hpp>
+#include <unordered_map>
+#include <unordered_set>
 
 PUSH_WARNINGS
 DISABLE_VS_WARNINGS(4355)
@@ -130,6 +135,22 @@ namespace cryptonote
     bool request_missing_objects(cryptonote_connection_context& context, bool check_having_blocks);
     size_t get_synchronizing_connections_count();
     bool on_connection_synchronized();
+
+    /**
+     * @brief remember that a peer has transactions, so they are not relayed to it
+     *
+     * @param connection_id the peer's connection
+     * @param tx_hashes the hashes of the transactions
+     */
+    void add_known_txs(const boost::uuids::uuid& connection_id, const std::vector<crypto::hash>& tx_hashes);
+
+    /**
+     * @brief send the queued transactions to the peers which don't have them
+     *
+     * Peers missing the same transactions share a notification, and each
+     * notification carries up to P2P_TX_RELAY_BATCH_MAX_SIZE bytes of them.
+     */
+    void flush_relay_queue();
     t_core& m_core;
 
     nodetool::p2p_endpoint_stub<connection_context> m_p2p_stub;
@@ -142,6 +163,13 @@ namespace cryptonote
 		// static std::ofstream m_logreq;
     boost::mutex m_buffer_mutex;
     double get_avg_block_size();
+
+    boost::mutex m_relay_lock;  //!< lock for the relay queue and the peers' known txes
+    std::vector<std::pair<crypto::hash, blobdata>> m_relay_queue;  //!< txes waiting to be relayed
+    std::unordered_set<crypto::hash> m_relay_queued;  //!< the hashes of the txes in the relay queue
+    size_t m_relay_queue_size;  //!< the total size of the txes in the relay queue
+    //! txes each peer sent us or was sent, by connection
+    std::unordered_map<boost::uuids::uuid, std::unordered_set<crypto::hash>, boost::hash<boost::uuids::uuid>> m_peer_known_txs;
     boost::circular_buffer<size_t> m_avg_buffer = boost::circular_buffer<size_t>(10);
 
     template<class t_parameter>
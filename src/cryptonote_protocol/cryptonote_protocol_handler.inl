@@ -38,6 +38,7 @@
 
 #include <boost/interprocess/detail/atomic.hpp>
 #include <list>
+#include <map>
 #include <unordered_map>
 
 #include "cryptonote_core/cryptonote_format_utils.h"
@@ -61,7 +62,8 @@ namespace cryptonote
                                                                                                               m_p2p(p_net_layout),
                                                                                                               m_syncronized_connections_count(0),
                                                                                                               m_synchronized(false),
-                                                                                                              m_stopping(false)
+                                                                                                              m_stopping(false),
+                                                                                                              m_relay_queue_size(0)
 
   {
     if(!m_p2p)
@@ -691,17 +693,21 @@ namespace cryptonote
     if(context.m_state != cryptonote_connection_context::state_normal)
       return 1;
 
-    for(auto tx_blob_it = arg.txs.begin(); tx_blob_it!=arg.txs.end();)
+    std::vector<crypto::hash> tx_hashes;
+    std::vector<cryptonote::tx_verification_context> tvc;
+    m_core.handle_incoming_txs(arg.txs, tx_hashes, tvc, false, true);
+    // whether we take them or not, this peer has them, so don't send them back
+    add_known_txs(context.m_connection_id, tx_hashes);
+    size_t i = 0;
+    for(auto tx_blob_it = arg.txs.begin(); tx_blob_it!=arg.txs.end(); ++i)
     {
-      cryptonote::tx_verification_context tvc = AUTO_VAL_INIT(tvc);
-      m_core.handle_incoming_tx(*tx_blob_it, tvc, false, true);
-      if(tvc.m_verifivation_failed)
+      if(tvc[i].m_verifivation_failed)
       {
         LOG_PRINT_CCONTEXT_L1("Tx verification failed, dropping connection");
         m_p2p->drop_connection(context);
         return 1;
       }
-      if(tvc.m_should_be_relayed)
+      if(tvc[i].m_should_be_relayed)
         ++tx_blob_it;
       else
         arg.txs.erase(tx_blob_it++);
@@ -803,6 +809,16 @@ namespace cryptonote
 
     context.m_remote_blockchain_height = arg.current_blockchain_height;
 
+    // parse every block and tx of the batch once, the parsed objects are
+    // reused by all the processing below
+    std::vector<prepared_block> parsed_blocks;
+    if(!m_core.parse_incoming_blocks(arg.blocks, parsed_blocks))
+    {
+      LOG_ERROR_CCONTEXT("sent wrong NOTIFY_RESPONSE_GET_OBJECTS: failed to parse and validate blocks or transactions, dropping connection");
+      m_p2p->drop_connection(context);
+      return 1;
+    }
+
     size_t count = 0;
     BOOST_FOREACH(const block_complete_entry& block_entry, arg.blocks)
     {
@@ -811,19 +827,13 @@ namespace cryptonote
         return 1;
       }
 
+      const block& b = parsed_blocks[count].bl;
+      const crypto::hash& block_hash = parsed_blocks[count].hash;
       ++count;
-      block b;
-      if(!parse_and_validate_block_from_blob(block_entry.block, b))
-      {
-        LOG_ERROR_CCONTEXT("sent wrong block: failed to parse and validate block: \r\n"
-          << epee::string_tools::buff_to_hex_nodelimer(block_entry.block) << "\r\n dropping connection");
-        m_p2p->drop_connection(context);
-        return 1;
-      }
       //to avoid concurrency in core between connections, suspend connections which delivered block later then first one
       if(count == 2)
       {
-        if(m_core.have_block(get_block_hash(b)))
+        if(m_core.have_block(block_hash))
         {
           context.m_state = cryptonote_connection_context::state_idle;
           context.m_needed_objects.clear();
@@ -833,7 +843,7 @@ namespace cryptonote
         }
       }
 
-      auto req_it = context.m_requested_objects.find(get_block_hash(b));
+      auto req_it = context.m_requested_objects.find(block_hash);
       if(req_it == context.m_requested_objects.end())
       {
         LOG_ERROR_CCONTEXT("sent wrong NOTIFY_RESPONSE_GET_OBJECTS: block with id=" << epee::string_tools::pod_to_hex(get_blob_hash(block_entry.block))
@@ -872,7 +882,8 @@ namespace cryptonote
 
         uint64_t previous_height = m_core.get_current_blockchain_height();
 
-        m_core.prepare_handle_incoming_blocks(arg.blocks);
+        m_core.prepare_handle_incoming_blocks(parsed_blocks);
+        size_t block_idx = 0;
         BOOST_FOREACH(const block_complete_entry& block_entry, arg.blocks)
         {
           if (m_stopping)
@@ -881,16 +892,18 @@ namespace cryptonote
               return 1;
           }
 
+          const prepared_block& pblock = parsed_blocks[block_idx++];
+
           // process transactions
           TIME_MEASURE_START(transactions_process_time);
-          BOOST_FOREACH(auto& tx_blob, block_entry.txs)
+          BOOST_FOREACH(const prepared_tx& ptx, pblock.txs)
           {
             tx_verification_context tvc = AUTO_VAL_INIT(tvc);
-            m_core.handle_incoming_tx(tx_blob, tvc, true, true);
+            m_core.handle_incoming_tx(ptx, tvc, true, true);
             if(tvc.m_verifivation_failed)
             {
               LOG_ERROR_CCONTEXT("transaction verification failed on NOTIFY_RESPONSE_GET_OBJECTS, \r\ntx_id = "
-                  << epee::string_tools::pod_to_hex(get_blob_hash(tx_blob)) << ", dropping connection");
+                  << epee::string_tools::pod_to_hex(ptx.tx_hash) << ", dropping connection");
               m_p2p->drop_connection(context);
               m_core.cleanup_handle_incoming_blocks();
               return 1;
@@ -903,7 +916,7 @@ namespace cryptonote
           TIME_MEASURE_START(block_process_time);
           block_verification_context bvc = boost::value_initialized<block_verification_context>();
 
-          m_core.handle_incoming_block(block_entry.block, bvc, false); // <--- process block
+          m_core.handle_incoming_block(block_entry.block, &pblock.bl, bvc, false); // <--- process block
 
           if(bvc.m_verifivation_failed)
           {
@@ -943,6 +956,7 @@ namespace cryptonote
   template<class t_core>
   bool t_cryptonote_protocol_handler<t_core>::on_idle()
   {
+    flush_relay_queue();
     return m_core.on_idle();
   }
   //------------------------------------------------------------------------------------------------------------------------
@@ -1150,9 +1164,126 @@ namespace cryptonote
   bool t_cryptonote_protocol_handler<t_core>::relay_transactions(NOTIFY_NEW_TRANSACTIONS::request& arg, cryptonote_connection_context& exclude_context)
   {
     // no check for success, so tell core they're relayed unconditionally
+    std::vector<crypto::hash> tx_hashes;
+    std::vector<std::pair<crypto::hash, blobdata>> txs;
     for(auto tx_blob_it = arg.txs.begin(); tx_blob_it!=arg.txs.end(); ++tx_blob_it)
-      m_core.on_transaction_relayed(*tx_blob_it);
-    return relay_post_notify<NOTIFY_NEW_TRANSACTIONS>(arg, exclude_context);
+    {
+      crypto::hash tx_hash;
+      if (m_core.on_transaction_relayed(*tx_blob_it, tx_hash))
+      {
+        tx_hashes.push_back(tx_hash);
+        txs.push_back(std::make_pair(tx_hash, *tx_blob_it));
+      }
+    }
+    add_known_txs(exclude_context.m_connection_id, tx_hashes);
+
+    // queue them, they go out in batches from on_idle, or once there's a full batch
+    bool flush = false;
+    {
+      boost::lock_guard<boost::mutex> lock(m_relay_lock);
+      for (auto &tx : txs)
+      {
+        if (!m_relay_queued.insert(tx.first).second)
+          continue;
+        m_relay_queue_size += tx.second.size();
+        m_relay_queue.push_back(std::move(tx));
+      }
+      flush = m_relay_queue_size >= P2P_TX_RELAY_BATCH_MAX_SIZE;
+    }
+    if (flush)
+      flush_relay_queue();
+    return true;
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  void t_cryptonote_protocol_handler<t_core>::add_known_txs(const boost::uuids::uuid& connection_id, const std::vector<crypto::hash>& tx_hashes)
+  {
+    // local txes come with a blank context
+    if (connection_id.is_nil() || tx_hashes.empty())
+      return;
+    boost::lock_guard<boost::mutex> lock(m_relay_lock);
+    std::unordered_set<crypto::hash> &known = m_peer_known_txs[connection_id];
+    if (known.size() + tx_hashes.size() > P2P_TX_RELAY_KNOWN_TXES_MAX)
+      known.clear();
+    for (const crypto::hash &tx_hash : tx_hashes)
+    {
+      if (tx_hash != null_hash)
+        known.insert(tx_hash);
+    }
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  void t_cryptonote_protocol_handler<t_core>::flush_relay_queue()
+  {
+    std::vector<std::pair<crypto::hash, blobdata>> queue;
+    {
+      boost::lock_guard<boost::mutex> lock(m_relay_lock);
+      if (m_relay_queue.empty())
+        return;
+      queue.swap(m_relay_queue);
+      m_relay_queued.clear();
+      m_relay_queue_size = 0;
+    }
+
+    // peers still synchronizing drop the notification, so only those in the
+    // normal state are sent the txes and have them marked as known
+    std::list<std::pair<boost::uuids::uuid, bool>> connections;
+    m_p2p->for_each_connection([&connections](cryptonote_connection_context& context, nodetool::peerid_type peer_id, uint32_t support_flags)
+    {
+      if (peer_id)
+        connections.push_back(std::make_pair(context.m_connection_id, context.m_state == cryptonote_connection_context::state_normal));
+      return true;
+    });
+
+    // peers missing the same txes get the same notifications
+    std::map<std::vector<size_t>, std::list<boost::uuids::uuid>> groups;
+    {
+      boost::lock_guard<boost::mutex> lock(m_relay_lock);
+      std::unordered_map<boost::uuids::uuid, std::unordered_set<crypto::hash>, boost::hash<boost::uuids::uuid>> live_known_txs;
+      for (const auto &connection : connections)
+      {
+        const boost::uuids::uuid &connection_id = connection.first;
+        std::unordered_set<crypto::hash> &known = live_known_txs[connection_id];
+        auto it = m_peer_known_txs.find(connection_id);
+        if (it != m_peer_known_txs.end())
+          known.swap(it->second);
+        if (!connection.second)
+          continue;
+        if (known.size() + queue.size() > P2P_TX_RELAY_KNOWN_TXES_MAX)
+          known.clear();
+        std::vector<size_t> missing;
+        for (size_t i = 0; i < queue.size(); ++i)
+        {
+          if (known.insert(queue[i].first).second)
+            missing.push_back(i);
+        }
+        if (!missing.empty())
+          groups[missing].push_back(connection_id);
+      }
+      // peers which are gone are dropped here
+      m_peer_known_txs.swap(live_known_txs);
+    }
+
+    for (const auto &group : groups)
+    {
+      auto it = group.first.begin();
+      while (it != group.first.end())
+      {
+        NOTIFY_NEW_TRANSACTIONS::request r;
+        size_t batch_size = 0;
+        do
+        {
+          batch_size += queue[*it].second.size();
+          r.txs.push_back(queue[*it].second);
+          ++it;
+        } while (it != group.first.end() && batch_size + queue[*it].second.size() <= P2P_TX_RELAY_BATCH_MAX_SIZE);
+
+        LOG_PRINT_L2("Relaying " << r.txs.size() << " txes, " << batch_size << " bytes, to " << group.second.size() << " peers");
+        std::string blob;
+        epee::serialization::store_t_to_binary(r, blob);
+        m_p2p->relay_notify_to_list(NOTIFY_NEW_TRANSACTIONS::ID, blob, group.second);
+      }
+    }
   }
 
   /// @deprecated
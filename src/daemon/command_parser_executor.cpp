@@ -504,4 +504,33 @@ bool t_command_parser_executor::print_coinbase_tx_sum(const std::vector<std::str
   return m_executor.print_coinbase_tx_sum(height, count);
 }
 
+bool t_command_parser_executor::db_stats(const std::vector<std::string>& args)
+{
+  if (!args.empty()) return false;
+
+  return m_executor.db_stats();
+}
+
+bool t_command_parser_executor::save_snapshot(const std::vector<std::string>& args)
+{
+  if (args.empty() || args.size() > 2)
+  {
+    std::cout << "usage: save_snapshot <path> [compact]" << std::endl;
+    return false;
+  }
+
+  bool compact = false;
+  if (args.size() == 2)
+  {
+    if (args[1] != "compact")
+    {
+      std::cout << "wrong parameter " << args[1] << ", expected \"compact\"" << std::endl;
+      return false;
+    }
+    compact = true;
+  }
+
+  return m_executor.save_snapshot(args[0], compact);
+}
+
 } // namespace daemonize
@@ -120,6 +120,10 @@ public:
   bool output_histogram(const std::vector<std::string>& args);
 
   bool print_coinbase_tx_sum(const std::vector<std::string>& args);
+
+  bool db_stats(const std::vector<std::string>& args);
+
+  bool save_snapshot(const std::vector<std::string>& args);
 };
 
 } // namespace daemonize
@@ -221,6 +221,16 @@ t_command_server::t_command_server(
     , std::bind(&t_command_parser_executor::output_histogram, &m_parser, p::_1)
     , "Print output histogram (amount, instances)"
     );
+    m_command_lookup.set_handler(
+      "db_stats"
+    , std::bind(&t_command_parser_executor::db_stats, &m_parser, p::_1)
+    , "Print database operation latencies, table sizes and memory map use"
+    );
+    m_command_lookup.set_handler(
+      "save_snapshot"
+    , std::bind(&t_command_parser_executor::save_snapshot, &m_parser, p::_1)
+    , "Save a copy of the database to a directory while running, save_snapshot <path> [compact]"
+    );
     m_command_lookup.set_handler(
       "print_coinbase_tx_sum"
     , std::bind(&t_command_parser_executor::print_coinbase_tx_sum, &m_parser, p::_1)
@@ -30,6 +30,7 @@
 // Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
 
 #include "string_tools.h"
+#include "misc_language.h"
 #include "common/scoped_message_writer.h"
 #include "daemon/rpc_command_executor.h"
 #include "rpc/core_rpc_server_commands_defs.h"
@@ -72,6 +73,20 @@ namespace {
       << "reward: " << boost::lexical_cast<std::string>(header.reward);
   }
 
+  // the upper bound, in microseconds, of the latency bucket holding the call
+  // at the given fraction of all calls
+  uint64_t get_latency_percentile(const std::vector<uint64_t> &buckets, uint64_t count, double fraction)
+  {
+    uint64_t seen = 0;
+    for (size_t n = 0; n < buckets.size(); ++n)
+    {
+      seen += buckets[n];
+      if (seen >= count * fraction)
+        return 1ull << n;
+    }
+    return 1ull << buckets.size();
+  }
+
   std::string get_human_time_ago(time_t t, time_t now)
   {
     if (t == now)
@@ -640,14 +655,13 @@ bool t_rpc_command_executor::print_transaction(crypto::hash transaction_hash) {
     tools::success_msg_writer() << as_hex;
 
     // then as json
-    crypto::hash tx_hash, tx_prefix_hash;
     cryptonote::transaction tx;
     cryptonote::blobdata blob;
     if (!string_tools::parse_hexstr_to_binbuff(as_hex, blob))
     {
       tools::fail_msg_writer() << "Failed to parse tx";
     }
-    else if (!cryptonote::parse_and_validate_tx_from_blob(blob, tx, tx_hash, tx_prefix_hash))
+    else if (!cryptonote::parse_and_validate_tx_from_blob_maybe_pruned(blob, tx))
     {
       tools::fail_msg_writer() << "Failed to parse tx blob";
     }
@@ -880,7 +894,8 @@ bool t_rpc_command_executor::print_transaction_pool_stats() {
 
   tools::msg_writer() << n_transactions << " tx(es), " << bytes << " bytes total (min " << min_bytes << ", max " << max_bytes << ", avg " << avg_bytes << ")" << std::endl
       << "fees " << cryptonote::print_money(fee) << " (avg " << cryptonote::print_money(n_transactions ? fee / n_transactions : 0) << " per tx)" << std::endl
-      << n_not_relayed << " not relayed, " << n_failing << " failing, " << n_10m << " older than 10 minutes (oldest " << (oldest == 0 ? "-" : get_human_time_ago(oldest, now)) << ")" << std::endl;
+      << n_not_relayed << " not relayed, " << n_failing << " failing, " << n_10m << " older than 10 minutes (oldest " << (oldest == 0 ? "-" : get_human_time_ago(oldest, now)) << ")" << std::endl
+      << res.evicted_count << " evicted since startup, limit " << res.pool_max_size << " bytes" << std::endl;
 
   return true;
 }
@@ -1368,5 +1383,131 @@ bool t_rpc_command_executor::print_coinbase_tx_sum(uint64_t height, uint64_t cou
   return true;
 }
 
+bool t_rpc_command_executor::db_stats()
+{
+  cryptonote::COMMAND_RPC_GET_DB_STATS::request req;
+  cryptonote::COMMAND_RPC_GET_DB_STATS::response res;
+  epee::json_rpc::error error_resp;
+
+  std::string fail_message = "Unsuccessful";
+
+  if (m_is_rpc)
+  {
+    if (!m_rpc_client->json_rpc_request(req, res, "get_db_stats", fail_message.c_str()))
+    {
+      return true;
+    }
+  }
+  else
+  {
+    if (!m_rpc_server->on_get_db_stats(req, res, error_resp))
+    {
+      tools::fail_msg_writer() << fail_message.c_str();
+      return true;
+    }
+  }
+
+  tools::msg_writer() << "database: " << res.db_type;
+  if (res.map_size > 0)
+  {
+    tools::msg_writer() << boost::format("memory map: %.1f of %.1f MiB used, %u byte pages, %u resizes taking %.3f s")
+      % (res.map_used / 1048576.0) % (res.map_size / 1048576.0) % res.page_size % res.num_resizes % (res.resize_time_us / 1e6);
+    tools::msg_writer() << "reader slots: " << res.readers_used << " of " << res.max_readers << " in use";
+  }
+
+  // percentiles are the upper bounds of the latency buckets they fall in
+  tools::msg_writer() << boost::format("%-16s %12s %10s %10s %10s %10s") % "operation" % "calls" % "avg us" % "p50 us <" % "p99 us <" % "max us";
+  for (const auto &op: res.ops)
+  {
+    if (op.count == 0)
+    {
+      tools::msg_writer() << boost::format("%-16s %12u") % op.name % 0;
+      continue;
+    }
+    tools::msg_writer() << boost::format("%-16s %12u %10.1f %10u %10u %10u") % op.name % op.count
+      % ((double)op.total_us / op.count)
+      % get_latency_percentile(op.latency_buckets, op.count, 0.5)
+      % get_latency_percentile(op.latency_buckets, op.count, 0.99)
+      % op.max_us;
+  }
+
+  tools::msg_writer() << boost::format("%-20s %12s %6s %10s %10s %10s") % "table" % "entries" % "depth" % "branch" % "leaf" % "overflow";
+  for (const auto &t: res.tables)
+  {
+    tools::msg_writer() << boost::format("%-20s %12u %6u %10u %10u %10u") % t.name % t.entries % t.depth
+      % t.branch_pages % t.leaf_pages % t.overflow_pages;
+  }
+
+  return true;
+}
+
+bool t_rpc_command_executor::save_snapshot(const std::string &path, bool compact)
+{
+  cryptonote::COMMAND_RPC_SAVE_SNAPSHOT::request req;
+  cryptonote::COMMAND_RPC_SAVE_SNAPSHOT::response res;
+  epee::json_rpc::error error_resp;
+
+  std::string fail_message = "Unsuccessful";
+
+  req.path = path;
+  req.compact = compact;
+  if (m_is_rpc)
+  {
+    if (!m_rpc_client->json_rpc_request(req, res, "save_snapshot", fail_message.c_str()))
+    {
+      return true;
+    }
+  }
+  else
+  {
+    if (!m_rpc_server->on_save_snapshot(req, res, error_resp) || res.status != CORE_RPC_STATUS_OK)
+    {
+      tools::fail_msg_writer() << fail_message.c_str() << ": " << (error_resp.message.empty() ? res.status : error_resp.message);
+      return true;
+    }
+  }
+
+  tools::success_msg_writer() << "Saving " << (compact ? "a compacted" : "a") << " snapshot to " << path;
+
+  // the snapshot goes on in the daemon whether or not we stay to watch it
+  cryptonote::COMMAND_RPC_GET_SNAPSHOT_STATUS::request status_req;
+  cryptonote::COMMAND_RPC_GET_SNAPSHOT_STATUS::response status_res;
+  while (true)
+  {
+    epee::misc_utils::sleep_no_w(2000);
+    if (m_is_rpc)
+    {
+      if (!m_rpc_client->json_rpc_request(status_req, status_res, "get_snapshot_status", fail_message.c_str()))
+      {
+        return true;
+      }
+    }
+    else
+    {
+      if (!m_rpc_server->on_get_snapshot_status(status_req, status_res, error_resp))
+      {
+        tools::fail_msg_writer() << fail_message.c_str();
+        return true;
+      }
+    }
+    if (!status_res.running)
+      break;
+
+    // the estimate is rough, so the percentage is capped short of done
+    const double percent = status_res.bytes_estimate ? std::min(99.9, 100.0 * status_res.bytes_written / status_res.bytes_estimate) : 0.0;
+    tools::msg_writer() << boost::format("%.1f of about %.1f MiB written (%.1f%%)")
+      % (status_res.bytes_written / 1048576.0) % (status_res.bytes_estimate / 1048576.0) % percent;
+  }
+
+  if (!status_res.error.empty())
+  {
+    tools::fail_msg_writer() << "Failed to save the snapshot: " << status_res.error;
+    return true;
+  }
+  tools::success_msg_writer() << boost::format("Snapshot saved to %s, %.1f MiB in %u s")
+    % status_res.path % (status_res.bytes_written / 1048576.0) % (status_res.end_time - status_res.start_time);
+  return true;
+}
+
 
 }// namespace daemonize
@@ -138,6 +138,10 @@ public:
   bool output_histogram(uint64_t min_count, uint64_t max_count);
 
   bool print_coinbase_tx_sum(uint64_t height, uint64_t count);
+
+  bool db_stats();
+
+  bool save_snapshot(const std::string &path, bool compact);
 };
 
 } // namespace daemonize
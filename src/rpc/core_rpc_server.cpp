@@ -151,7 +151,7 @@ namespace cryptonote
   bool core_rpc_server::on_get_blocks(const COMMAND_RPC_GET_BLOCKS_FAST::request& req, COMMAND_RPC_GET_BLOCKS_FAST::response& res)
   {
     CHECK_CORE_BUSY();
-    std::list<std::pair<block, std::list<transaction> > > bs;
+    std::vector<block_blobs_t> bs;
 
     if(!m_core.find_blockchain_supplement(req.start_height, req.block_ids, bs, res.current_height, res.start_height, COMMAND_RPC_GET_BLOCKS_FAST_MAX_COUNT))
     {
@@ -159,29 +159,18 @@ namespace cryptonote
       return false;
     }
 
-    BOOST_FOREACH(auto& b, bs)
+    // the blobs come straight from the database, they are not parsed here
+    for (auto& b: bs)
     {
       res.blocks.resize(res.blocks.size()+1);
-      res.blocks.back().block = block_to_blob(b.first);
+      res.blocks.back().block = std::move(b.block);
+      for (auto& tx_blob: b.txs)
+        res.blocks.back().txs.push_back(std::move(tx_blob));
       res.output_indices.push_back(COMMAND_RPC_GET_BLOCKS_FAST::block_output_indices());
-      res.output_indices.back().indices.push_back(COMMAND_RPC_GET_BLOCKS_FAST::tx_output_indices());
-      bool r = m_core.get_tx_outputs_gindexs(get_transaction_hash(b.first.miner_tx), res.output_indices.back().indices.back().indices);
-      if (!r)
-      {
-        res.status = "Failed";
-        return false;
-      }
-      size_t txidx = 0;
-      BOOST_FOREACH(auto& t, b.second)
+      for (auto& indices: b.output_indices)
       {
-        res.blocks.back().txs.push_back(tx_to_blob(t));
         res.output_indices.back().indices.push_back(COMMAND_RPC_GET_BLOCKS_FAST::tx_output_indices());
-        bool r = m_core.get_tx_outputs_gindexs(b.first.tx_hashes[txidx++], res.output_indices.back().indices.back().indices);
-        if (!r)
-        {
-          res.status = "Failed";
-          return false;
-        }
+        res.output_indices.back().indices.back().indices = std::move(indices);
       }
     }
 
@@ -703,6 +692,23 @@ namespace cryptonote
   {
     CHECK_CORE_BUSY();
     m_core.get_pool_transactions_and_spent_keys_info(res.transactions, res.spent_key_images);
+    m_core.get_pool_size_stats(res.pool_size, res.pool_max_size, res.evicted_count);
+    res.status = CORE_RPC_STATUS_OK;
+    return true;
+  }
+  //------------------------------------------------------------------------------------------------------------------------------
+  bool core_rpc_server::on_get_transaction_pool_hashes_bin(const COMMAND_RPC_GET_TRANSACTION_POOL_HASHES_BIN::request& req, COMMAND_RPC_GET_TRANSACTION_POOL_HASHES_BIN::response& res)
+  {
+    CHECK_CORE_BUSY();
+    m_core.get_pool_transaction_hashes(res.tx_hashes, res.revision);
+    res.status = CORE_RPC_STATUS_OK;
+    return true;
+  }
+  //------------------------------------------------------------------------------------------------------------------------------
+  bool core_rpc_server::on_get_pool_changes_since(const COMMAND_RPC_GET_POOL_CHANGES_SINCE::request& req, COMMAND_RPC_GET_POOL_CHANGES_SINCE::response& res)
+  {
+    CHECK_CORE_BUSY();
+    res.full_resync = !m_core.get_pool_changes_since(req.revision, res.added, res.removed, res.revision);
     res.status = CORE_RPC_STATUS_OK;
     return true;
   }
@@ -896,6 +902,11 @@ namespace cryptonote
   }
   //------------------------------------------------------------------------------------------------------------------------------
   bool core_rpc_server::fill_block_header_response(const block& blk, bool orphan_status, uint64_t height, const crypto::hash& hash, block_header_response& response)
+  {
+    return fill_block_header_response(blk, orphan_status, height, hash, m_core.get_blockchain_storage().block_difficulty(height), m_core.get_current_blockchain_height(), response);
+  }
+  //------------------------------------------------------------------------------------------------------------------------------
+  bool core_rpc_server::fill_block_header_response(const block& blk, bool orphan_status, uint64_t height, const crypto::hash& hash, difficulty_type difficulty, uint64_t chain_height, block_header_response& response)
   {
     response.major_version = blk.major_version;
     response.minor_version = blk.minor_version;
@@ -904,9 +915,9 @@ namespace cryptonote
     response.nonce = blk.nonce;
     response.orphan_status = orphan_status;
     response.height = height;
-    response.depth = m_core.get_current_blockchain_height() - height - 1;
+    response.depth = chain_height - height - 1;
     response.hash = string_tools::pod_to_hex(hash);
-    response.difficulty = m_core.get_blockchain_storage().block_difficulty(height);
+    response.difficulty = difficulty;
     response.reward = get_block_reward(blk);
     return true;
   }
@@ -1002,17 +1013,34 @@ namespace cryptonote
       error_resp.message = "Invalid start/end heights.";
       return false;
     }
-    for (uint64_t h = req.start_height; h <= req.end_height; ++h)
+    // the hashes and difficulties come from one pass over the block metadata,
+    // starting a block early for the first block's difficulty
+    const uint64_t count = req.end_height - req.start_height + 1;
+    const uint64_t info_start = req.start_height > 0 ? req.start_height - 1 : 0;
+    std::vector<block_info_t> infos;
+    std::list<block> blocks;
+    try
+    {
+      m_core.get_blockchain_storage().get_db().get_block_info_range(info_start, req.end_height, infos, BI_HASH | BI_CUMULATIVE_DIFFICULTY);
+    }
+    catch (const std::exception &e)
+    {
+      error_resp.code = CORE_RPC_ERROR_CODE_INTERNAL_ERROR;
+      error_resp.message = std::string("Internal error: can't get block info: ") + e.what();
+      return false;
+    }
+    if (!m_core.get_blocks(req.start_height, count, blocks) || blocks.size() != count)
+    {
+      error_resp.code = CORE_RPC_ERROR_CODE_INTERNAL_ERROR;
+      error_resp.message = "Internal error: can't get blocks by height.";
+      return false;
+    }
+    auto info = infos.begin() + (req.start_height - info_start);
+    difficulty_type prev_cumulative_difficulty = req.start_height > 0 ? infos.front().cumulative_difficulty : 0;
+    res.headers.reserve(count);
+    uint64_t h = req.start_height;
+    for (const block &blk: blocks)
     {
-      crypto::hash block_hash = m_core.get_block_id_by_height(h);
-      block blk;
-      bool have_block = m_core.get_block_by_hash(block_hash, blk);
-      if (!have_block)
-      {
-        error_resp.code = CORE_RPC_ERROR_CODE_INTERNAL_ERROR;
-        error_resp.message = "Internal error: can't get block by height. Height = " + boost::lexical_cast<std::string>(h) + ". Hash = " + epee::string_tools::pod_to_hex(block_hash) + '.';
-        return false;
-      }
       if (blk.miner_tx.vin.front().type() != typeid(txin_gen))
       {
         error_resp.code = CORE_RPC_ERROR_CODE_INTERNAL_ERROR;
@@ -1027,13 +1055,16 @@ namespace cryptonote
         return false;
       }
       res.headers.push_back(block_header_response());
-      bool responce_filled = fill_block_header_response(blk, false, block_height, block_hash, res.headers.back());
+      bool responce_filled = fill_block_header_response(blk, false, block_height, info->hash, info->cumulative_difficulty - prev_cumulative_difficulty, bc_height, res.headers.back());
       if (!responce_filled)
       {
         error_resp.code = CORE_RPC_ERROR_CODE_INTERNAL_ERROR;
         error_resp.message = "Internal error: can't produce valid response.";
         return false;
       }
+      prev_cumulative_difficulty = info->cumulative_difficulty;
+      ++info;
+      ++h;
     }
     res.status = CORE_RPC_STATUS_OK;
     return true;
@@ -1332,6 +1363,134 @@ namespace cryptonote
     return true;
   }
   //------------------------------------------------------------------------------------------------------------------------------
+  bool core_rpc_server::on_get_output_distribution(const COMMAND_RPC_GET_OUTPUT_DISTRIBUTION::request& req, COMMAND_RPC_GET_OUTPUT_DISTRIBUTION::response& res, epee::json_rpc::error& error_resp)
+  {
+    if(!check_core_busy())
+    {
+      error_resp.code = CORE_RPC_ERROR_CODE_CORE_BUSY;
+      error_resp.message = "Core is busy.";
+      return false;
+    }
+
+    res.distributions.clear();
+    res.distributions.reserve(req.amounts.size());
+    for (uint64_t amount: req.amounts)
+    {
+      res.distributions.push_back(COMMAND_RPC_GET_OUTPUT_DISTRIBUTION::distribution());
+      COMMAND_RPC_GET_OUTPUT_DISTRIBUTION::distribution &d = res.distributions.back();
+      d.amount = amount;
+      d.start_height = req.from_height;
+      if (!m_core.get_blockchain_storage().get_output_distribution(amount, req.from_height, req.to_height, d.distribution, d.base))
+      {
+        error_resp.code = CORE_RPC_ERROR_CODE_INTERNAL_ERROR;
+        error_resp.message = "Failed to get output distribution";
+        return false;
+      }
+      if (!req.cumulative)
+      {
+        // turn the running totals into per-block counts
+        uint64_t prev = d.base;
+        for (auto &n: d.distribution)
+        {
+          const uint64_t total = n;
+          n -= prev;
+          prev = total;
+        }
+      }
+    }
+
+    res.status = CORE_RPC_STATUS_OK;
+    return true;
+  }
+  //------------------------------------------------------------------------------------------------------------------------------
+  bool core_rpc_server::on_get_db_stats(const COMMAND_RPC_GET_DB_STATS::request& req, COMMAND_RPC_GET_DB_STATS::response& res, epee::json_rpc::error& error_resp)
+  {
+    db_stats_t stats;
+    try
+    {
+      m_core.get_blockchain_storage().get_db().get_stats(stats);
+    }
+    catch (const std::exception &e)
+    {
+      error_resp.code = CORE_RPC_ERROR_CODE_INTERNAL_ERROR;
+      error_resp.message = std::string("Failed to get db stats: ") + e.what();
+      return false;
+    }
+
+    res.db_type = stats.db_type;
+    res.ops.clear();
+    res.ops.reserve(stats.ops.size());
+    for (const auto &op: stats.ops)
+    {
+      res.ops.push_back(COMMAND_RPC_GET_DB_STATS::op_stats());
+      COMMAND_RPC_GET_DB_STATS::op_stats &o = res.ops.back();
+      o.name = op.name;
+      o.count = op.count;
+      o.total_us = op.total_us;
+      o.max_us = op.max_us;
+      o.latency_buckets = op.latency_buckets;
+    }
+    res.tables.clear();
+    res.tables.reserve(stats.tables.size());
+    for (const auto &table: stats.tables)
+    {
+      res.tables.push_back(COMMAND_RPC_GET_DB_STATS::table_stats());
+      COMMAND_RPC_GET_DB_STATS::table_stats &t = res.tables.back();
+      t.name = table.name;
+      t.entries = table.entries;
+      t.depth = table.depth;
+      t.branch_pages = table.branch_pages;
+      t.leaf_pages = table.leaf_pages;
+      t.overflow_pages = table.overflow_pages;
+    }
+    res.page_size = stats.page_size;
+    res.map_size = stats.map_size;
+    res.map_used = stats.map_used;
+    res.max_readers = stats.max_readers;
+    res.readers_used = stats.readers_used;
+    res.num_resizes = stats.num_resizes;
+    res.resize_time_us = stats.resize_time_us;
+
+    res.status = CORE_RPC_STATUS_OK;
+    return true;
+  }
+  //------------------------------------------------------------------------------------------------------------------------------
+  bool core_rpc_server::on_save_snapshot(const COMMAND_RPC_SAVE_SNAPSHOT::request& req, COMMAND_RPC_SAVE_SNAPSHOT::response& res, epee::json_rpc::error& error_resp)
+  {
+    if (req.path.empty())
+    {
+      error_resp.code = CORE_RPC_ERROR_CODE_WRONG_PARAM;
+      error_resp.message = "No snapshot path given";
+      return false;
+    }
+
+    std::string error;
+    if (!m_core.get_blockchain_storage().start_db_snapshot(req.path, req.compact, error))
+    {
+      res.status = error;
+      return true;
+    }
+
+    res.status = CORE_RPC_STATUS_OK;
+    return true;
+  }
+  //------------------------------------------------------------------------------------------------------------------------------
+  bool core_rpc_server::on_get_snapshot_status(const COMMAND_RPC_GET_SNAPSHOT_STATUS::request& req, COMMAND_RPC_GET_SNAPSHOT_STATUS::response& res, epee::json_rpc::error& error_resp)
+  {
+    const Blockchain::db_snapshot_status status = m_core.get_blockchain_storage().get_db_snapshot_status();
+    res.running = status.running;
+    res.path = status.path;
+    res.compact = status.compact;
+    res.bytes_written = status.bytes_written;
+    res.bytes_estimate = status.bytes_estimate;
+    res.start_time = status.start_time;
+    res.end_time = status.end_time;
+    res.error = status.error;
+
+    res.status = CORE_RPC_STATUS_OK;
+    return true;
+  }
+  //------------------------------------------------------------------------------------------------------------------------------
   bool core_rpc_server::on_get_version(const COMMAND_RPC_GET_VERSION::request& req, COMMAND_RPC_GET_VERSION::response& res, epee::json_rpc::error& error_resp)
   {
     res.version = CORE_RPC_VERSION;
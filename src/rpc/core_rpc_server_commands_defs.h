@@ -50,7 +50,7 @@ namespace cryptonote
 // advance which version they will stop working with
 // Don't go over 32767 for any of these
 #define CORE_RPC_VERSION_MAJOR 1
-#define CORE_RPC_VERSION_MINOR 0
+#define CORE_RPC_VERSION_MINOR 3
 #define CORE_RPC_VERSION (((CORE_RPC_VERSION_MAJOR)<<16)|(CORE_RPC_VERSION_MINOR))
 
   struct COMMAND_RPC_GET_HEIGHT
@@ -952,11 +952,68 @@ namespace cryptonote
       std::string status;
       std::vector<tx_info> transactions;
       std::vector<spent_key_image_info> spent_key_images;
+      uint64_t pool_size;
+      uint64_t pool_max_size;
+      uint64_t evicted_count;
 
       BEGIN_KV_SERIALIZE_MAP()
         KV_SERIALIZE(status)
         KV_SERIALIZE(transactions)
         KV_SERIALIZE(spent_key_images)
+        KV_SERIALIZE(pool_size)
+        KV_SERIALIZE(pool_max_size)
+        KV_SERIALIZE(evicted_count)
+      END_KV_SERIALIZE_MAP()
+    };
+  };
+
+  struct COMMAND_RPC_GET_TRANSACTION_POOL_HASHES_BIN
+  {
+    struct request
+    {
+      BEGIN_KV_SERIALIZE_MAP()
+      END_KV_SERIALIZE_MAP()
+    };
+
+    struct response
+    {
+      std::string status;
+      std::vector<crypto::hash> tx_hashes;
+      uint64_t revision;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE(status)
+        KV_SERIALIZE_CONTAINER_POD_AS_BLOB(tx_hashes)
+        KV_SERIALIZE(revision)
+      END_KV_SERIALIZE_MAP()
+    };
+  };
+
+  struct COMMAND_RPC_GET_POOL_CHANGES_SINCE
+  {
+    struct request
+    {
+      uint64_t revision;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE(revision)
+      END_KV_SERIALIZE_MAP()
+    };
+
+    struct response
+    {
+      std::string status;
+      std::vector<crypto::hash> added;
+      std::vector<crypto::hash> removed;
+      uint64_t revision;
+      bool full_resync;  // the revision asked for is too old, fetch all the hashes again
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE(status)
+        KV_SERIALIZE_CONTAINER_POD_AS_BLOB(added)
+        KV_SERIALIZE_CONTAINER_POD_AS_BLOB(removed)
+        KV_SERIALIZE(revision)
+        KV_SERIALIZE(full_resync)
       END_KV_SERIALIZE_MAP()
     };
   };
@@ -1272,6 +1329,181 @@ namespace cryptonote
     };
   };
 
+  struct COMMAND_RPC_GET_OUTPUT_DISTRIBUTION
+  {
+    struct request
+    {
+      std::vector<uint64_t> amounts;
+      uint64_t from_height;
+      uint64_t to_height;
+      bool cumulative;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE(amounts)
+        KV_SERIALIZE(from_height)
+        KV_SERIALIZE(to_height)
+        KV_SERIALIZE(cumulative)
+      END_KV_SERIALIZE_MAP()
+    };
+
+    struct distribution
+    {
+      uint64_t amount;
+      uint64_t start_height;
+      std::vector<uint64_t> distribution;
+      uint64_t base;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE(amount)
+        KV_SERIALIZE(start_height)
+        KV_SERIALIZE(distribution)
+        KV_SERIALIZE(base)
+      END_KV_SERIALIZE_MAP()
+    };
+
+    struct response
+    {
+      std::string status;
+      std::vector<distribution> distributions;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE(status)
+        KV_SERIALIZE(distributions)
+      END_KV_SERIALIZE_MAP()
+    };
+  };
+
+  struct COMMAND_RPC_GET_DB_STATS
+  {
+    struct request
+    {
+      BEGIN_KV_SERIALIZE_MAP()
+      END_KV_SERIALIZE_MAP()
+    };
+
+    struct op_stats
+    {
+      std::string name;
+      uint64_t count;
+      uint64_t total_us;
+      uint64_t max_us;
+      std::vector<uint64_t> latency_buckets;  // bucket n: calls under 2^n microseconds
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE(name)
+        KV_SERIALIZE(count)
+        KV_SERIALIZE(total_us)
+        KV_SERIALIZE(max_us)
+        KV_SERIALIZE(latency_buckets)
+      END_KV_SERIALIZE_MAP()
+    };
+
+    struct table_stats
+    {
+      std::string name;
+      uint64_t entries;
+      uint64_t depth;
+      uint64_t branch_pages;
+      uint64_t leaf_pages;
+      uint64_t overflow_pages;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE(name)
+        KV_SERIALIZE(entries)
+        KV_SERIALIZE(depth)
+        KV_SERIALIZE(branch_pages)
+        KV_SERIALIZE(leaf_pages)
+        KV_SERIALIZE(overflow_pages)
+      END_KV_SERIALIZE_MAP()
+    };
+
+    struct response
+    {
+      std::string status;
+      std::string db_type;
+      std::vector<op_stats> ops;
+      std::vector<table_stats> tables;
+      uint64_t page_size;
+      uint64_t map_size;
+      uint64_t map_used;
+      uint64_t max_readers;
+      uint64_t readers_used;
+      uint64_t num_resizes;
+      uint64_t resize_time_us;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE(status)
+        KV_SERIALIZE(db_type)
+        KV_SERIALIZE(ops)
+        KV_SERIALIZE(tables)
+        KV_SERIALIZE(page_size)
+        KV_SERIALIZE(map_size)
+        KV_SERIALIZE(map_used)
+        KV_SERIALIZE(max_readers)
+        KV_SERIALIZE(readers_used)
+        KV_SERIALIZE(num_resizes)
+        KV_SERIALIZE(resize_time_us)
+      END_KV_SERIALIZE_MAP()
+    };
+  };
+
+  struct COMMAND_RPC_SAVE_SNAPSHOT
+  {
+    struct request
+    {
+      std::string path;
+      bool compact;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE(path)
+        KV_SERIALIZE(compact)
+      END_KV_SERIALIZE_MAP()
+    };
+
+    struct response
+    {
+      std::string status;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE(status)
+      END_KV_SERIALIZE_MAP()
+    };
+  };
+
+  struct COMMAND_RPC_GET_SNAPSHOT_STATUS
+  {
+    struct request
+    {
+      BEGIN_KV_SERIALIZE_MAP()
+      END_KV_SERIALIZE_MAP()
+    };
+
+    struct response
+    {
+      std::string status;
+      bool running;
+      std::string path;
+      bool compact;
+      uint64_t bytes_written;
+      uint64_t bytes_estimate;
+      uint64_t start_time;
+      uint64_t end_time;
+      std::string error;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE(status)
+        KV_SERIALIZE(running)
+        KV_SERIALIZE(path)
+        KV_SERIALIZE(compact)
+        KV_SERIALIZE(bytes_written)
+        KV_SERIALIZE(bytes_estimate)
+        KV_SERIALIZE(start_time)
+        KV_SERIALIZE(end_time)
+        KV_SERIALIZE(error)
+      END_KV_SERIALIZE_MAP()
+    };
+  };
+
   struct COMMAND_RPC_GET_VERSION
   {
     struct request
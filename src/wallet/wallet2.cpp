@@ -92,6 +92,8 @@ using namespace cryptonote;
 
 #define FEE_ESTIMATE_GRACE_BLOCKS 10 // estimate fee valid for that many blocks
 
+#define WALLET_SCANNED_POOL_TXS_MAX 5000 // pool txids remembered as scanned, per half
+
 
 
 #define KILL_IOSERVICE()  \
@@ -492,6 +494,7 @@ void wallet2::init(const std::string& daemon_address, uint64_t upper_transaction
 {
   m_upper_transaction_size_limit = upper_transaction_size_limit;
   m_daemon_address = daemon_address;
+  m_pool_revision_valid = false;
   if (enable_ssl) {
     m_http_client.enable_ssl(cacerts_path);
   }
@@ -731,7 +734,7 @@ static uint64_t decodeRct(const rct::rctSig & rv, const crypto::key_derivation &
 void wallet2::process_new_transaction(const crypto::hash &txid, const cryptonote::transaction& tx, const std::vector<uint64_t> &o_indices, uint64_t height, uint64_t ts, bool miner_tx, bool pool)
 {
   if (!miner_tx && !pool)
-    process_unconfirmed(tx, height);
+    process_unconfirmed(txid, tx, height);
   std::vector<size_t> outs;
   std::unordered_map<cryptonote::subaddress_index, uint64_t> tx_money_got_in_outs;  // per receiving subaddress index
   crypto::public_key tx_pub_key = null_pkey;
@@ -1169,12 +1172,12 @@ void wallet2::process_new_transaction(const crypto::hash &txid, const cryptonote
   }
 }
 //----------------------------------------------------------------------------------------------------
-void wallet2::process_unconfirmed(const cryptonote::transaction& tx, uint64_t height)
+void wallet2::process_unconfirmed(const crypto::hash &txid, const cryptonote::transaction& tx, uint64_t height)
 {
   if (m_unconfirmed_txs.empty())
     return;
 
-  crypto::hash txid = get_transaction_hash(tx);
+  // the tx may be pruned, so it can't be hashed here
   auto unconf_it = m_unconfirmed_txs.find(txid);
   if(unconf_it != m_unconfirmed_txs.end()) {
     if (store_tx_info()) {
@@ -1244,7 +1247,8 @@ void wallet2::process_new_blockchain_entry(const cryptonote::block& b, const cry
     BOOST_FOREACH(auto& txblob, bche.txs)
     {
       cryptonote::transaction tx;
-      bool r = parse_and_validate_tx_from_blob(txblob, tx);
+      // a pruning daemon sends older transactions without their signatures
+      bool r = parse_and_validate_tx_from_blob_maybe_pruned(txblob, tx);
       THROW_WALLET_EXCEPTION_IF(!r, error::tx_parse_error, txblob);
       process_new_transaction(b.tx_hashes[idx], tx, o_indices.indices[txidx++].indices, height, b.timestamp, false, false);
       ++idx;
@@ -1477,32 +1481,78 @@ void wallet2::pull_next_blocks(uint64_t start_height, uint64_t &blocks_start_hei
   }
 }
 //----------------------------------------------------------------------------------------------------
-void wallet2::update_pool_state()
+void wallet2::update_pool_hashes()
 {
-  // get the pool state
-  cryptonote::COMMAND_RPC_GET_TRANSACTION_POOL::request req;
-  cryptonote::COMMAND_RPC_GET_TRANSACTION_POOL::response res;
+  // only ask for what changed since last time if we can
+  if (m_pool_revision_valid)
+  {
+    cryptonote::COMMAND_RPC_GET_POOL_CHANGES_SINCE::request req;
+    cryptonote::COMMAND_RPC_GET_POOL_CHANGES_SINCE::response res;
+    req.revision = m_pool_revision;
+    m_daemon_rpc_mutex.lock();
+    bool r = epee::net_utils::invoke_http_bin_remote_command2(m_daemon_address + "/get_pool_changes_since.bin", req, res, m_http_client, WALLET_RCP_CONNECTION_TIMEOUT);
+    m_daemon_rpc_mutex.unlock();
+    THROW_WALLET_EXCEPTION_IF(!r, error::no_connection_to_daemon, "get_pool_changes_since.bin");
+    THROW_WALLET_EXCEPTION_IF(res.status == CORE_RPC_STATUS_BUSY, error::daemon_busy, "get_pool_changes_since.bin");
+    THROW_WALLET_EXCEPTION_IF(res.status != CORE_RPC_STATUS_OK, error::get_tx_pool_error);
+    if (!res.full_resync)
+    {
+      for (const crypto::hash &txid: res.removed)
+        m_pool_tx_hashes.erase(txid);
+      for (const crypto::hash &txid: res.added)
+        m_pool_tx_hashes.insert(txid);
+      m_pool_revision = res.revision;
+      return;
+    }
+    LOG_PRINT_L1("Pool changed too much since revision " << m_pool_revision << ", getting all of it");
+  }
+
+  m_pool_revision_valid = false;
+  m_pool_tx_hashes.clear();
+
+  cryptonote::COMMAND_RPC_GET_TRANSACTION_POOL_HASHES_BIN::request req;
+  cryptonote::COMMAND_RPC_GET_TRANSACTION_POOL_HASHES_BIN::response res;
   m_daemon_rpc_mutex.lock();
-  bool r = epee::net_utils::invoke_http_json_remote_command2(m_daemon_address + "/get_transaction_pool", req, res, m_http_client, 200000);
+  bool r = epee::net_utils::invoke_http_bin_remote_command2(m_daemon_address + "/get_transaction_pool_hashes.bin", req, res, m_http_client, WALLET_RCP_CONNECTION_TIMEOUT);
+  m_daemon_rpc_mutex.unlock();
+  if (r && res.status == CORE_RPC_STATUS_OK)
+  {
+    m_pool_tx_hashes.insert(res.tx_hashes.begin(), res.tx_hashes.end());
+    m_pool_revision = res.revision;
+    m_pool_revision_valid = true;
+    return;
+  }
+
+  // older daemons only have the full pool
+  cryptonote::COMMAND_RPC_GET_TRANSACTION_POOL::request jreq;
+  cryptonote::COMMAND_RPC_GET_TRANSACTION_POOL::response jres;
+  m_daemon_rpc_mutex.lock();
+  r = epee::net_utils::invoke_http_json_remote_command2(m_daemon_address + "/get_transaction_pool", jreq, jres, m_http_client, 200000);
   m_daemon_rpc_mutex.unlock();
   THROW_WALLET_EXCEPTION_IF(!r, error::no_connection_to_daemon, "get_transaction_pool");
-  THROW_WALLET_EXCEPTION_IF(res.status == CORE_RPC_STATUS_BUSY, error::daemon_busy, "get_transaction_pool");
-  THROW_WALLET_EXCEPTION_IF(res.status != CORE_RPC_STATUS_OK, error::get_tx_pool_error);
+  THROW_WALLET_EXCEPTION_IF(jres.status == CORE_RPC_STATUS_BUSY, error::daemon_busy, "get_transaction_pool");
+  THROW_WALLET_EXCEPTION_IF(jres.status != CORE_RPC_STATUS_OK, error::get_tx_pool_error);
+  for (const auto &tx: jres.transactions)
+  {
+    cryptonote::blobdata txid_data;
+    if (epee::string_tools::parse_hexstr_to_binbuff(tx.id_hash, txid_data) && txid_data.size() == sizeof(crypto::hash))
+      m_pool_tx_hashes.insert(*reinterpret_cast<const crypto::hash*>(txid_data.data()));
+    else
+      LOG_PRINT_L0("Failed to parse txid");
+  }
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::update_pool_state()
+{
+  // get the pool state
+  update_pool_hashes();
 
   // remove any pending tx that's not in the pool
   std::unordered_map<crypto::hash, wallet2::unconfirmed_transfer_details>::iterator it = m_unconfirmed_txs.begin();
   while (it != m_unconfirmed_txs.end())
   {
     const std::string txid = epee::string_tools::pod_to_hex(it->first);
-    bool found = false;
-    for (auto it2: res.transactions)
-    {
-      if (it2.id_hash == txid)
-      {
-        found = true;
-        break;
-      }
-    }
+    bool found = m_pool_tx_hashes.find(it->first) != m_pool_tx_hashes.end();
     auto pit = it++;
     if (!found)
     {
@@ -1547,16 +1597,7 @@ void wallet2::update_pool_state()
   std::unordered_map<crypto::hash, wallet2::payment_details>::iterator uit = m_unconfirmed_payments.begin();
   while (uit != m_unconfirmed_payments.end())
   {
-    const std::string txid = string_tools::pod_to_hex(uit->first);
-    bool found = false;
-    for (auto it2: res.transactions)
-    {
-      if (it2.id_hash == txid)
-      {
-        found = true;
-        break;
-      }
-    }
+    bool found = m_pool_tx_hashes.find(uit->first) != m_pool_tx_hashes.end();
     auto pit = uit++;
     if (!found)
     {
@@ -1565,21 +1606,17 @@ void wallet2::update_pool_state()
   }
 
   // add new pool txes to us
-  for (auto it: res.transactions)
+  for (const crypto::hash &txid: m_pool_tx_hashes)
   {
-    cryptonote::blobdata txid_data;
-    if(epee::string_tools::parse_hexstr_to_binbuff(it.id_hash, txid_data))
+    if (m_unconfirmed_payments.find(txid) == m_unconfirmed_payments.end())
     {
-      const crypto::hash txid = *reinterpret_cast<const crypto::hash*>(txid_data.data());
-      if (m_unconfirmed_payments.find(txid) == m_unconfirmed_payments.end())
+      LOG_PRINT_L1("Found new pool tx: " << txid);
+      bool found = false;
+      for (const auto &i: m_unconfirmed_txs)
       {
-        LOG_PRINT_L1("Found new pool tx: " << txid);
-        bool found = false;
-        for (const auto &i: m_unconfirmed_txs)
+        if (i.first == txid)
         {
-          if (i.first == txid)
-          {
-            found = true;
+          found = true;
 			// if this is a payment to yourself at a different subaddress account, don't skip it
 			// so that you can see the incoming pool tx with 'show_transfers' on that receiving subaddress account
 			const unconfirmed_transfer_details& utd = i.second;
@@ -1592,80 +1629,90 @@ void wallet2::update_pool_state()
 					break;
 				}
 			}
-            break;
-          }
+          break;
         }
-        if (!found)
+      }
+      if (!found)
+      {
+        // pool txes which aren't ours are only fetched once
+        if (m_scanned_pool_txs[0].find(txid) != m_scanned_pool_txs[0].end() || m_scanned_pool_txs[1].find(txid) != m_scanned_pool_txs[1].end())
         {
-          // not one of those we sent ourselves
-          cryptonote::COMMAND_RPC_GET_TRANSACTIONS::request req;
-          cryptonote::COMMAND_RPC_GET_TRANSACTIONS::response res;
-          req.txs_hashes.push_back(it.id_hash);
-          req.decode_as_json = false;
-          m_daemon_rpc_mutex.lock();
-          bool r = epee::net_utils::invoke_http_json_remote_command2(m_daemon_address + "/gettransactions", req, res, m_http_client, 200000);
-          m_daemon_rpc_mutex.unlock();
-          if (r && res.status == CORE_RPC_STATUS_OK)
+          LOG_PRINT_L2("Already scanned " << txid << ", skipped");
+          continue;
+        }
+
+        // not one of those we sent ourselves
+        cryptonote::COMMAND_RPC_GET_TRANSACTIONS::request req;
+        cryptonote::COMMAND_RPC_GET_TRANSACTIONS::response res;
+        req.txs_hashes.push_back(epee::string_tools::pod_to_hex(txid));
+        req.decode_as_json = false;
+        m_daemon_rpc_mutex.lock();
+        bool r = epee::net_utils::invoke_http_json_remote_command2(m_daemon_address + "/gettransactions", req, res, m_http_client, 200000);
+        m_daemon_rpc_mutex.unlock();
+        if (r && res.status == CORE_RPC_STATUS_OK)
+        {
+          if (res.txs.size() == 1)
           {
-            if (res.txs.size() == 1)
+            // might have just been put in a block
+            if (res.txs[0].in_pool)
             {
-              // might have just been put in a block
-              if (res.txs[0].in_pool)
+              cryptonote::transaction tx;
+              cryptonote::blobdata bd;
+              crypto::hash tx_hash, tx_prefix_hash;
+              if (epee::string_tools::parse_hexstr_to_binbuff(res.txs[0].as_hex, bd))
               {
-                cryptonote::transaction tx;
-                cryptonote::blobdata bd;
-                crypto::hash tx_hash, tx_prefix_hash;
-                if (epee::string_tools::parse_hexstr_to_binbuff(res.txs[0].as_hex, bd))
+                if (cryptonote::parse_and_validate_tx_from_blob(bd, tx, tx_hash, tx_prefix_hash))
                 {
-                  if (cryptonote::parse_and_validate_tx_from_blob(bd, tx, tx_hash, tx_prefix_hash))
+                  if (tx_hash == txid)
                   {
-                    if (tx_hash == txid)
-                    {
-                      process_new_transaction(txid, tx, std::vector<uint64_t>(), 0, time(NULL), false, true);
-                    }
-                    else
+                    process_new_transaction(txid, tx, std::vector<uint64_t>(), 0, time(NULL), false, true);
+                    // the older half is dropped when full, a tx left there
+                    // that is still in the pool is just fetched again
+                    m_scanned_pool_txs[0].insert(txid);
+                    if (m_scanned_pool_txs[0].size() > WALLET_SCANNED_POOL_TXS_MAX)
                     {
-                      LOG_PRINT_L0("Mismatched txids when processing unconfimed txes from pool");
+                      std::swap(m_scanned_pool_txs[0], m_scanned_pool_txs[1]);
+                      m_scanned_pool_txs[0].clear();
                     }
                   }
                   else
                   {
-                    LOG_PRINT_L0("failed to validate transaction from daemon");
+                    LOG_PRINT_L0("Mismatched txids when processing unconfimed txes from pool");
                   }
                 }
                 else
                 {
-                  LOG_PRINT_L0("Failed to parse tx " << txid);
+                  LOG_PRINT_L0("failed to validate transaction from daemon");
                 }
               }
               else
               {
-                LOG_PRINT_L1("Tx " << txid << " was in pool, but is no more");
+                LOG_PRINT_L0("Failed to parse tx " << txid);
               }
             }
             else
             {
-              LOG_PRINT_L0("Expected 1 tx, got " << res.txs.size());
+              LOG_PRINT_L1("Tx " << txid << " was in pool, but is no more");
             }
           }
           else
           {
-            LOG_PRINT_L0("Error calling gettransactions daemon RPC: r " << r << ", status " << res.status);
+            LOG_PRINT_L0("Expected 1 tx, got " << res.txs.size());
           }
         }
         else
         {
-          LOG_PRINT_L1("We sent that one");
+          LOG_PRINT_L0("Error calling gettransactions daemon RPC: r " << r << ", status " << res.status);
         }
       }
       else
       {
-        LOG_PRINT_L1("Already saw that one");
+        LOG_PRINT_L1("We sent that one");
       }
     }
     else
     {
-      LOG_PRINT_L0("Failed to parse txid");
+      LOG_PRINT_L1("Already saw that one");
     }
   }
 }
@@ -1939,6 +1986,8 @@ bool wallet2::clear()
   m_unconfirmed_txs.clear();
   m_payments.clear();
   m_tx_keys.clear();
+  m_scanned_pool_txs[0].clear();
+  m_scanned_pool_txs[1].clear();
   m_confirmed_txs.clear();
   m_subaddresses.clear();
   m_subaddresses_inv.clear();
@@ -2469,6 +2518,9 @@ bool wallet2::check_connection(uint32_t *version)
 
     if (!m_http_client.connect(u.host, std::to_string(u.port), WALLET_RCP_CONNECTION_TIMEOUT))
       return false;
+
+    // the daemon may not be the one the pool revision came from
+    m_pool_revision_valid = false;
   }
 
   if (version)